@@ -57,6 +57,8 @@ int threads_count = 0;
 pthread_t main_job;
 int arg_default_xrun = 0;
 int arg_default_wake = 0;
+int arg_pool = -1;		/* -1 = off, 0 = number of CPUs */
+char *arg_stats = NULL;		/* stats socket path */
 
 static void my_exit(struct loopback_thread *thread, int exitcode)
 {
@@ -126,9 +128,11 @@ static int create_loopback(struct loopback **_handle,
 	handle->loop_limit = ~0ULL;
 	handle->output = output;
 	handle->state = output;
-#ifdef USE_SAMPLERATE
 	handle->src_enable = 1;
+#ifdef USE_SAMPLERATE
 	handle->src_converter_type = SRC_SINC_BEST_QUALITY;
+#else
+	handle->src_converter_type = SRC_NATIVE;
 #endif
 	*_handle = handle;
 	return 0;
@@ -140,7 +144,7 @@ static void set_loop_time(struct loopback *loop, unsigned long loop_time)
 	loop->loop_limit = loop->capt->rate * loop_time;
 }
 
-static void setscheduler(void)
+void setscheduler(void)
 {
 	struct sched_param sched_param;
 
@@ -177,26 +181,35 @@ void help(void)
 "-r,--rate      rate\n"
 "-n,--resample  resample in alsa-lib\n"
 "-A,--samplerate use converter (0=sincbest,1=sincmedium,2=sincfastest,\n"
-"                               3=zerohold,4=linear)\n"
+"                               3=zerohold,4=linear,5=auto,6=native)\n"
 "-B,--buffer    buffer size in frames\n"
 "-E,--period    period size in frames\n"
 "-s,--seconds   duration of loop in seconds\n"
 "-b,--nblock    non-block mode (very early process wakeup)\n"
 "-S,--sync      sync mode(0=none,1=simple,2=captshift,3=playshift,4=samplerate,\n"
-"                         5=auto)\n"
+"                         5=auto,6=pi)\n"
 "-a,--slave     stream parameters slave mode (0=auto, 1=on, 2=off)\n"
 "-T,--thread    thread number (-1 = create unique)\n"
+"-k,--pool      run all loopbacks on a pool of N threads (0 = CPU count),\n"
+"               -T is ignored\n"
+"-x,--split     service capture in a separate thread (lock-free ring)\n"
+"-M,--mmap      copy directly between the mmap areas (identical params)\n"
 "-m,--mixer	redirect mixer, argument is:\n"
 "		    SRC_SLAVE_ID(PLAYBACK)[@DST_SLAVE_ID(CAPTURE)]\n"
 "-O,--ossmixer	rescan and redirect oss mixer, argument is:\n"
 "		    ALSA_ID@OSS_ID  (for example: \"Master@VOLUME\")\n"
-"-e,--effect    apply an effect (bandpass filter sweep)\n"
+"-e,--effect    apply an effect, can be repeated, optional argument is:\n"
+"		    NAME[:ARG...] (for example: \"sweep\" or \"eq:1000:6\",\n"
+"		    default \"sweep\")\n"
 "-v,--verbose   verbose mode (more -v means more verbose)\n"
 "-w,--workaround use workaround (serialopen)\n"
 "-U,--xrun      xrun profiling\n"
+"-Q,--stats     export statistics (JSON) through an unix socket\n"
 "-W,--wake      process wake timeout in ms\n"
 "-z,--syslog    use syslog for errors\n"
 );
+	printf("\nAvailable effects are:\n");
+	effect_list();
 	printf("\nRecognized sample formats are:");
 	for (k = 0; k < SND_PCM_FORMAT_LAST; ++k) {
 		const char *s = snd_pcm_format_name(k);
@@ -366,21 +379,25 @@ static int parse_config(int argc, char *argv[], snd_output_t *output,
 		{"period", 1, NULL, 'E'},
 		{"seconds", 1, NULL, 's'},
 		{"nblock", 0, NULL, 'b'},
-		{"effect", 0, NULL, 'e'},
+		{"effect", 2, NULL, 'e'},
 		{"verbose", 0, NULL, 'v'},
 		{"resample", 0, NULL, 'n'},
 		{"samplerate", 1, NULL, 'A'},
 		{"sync", 1, NULL, 'S'},
 		{"slave", 1, NULL, 'a'},
 		{"thread", 1, NULL, 'T'},
+		{"split", 0, NULL, 'x'},
+		{"mmap", 0, NULL, 'M'},
+		{"pool", 1, NULL, 'k'},
 		{"mixer", 1, NULL, 'm'},
 		{"ossmixer", 1, NULL, 'O'},
 		{"workaround", 1, NULL, 'w'},
 		{"xrun", 0, NULL, 'U'},
+		{"stats", 1, NULL, 'Q'},
 		{"syslog", 0, NULL, 'z'},
 		{NULL, 0, NULL, 0},
 	};
-	int err, morehelp;
+	int i, err, morehelp;
 	char *arg_config = NULL;
 	char *arg_pdevice = NULL;
 	char *arg_cdevice = NULL;
@@ -395,17 +412,18 @@ static int parse_config(int argc, char *argv[], snd_output_t *output,
 	snd_pcm_uframes_t arg_period_size = 0;
 	unsigned long arg_loop_time = ~0UL;
 	int arg_nblock = 0;
-	int arg_effect = 0;
 	int arg_resample = 0;
-#ifdef USE_SAMPLERATE
-	int arg_samplerate = SRC_SINC_FASTEST + 1;
-#endif
+	int arg_samplerate = SRC_AUTO + 1;
 	int arg_sync = SYNC_TYPE_AUTO;
 	int arg_slave = SLAVE_TYPE_AUTO;
 	int arg_thread = 0;
+	int arg_split = 0;
+	int arg_mmap = 0;
 	struct loopback *loop = NULL;
 	char *arg_mixers[MAX_MIXERS];
 	int arg_mixers_count = 0;
+	const char *arg_effects[MAX_EFFECTS];
+	int arg_effects_count = 0;
 	char *arg_ossmixers[MAX_MIXERS];
 	int arg_ossmixers_count = 0;
 	int arg_xrun = arg_default_xrun;
@@ -415,7 +433,7 @@ static int parse_config(int argc, char *argv[], snd_output_t *output,
 	while (1) {
 		int c;
 		if ((c = getopt_long(argc, argv,
-				"hdg:P:C:X:Y:l:t:F:f:c:r:s:benvA:S:a:m:T:O:w:UW:z",
+				"hdg:P:C:X:Y:l:t:F:f:c:r:s:be::nvA:S:a:m:T:xMk:O:w:UQ:W:z",
 				long_option, NULL)) < 0)
 			break;
 		switch (c) {
@@ -480,12 +498,19 @@ static int parse_config(int argc, char *argv[], snd_output_t *output,
 			arg_nblock = 1;
 			break;
 		case 'e':
-			arg_effect = 1;
+			if (arg_effects_count >= MAX_EFFECTS) {
+				logit(LOG_CRIT, "Maximum effects reached (max %i)\n", (int)MAX_EFFECTS);
+				exit(EXIT_FAILURE);
+			}
+			/* a bare -e selects the sweep filter as before */
+			if (optarg == NULL && optind < argc &&
+			    argv[optind][0] != '-')
+				optarg = argv[optind++];
+			arg_effects[arg_effects_count++] = optarg ? optarg : "sweep";
 			break;
 		case 'n':
 			arg_resample = 1;
 			break;
-#ifdef USE_SAMPLERATE
 		case 'A':
 			if (strcasecmp(optarg, "sincbest") == 0)
 				arg_samplerate = SRC_SINC_BEST_QUALITY;
@@ -497,16 +522,33 @@ static int parse_config(int argc, char *argv[], snd_output_t *output,
 				arg_samplerate = SRC_ZERO_ORDER_HOLD;
 			else if (strcasecmp(optarg, "linear") == 0)
 				arg_samplerate = SRC_LINEAR;
-			else
+			else if (strcasecmp(optarg, "auto") == 0)
+				arg_samplerate = SRC_AUTO;
+			else if (strcasecmp(optarg, "native") == 0)
+				arg_samplerate = SRC_NATIVE;
+			else {
+				/* 5 keeps meaning auto, native is 6 */
 				arg_samplerate = atoi(optarg);
-			if (arg_samplerate < 0 || arg_samplerate > SRC_LINEAR)
-				arg_sync = SRC_SINC_FASTEST;
+				if (arg_samplerate == 5)
+					arg_samplerate = SRC_AUTO;
+				else if (arg_samplerate == 6)
+					arg_samplerate = SRC_NATIVE;
+				else if (arg_samplerate < 0 ||
+					 arg_samplerate > SRC_LINEAR)
+					arg_samplerate = SRC_AUTO;
+			}
+#ifndef USE_SAMPLERATE
+			/* only the built-in converter is available */
+			if (arg_samplerate >= 0)
+				arg_samplerate = SRC_NATIVE;
+#endif
 			arg_samplerate += 1;
 			break;
-#endif
 		case 'S':
 			if (strcasecmp(optarg, "samplerate") == 0)
 				arg_sync = SYNC_TYPE_SAMPLERATE;
+			else if (strcasecmp(optarg, "pi") == 0)
+				arg_sync = SYNC_TYPE_PI;
 			else if (optarg[0] == 'n')
 				arg_sync = SYNC_TYPE_NONE;
 			else if (optarg[0] == 's')
@@ -539,6 +581,21 @@ static int parse_config(int argc, char *argv[], snd_output_t *output,
 			if (arg_thread < 0)
 				arg_thread = 10000000 + loopbacks_count;
 			break;
+		case 'x':
+			arg_split = 1;
+			break;
+		case 'M':
+			arg_mmap = 1;
+			break;
+		case 'k':
+			arg_pool = atoi(optarg);
+			if (arg_pool < 0)
+				arg_pool = 0;
+			break;
+		case 'Q':
+			free(arg_stats);
+			arg_stats = strdup(optarg);
+			break;
 		case 'm':
 			if (arg_mixers_count >= MAX_MIXERS) {
 				logit(LOG_CRIT, "Maximum redirected mixer controls reached (max %i)\n", (int)MAX_MIXERS);
@@ -610,6 +667,8 @@ static int parse_config(int argc, char *argv[], snd_output_t *output,
 		loop->sync = arg_sync;
 		loop->slave = arg_slave;
 		loop->thread = arg_thread;
+		loop->split = arg_split;
+		loop->mmap = arg_mmap;
 		loop->xrun = arg_xrun;
 		loop->wake = arg_wake;
 		err = add_mixers(loop, arg_mixers, arg_mixers_count);
@@ -622,11 +681,16 @@ static int parse_config(int argc, char *argv[], snd_output_t *output,
 			logit(LOG_CRIT, "Unable to add ossmixer controls.\n");
 			exit(EXIT_FAILURE);
 		}
-#ifdef USE_SAMPLERATE
+		for (i = 0; i < arg_effects_count; i++) {
+			err = effect_add(loop, arg_effects[i]);
+			if (err < 0) {
+				logit(LOG_CRIT, "Unable to add effect.\n");
+				exit(EXIT_FAILURE);
+			}
+		}
 		loop->src_enable = arg_samplerate > 0;
 		if (loop->src_enable)
 			loop->src_converter_type = arg_samplerate - 1;
-#endif
 		set_loop_time(loop, arg_loop_time);
 		add_loop(loop);
 		return 0;
@@ -801,6 +865,7 @@ static void send_to_all(int sig)
 		if (thread->threaded)
 			pthread_kill(thread->thread, sig);
 	}
+	pool_kill(sig);
 }
 
 static void signal_handler(int sig)
@@ -824,6 +889,7 @@ static void signal_handler_state(int sig)
 				pcmjob_state(thread->loopbacks[j]);
 		}
 	}
+	pool_state();
 	signal(sig, signal_handler_state);
 }
 
@@ -872,6 +938,25 @@ int main(int argc, char *argv[])
 		}
 	}
 
+	if (arg_stats) {
+		err = stats_start(arg_stats, loopbacks, loopbacks_count);
+		if (err < 0)
+			exit(EXIT_FAILURE);
+	}
+
+	if (arg_pool >= 0) {
+		main_job = pthread_self();
+		signal(SIGINT, signal_handler);
+		signal(SIGTERM, signal_handler);
+		signal(SIGABRT, signal_handler);
+		signal(SIGUSR1, signal_handler_state);
+		signal(SIGUSR2, signal_handler_ignore);
+		err = pool_run(loopbacks, loopbacks_count, arg_pool, output);
+		if (use_syslog)
+			closelog();
+		exit(err < 0 ? EXIT_FAILURE : EXIT_SUCCESS);
+	}
+
 	/* we must sort thread IDs */
 	j = -1;
 	do {
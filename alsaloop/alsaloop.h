@@ -19,6 +19,8 @@
  */
 
 #include "aconfig.h"
+#include <pthread.h>
+#include "ring.h"
 #ifdef HAVE_SAMPLERATE_H
 #define USE_SAMPLERATE
 #include <samplerate.h>
@@ -31,9 +33,16 @@ enum {
 	SRC_LINEAR		= 4
 };
 #endif
+#define SRC_NATIVE	(SRC_LINEAR + 1)	/* built-in polyphase resampler */
+#ifdef USE_SAMPLERATE				/* default converter */
+#define SRC_AUTO	SRC_SINC_FASTEST
+#else
+#define SRC_AUTO	SRC_NATIVE
+#endif
 
 #define MAX_ARGS	128
 #define MAX_MIXERS	64
+#define MAX_EFFECTS	16
 
 #if 0
 #define FILE_PWRITE "/tmp/alsaloop.praw"
@@ -50,9 +59,58 @@ typedef enum _sync_type {
 	SYNC_TYPE_SAMPLERATE,
 	SYNC_TYPE_AUTO,		/* order: CAPTRATESHIFT, PLAYRATESHIFT, */
 				/*        SAMPLERATE, SIMPLE */
-	SYNC_TYPE_LAST = SYNC_TYPE_AUTO
+	SYNC_TYPE_PI,		/* timestamp based PI controller, */
+				/* the method is selected like AUTO */
+	SYNC_TYPE_LAST = SYNC_TYPE_PI
 } sync_type_t;
 
+struct sync_pi {
+	double rate;			/* nominal playback rate */
+	double target;			/* requested fill in frames */
+	double ratio;			/* estimated rate ratio - 1 */
+	double prop;			/* applied PI correction */
+	double integ;			/* fill error integral */
+	unsigned int locked:1;
+	/* least squares fit over the current window */
+	unsigned int n;
+	double t0, tn;
+	double sx, sy, sxx, sxy;
+};
+
+typedef void (*convert_to_float_t)(const void *src, float *dst,
+				   unsigned long samples);
+typedef void (*convert_from_float_t)(const float *src, void *dst,
+				     unsigned long samples);
+
+struct resampler;
+struct loopback;
+
+struct effect_ops {
+	const char *name;
+	const char *help;
+	size_t private_size;
+	int (*parse)(void *private_data, const char *args);
+	int (*init)(struct loopback *loop, void *private_data,
+		    unsigned int channels, unsigned int rate);
+	/* interleaved float frames, modified in place */
+	void (*apply)(struct loopback *loop, void *private_data,
+		      float *buf, snd_pcm_uframes_t frames);
+	void (*done)(struct loopback *loop, void *private_data);
+};
+
+struct loopback_effect {
+	const struct effect_ops *ops;
+	void *private_data;
+	unsigned int active:1;
+	struct loopback_effect *next;
+};
+
+struct effect_biquad {
+	float b0, b1, b2, a1, a2;
+	unsigned int channels;
+	float *x1, *x2, *y1, *y2;	/* per channel state */
+};
+
 typedef enum _slave_type {
 	SLAVE_TYPE_AUTO = 0,
 	SLAVE_TYPE_ON = 1,
@@ -60,6 +118,32 @@ typedef enum _slave_type {
 	SLAVE_TYPE_LAST = SLAVE_TYPE_OFF
 } slave_type_t;
 
+/* histogram bucket i counts values below 2^i us, the last one the rest */
+#define STATS_HIST_BUCKETS	16
+
+/*
+ * Counters exported by the stats socket. Each field has a single writer
+ * (the thread servicing the stream), readers only do relaxed loads, so
+ * the audio path never takes a lock.
+ */
+struct handle_stats {
+	atomic_ullong frames;		/* frames transferred */
+	atomic_ulong xruns;
+	atomic_long queued;		/* last queued frames (sync) */
+};
+
+struct loopback_stats {
+	atomic_int running;
+	atomic_ulong latency;		/* frames */
+	atomic_ullong pitch;		/* double, bit copy */
+	atomic_long pitch_diff;
+	atomic_long pitch_diff_min;
+	atomic_long pitch_diff_max;
+	atomic_long proctime_max;	/* us */
+	atomic_ulong proctime[STATS_HIST_BUCKETS];
+	atomic_ulong wakeup[STATS_HIST_BUCKETS];	/* playback wakeup latency */
+};
+
 struct loopback_control {
 	snd_ctl_elem_id_t *id;
 	snd_ctl_elem_info_t *info;
@@ -103,11 +187,15 @@ struct loopback_handle {
 	unsigned int nblock:1;		/* do block (period size) transfers */
 	unsigned int xrun_pending:1;
 	unsigned int pollfd_count;
+	unsigned long xrun_count;	/* xruns seen by this side */
+	struct handle_stats stats;
 	/* I/O job */
 	char *buf;			/* I/O buffer */
 	snd_pcm_uframes_t buf_pos;	/* I/O position */
 	snd_pcm_uframes_t buf_count;	/* filled samples */
 	snd_pcm_uframes_t buf_size;	/* buffer size in frames */
+	/* buf_over and max are written by the capture thread in the split
+	   mode, they are accessed by __atomic builtins there */
 	snd_pcm_uframes_t buf_over;	/* capture buffer overflow */
 	int stall;
 	/* statistics */
@@ -145,12 +233,37 @@ struct loopback {
 	unsigned int reinit:1;
 	unsigned int running:1;
 	unsigned int stop_pending:1;
+	unsigned int split:1;		/* capture in a separate thread */
+	unsigned int use_split:1;
+	unsigned int mmap:1;		/* copy between the mmap areas */
+	unsigned int use_mmap:1;
 	snd_pcm_uframes_t stop_count;
+	/* split mode: capture thread feeds the ring, the loop thread drains it */
+	struct loopback_ring *ring;
+	pthread_t capt_thread;
+	int capt_thread_running;
+	int capt_wakefd;		/* eventfd to wake the capture thread */
+	atomic_int capt_quit;
+	atomic_int capt_reinit;		/* capture side requested reinit */
+	atomic_long capt_delay;		/* last capture delay */
 	sync_type_t sync;		/* type of sync */
+	unsigned int sync_pi:1;		/* PI controller drives the pitch */
+	struct sync_pi pi;
 	slave_type_t slave;
 	int thread;			/* thread number */
 	unsigned int wake;
+	/* worker pool */
+	unsigned int pool:1;		/* serviced by the worker pool */
+	int pool_index;			/* index in the loopbacks array */
+	atomic_int pool_worker;		/* current owner */
+	atomic_int pool_target;		/* owner requested by the rebalancer */
+	atomic_long pool_load;		/* processing time since last rebalance (us) */
+	unsigned long pool_mark;
+	struct pollfd *pool_fds;	/* descriptors registered to epoll */
+	int pool_fds_count;
 	/* statistics */
+	unsigned int stats_enabled:1;	/* export through the stats socket */
+	struct loopback_stats stats;
 	double pitch;
 	double pitch_delta;
 	snd_pcm_sframes_t pitch_diff;
@@ -173,17 +286,32 @@ struct loopback {
 	unsigned int xrun_out_frames;
 	long xrun_max_proctime;
 	double xrun_max_missing;
+	/* effect chain, runs on the captured frames */
+	struct loopback_effect *effects;
+	float *effect_buf;
+	unsigned int effect_channels;
+	unsigned int effect_frame_size;
+	convert_to_float_t effect_to_float;
+	convert_from_float_t effect_from_float;
 	/* control mixer */
 	struct loopback_mixer *controls;
 	struct loopback_ossmixer *oss_controls;
 	/* sample rate */
 	unsigned int use_samplerate:1;
-#ifdef USE_SAMPLERATE
 	unsigned int src_enable:1;
 	int src_converter_type;
+	double src_ratio;
+	unsigned int src_out_frames;
+	convert_to_float_t src_to_float;
+	convert_from_float_t src_from_float;
+	struct resampler *src_native;
+	float *src_native_out;
+	/* fade in after a capture only reconfiguration */
+	snd_pcm_uframes_t fade_pos;
+	snd_pcm_uframes_t fade_len;	/* 0 = no fade */
+#ifdef USE_SAMPLERATE
 	SRC_STATE *src_state;
 	SRC_DATA src_data;
-	unsigned int src_out_frames;
 #endif
 #ifdef FILE_CWRITE
 	FILE *cfile;
@@ -193,9 +321,13 @@ struct loopback {
 #endif
 };
 
+typedef int (*pcm_open_t)(snd_pcm_t **pcm, const char *name,
+			  snd_pcm_stream_t stream, int mode);
+
 extern int verbose;
 extern int workarounds;
 extern int use_syslog;
+extern int quit;
 
 #define logit(priority, fmt, args...) do {		\
 	if (use_syslog)					\
@@ -204,6 +336,37 @@ extern int use_syslog;
 		fprintf(stderr, fmt, ##args);		\
 } while (0)
 
+/* single writer, so a plain load + store is enough */
+static inline void stats_add(atomic_ullong *counter, unsigned long long val)
+{
+	atomic_store_explicit(counter,
+		atomic_load_explicit(counter, memory_order_relaxed) + val,
+		memory_order_relaxed);
+}
+
+static inline void stats_inc(atomic_ulong *counter)
+{
+	atomic_store_explicit(counter,
+		atomic_load_explicit(counter, memory_order_relaxed) + 1,
+		memory_order_relaxed);
+}
+
+static inline void stats_set(atomic_long *val, long v)
+{
+	atomic_store_explicit(val, v, memory_order_relaxed);
+}
+
+static inline unsigned int stats_bucket(long us)
+{
+	unsigned int i = 0;
+
+	while (i < STATS_HIST_BUCKETS - 1 && us >= (1L << i))
+		i++;
+	return i;
+}
+
+extern pcm_open_t pcmjob_pcm_open;	/* snd_pcm_open by default */
+
 int pcmjob_init(struct loopback *loop);
 int pcmjob_done(struct loopback *loop);
 int pcmjob_start(struct loopback *loop);
@@ -212,6 +375,52 @@ int pcmjob_pollfds_init(struct loopback *loop, struct pollfd *fds);
 int pcmjob_pollfds_handle(struct loopback *loop, struct pollfd *fds);
 void pcmjob_state(struct loopback *loop);
 
+void setscheduler(void);
+
+int pool_run(struct loopback **loops, int count, int workers,
+	     snd_output_t *output);
+void pool_kill(int sig);
+void pool_state(void);
+
+int stats_start(const char *path, struct loopback **loops, int count);
+
+int convert_supported(snd_pcm_format_t format);
+convert_to_float_t convert_get_to_float(snd_pcm_format_t format);
+convert_from_float_t convert_get_from_float(snd_pcm_format_t format);
+
+int resampler_new(struct resampler **r, unsigned int channels, double ratio);
+void resampler_delete(struct resampler *r);
+void resampler_reset(struct resampler *r);
+void resampler_set_ratio(struct resampler *r, double ratio);
+snd_pcm_uframes_t resampler_process(struct resampler *r,
+				    const void *in,
+				    snd_pcm_uframes_t in_frames,
+				    unsigned int in_frame_size,
+				    convert_to_float_t to_float,
+				    float *out,
+				    snd_pcm_uframes_t *out_frames);
+
+void sync_pi_init(struct sync_pi *pi, double rate, double target);
+void sync_pi_restart(struct sync_pi *pi);
+void sync_pi_sample(struct sync_pi *pi, double t, double fill);
+int sync_pi_update(struct sync_pi *pi, double *pitch, double *error);
+double sync_simple_update(double pitch, double delta, long diff,
+			  long last_diff);
+
+int effect_add(struct loopback *loop, const char *arg);
+int effect_chain_init(struct loopback *loop, unsigned int channels,
+		      unsigned int rate, snd_pcm_format_t format);
+void effect_chain_done(struct loopback *loop);
+void effect_chain_apply(struct loopback *loop, char *buf,
+			snd_pcm_uframes_t frames);
+void effect_list(void);
+int effect_biquad_init(struct effect_biquad *bq, unsigned int channels);
+void effect_biquad_done(struct effect_biquad *bq);
+void effect_biquad_process(struct effect_biquad *bq, float *buf,
+			   unsigned int frames);
+extern const struct effect_ops effect_sweep;
+extern const struct effect_ops effect_eq;
+
 int control_parse_id(const char *str, snd_ctl_elem_id_t *id);
 int control_id_match(snd_ctl_elem_id_t *id1, snd_ctl_elem_id_t *id2);
 int control_init(struct loopback *loop);
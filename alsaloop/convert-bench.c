@@ -0,0 +1,179 @@
+/*
+ *  A simple PCM loopback utility
+ *  Micro-benchmark for the sample format conversion kernels
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ *  Build with "make convert-bench", run "ALSALOOP_NO_SIMD=1 ./convert-bench"
+ *  to measure the scalar fallback.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <math.h>
+#include <alsa/asoundlib.h>
+#include "alsaloop.h"
+
+#define CHANNELS	32
+#define FRAMES		1024
+#define SAMPLES		(CHANNELS * FRAMES)
+#define LOOPS		2000
+
+static double now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* reference integer value of a float sample for the given width */
+static int32_t ref_int(float v, int bits)
+{
+	double max = ldexp(1.0, bits - 1);
+	double d = (double)v * max;
+
+	if (d >= max - 1)
+		return max - 1;
+	if (d <= -max)
+		return -max;
+	return lrint(d);
+}
+
+static int32_t get_int(snd_pcm_format_t format, const void *buf,
+		       unsigned long idx)
+{
+	const uint8_t *p;
+
+	switch (format) {
+	case SND_PCM_FORMAT_S16:
+		return ((const int16_t *)buf)[idx];
+	case SND_PCM_FORMAT_S24:
+		return (int32_t)((uint32_t)((const int32_t *)buf)[idx] << 8) >> 8;
+	case SND_PCM_FORMAT_S24_3LE:
+		p = (const uint8_t *)buf + idx * 3;
+		return (int32_t)((uint32_t)p[0] << 8 | (uint32_t)p[1] << 16 |
+				 (uint32_t)p[2] << 24) >> 8;
+	default:
+		return ((const int32_t *)buf)[idx];
+	}
+}
+
+static int check(snd_pcm_format_t format, const float *in, const void *buf,
+		 const float *back)
+{
+	int bits = snd_pcm_format_width(format);
+	unsigned long i;
+	int32_t v;
+
+	if (format == SND_PCM_FORMAT_FLOAT)
+		return memcmp(in, buf, SAMPLES * sizeof(float)) ? -1 : 0;
+	for (i = 0; i < SAMPLES; i++) {
+		v = get_int(format, buf, i);
+		if (v != ref_int(in[i], bits)) {
+			printf("  mismatch at %lu: %f -> %i (expected %i)\n",
+			       i, in[i], v, ref_int(in[i], bits));
+			return -1;
+		}
+		if (back[i] != (float)ldexp(v, -(bits - 1))) {
+			printf("  mismatch at %lu: %i -> %f\n", i, v, back[i]);
+			return -1;
+		}
+	}
+	return 0;
+}
+
+static void report(const char *name, double t)
+{
+	printf("  %-24s %8.3f ns/sample\n", name, t * 1e9 / ((double)SAMPLES * LOOPS));
+}
+
+int main(void)
+{
+	static const snd_pcm_format_t formats[] = {
+		SND_PCM_FORMAT_S16,
+		SND_PCM_FORMAT_S24,
+		SND_PCM_FORMAT_S24_3LE,
+		SND_PCM_FORMAT_S32,
+		SND_PCM_FORMAT_FLOAT,
+	};
+	convert_to_float_t to_float;
+	convert_from_float_t from_float;
+	float *in, *out;
+	void *buf;
+	double t;
+	unsigned int f, i;
+	int err = 0;
+
+	in = malloc(SAMPLES * sizeof(float));
+	out = malloc(SAMPLES * sizeof(float));
+	buf = malloc(SAMPLES * sizeof(int32_t));
+	if (in == NULL || out == NULL || buf == NULL)
+		return EXIT_FAILURE;
+	srand(1);
+	/* include out of range values to exercise clipping */
+	for (i = 0; i < SAMPLES; i++)
+		in[i] = ((float)rand() / RAND_MAX) * 2.4f - 1.2f;
+
+	printf("%i channels, %i frames, %i loops%s\n", CHANNELS, FRAMES, LOOPS,
+	       getenv("ALSALOOP_NO_SIMD") ? " (no SIMD)" : "");
+	for (f = 0; f < sizeof(formats) / sizeof(formats[0]); f++) {
+		printf("%s:\n", snd_pcm_format_name(formats[f]));
+		to_float = convert_get_to_float(formats[f]);
+		from_float = convert_get_from_float(formats[f]);
+		from_float(in, buf, SAMPLES);
+		to_float(buf, out, SAMPLES);
+		if (check(formats[f], in, buf, out) < 0) {
+			printf("  FAILED\n");
+			err = 1;
+		}
+		t = now();
+		for (i = 0; i < LOOPS; i++)
+			to_float(buf, out, SAMPLES);
+		report("to float", now() - t);
+		t = now();
+		for (i = 0; i < LOOPS; i++)
+			from_float(out, buf, SAMPLES);
+		report("from float", now() - t);
+#ifdef USE_SAMPLERATE
+		if (formats[f] == SND_PCM_FORMAT_S16) {
+			t = now();
+			for (i = 0; i < LOOPS; i++)
+				src_short_to_float_array(buf, out, SAMPLES);
+			report("src_short_to_float_array", now() - t);
+			t = now();
+			for (i = 0; i < LOOPS; i++)
+				src_float_to_short_array(out, buf, SAMPLES);
+			report("src_float_to_short_array", now() - t);
+		} else if (formats[f] == SND_PCM_FORMAT_S32) {
+			t = now();
+			for (i = 0; i < LOOPS; i++)
+				src_int_to_float_array(buf, out, SAMPLES);
+			report("src_int_to_float_array", now() - t);
+			t = now();
+			for (i = 0; i < LOOPS; i++)
+				src_float_to_int_array(out, buf, SAMPLES);
+			report("src_float_to_int_array", now() - t);
+		}
+#endif
+	}
+	free(in);
+	free(out);
+	free(buf);
+	return err ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,549 @@
+/*
+ *  A simple PCM loopback utility
+ *  Sample format to/from float conversion for the resampling path
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <math.h>
+#include <pthread.h>
+#include <alsa/asoundlib.h>
+#include "alsaloop.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define CONVERT_X86
+#include <immintrin.h>
+#endif
+
+/*
+ * The scaling follows libsamplerate: full scale of an N bit integer maps
+ * to [-1.0, 1.0), conversion back rounds to nearest and clips.
+ */
+
+#define S16_SCALE	(1.0f / 32768.0f)
+#define S24_SCALE	(1.0f / 8388608.0f)
+#define S32_SCALE	(1.0f / 2147483648.0f)
+
+static void s16_to_float_c(const void *src, float *dst, unsigned long samples)
+{
+	const int16_t *s = src;
+	unsigned long i;
+
+	for (i = 0; i < samples; i++)
+		dst[i] = s[i] * S16_SCALE;
+}
+
+static void float_to_s16_c(const float *src, void *dst, unsigned long samples)
+{
+	int16_t *d = dst;
+	unsigned long i;
+	float v;
+
+	for (i = 0; i < samples; i++) {
+		v = src[i] * 32768.0f;
+		if (v >= 32767.0f)
+			d[i] = 32767;
+		else if (v <= -32768.0f)
+			d[i] = -32768;
+		else
+			d[i] = lrintf(v);
+	}
+}
+
+static void s24_to_float_c(const void *src, float *dst, unsigned long samples)
+{
+	const int32_t *s = src;
+	unsigned long i;
+
+	for (i = 0; i < samples; i++)
+		dst[i] = ((int32_t)((uint32_t)s[i] << 8) >> 8) * S24_SCALE;
+}
+
+static void float_to_s24_c(const float *src, void *dst, unsigned long samples)
+{
+	int32_t *d = dst;
+	unsigned long i;
+	float v;
+
+	for (i = 0; i < samples; i++) {
+		v = src[i] * 8388608.0f;
+		if (v >= 8388607.0f)
+			d[i] = 8388607;
+		else if (v <= -8388608.0f)
+			d[i] = -8388608;
+		else
+			d[i] = lrintf(v);
+	}
+}
+
+static void s24_3le_to_float_c(const void *src, float *dst,
+			       unsigned long samples)
+{
+	const uint8_t *s = src;
+	unsigned long i;
+	int32_t v;
+
+	for (i = 0; i < samples; i++, s += 3) {
+		v = (uint32_t)s[0] << 8 | (uint32_t)s[1] << 16 |
+		    (uint32_t)s[2] << 24;
+		dst[i] = (v >> 8) * S24_SCALE;
+	}
+}
+
+static void float_to_s24_3le_c(const float *src, void *dst,
+			       unsigned long samples)
+{
+	uint8_t *d = dst;
+	unsigned long i;
+	int32_t v;
+	float f;
+
+	for (i = 0; i < samples; i++, d += 3) {
+		f = src[i] * 8388608.0f;
+		if (f >= 8388607.0f)
+			v = 8388607;
+		else if (f <= -8388608.0f)
+			v = -8388608;
+		else
+			v = lrintf(f);
+		d[0] = v;
+		d[1] = v >> 8;
+		d[2] = v >> 16;
+	}
+}
+
+static void s32_to_float_c(const void *src, float *dst, unsigned long samples)
+{
+	const int32_t *s = src;
+	unsigned long i;
+
+	for (i = 0; i < samples; i++)
+		dst[i] = s[i] * S32_SCALE;
+}
+
+static void float_to_s32_c(const float *src, void *dst, unsigned long samples)
+{
+	int32_t *d = dst;
+	unsigned long i;
+	double v;
+
+	for (i = 0; i < samples; i++) {
+		v = src[i] * 2147483648.0;
+		if (v >= 2147483647.0)
+			d[i] = 2147483647;
+		else if (v <= -2147483648.0)
+			d[i] = -2147483647 - 1;
+		else
+			d[i] = lrint(v);
+	}
+}
+
+static void float_to_float(const void *src, float *dst, unsigned long samples)
+{
+	memcpy(dst, src, samples * sizeof(float));
+}
+
+static void float_from_float(const float *src, void *dst,
+			     unsigned long samples)
+{
+	memcpy(dst, src, samples * sizeof(float));
+}
+
+#ifdef CONVERT_X86
+
+/* SSE2 is the x86_64 baseline, on i386 it is checked at runtime */
+
+__attribute__((target("sse2")))
+static void s16_to_float_sse2(const void *src, float *dst,
+			      unsigned long samples)
+{
+	const int16_t *s = src;
+	const __m128 scale = _mm_set1_ps(S16_SCALE);
+	unsigned long i = 0;
+	__m128i v, lo, hi;
+
+	for (; i + 8 <= samples; i += 8) {
+		v = _mm_loadu_si128((const __m128i *)(s + i));
+		/* sign extend by unpacking into the high half */
+		lo = _mm_srai_epi32(_mm_unpacklo_epi16(v, v), 16);
+		hi = _mm_srai_epi32(_mm_unpackhi_epi16(v, v), 16);
+		_mm_storeu_ps(dst + i, _mm_mul_ps(_mm_cvtepi32_ps(lo), scale));
+		_mm_storeu_ps(dst + i + 4,
+			      _mm_mul_ps(_mm_cvtepi32_ps(hi), scale));
+	}
+	s16_to_float_c(s + i, dst + i, samples - i);
+}
+
+__attribute__((target("sse2")))
+static void float_to_s16_sse2(const float *src, void *dst,
+			      unsigned long samples)
+{
+	int16_t *d = dst;
+	const __m128 scale = _mm_set1_ps(32768.0f);
+	const __m128 vmax = _mm_set1_ps(32767.0f);
+	const __m128 vmin = _mm_set1_ps(-32768.0f);
+	unsigned long i = 0;
+	__m128i lo, hi;
+	__m128 v;
+
+	for (; i + 8 <= samples; i += 8) {
+		v = _mm_mul_ps(_mm_loadu_ps(src + i), scale);
+		lo = _mm_cvtps_epi32(_mm_max_ps(_mm_min_ps(v, vmax), vmin));
+		v = _mm_mul_ps(_mm_loadu_ps(src + i + 4), scale);
+		hi = _mm_cvtps_epi32(_mm_max_ps(_mm_min_ps(v, vmax), vmin));
+		_mm_storeu_si128((__m128i *)(d + i), _mm_packs_epi32(lo, hi));
+	}
+	float_to_s16_c(src + i, d + i, samples - i);
+}
+
+__attribute__((target("sse2")))
+static void s24_to_float_sse2(const void *src, float *dst,
+			      unsigned long samples)
+{
+	const int32_t *s = src;
+	const __m128 scale = _mm_set1_ps(S24_SCALE);
+	unsigned long i = 0;
+	__m128i v;
+
+	for (; i + 4 <= samples; i += 4) {
+		v = _mm_loadu_si128((const __m128i *)(s + i));
+		v = _mm_srai_epi32(_mm_slli_epi32(v, 8), 8);
+		_mm_storeu_ps(dst + i, _mm_mul_ps(_mm_cvtepi32_ps(v), scale));
+	}
+	s24_to_float_c(s + i, dst + i, samples - i);
+}
+
+__attribute__((target("sse2")))
+static void float_to_s24_sse2(const float *src, void *dst,
+			      unsigned long samples)
+{
+	int32_t *d = dst;
+	const __m128 scale = _mm_set1_ps(8388608.0f);
+	const __m128 vmax = _mm_set1_ps(8388607.0f);
+	const __m128 vmin = _mm_set1_ps(-8388608.0f);
+	unsigned long i = 0;
+	__m128 v;
+
+	for (; i + 4 <= samples; i += 4) {
+		v = _mm_mul_ps(_mm_loadu_ps(src + i), scale);
+		v = _mm_max_ps(_mm_min_ps(v, vmax), vmin);
+		_mm_storeu_si128((__m128i *)(d + i), _mm_cvtps_epi32(v));
+	}
+	float_to_s24_c(src + i, d + i, samples - i);
+}
+
+__attribute__((target("sse2")))
+static void s32_to_float_sse2(const void *src, float *dst,
+			      unsigned long samples)
+{
+	const int32_t *s = src;
+	const __m128 scale = _mm_set1_ps(S32_SCALE);
+	unsigned long i = 0;
+	__m128i v;
+
+	for (; i + 4 <= samples; i += 4) {
+		v = _mm_loadu_si128((const __m128i *)(s + i));
+		_mm_storeu_ps(dst + i, _mm_mul_ps(_mm_cvtepi32_ps(v), scale));
+	}
+	s32_to_float_c(s + i, dst + i, samples - i);
+}
+
+__attribute__((target("sse2")))
+static void float_to_s32_sse2(const float *src, void *dst,
+			      unsigned long samples)
+{
+	int32_t *d = dst;
+	const __m128 scale = _mm_set1_ps(2147483648.0f);
+	unsigned long i = 0;
+	__m128 v, over;
+	__m128i r;
+
+	for (; i + 4 <= samples; i += 4) {
+		v = _mm_mul_ps(_mm_loadu_ps(src + i), scale);
+		/*
+		 * cvtps returns 0x80000000 for positive overflow,
+		 * flipping all bits of those lanes gives 0x7fffffff
+		 */
+		over = _mm_cmpge_ps(v, scale);
+		r = _mm_cvtps_epi32(v);
+		r = _mm_xor_si128(r, _mm_castps_si128(over));
+		_mm_storeu_si128((__m128i *)(d + i), r);
+	}
+	float_to_s32_c(src + i, d + i, samples - i);
+}
+
+__attribute__((target("ssse3")))
+static void s24_3le_to_float_ssse3(const void *src, float *dst,
+				   unsigned long samples)
+{
+	const uint8_t *s = src;
+	const __m128 scale = _mm_set1_ps(S24_SCALE);
+	/* place the three bytes of each sample into the upper 24 bits */
+	const __m128i shuf = _mm_setr_epi8(-1, 0, 1, 2, -1, 3, 4, 5,
+					   -1, 6, 7, 8, -1, 9, 10, 11);
+	unsigned long i = 0;
+	__m128i v;
+
+	/* a 16 byte load consumes 12 bytes, keep it inside the buffer */
+	for (; i + 6 <= samples; i += 4) {
+		v = _mm_loadu_si128((const __m128i *)(s + i * 3));
+		v = _mm_srai_epi32(_mm_shuffle_epi8(v, shuf), 8);
+		_mm_storeu_ps(dst + i, _mm_mul_ps(_mm_cvtepi32_ps(v), scale));
+	}
+	s24_3le_to_float_c(s + i * 3, dst + i, samples - i);
+}
+
+__attribute__((target("ssse3")))
+static void float_to_s24_3le_ssse3(const float *src, void *dst,
+				   unsigned long samples)
+{
+	uint8_t *d = dst;
+	const __m128 scale = _mm_set1_ps(8388608.0f);
+	const __m128 vmax = _mm_set1_ps(8388607.0f);
+	const __m128 vmin = _mm_set1_ps(-8388608.0f);
+	const __m128i shuf = _mm_setr_epi8(0, 1, 2, 4, 5, 6, 8, 9,
+					   10, 12, 13, 14, -1, -1, -1, -1);
+	unsigned long i = 0;
+	__m128 v;
+	__m128i r;
+	int32_t tail;
+
+	for (; i + 4 <= samples; i += 4) {
+		v = _mm_mul_ps(_mm_loadu_ps(src + i), scale);
+		v = _mm_max_ps(_mm_min_ps(v, vmax), vmin);
+		r = _mm_shuffle_epi8(_mm_cvtps_epi32(v), shuf);
+		/* store exactly 12 bytes, the buffer is not aligned */
+		_mm_storel_epi64((__m128i *)(d + i * 3), r);
+		tail = _mm_cvtsi128_si32(_mm_srli_si128(r, 8));
+		memcpy(d + i * 3 + 8, &tail, sizeof(tail));
+	}
+	float_to_s24_3le_c(src + i, d + i * 3, samples - i);
+}
+
+__attribute__((target("avx2")))
+static void s16_to_float_avx2(const void *src, float *dst,
+			      unsigned long samples)
+{
+	const int16_t *s = src;
+	const __m256 scale = _mm256_set1_ps(S16_SCALE);
+	unsigned long i = 0;
+	__m256i v;
+
+	for (; i + 8 <= samples; i += 8) {
+		v = _mm256_cvtepi16_epi32(
+			_mm_loadu_si128((const __m128i *)(s + i)));
+		_mm256_storeu_ps(dst + i,
+				 _mm256_mul_ps(_mm256_cvtepi32_ps(v), scale));
+	}
+	s16_to_float_c(s + i, dst + i, samples - i);
+}
+
+__attribute__((target("avx2")))
+static void float_to_s16_avx2(const float *src, void *dst,
+			      unsigned long samples)
+{
+	int16_t *d = dst;
+	const __m256 scale = _mm256_set1_ps(32768.0f);
+	const __m256 vmax = _mm256_set1_ps(32767.0f);
+	const __m256 vmin = _mm256_set1_ps(-32768.0f);
+	unsigned long i = 0;
+	__m256i lo, hi, r;
+	__m256 v;
+
+	for (; i + 16 <= samples; i += 16) {
+		v = _mm256_mul_ps(_mm256_loadu_ps(src + i), scale);
+		lo = _mm256_cvtps_epi32(
+			_mm256_max_ps(_mm256_min_ps(v, vmax), vmin));
+		v = _mm256_mul_ps(_mm256_loadu_ps(src + i + 8), scale);
+		hi = _mm256_cvtps_epi32(
+			_mm256_max_ps(_mm256_min_ps(v, vmax), vmin));
+		/* packs works per 128 bit lane, fix the order afterwards */
+		r = _mm256_packs_epi32(lo, hi);
+		r = _mm256_permute4x64_epi64(r, 0xd8);
+		_mm256_storeu_si256((__m256i *)(d + i), r);
+	}
+	float_to_s16_sse2(src + i, d + i, samples - i);
+}
+
+__attribute__((target("avx2")))
+static void s24_to_float_avx2(const void *src, float *dst,
+			      unsigned long samples)
+{
+	const int32_t *s = src;
+	const __m256 scale = _mm256_set1_ps(S24_SCALE);
+	unsigned long i = 0;
+	__m256i v;
+
+	for (; i + 8 <= samples; i += 8) {
+		v = _mm256_loadu_si256((const __m256i *)(s + i));
+		v = _mm256_srai_epi32(_mm256_slli_epi32(v, 8), 8);
+		_mm256_storeu_ps(dst + i,
+				 _mm256_mul_ps(_mm256_cvtepi32_ps(v), scale));
+	}
+	s24_to_float_c(s + i, dst + i, samples - i);
+}
+
+__attribute__((target("avx2")))
+static void float_to_s24_avx2(const float *src, void *dst,
+			      unsigned long samples)
+{
+	int32_t *d = dst;
+	const __m256 scale = _mm256_set1_ps(8388608.0f);
+	const __m256 vmax = _mm256_set1_ps(8388607.0f);
+	const __m256 vmin = _mm256_set1_ps(-8388608.0f);
+	unsigned long i = 0;
+	__m256 v;
+
+	for (; i + 8 <= samples; i += 8) {
+		v = _mm256_mul_ps(_mm256_loadu_ps(src + i), scale);
+		v = _mm256_max_ps(_mm256_min_ps(v, vmax), vmin);
+		_mm256_storeu_si256((__m256i *)(d + i), _mm256_cvtps_epi32(v));
+	}
+	float_to_s24_c(src + i, d + i, samples - i);
+}
+
+__attribute__((target("avx2")))
+static void s32_to_float_avx2(const void *src, float *dst,
+			      unsigned long samples)
+{
+	const int32_t *s = src;
+	const __m256 scale = _mm256_set1_ps(S32_SCALE);
+	unsigned long i = 0;
+	__m256i v;
+
+	for (; i + 8 <= samples; i += 8) {
+		v = _mm256_loadu_si256((const __m256i *)(s + i));
+		_mm256_storeu_ps(dst + i,
+				 _mm256_mul_ps(_mm256_cvtepi32_ps(v), scale));
+	}
+	s32_to_float_c(s + i, dst + i, samples - i);
+}
+
+__attribute__((target("avx2")))
+static void float_to_s32_avx2(const float *src, void *dst,
+			      unsigned long samples)
+{
+	int32_t *d = dst;
+	const __m256 scale = _mm256_set1_ps(2147483648.0f);
+	unsigned long i = 0;
+	__m256 v, over;
+	__m256i r;
+
+	for (; i + 8 <= samples; i += 8) {
+		v = _mm256_mul_ps(_mm256_loadu_ps(src + i), scale);
+		over = _mm256_cmp_ps(v, scale, _CMP_GE_OQ);
+		r = _mm256_cvtps_epi32(v);
+		r = _mm256_xor_si256(r, _mm256_castps_si256(over));
+		_mm256_storeu_si256((__m256i *)(d + i), r);
+	}
+	float_to_s32_c(src + i, d + i, samples - i);
+}
+
+#endif /* CONVERT_X86 */
+
+struct convert_ops {
+	snd_pcm_format_t format;
+	convert_to_float_t to_float;
+	convert_from_float_t from_float;
+};
+
+static struct convert_ops convert_table[] = {
+	{ SND_PCM_FORMAT_S16, s16_to_float_c, float_to_s16_c },
+	{ SND_PCM_FORMAT_S24, s24_to_float_c, float_to_s24_c },
+	{ SND_PCM_FORMAT_S24_3LE, s24_3le_to_float_c, float_to_s24_3le_c },
+	{ SND_PCM_FORMAT_S32, s32_to_float_c, float_to_s32_c },
+	{ SND_PCM_FORMAT_FLOAT, float_to_float, float_from_float },
+};
+
+#define CONVERT_COUNT (sizeof(convert_table) / sizeof(convert_table[0]))
+
+static pthread_once_t convert_once = PTHREAD_ONCE_INIT;
+
+static void convert_set(snd_pcm_format_t format,
+			convert_to_float_t to_float,
+			convert_from_float_t from_float)
+{
+	unsigned int i;
+
+	for (i = 0; i < CONVERT_COUNT; i++) {
+		if (convert_table[i].format == format) {
+			convert_table[i].to_float = to_float;
+			convert_table[i].from_float = from_float;
+		}
+	}
+}
+
+static void convert_select(void)
+{
+	if (getenv("ALSALOOP_NO_SIMD"))
+		return;
+#ifdef CONVERT_X86
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("sse2")) {
+		convert_set(SND_PCM_FORMAT_S16, s16_to_float_sse2,
+			    float_to_s16_sse2);
+		convert_set(SND_PCM_FORMAT_S24, s24_to_float_sse2,
+			    float_to_s24_sse2);
+		convert_set(SND_PCM_FORMAT_S32, s32_to_float_sse2,
+			    float_to_s32_sse2);
+	}
+	if (__builtin_cpu_supports("ssse3"))
+		convert_set(SND_PCM_FORMAT_S24_3LE, s24_3le_to_float_ssse3,
+			    float_to_s24_3le_ssse3);
+	if (__builtin_cpu_supports("avx2")) {
+		convert_set(SND_PCM_FORMAT_S16, s16_to_float_avx2,
+			    float_to_s16_avx2);
+		convert_set(SND_PCM_FORMAT_S24, s24_to_float_avx2,
+			    float_to_s24_avx2);
+		convert_set(SND_PCM_FORMAT_S32, s32_to_float_avx2,
+			    float_to_s32_avx2);
+	}
+#endif
+}
+
+static struct convert_ops *convert_find(snd_pcm_format_t format)
+{
+	unsigned int i;
+
+	pthread_once(&convert_once, convert_select);
+	for (i = 0; i < CONVERT_COUNT; i++) {
+		if (convert_table[i].format == format)
+			return &convert_table[i];
+	}
+	return NULL;
+}
+
+int convert_supported(snd_pcm_format_t format)
+{
+	return convert_find(format) != NULL;
+}
+
+convert_to_float_t convert_get_to_float(snd_pcm_format_t format)
+{
+	struct convert_ops *ops = convert_find(format);
+
+	return ops ? ops->to_float : NULL;
+}
+
+convert_from_float_t convert_get_from_float(snd_pcm_format_t format)
+{
+	struct convert_ops *ops = convert_find(format);
+
+	return ops ? ops->from_float : NULL;
+}
@@ -0,0 +1,98 @@
+/*
+ *  A simple PCM loopback utility
+ *  Parametric (peaking) equalizer effect
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include <syslog.h>
+#include <alsa/asoundlib.h>
+#include "alsaloop.h"
+
+struct eq_private {
+	float freq, gain, Q;
+	struct effect_biquad bq;
+};
+
+static int eq_parse(void *private_data, const char *args)
+{
+	struct eq_private *priv = private_data;
+
+	priv->freq = 1000.;
+	priv->gain = 0.;
+	priv->Q = 0.707;
+	if (args == NULL ||
+	    sscanf(args, "%f:%f:%f", &priv->freq, &priv->gain, &priv->Q) < 2)
+		return -EINVAL;
+	if (priv->freq <= 0 || priv->Q <= 0)
+		return -EINVAL;
+	return 0;
+}
+
+static int eq_init(struct loopback *loop, void *private_data,
+		   unsigned int channels, unsigned int rate)
+{
+	struct eq_private *priv = private_data;
+	double A, w0, alpha, a0;
+	int err;
+
+	if (priv->freq >= rate / 2.) {
+		logit(LOG_CRIT, "%s: eq frequency %.1fHz is above Nyquist\n", loop->id, priv->freq);
+		return -EINVAL;
+	}
+	err = effect_biquad_init(&priv->bq, channels);
+	if (err < 0)
+		return err;
+	/* RBJ audio EQ cookbook, peaking EQ */
+	A = pow(10., priv->gain / 40.);
+	w0 = 2. * M_PI * priv->freq / rate;
+	alpha = sin(w0) / (2. * priv->Q);
+	a0 = 1. + alpha / A;
+	priv->bq.b0 = (1. + alpha * A) / a0;
+	priv->bq.b1 = -2. * cos(w0) / a0;
+	priv->bq.b2 = (1. - alpha * A) / a0;
+	priv->bq.a1 = priv->bq.b1;
+	priv->bq.a2 = (1. - alpha / A) / a0;
+	return 0;
+}
+
+static void eq_done(struct loopback *loop, void *private_data)
+{
+	struct eq_private *priv = private_data;
+
+	effect_biquad_done(&priv->bq);
+}
+
+static void eq_apply(struct loopback *loop, void *private_data,
+		     float *buf, snd_pcm_uframes_t frames)
+{
+	struct eq_private *priv = private_data;
+
+	effect_biquad_process(&priv->bq, buf, frames);
+}
+
+const struct effect_ops effect_eq = {
+	.name = "eq",
+	.help = ":freq:gain_db[:Q] peaking equalizer band",
+	.private_size = sizeof(struct eq_private),
+	.parse = eq_parse,
+	.init = eq_init,
+	.apply = eq_apply,
+	.done = eq_done,
+};
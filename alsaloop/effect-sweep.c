@@ -18,111 +18,90 @@
  *
  */
 
+#include <stdio.h>
+#include <stdlib.h>
 #include <math.h>
 #include <alsa/asoundlib.h>
+#include "alsaloop.h"
 
-struct effect_private {
-	/* filter the sweep variables */
-	float lfo,dlfo,fs,fc,BW,C,D,a0,a1,a2,b1,b2,*x[3],*y[3];
-	float lfo_depth, lfo_center;
-	unsigned int channels;
+/* the filter coefficients follow the LFO once per block */
+#define SWEEP_BLOCK	32
+
+struct sweep_private {
+	float lfo_center, lfo_depth, lfo_freq, BW;
+	double lfo, dlfo, fs, C;
+	struct effect_biquad bq;
 };
 
-static int effect_init(struct lookback *loopback,
-		       void *private_data,
-		       snd_pcm_access_t access,
-		       unsigned int channels,
-		       unsigned int rate,
-		       snd_pcm_format_t format)
+static int sweep_parse(void *private_data, const char *args)
 {
-	struct effect_private *priv = private_data;
-	int i;
+	struct sweep_private *priv = private_data;
 
-#if __BYTE_ORDER == __LITTLE_ENDIAN
-	if (format != SND_PCM_FORMAT_S16_LE)
-		return -EIO;
-#elif __BYTE_ORDER == __BIG_ENDIAN
-	if (format != SND_PCM_FORMAT_S16_BE)
-		return -EIO;
-#else
-	return -EIO;
-#endif
-	priv->fs = (float) rate;
-	priv->channels = channels;
-	for (i = 0; i < 3; i++) {
-		priv->x[i] = calloc(channels * sizeof(float));
-		priv->y[i] = calloc(channels * sizeof(float));
-	}
+	priv->lfo_center = 2000.;
+	priv->lfo_depth = 1800.;
+	priv->lfo_freq = 0.2;
+	priv->BW = 50;
+	/* "sweep" and "sweep:" take the defaults */
+	if (args && *args &&
+	    sscanf(args, "%f:%f:%f:%f", &priv->lfo_center,
+		   &priv->lfo_depth, &priv->lfo_freq, &priv->BW) < 1)
+		return -EINVAL;
+	if (priv->BW <= 0 || priv->lfo_freq < 0)
+		return -EINVAL;
 	return 0;
 }
 
-static int effect_done(struct loopback *loopback,
-		       void *private_data)
+static int sweep_init(struct loopback *loop, void *private_data,
+		      unsigned int channels, unsigned int rate)
 {
-	struct effect_private *priv = private_data;
-	int i;
+	struct sweep_private *priv = private_data;
 
-	for (i = 0; i < 3; i++) {
-		free(priv->x[i]);
-		free(priv->y[i]);
-	}
-	return 0;
+	priv->fs = rate;
+	priv->lfo = 0;
+	priv->dlfo = 2. * M_PI * priv->lfo_freq / priv->fs;
+	priv->C = 1. / tan(M_PI * priv->BW / priv->fs);
+	return effect_biquad_init(&priv->bq, channels);
 }
 
-static int effect_apply(struct loopback *loopback,
-			void *private_data,
-			const snd_pcm_channel_area_t *areas,
-			snd_uframes_t offset,
-			snd_uframes_t frames)
+static void sweep_done(struct loopback *loop, void *private_data)
 {
-	struct effect_private *priv = private_data;
-	short *samples = (short*)areas[0].addr + offset*priv->channels;
-	snd_uframes_t i;
-
-	for (i=0; i < frames; i++) {
-		int chn;
-
-		fc = sin(priv->lfo)*priv->lfo_depth+priv->lfo_center;
-		priv->lfo += priv->dlfo;
-		if (priv->lfo>2.*M_PI) priv->lfo -= 2.*M_PI;
-		priv->C = 1./tan(M_PI*priv->BW/priv->fs);
-		priv->D = 2.*cos(2*M_PI*fc/fs);
-		priv->a0 = 1./(1.+priv->C);
-		priv->a1 = 0;
-		priv->a2 = -priv->a0;
-		priv->b1 = -priv->C*priv->D*a0;
-		priv->b2 = (priv->C-1)*priv->a0;
+	struct sweep_private *priv = private_data;
 
-		for (chn=0; chn < priv->channels; chn++)
-		{
-			priv->x[chn][2] = priv->x[chn][1];
-			priv->x[chn][1] = priv->x[chn][0];
-
-			priv->y[chn][2] = priv->y[chn][1];
-			priv->y[chn][1] = priv->y[chn][0];
-
-			priv->x[chn][0] = samples[i*channels+chn];
-			priv->y[chn][0] = priv->a0*priv->x[0][chn]
-				+ priv->a1*priv->x[1][chn] + priv->a2*x[2][chn]
-				- priv->b1*priv->y[1][chn] - priv->b2*y[2][chn];
-			samples[i*channels+chn] = priv->y[chn][0];
-		}
-	}
-	return 0;
+	effect_biquad_done(&priv->bq);
 }
 
-void effect_init_sweep(void)
+static void sweep_apply(struct loopback *loop, void *private_data,
+			float *buf, snd_pcm_uframes_t frames)
 {
-	struct effect_private *priv;
+	struct sweep_private *priv = private_data;
+	unsigned int count;
+	double fc, D, a0;
 
-	priv = register_effect(effect_init,
-			       effect_apply,
-			       effect_done,
-			       sizeof(struct effectprivate));
-	if (priv) {
-		priv->lfo_center = 2000.;
-		priv->lfo_depth = 1800.;
-		priv->lfo_freq = 0.2;
-		priv->BW = 50;
+	while (frames > 0) {
+		count = frames > SWEEP_BLOCK ? SWEEP_BLOCK : frames;
+		fc = sin(priv->lfo) * priv->lfo_depth + priv->lfo_center;
+		priv->lfo += priv->dlfo * count;
+		if (priv->lfo > 2. * M_PI)
+			priv->lfo -= 2. * M_PI;
+		D = 2. * cos(2 * M_PI * fc / priv->fs);
+		a0 = 1. / (1. + priv->C);
+		priv->bq.b0 = a0;
+		priv->bq.b1 = 0;
+		priv->bq.b2 = -a0;
+		priv->bq.a1 = -priv->C * D * a0;
+		priv->bq.a2 = (priv->C - 1) * a0;
+		effect_biquad_process(&priv->bq, buf, count);
+		buf += count * priv->bq.channels;
+		frames -= count;
 	}
 }
+
+const struct effect_ops effect_sweep = {
+	.name = "sweep",
+	.help = "[:center:depth:lfo_freq:bandwidth] bandpass filter sweep (2000:1800:0.2:50)",
+	.private_size = sizeof(struct sweep_private),
+	.parse = sweep_parse,
+	.init = sweep_init,
+	.apply = sweep_apply,
+	.done = sweep_done,
+};
@@ -0,0 +1,286 @@
+/*
+ *  A simple PCM loopback utility
+ *  Effect chain applied to the captured frames
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <pthread.h>
+#include <syslog.h>
+#include <alsa/asoundlib.h>
+#include "alsaloop.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define EFFECT_X86
+#include <immintrin.h>
+#endif
+
+#define EFFECT_BLOCK	256	/* frames converted to float at once */
+
+static const struct effect_ops *effect_table[] = {
+	&effect_sweep,
+	&effect_eq,
+};
+
+#define EFFECT_COUNT (sizeof(effect_table) / sizeof(effect_table[0]))
+
+/*
+ * Biquad filter, direct form I. The channels are independent, so the
+ * SIMD version filters four channels at once and keeps their state in
+ * registers for the whole block.
+ */
+
+static void biquad_process_c(struct effect_biquad *bq, float *buf,
+			     unsigned int ch, unsigned int channels,
+			     unsigned int frames)
+{
+	float x, y, x1 = bq->x1[ch], x2 = bq->x2[ch];
+	float y1 = bq->y1[ch], y2 = bq->y2[ch];
+	unsigned int i;
+
+	for (i = 0; i < frames; i++, buf += channels) {
+		x = buf[ch];
+		y = bq->b0 * x + bq->b1 * x1 + bq->b2 * x2
+		    - bq->a1 * y1 - bq->a2 * y2;
+		x2 = x1;
+		x1 = x;
+		y2 = y1;
+		y1 = y;
+		buf[ch] = y;
+	}
+	bq->x1[ch] = x1;
+	bq->x2[ch] = x2;
+	bq->y1[ch] = y1;
+	bq->y2[ch] = y2;
+}
+
+#ifdef EFFECT_X86
+__attribute__((target("sse")))
+static unsigned int biquad_process_sse(struct effect_biquad *bq, float *buf,
+				       unsigned int channels,
+				       unsigned int frames)
+{
+	__m128 b0 = _mm_set1_ps(bq->b0), b1 = _mm_set1_ps(bq->b1);
+	__m128 b2 = _mm_set1_ps(bq->b2), a1 = _mm_set1_ps(bq->a1);
+	__m128 a2 = _mm_set1_ps(bq->a2);
+	__m128 x, y, x1, x2, y1, y2;
+	unsigned int ch, i;
+	float *p;
+
+	for (ch = 0; ch + 4 <= channels; ch += 4) {
+		x1 = _mm_loadu_ps(bq->x1 + ch);
+		x2 = _mm_loadu_ps(bq->x2 + ch);
+		y1 = _mm_loadu_ps(bq->y1 + ch);
+		y2 = _mm_loadu_ps(bq->y2 + ch);
+		for (i = 0, p = buf + ch; i < frames; i++, p += channels) {
+			x = _mm_loadu_ps(p);
+			y = _mm_add_ps(_mm_mul_ps(b0, x), _mm_mul_ps(b1, x1));
+			y = _mm_add_ps(y, _mm_mul_ps(b2, x2));
+			y = _mm_sub_ps(y, _mm_mul_ps(a1, y1));
+			y = _mm_sub_ps(y, _mm_mul_ps(a2, y2));
+			x2 = x1;
+			x1 = x;
+			y2 = y1;
+			y1 = y;
+			_mm_storeu_ps(p, y);
+		}
+		_mm_storeu_ps(bq->x1 + ch, x1);
+		_mm_storeu_ps(bq->x2 + ch, x2);
+		_mm_storeu_ps(bq->y1 + ch, y1);
+		_mm_storeu_ps(bq->y2 + ch, y2);
+	}
+	return ch;
+}
+#endif
+
+static pthread_once_t effect_once = PTHREAD_ONCE_INIT;
+static int effect_use_sse;
+
+static void effect_select(void)
+{
+	if (getenv("ALSALOOP_NO_SIMD"))
+		return;
+#ifdef EFFECT_X86
+	__builtin_cpu_init();
+	effect_use_sse = __builtin_cpu_supports("sse");
+#endif
+}
+
+void effect_biquad_process(struct effect_biquad *bq, float *buf,
+			   unsigned int frames)
+{
+	unsigned int ch = 0;
+
+#ifdef EFFECT_X86
+	if (effect_use_sse)
+		ch = biquad_process_sse(bq, buf, bq->channels, frames);
+#endif
+	for (; ch < bq->channels; ch++)
+		biquad_process_c(bq, buf, ch, bq->channels, frames);
+}
+
+int effect_biquad_init(struct effect_biquad *bq, unsigned int channels)
+{
+	pthread_once(&effect_once, effect_select);
+	bq->channels = channels;
+	bq->x1 = calloc(4 * channels, sizeof(float));
+	if (bq->x1 == NULL)
+		return -ENOMEM;
+	bq->x2 = bq->x1 + channels;
+	bq->y1 = bq->x2 + channels;
+	bq->y2 = bq->y1 + channels;
+	/* pass through */
+	bq->b0 = 1;
+	bq->b1 = bq->b2 = bq->a1 = bq->a2 = 0;
+	return 0;
+}
+
+void effect_biquad_done(struct effect_biquad *bq)
+{
+	free(bq->x1);
+	bq->x1 = bq->x2 = bq->y1 = bq->y2 = NULL;
+}
+
+/*
+ * Chain handling
+ */
+
+/* name[:arg:...] */
+int effect_add(struct loopback *loop, const char *arg)
+{
+	struct loopback_effect *effect, **tail;
+	const char *args;
+	size_t len;
+	unsigned int i;
+	int err;
+
+	args = strchr(arg, ':');
+	len = args ? (size_t)(args - arg) : strlen(arg);
+	if (args)
+		args++;
+	for (i = 0; i < EFFECT_COUNT; i++) {
+		if (strlen(effect_table[i]->name) == len &&
+		    strncasecmp(effect_table[i]->name, arg, len) == 0)
+			break;
+	}
+	if (i >= EFFECT_COUNT) {
+		logit(LOG_CRIT, "Unknown effect '%s'\n", arg);
+		return -EINVAL;
+	}
+	effect = calloc(1, sizeof(*effect));
+	if (effect == NULL)
+		return -ENOMEM;
+	effect->ops = effect_table[i];
+	effect->private_data = calloc(1, effect->ops->private_size);
+	if (effect->private_data == NULL) {
+		free(effect);
+		return -ENOMEM;
+	}
+	err = effect->ops->parse(effect->private_data, args);
+	if (err < 0) {
+		logit(LOG_CRIT, "Wrong arguments for effect '%s'\n", arg);
+		free(effect->private_data);
+		free(effect);
+		return err;
+	}
+	for (tail = &loop->effects; *tail; tail = &(*tail)->next)
+		;
+	*tail = effect;
+	return 0;
+}
+
+int effect_chain_init(struct loopback *loop, unsigned int channels,
+		      unsigned int rate, snd_pcm_format_t format)
+{
+	struct loopback_effect *effect;
+	int err;
+
+	if (loop->effects == NULL)
+		return 0;
+	loop->effect_to_float = convert_get_to_float(format);
+	loop->effect_from_float = convert_get_from_float(format);
+	if (loop->effect_to_float == NULL || loop->effect_from_float == NULL) {
+		logit(LOG_CRIT, "%s: effects do not support format %s\n", loop->id, snd_pcm_format_name(format));
+		return -EINVAL;
+	}
+	loop->effect_buf = malloc(EFFECT_BLOCK * channels * sizeof(float));
+	if (loop->effect_buf == NULL)
+		return -ENOMEM;
+	loop->effect_channels = channels;
+	loop->effect_frame_size = snd_pcm_format_physical_width(format) / 8 *
+				  channels;
+	for (effect = loop->effects; effect; effect = effect->next) {
+		err = effect->ops->init(loop, effect->private_data,
+					channels, rate);
+		if (err < 0) {
+			logit(LOG_CRIT, "%s: effect %s initialization failed: %s\n", loop->id, effect->ops->name, snd_strerror(err));
+			effect_chain_done(loop);
+			return err;
+		}
+		effect->active = 1;
+		if (verbose > 1)
+			snd_output_printf(loop->output, "%s: effect %s enabled\n", loop->id, effect->ops->name);
+	}
+	return 0;
+}
+
+void effect_chain_done(struct loopback *loop)
+{
+	struct loopback_effect *effect;
+
+	for (effect = loop->effects; effect; effect = effect->next) {
+		if (effect->active)
+			effect->ops->done(loop, effect->private_data);
+		effect->active = 0;
+	}
+	free(loop->effect_buf);
+	loop->effect_buf = NULL;
+}
+
+/* process interleaved frames in place */
+void effect_chain_apply(struct loopback *loop, char *buf,
+			snd_pcm_uframes_t frames)
+{
+	struct loopback_effect *effect;
+	snd_pcm_uframes_t count;
+
+	if (loop->effect_buf == NULL)
+		return;
+	while (frames > 0) {
+		count = frames > EFFECT_BLOCK ? EFFECT_BLOCK : frames;
+		loop->effect_to_float(buf, loop->effect_buf,
+				      count * loop->effect_channels);
+		for (effect = loop->effects; effect; effect = effect->next)
+			effect->ops->apply(loop, effect->private_data,
+					   loop->effect_buf, count);
+		loop->effect_from_float(loop->effect_buf, buf,
+					count * loop->effect_channels);
+		buf += count * loop->effect_frame_size;
+		frames -= count;
+	}
+}
+
+void effect_list(void)
+{
+	unsigned int i;
+
+	for (i = 0; i < EFFECT_COUNT; i++)
+		printf("  %s%s\n", effect_table[i]->name, effect_table[i]->help);
+}
@@ -0,0 +1,573 @@
+/*
+ *  A simple PCM loopback utility
+ *  Benchmark of the loopback job with simulated PCM devices
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ *  Build with "make pcmjob-bench". No sound card is required: both
+ *  streams are ioplug PCMs created in the process. Their hardware pointers
+ *  advance by periods at the nominal rate plus a drift, a timerfd wakes
+ *  the job after each period with a random delay and xruns can be injected
+ *  at fixed intervals. The job runs in real time, the consumed CPU time,
+ *  the achieved latency (from the exact simulated positions) and the xrun
+ *  counts are reported.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <getopt.h>
+#include <math.h>
+#include <time.h>
+#include <unistd.h>
+#include <poll.h>
+#include <syslog.h>
+#include <sys/timerfd.h>
+#include <alsa/asoundlib.h>
+#include <alsa/pcm_external.h>
+#include "alsaloop.h"
+
+int verbose = 0;
+int workarounds = 0;
+int use_syslog = 0;
+int quit = 0;
+
+struct sim_stream {
+	double drift;			/* ppm */
+	double jitter;			/* max. wakeup delay in us */
+	double xrun;			/* inject xrun every N seconds, 0 = off */
+};
+
+struct sim_pcm {
+	snd_pcm_ioplug_t io;
+	struct sim_stream *par;
+	int timerfd;
+	int running;
+	double rate;			/* real rate (drift included) */
+	struct timespec start;
+	snd_pcm_uframes_t hw;		/* frames transferred since start */
+	double next_xrun;		/* in seconds since start */
+	double phase;			/* generated sine */
+	unsigned int seed;
+};
+
+static struct sim_stream sim_params[2];
+static struct sim_pcm *sim_pcms[2];
+static unsigned long sim_injected[2];
+
+static double elapsed(struct sim_pcm *sim)
+{
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (now.tv_sec - sim->start.tv_sec) +
+	       (now.tv_nsec - sim->start.tv_nsec) / 1e9;
+}
+
+/* wake up after the next period boundary */
+static void sim_arm(struct sim_pcm *sim)
+{
+	struct itimerspec its;
+	double t, period = sim->io.period_size / sim->rate;
+
+	t = (floor(elapsed(sim) / period) + 1) * period;
+	t += sim->par->jitter * (rand_r(&sim->seed) / (double)RAND_MAX) / 1e6;
+	memset(&its, 0, sizeof(its));
+	its.it_value.tv_sec = sim->start.tv_sec + (time_t)t;
+	its.it_value.tv_nsec = sim->start.tv_nsec +
+			       (long)((t - floor(t)) * 1e9);
+	if (its.it_value.tv_nsec >= 1000000000L) {
+		its.it_value.tv_sec++;
+		its.it_value.tv_nsec -= 1000000000L;
+	}
+	timerfd_settime(sim->timerfd, TFD_TIMER_ABSTIME, &its, NULL);
+}
+
+static void sim_disarm(struct sim_pcm *sim)
+{
+	struct itimerspec its;
+
+	memset(&its, 0, sizeof(its));
+	timerfd_settime(sim->timerfd, 0, &its, NULL);
+}
+
+/* the capture "hardware" writes a 1kHz sine */
+static void sim_capture(struct sim_pcm *sim, snd_pcm_uframes_t pos,
+			snd_pcm_uframes_t frames)
+{
+	const snd_pcm_channel_area_t *areas = snd_pcm_ioplug_mmap_areas(&sim->io);
+	double dphase = 2 * M_PI * 1000 / sim->io.rate;
+	unsigned int ch;
+	int16_t val, *dst;
+
+	for (; frames > 0; frames--, pos++) {
+		pos %= sim->io.buffer_size;
+		val = 8192 * sin(sim->phase);
+		sim->phase += dphase;
+		if (sim->phase > 2 * M_PI)
+			sim->phase -= 2 * M_PI;
+		for (ch = 0; ch < sim->io.channels; ch++) {
+			dst = (int16_t *)((char *)areas[ch].addr +
+				(areas[ch].first + pos * areas[ch].step) / 8);
+			*dst = val;
+		}
+	}
+}
+
+static snd_pcm_sframes_t sim_pointer(snd_pcm_ioplug_t *io)
+{
+	struct sim_pcm *sim = io->private_data;
+	snd_pcm_uframes_t hw, delta, room;
+	double t;
+
+	if (!sim->running)
+		return sim->hw % io->buffer_size;
+	t = elapsed(sim);
+	if (sim->par->xrun > 0 && t >= sim->next_xrun) {
+		sim->next_xrun += sim->par->xrun;
+		sim_injected[io->stream]++;
+		return -EPIPE;
+	}
+	hw = (snd_pcm_uframes_t)(t * sim->rate / io->period_size) *
+	     io->period_size;
+	if (hw <= sim->hw)
+		return sim->hw % io->buffer_size;
+	delta = hw - sim->hw;
+	if (io->stream == SND_PCM_STREAM_PLAYBACK)
+		room = io->appl_ptr - io->hw_ptr;
+	else
+		room = io->buffer_size - (io->hw_ptr - io->appl_ptr);
+	if (delta > room)
+		return -EPIPE;
+	if (io->stream == SND_PCM_STREAM_CAPTURE)
+		sim_capture(sim, sim->hw % io->buffer_size, delta);
+	sim->hw = hw;
+	return sim->hw % io->buffer_size;
+}
+
+static int sim_start(snd_pcm_ioplug_t *io)
+{
+	struct sim_pcm *sim = io->private_data;
+
+	sim->rate = io->rate * (1 + sim->par->drift / 1e6);
+	clock_gettime(CLOCK_MONOTONIC, &sim->start);
+	sim->hw = 0;
+	sim->next_xrun = sim->par->xrun;
+	sim->running = 1;
+	sim_arm(sim);
+	return 0;
+}
+
+static int sim_stop(snd_pcm_ioplug_t *io)
+{
+	struct sim_pcm *sim = io->private_data;
+
+	sim->running = 0;
+	sim_disarm(sim);
+	return 0;
+}
+
+static int sim_prepare(snd_pcm_ioplug_t *io)
+{
+	struct sim_pcm *sim = io->private_data;
+
+	sim->running = 0;
+	sim->hw = 0;
+	sim_disarm(sim);
+	return 0;
+}
+
+static int sim_poll_revents(snd_pcm_ioplug_t *io, struct pollfd *pfd,
+			    unsigned int nfds, unsigned short *revents)
+{
+	struct sim_pcm *sim = io->private_data;
+	uint64_t expirations;
+
+	*revents = 0;
+	if (read(sim->timerfd, &expirations, sizeof(expirations)) ==
+						sizeof(expirations)) {
+		*revents = io->stream == SND_PCM_STREAM_PLAYBACK ?
+							POLLOUT : POLLIN;
+		if (sim->running)
+			sim_arm(sim);
+	}
+	return 0;
+}
+
+static int sim_close(snd_pcm_ioplug_t *io)
+{
+	struct sim_pcm *sim = io->private_data;
+
+	sim_pcms[io->stream] = NULL;
+	close(sim->timerfd);
+	free(sim);
+	return 0;
+}
+
+static const snd_pcm_ioplug_callback_t sim_callback = {
+	.start = sim_start,
+	.stop = sim_stop,
+	.pointer = sim_pointer,
+	.prepare = sim_prepare,
+	.poll_revents = sim_poll_revents,
+	.close = sim_close,
+};
+
+static int sim_open(snd_pcm_t **pcmp, const char *name,
+		    snd_pcm_stream_t stream, int mode)
+{
+	static const unsigned int access_list[] = {
+		SND_PCM_ACCESS_MMAP_INTERLEAVED,
+		SND_PCM_ACCESS_RW_INTERLEAVED
+	};
+	static const unsigned int format_list[] = {
+		SND_PCM_FORMAT_S16
+	};
+	struct sim_pcm *sim;
+	int err;
+
+	sim = calloc(1, sizeof(*sim));
+	if (sim == NULL)
+		return -ENOMEM;
+	sim->par = &sim_params[stream];
+	sim->seed = stream + 1;
+	sim->timerfd = timerfd_create(CLOCK_MONOTONIC,
+				      TFD_NONBLOCK | TFD_CLOEXEC);
+	if (sim->timerfd < 0) {
+		err = -errno;
+		free(sim);
+		return err;
+	}
+	sim->io.version = SND_PCM_IOPLUG_VERSION;
+	sim->io.name = "alsaloop simulated PCM";
+	sim->io.flags = SND_PCM_IOPLUG_FLAG_MONOTONIC;
+	sim->io.callback = &sim_callback;
+	sim->io.private_data = sim;
+	sim->io.poll_fd = sim->timerfd;
+	sim->io.poll_events = POLLIN;
+	sim->io.mmap_rw = 1;
+	err = snd_pcm_ioplug_create(&sim->io, name, stream, mode);
+	if (err < 0) {
+		close(sim->timerfd);
+		free(sim);
+		return err;
+	}
+	if ((err = snd_pcm_ioplug_set_param_list(&sim->io, SND_PCM_IOPLUG_HW_ACCESS, 2, access_list)) < 0 ||
+	    (err = snd_pcm_ioplug_set_param_list(&sim->io, SND_PCM_IOPLUG_HW_FORMAT, 1, format_list)) < 0 ||
+	    (err = snd_pcm_ioplug_set_param_minmax(&sim->io, SND_PCM_IOPLUG_HW_CHANNELS, 1, 32)) < 0 ||
+	    (err = snd_pcm_ioplug_set_param_minmax(&sim->io, SND_PCM_IOPLUG_HW_RATE, 8000, 192000)) < 0 ||
+	    (err = snd_pcm_ioplug_set_param_minmax(&sim->io, SND_PCM_IOPLUG_HW_PERIOD_BYTES, 64, 1024 * 1024)) < 0 ||
+	    (err = snd_pcm_ioplug_set_param_minmax(&sim->io, SND_PCM_IOPLUG_HW_PERIODS, 2, 1024)) < 0 ||
+	    (err = snd_pcm_ioplug_set_param_minmax(&sim->io, SND_PCM_IOPLUG_HW_BUFFER_BYTES, 128, 4 * 1024 * 1024)) < 0) {
+		snd_pcm_ioplug_delete(&sim->io);
+		return err;
+	}
+	sim_pcms[stream] = sim;
+	*pcmp = sim->io.pcm;
+	return 0;
+}
+
+/* frames between the capture ADC and the playback DAC */
+static int sim_latency(struct loopback *loop, double *latency)
+{
+	struct sim_pcm *capt = sim_pcms[SND_PCM_STREAM_CAPTURE];
+	struct sim_pcm *play = sim_pcms[SND_PCM_STREAM_PLAYBACK];
+	double cdelay, pdelay, buffered;
+
+	if (!loop->running || capt == NULL || play == NULL ||
+	    !capt->running || !play->running)
+		return 0;
+	cdelay = elapsed(capt) * capt->rate - capt->hw +
+		 (snd_pcm_uframes_t)(capt->io.hw_ptr - capt->io.appl_ptr);
+	pdelay = (snd_pcm_uframes_t)(play->io.appl_ptr - play->io.hw_ptr) +
+		 play->hw - elapsed(play) * play->rate;
+	buffered = loop->play->buf_count + loop->src_out_frames;
+	if (loop->use_split)
+		buffered += ring_count(loop->ring);
+	else
+		buffered += loop->capt->buf_count;
+	*latency = cdelay + buffered + pdelay;
+	return 1;
+}
+
+static double cputime(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static double walltime(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void help(void)
+{
+	printf(
+"Usage: pcmjob-bench [OPTION]...\n\n"
+"-h,--help      help\n"
+"-r,--rate      rate (48000)\n"
+"-c,--channels  channels (2)\n"
+"-l,--latency   requested latency in frames\n"
+"-t,--tlatency  requested latency in usec (10000)\n"
+"-B,--buffer    buffer size in frames\n"
+"-E,--period    period size in frames\n"
+"-S,--sync      sync mode (0=none,1=simple,2=captshift,3=playshift,\n"
+"               4=samplerate,5=auto,6=pi)\n"
+"-A,--samplerate use converter (0=sincbest,1=sincmedium,2=sincfastest,\n"
+"                               3=zerohold,4=linear,5=native)\n"
+"-x,--split     service capture in a separate thread\n"
+"-M,--mmap      copy directly between the mmap areas\n"
+"-b,--nblock    non-block mode\n"
+"-e,--effect    apply an effect, can be repeated\n"
+"-s,--seconds   duration in seconds (10)\n"
+"-d,--cdrift    capture clock drift in ppm (100)\n"
+"-D,--pdrift    playback clock drift in ppm (-100)\n"
+"-j,--cjitter   capture wakeup jitter in us (500)\n"
+"-J,--pjitter   playback wakeup jitter in us (500)\n"
+"-X,--pxrun     inject a playback xrun every N seconds\n"
+"-Y,--cxrun     inject a capture xrun every N seconds\n"
+"-v,--verbose   verbose mode (more -v means more verbose)\n"
+);
+}
+
+int main(int argc, char *argv[])
+{
+	struct option long_option[] =
+	{
+		{"help", 0, NULL, 'h'},
+		{"rate", 1, NULL, 'r'},
+		{"channels", 1, NULL, 'c'},
+		{"latency", 1, NULL, 'l'},
+		{"tlatency", 1, NULL, 't'},
+		{"buffer", 1, NULL, 'B'},
+		{"period", 1, NULL, 'E'},
+		{"sync", 1, NULL, 'S'},
+		{"samplerate", 1, NULL, 'A'},
+		{"split", 0, NULL, 'x'},
+		{"mmap", 0, NULL, 'M'},
+		{"nblock", 0, NULL, 'b'},
+		{"effect", 1, NULL, 'e'},
+		{"seconds", 1, NULL, 's'},
+		{"cdrift", 1, NULL, 'd'},
+		{"pdrift", 1, NULL, 'D'},
+		{"cjitter", 1, NULL, 'j'},
+		{"pjitter", 1, NULL, 'J'},
+		{"pxrun", 1, NULL, 'X'},
+		{"cxrun", 1, NULL, 'Y'},
+		{"verbose", 0, NULL, 'v'},
+		{NULL, 0, NULL, 0},
+	};
+	struct loopback_handle play, capt;
+	struct loopback loop;
+	snd_output_t *output;
+	struct pollfd *pfds = NULL;
+	int pfds_count = 0;
+	double seconds = 10, wall, cpu, lat, lat_sum = 0;
+	double lat_min = 1e12, lat_max = -1e12;
+	unsigned long lat_count = 0;
+	unsigned long long frames;
+	int c, err, count;
+
+	err = snd_output_stdio_attach(&output, stdout, 0);
+	if (err < 0)
+		return EXIT_FAILURE;
+	memset(&play, 0, sizeof(play));
+	memset(&capt, 0, sizeof(capt));
+	memset(&loop, 0, sizeof(loop));
+	play.device = capt.device = "sim";
+	play.id = "playback sim";
+	capt.id = "capture sim";
+	play.access = capt.access = SND_PCM_ACCESS_RW_INTERLEAVED;
+	play.format = capt.format = SND_PCM_FORMAT_S16_LE;
+	play.rate = play.rate_req = capt.rate = capt.rate_req = 48000;
+	play.channels = capt.channels = 2;
+	play.loopback = capt.loopback = &loop;
+	loop.play = &play;
+	loop.capt = &capt;
+	loop.latency_reqtime = 10000;
+	loop.loop_time = ~0UL;
+	loop.loop_limit = ~0ULL;
+	loop.output = loop.state = output;
+	loop.sync = SYNC_TYPE_AUTO;
+	loop.src_enable = 1;
+	loop.src_converter_type = SRC_NATIVE;
+	sim_params[SND_PCM_STREAM_CAPTURE].drift = 100;
+	sim_params[SND_PCM_STREAM_PLAYBACK].drift = -100;
+	sim_params[SND_PCM_STREAM_CAPTURE].jitter = 500;
+	sim_params[SND_PCM_STREAM_PLAYBACK].jitter = 500;
+
+	while ((c = getopt_long(argc, argv, "hr:c:l:t:B:E:S:A:xMbe:s:d:D:j:J:X:Y:v",
+				long_option, NULL)) >= 0) {
+		switch (c) {
+		case 'h':
+			help();
+			return EXIT_SUCCESS;
+		case 'r':
+			play.rate = play.rate_req = capt.rate = capt.rate_req = atoi(optarg);
+			break;
+		case 'c':
+			play.channels = capt.channels = atoi(optarg);
+			break;
+		case 'l':
+			loop.latency_req = atoi(optarg);
+			break;
+		case 't':
+			loop.latency_reqtime = atoi(optarg);
+			break;
+		case 'B':
+			play.buffer_size_req = capt.buffer_size_req = atoi(optarg);
+			break;
+		case 'E':
+			play.period_size_req = capt.period_size_req = atoi(optarg);
+			break;
+		case 'S':
+			if (strcasecmp(optarg, "pi") == 0)
+				loop.sync = SYNC_TYPE_PI;
+			else
+				loop.sync = atoi(optarg);
+			if (loop.sync > SYNC_TYPE_LAST)
+				loop.sync = SYNC_TYPE_AUTO;
+			break;
+		case 'A':
+			c = atoi(optarg);
+#ifndef USE_SAMPLERATE
+			c = SRC_NATIVE;
+#endif
+			loop.src_converter_type = c;
+			break;
+		case 'x':
+			loop.split = 1;
+			break;
+		case 'M':
+			loop.mmap = 1;
+			break;
+		case 'b':
+			play.nblock = capt.nblock = 1;
+			break;
+		case 'e':
+			if (effect_add(&loop, optarg) < 0)
+				return EXIT_FAILURE;
+			break;
+		case 's':
+			seconds = atof(optarg);
+			break;
+		case 'd':
+			sim_params[SND_PCM_STREAM_CAPTURE].drift = atof(optarg);
+			break;
+		case 'D':
+			sim_params[SND_PCM_STREAM_PLAYBACK].drift = atof(optarg);
+			break;
+		case 'j':
+			sim_params[SND_PCM_STREAM_CAPTURE].jitter = atof(optarg);
+			break;
+		case 'J':
+			sim_params[SND_PCM_STREAM_PLAYBACK].jitter = atof(optarg);
+			break;
+		case 'X':
+			sim_params[SND_PCM_STREAM_PLAYBACK].xrun = atof(optarg);
+			break;
+		case 'Y':
+			sim_params[SND_PCM_STREAM_CAPTURE].xrun = atof(optarg);
+			break;
+		case 'v':
+			verbose++;
+			break;
+		default:
+			help();
+			return EXIT_FAILURE;
+		}
+	}
+
+	pcmjob_pcm_open = sim_open;
+	if ((err = pcmjob_init(&loop)) < 0) {
+		logit(LOG_CRIT, "Job initialization failed: %s\n", snd_strerror(err));
+		return EXIT_FAILURE;
+	}
+	if ((err = pcmjob_start(&loop)) < 0) {
+		logit(LOG_CRIT, "Job start failed: %s\n", snd_strerror(err));
+		return EXIT_FAILURE;
+	}
+	wall = walltime();
+	cpu = cputime();
+	while (walltime() - wall < seconds) {
+		/* the job may be restarted with other parameters */
+		if (loop.pollfd_count > pfds_count) {
+			free(pfds);
+			pfds_count = loop.pollfd_count;
+			pfds = calloc(pfds_count, sizeof(struct pollfd));
+			if (pfds == NULL)
+				return EXIT_FAILURE;
+		}
+		count = pcmjob_pollfds_init(&loop, pfds);
+		if (count < 0) {
+			logit(LOG_CRIT, "Poll FD initialization failed.\n");
+			return EXIT_FAILURE;
+		}
+		err = poll(pfds, count, 100);
+		if (err < 0) {
+			if (errno == EINTR)
+				continue;
+			logit(LOG_CRIT, "Poll failed: %s\n", strerror(errno));
+			return EXIT_FAILURE;
+		}
+		err = pcmjob_pollfds_handle(&loop, pfds);
+		if (err < 0) {
+			logit(LOG_CRIT, "pcmjob failed: %s\n", snd_strerror(err));
+			return EXIT_FAILURE;
+		}
+		if (sim_latency(&loop, &lat)) {
+			lat_sum += lat;
+			lat_count++;
+			if (lat < lat_min)
+				lat_min = lat;
+			if (lat > lat_max)
+				lat_max = lat;
+		}
+	}
+	cpu = cputime() - cpu;
+	wall = walltime() - wall;
+	frames = atomic_load(&play.stats.frames);
+
+	printf("sync %i%s, rate %u, channels %u, period %u/%u, buffer %u/%u\n",
+	       loop.sync, loop.sync_pi ? " (pi)" : "", play.rate,
+	       play.channels, capt.period_size, play.period_size,
+	       capt.buffer_size, play.buffer_size);
+	printf("frames          %llu in %.1fs\n", frames, wall);
+	printf("cpu             %.3f%%, %.1fns per frame\n", cpu * 100 / wall,
+	       frames ? cpu * 1e9 / frames : 0);
+	if (lat_count)
+		printf("latency         %.2fms mean, %.2f/%.2fms min/max (requested %.2fms)\n",
+		       lat_sum / lat_count * 1000 / play.rate,
+		       lat_min * 1000 / play.rate, lat_max * 1000 / play.rate,
+		       (double)loop.latency * 1000 / play.rate);
+	printf("pitch           %.8f\n", loop.pitch);
+	printf("xruns           playback %lu (%lu injected), capture %lu (%lu injected)\n",
+	       play.xrun_count, sim_injected[SND_PCM_STREAM_PLAYBACK],
+	       capt.xrun_count, sim_injected[SND_PCM_STREAM_CAPTURE]);
+
+	pcmjob_stop(&loop);
+	pcmjob_done(&loop);
+	free(pfds);
+	snd_output_close(output);
+	return EXIT_SUCCESS;
+}
@@ -29,12 +29,18 @@
 #include <getopt.h>
 #include <alsa/asoundlib.h>
 #include <sys/time.h>
+#include <time.h>
 #include <math.h>
 #include <syslog.h>
 #include <pthread.h>
+#include <signal.h>
+#include <poll.h>
+#include <sys/eventfd.h>
 #include "alsaloop.h"
 
 #define XRUN_PROFILE_UNKNOWN (-10000000)
+#define FADE_TIME	5000	/* fade around a capture reconfiguration (us) */
+#define FADE_BLOCK	1024	/* samples converted to float at once */
 
 static int set_rate_shift(struct loopback_handle *lhandle, double pitch);
 static int get_rate(struct loopback_handle *lhandle);
@@ -47,20 +53,23 @@ static const char *sync_types[] = {
 	SYNCTYPE(CAPTRATESHIFT),
 	SYNCTYPE(PLAYRATESHIFT),
 	SYNCTYPE(SAMPLERATE),
-	SYNCTYPE(AUTO)
+	SYNCTYPE(AUTO),
+	SYNCTYPE(PI)
 };
 
 #define SRCTYPE(v) [SRC_##v] = "SRC_" #v
 
-#ifdef USE_SAMPLERATE
 static const char *src_types[] = {
 	SRCTYPE(SINC_BEST_QUALITY),
 	SRCTYPE(SINC_MEDIUM_QUALITY),
 	SRCTYPE(SINC_FASTEST),
 	SRCTYPE(ZERO_ORDER_HOLD),
-	SRCTYPE(LINEAR)
+	SRCTYPE(LINEAR),
+	SRCTYPE(NATIVE)
 };
-#endif
+
+/* the benchmark replaces it with the simulated devices */
+pcm_open_t pcmjob_pcm_open = snd_pcm_open;
 
 static pthread_once_t pcm_open_mutex_once = PTHREAD_ONCE_INIT;
 static pthread_mutex_t pcm_open_mutex;
@@ -124,6 +133,12 @@ static int setparams_stream(struct loopback_handle *lhandle,
 		return err;
 	}
 	err = snd_pcm_hw_params_set_access(handle, params, lhandle->access);
+	if (err < 0 && lhandle->access == SND_PCM_ACCESS_MMAP_INTERLEAVED) {
+		if (verbose)
+			snd_output_printf(lhandle->loopback->output, "%s: mmap access not available, using read/write\n", lhandle->id);
+		lhandle->access = SND_PCM_ACCESS_RW_INTERLEAVED;
+		err = snd_pcm_hw_params_set_access(handle, params, lhandle->access);
+	}
 	if (err < 0) {
 		logit(LOG_CRIT, "Access type not available for %s: %s\n", lhandle->id, snd_strerror(err));
 		return err;
@@ -147,11 +162,7 @@ static int setparams_stream(struct loopback_handle *lhandle,
 	rrate = 0;
 	snd_pcm_hw_params_get_rate(params, &rrate, 0);
 	lhandle->rate = rrate;
-	if (
-#ifdef USE_SAMPLERATE
-	    !lhandle->loopback->src_enable &&
-#endif
-	    (int)rrate != lhandle->rate) {
+	if (!lhandle->loopback->src_enable && (int)rrate != lhandle->rate) {
 		logit(LOG_CRIT, "Rate does not match (requested %iHz, got %iHz, resample %i)\n", lhandle->rate, rrate, lhandle->resample);
 		return -EINVAL;
 	}
@@ -274,6 +285,16 @@ static int setparams_set(struct loopback_handle *lhandle,
 		return err;
 	}
 	snd_pcm_sw_params_get_avail_min(swparams, &lhandle->avail_min);
+	if (lhandle->loopback->sync_pi) {
+		/* status timestamps of the pointer updates */
+		err = snd_pcm_sw_params_set_tstamp_mode(handle, swparams, SND_PCM_TSTAMP_ENABLE);
+		if (err < 0) {
+			logit(LOG_CRIT, "Unable to set timestamp mode for %s: %s\n", lhandle->id, snd_strerror(err));
+			return err;
+		}
+		/* not fatal, get_delay_tstamp() checks the distance */
+		snd_pcm_sw_params_set_tstamp_type(handle, swparams, SND_PCM_TSTAMP_TYPE_MONOTONIC);
+	}
 	err = snd_pcm_sw_params(handle, swparams);
 	if (err < 0) {
 		logit(LOG_CRIT, "Unable to set sw params for %s: %s\n", lhandle->id, snd_strerror(err));
@@ -414,6 +435,18 @@ static void xrun_profile0(struct loopback *loop)
 {
 	snd_pcm_sframes_t pdelay, cdelay;
 
+	if (loop->use_split) {
+		/* the capture handle belongs to the capture thread */
+		if (snd_pcm_delay(loop->play->handle, &pdelay) < 0)
+			return;
+		getcurtimestamp(&loop->xrun_last_update);
+		loop->xrun_last_pdelay = pdelay;
+		loop->xrun_last_cdelay = atomic_load(&loop->capt_delay);
+		loop->xrun_buf_pcount = loop->play->buf_count +
+					ring_count(loop->ring);
+		loop->xrun_buf_ccount = 0;
+		return;
+	}
 	if (snd_pcm_delay(loop->play->handle, &pdelay) >= 0 &&
 	    snd_pcm_delay(loop->capt->handle, &cdelay) >= 0) {
 		getcurtimestamp(&loop->xrun_last_update);
@@ -421,9 +454,7 @@ static void xrun_profile0(struct loopback *loop)
 		loop->xrun_last_cdelay = cdelay;
 		loop->xrun_buf_pcount = loop->play->buf_count;
 		loop->xrun_buf_ccount = loop->capt->buf_count;
-#ifdef USE_SAMPLERATE
 		loop->xrun_out_frames = loop->src_out_frames;
-#endif
 	}
 }
 
@@ -537,8 +568,52 @@ static void buf_add_copy(struct loopback *loop)
 }
 #endif
 
+/*
+ * The built-in resampler reads the capture frames in place and writes
+ * only as many frames as fit into the playback buffer, the rest of the
+ * input stays queued in the capture buffer for the next round.
+ */
+static void buf_add_native(struct loopback *loop)
+{
+	struct loopback_handle *capt = loop->capt;
+	struct loopback_handle *play = loop->play;
+	snd_pcm_uframes_t count, count1, pos1, ppos, avail, used, gen;
+
+	count = capt->buf_count;
+	pos1 = capt->buf_pos - count;
+	if (pos1 > capt->buf_size)
+		pos1 += capt->buf_size;
+	while (count > 0) {
+		count1 = count;
+		if (count1 + pos1 > capt->buf_size)
+			count1 = capt->buf_size - pos1;
+		avail = buf_avail(play);
+		ppos = (play->buf_pos + play->buf_count) % play->buf_size;
+		if (avail > play->buf_size - ppos)
+			avail = play->buf_size - ppos;
+		if (avail == 0)
+			break;
+		gen = avail;
+		used = resampler_process(loop->src_native,
+					 capt->buf + pos1 * capt->frame_size,
+					 count1, capt->frame_size,
+					 loop->src_to_float,
+					 loop->src_native_out, &gen);
+		loop->src_from_float(loop->src_native_out,
+				     play->buf + ppos * play->frame_size,
+				     gen * play->channels);
+		play->buf_count += gen;
+		capt->buf_count -= used;
+		count -= used;
+		pos1 += used;
+		pos1 %= capt->buf_size;
+		if (used == 0 && gen == 0)
+			break;
+	}
+}
+
 #ifdef USE_SAMPLERATE
-static void buf_add_src(struct loopback *loop)
+static void buf_add_lsr(struct loopback *loop)
 {
 	struct loopback_handle *capt = loop->capt;
 	struct loopback_handle *play = loop->play;
@@ -553,18 +628,10 @@ static void buf_add_src(struct loopback *loop)
 		count1 = count;
 		if (count1 + pos1 > capt->buf_size)
 			count1 = capt->buf_size - pos1;
-		if (capt->format == SND_PCM_FORMAT_S32)
-			src_int_to_float_array((int *)(capt->buf +
-						pos1 * capt->frame_size),
-					 (void *)loop->src_data.data_in +
-					   pos * capt->channels,
-					 count1 * capt->channels);
-		else
-			src_short_to_float_array((short *)(capt->buf +
-						pos1 * capt->frame_size),
-					 (void *)loop->src_data.data_in +
-					   pos * capt->channels,
-					 count1 * capt->channels);
+		loop->src_to_float(capt->buf + pos1 * capt->frame_size,
+				   (float *)loop->src_data.data_in +
+				     pos * capt->channels,
+				   count1 * capt->channels);
 		count -= count1;
 		pos += count1;
 		pos1 += count1;
@@ -591,18 +658,10 @@ static void buf_add_src(struct loopback *loop)
 			count1 = buf_avail(play);
 		if (count1 == 0)
 			break;
-		if (capt->format == SND_PCM_FORMAT_S32)
-			src_float_to_int_array(loop->src_data.data_out +
-					   pos * play->channels,
-					 (int *)(play->buf +
-					   pos1 * play->frame_size),
-					 count1 * play->channels);
-		else
-			src_float_to_short_array(loop->src_data.data_out +
-					   pos * play->channels,
-					 (short *)(play->buf +
-					   pos1 * play->frame_size),
-					 count1 * play->channels);
+		loop->src_from_float(loop->src_data.data_out +
+				       pos * play->channels,
+				     play->buf + pos1 * play->frame_size,
+				     count1 * play->channels);
 		play->buf_count += count1;
 		count -= count1;
 		pos += count1;
@@ -622,11 +681,19 @@ static void buf_add_src(struct loopback *loop)
 			loop->src_out_frames * play->channels * sizeof(float));
 	}
 }
-#else
+#endif
+
 static void buf_add_src(struct loopback *loop)
 {
-}
+#ifdef USE_SAMPLERATE
+	if (loop->src_state) {
+		buf_add_lsr(loop);
+		return;
+	}
 #endif
+	if (loop->src_native)
+		buf_add_native(loop);
+}
 
 static void buf_add(struct loopback *loop, snd_pcm_uframes_t count)
 {
@@ -644,6 +711,8 @@ static int xrun(struct loopback_handle *lhandle)
 {
 	int err;
 
+	lhandle->xrun_count++;
+	stats_inc(&lhandle->stats.xruns);
 	if (lhandle == lhandle->loopback->play) {
 		logit(LOG_DEBUG, "underrun for %s\n", lhandle->id);
 		xrun_stats(lhandle->loopback);
@@ -671,6 +740,84 @@ static int suspend(struct loopback_handle *lhandle)
 	return 0;
 }
 
+/*
+ * Wakeup latency: how long the playback side had more room than
+ * avail_min when we were woken up.
+ */
+static void stats_wakeup(struct loopback_handle *lhandle)
+{
+	snd_pcm_sframes_t avail = snd_pcm_avail_update(lhandle->handle);
+	long us;
+
+	if (avail < 0 || (snd_pcm_uframes_t)avail <= lhandle->avail_min)
+		us = 0;
+	else
+		us = frames_to_time(lhandle->rate,
+				    avail - lhandle->avail_min);
+	stats_inc(&lhandle->loopback->stats.wakeup[stats_bucket(us)]);
+}
+
+static void stats_update(struct loopback *loop, long proctime)
+{
+	struct loopback_stats *stats = &loop->stats;
+	unsigned long long pitch;
+
+	stats_inc(&stats->proctime[stats_bucket(proctime)]);
+	if (atomic_load_explicit(&stats->proctime_max, memory_order_relaxed) < proctime)
+		stats_set(&stats->proctime_max, proctime);
+	memcpy(&pitch, &loop->pitch, sizeof(pitch));
+	atomic_store_explicit(&stats->pitch, pitch, memory_order_relaxed);
+	stats_set(&stats->pitch_diff, loop->pitch_diff);
+	stats_set(&stats->pitch_diff_min, loop->pitch_diff_min);
+	stats_set(&stats->pitch_diff_max, loop->pitch_diff_max);
+}
+
+/*
+ * Linear gain ramp over len frames, pos is the position of the first
+ * frame in the ramp. Frames past the ramp keep the final gain (full
+ * volume for a fade in, silence for a fade out).
+ */
+static void fade_frames(snd_pcm_format_t format, unsigned int channels,
+			char *buf, snd_pcm_uframes_t frames,
+			snd_pcm_uframes_t pos, snd_pcm_uframes_t len, int out)
+{
+	convert_to_float_t to_float = convert_get_to_float(format);
+	convert_from_float_t from_float = convert_get_from_float(format);
+	unsigned int frame_size = snd_pcm_format_physical_width(format) / 8 *
+				  channels;
+	float tmp[FADE_BLOCK], gain;
+	snd_pcm_uframes_t count, i;
+	unsigned int ch;
+
+	if (to_float == NULL || from_float == NULL || channels > FADE_BLOCK)
+		return;
+	while (frames > 0) {
+		count = FADE_BLOCK / channels;
+		if (count > frames)
+			count = frames;
+		to_float(buf, tmp, count * channels);
+		for (i = 0; i < count; i++, pos++) {
+			gain = pos < len ? (float)pos / len : 1;
+			if (out)
+				gain = 1 - gain;
+			for (ch = 0; ch < channels; ch++)
+				tmp[i * channels + ch] *= gain;
+		}
+		from_float(tmp, buf, count * channels);
+		buf += count * frame_size;
+		frames -= count;
+	}
+}
+
+static void fade_in(struct loopback *loop, char *buf, snd_pcm_uframes_t frames)
+{
+	fade_frames(loop->capt->format, loop->capt->channels, buf, frames,
+		    loop->fade_pos, loop->fade_len, 0);
+	loop->fade_pos += frames;
+	if (loop->fade_pos >= loop->fade_len)
+		loop->fade_len = 0;
+}
+
 static int readit(struct loopback_handle *lhandle)
 {
 	snd_pcm_sframes_t r, res = 0;
@@ -722,10 +869,18 @@ static int readit(struct loopback_handle *lhandle)
 			fwrite(lhandle->buf + lhandle->buf_pos * lhandle->frame_size,
 			       r, lhandle->frame_size, lhandle->loopback->cfile);
 #endif
+		effect_chain_apply(lhandle->loopback,
+				   lhandle->buf +
+				   lhandle->buf_pos * lhandle->frame_size, r);
+		if (lhandle->loopback->fade_len)
+			fade_in(lhandle->loopback,
+				lhandle->buf +
+				lhandle->buf_pos * lhandle->frame_size, r);
 		res += r;
 		if (lhandle->max < res)
 			lhandle->max = res;
 		lhandle->counter += r;
+		stats_add(&lhandle->stats.frames, r);
 		lhandle->buf_count += r;
 		lhandle->buf_pos += r;
 		lhandle->buf_pos %= lhandle->buf_size;
@@ -777,6 +932,7 @@ static int writeit(struct loopback_handle *lhandle)
 #endif
 		res += r;
 		lhandle->counter += r;
+		stats_add(&lhandle->stats.frames, r);
 		lhandle->buf_count -= r;
 		lhandle->buf_pos += r;
 		lhandle->buf_pos %= lhandle->buf_size;
@@ -794,6 +950,431 @@ static int writeit(struct loopback_handle *lhandle)
 	return res;
 }
 
+/*
+ * Mmap mode: with identical stream parameters the captured frames are
+ * copied straight from the capture to the playback mmap areas. The
+ * intermediate buffer is used only for the silence queued by start and
+ * xrun sync, it must be flushed before the direct copy takes over.
+ */
+static snd_pcm_sframes_t avail_mmap(struct loopback_handle *lhandle)
+{
+	snd_pcm_sframes_t avail;
+	int err;
+
+      __again:
+	avail = snd_pcm_avail_update(lhandle->handle);
+	if (avail == -EPIPE) {
+		if ((err = xrun(lhandle)) < 0)
+			return err;
+		return 0;
+	} else if (avail == -ESTRPIPE) {
+		if ((err = suspend(lhandle)) < 0)
+			return err;
+		goto __again;
+	}
+	return avail;
+}
+
+static int commit_mmap(struct loopback_handle *lhandle,
+		       snd_pcm_uframes_t offset,
+		       snd_pcm_uframes_t frames)
+{
+	snd_pcm_sframes_t r;
+	int err;
+
+	r = snd_pcm_mmap_commit(lhandle->handle, offset, frames);
+	if (r >= 0 && (snd_pcm_uframes_t)r == frames)
+		return 0;
+	if (r == -EPIPE || r >= 0) {
+		if ((err = xrun(lhandle)) < 0)
+			return err;
+		return -EPIPE;
+	}
+	if (r == -ESTRPIPE) {
+		if ((err = suspend(lhandle)) < 0)
+			return err;
+		return -EPIPE;
+	}
+	return r;
+}
+
+static snd_pcm_sframes_t copy_mmap(struct loopback *loop)
+{
+	struct loopback_handle *play = loop->play;
+	struct loopback_handle *capt = loop->capt;
+	const snd_pcm_channel_area_t *careas, *pareas;
+	snd_pcm_uframes_t coffset, poffset, cframes, pframes;
+	snd_pcm_sframes_t cavail, pavail, size, res = 0;
+	int err;
+
+	cavail = avail_mmap(capt);
+	if (cavail <= 0) {
+		if (cavail == 0 && !capt->xrun_pending &&
+		    snd_pcm_state(capt->handle) == SND_PCM_STATE_DRAINING)
+			loop->reinit = 1;
+		return cavail;
+	}
+	pavail = avail_mmap(play);
+	if (pavail <= 0)
+		return pavail;
+	size = cavail < pavail ? cavail : pavail;
+	while (size > 0) {
+		cframes = size;
+		err = snd_pcm_mmap_begin(capt->handle, &careas, &coffset, &cframes);
+		if (err < 0)
+			return res > 0 ? res : err;
+		pframes = cframes;
+		err = snd_pcm_mmap_begin(play->handle, &pareas, &poffset, &pframes);
+		if (err < 0) {
+			snd_pcm_mmap_commit(capt->handle, coffset, 0);
+			return res > 0 ? res : err;
+		}
+		if (pframes < cframes)
+			cframes = pframes;
+		snd_pcm_areas_copy(pareas, poffset, careas, coffset,
+				   play->channels, cframes, play->format);
+		/* interleaved: all channels start at areas[0].addr */
+		effect_chain_apply(loop, (char *)pareas[0].addr +
+					 pareas[0].first / 8 +
+					 poffset * (pareas[0].step / 8), cframes);
+#ifdef FILE_CWRITE
+		if (loop->cfile)
+			fwrite((char *)careas[0].addr + coffset * capt->frame_size,
+			       cframes, capt->frame_size, loop->cfile);
+#endif
+#ifdef FILE_PWRITE
+		if (loop->pfile)
+			fwrite((char *)pareas[0].addr + poffset * play->frame_size,
+			       cframes, play->frame_size, loop->pfile);
+#endif
+		if ((err = commit_mmap(capt, coffset, cframes)) < 0) {
+			snd_pcm_mmap_commit(play->handle, poffset, 0);
+			return err == -EPIPE ? res : err;
+		}
+		if ((err = commit_mmap(play, poffset, cframes)) < 0)
+			return err == -EPIPE ? res : err;
+		res += cframes;
+		size -= cframes;
+		capt->counter += cframes;
+		play->counter += cframes;
+		stats_add(&capt->stats.frames, cframes);
+		stats_add(&play->stats.frames, cframes);
+		if (capt->max < res)
+			capt->max = res;
+		xrun_profile(loop);
+		if (loop->stop_pending) {
+			loop->stop_count += cframes;
+			if (loop->stop_count * play->pitch >
+			    loop->latency * 3) {
+				loop->stop_pending = 0;
+				loop->reinit = 1;
+				break;
+			}
+		}
+	}
+	return res;
+}
+
+/*
+ * Split mode: the capture stream is serviced by its own thread which feeds
+ * loop->ring, the loop thread drains the ring to the playback stream.
+ */
+
+static int capture_xrun(struct loopback_handle *lhandle)
+{
+	int err;
+
+	lhandle->xrun_count++;
+	stats_inc(&lhandle->stats.xruns);
+	logit(LOG_DEBUG, "overrun for %s\n", lhandle->id);
+	if ((err = snd_pcm_prepare(lhandle->handle)) < 0)
+		return err;
+	return snd_pcm_start(lhandle->handle);
+}
+
+static int capture_suspend(struct loopback_handle *lhandle)
+{
+	int err;
+
+	while ((err = snd_pcm_resume(lhandle->handle)) == -EAGAIN)
+		usleep(1);
+	if (err < 0)
+		return capture_xrun(lhandle);
+	return 0;
+}
+
+static snd_pcm_sframes_t readit_ring(struct loopback_handle *lhandle)
+{
+	struct loopback *loop = lhandle->loopback;
+	snd_pcm_sframes_t r, res = 0;
+	snd_pcm_sframes_t avail;
+	char *ptr;
+	int err;
+
+	avail = snd_pcm_avail_update(lhandle->handle);
+	if (avail == -EPIPE) {
+		return capture_xrun(lhandle);
+	} else if (avail == -ESTRPIPE) {
+		if ((err = capture_suspend(lhandle)) < 0)
+			return err;
+		return 0;
+	} else if (avail < 0) {
+		return avail;
+	} else if (avail == 0) {
+		if (snd_pcm_state(lhandle->handle) == SND_PCM_STATE_DRAINING)
+			atomic_store(&loop->capt_reinit, 1);
+		return 0;
+	}
+	while (avail > 0) {
+		r = ring_write_begin(loop->ring, &ptr);
+		if (r == 0) {
+			/*
+			 * Playback is stalled. Drop the captured frames as an
+			 * overrun, otherwise poll() returns at once and this
+			 * thread spins until the ring is drained.
+			 */
+			r = snd_pcm_forward(lhandle->handle, avail);
+			if (r < 0)
+				return res > 0 ? res : r;
+			__atomic_fetch_add(&lhandle->buf_over, r,
+					   __ATOMIC_RELAXED);
+			logit(LOG_DEBUG, "%s: ring full, %li frames dropped\n",
+			      lhandle->id, (long)r);
+			break;
+		}
+		if (r > avail)
+			r = avail;
+		r = snd_pcm_readi(lhandle->handle, ptr, r);
+		if (r == 0)
+			break;
+		if (r < 0) {
+			if (r == -EPIPE) {
+				err = capture_xrun(lhandle);
+				return res > 0 ? res : err;
+			} else if (r == -ESTRPIPE) {
+				if ((err = capture_suspend(lhandle)) < 0)
+					return res > 0 ? res : err;
+				break;
+			}
+			return res > 0 ? res : r;
+		}
+#ifdef FILE_CWRITE
+		if (loop->cfile)
+			fwrite(ptr, r, lhandle->frame_size, loop->cfile);
+#endif
+		effect_chain_apply(loop, ptr, r);
+		ring_write_commit(loop->ring, r);
+		res += r;
+		if (__atomic_load_n(&lhandle->max, __ATOMIC_RELAXED) < res)
+			__atomic_store_n(&lhandle->max, res, __ATOMIC_RELAXED);
+		lhandle->counter += r;
+		stats_add(&lhandle->stats.frames, r);
+		avail -= r;
+	}
+	return res;
+}
+
+static void *capture_thread(void *data)
+{
+	struct loopback *loop = data;
+	struct loopback_handle *capt = loop->capt;
+	unsigned int count = capt->pollfd_count;
+	struct pollfd *pfds;
+	snd_pcm_sframes_t delay;
+	sigset_t mask;
+	int err;
+
+	/* SIGUSR1/SIGUSR2 are meant for the loop threads */
+	sigemptyset(&mask);
+	sigaddset(&mask, SIGUSR1);
+	sigaddset(&mask, SIGUSR2);
+	pthread_sigmask(SIG_BLOCK, &mask, NULL);
+
+	pfds = calloc(count + 1, sizeof(struct pollfd));
+	if (pfds == NULL) {
+		logit(LOG_CRIT, "%s: Poll FDs allocation failed.\n", capt->id);
+		atomic_store(&loop->capt_reinit, 1);
+		return NULL;
+	}
+	while (!atomic_load(&loop->capt_quit)) {
+		err = snd_pcm_poll_descriptors(capt->handle, pfds, count);
+		if (err < 0)
+			break;
+		pfds[count].fd = loop->capt_wakefd;
+		pfds[count].events = POLLIN;
+		pfds[count].revents = 0;
+		err = poll(pfds, count + 1, -1);
+		if (err < 0) {
+			if (errno == EINTR)
+				continue;
+			logit(LOG_CRIT, "%s: Poll failed: %s\n", capt->id, strerror(errno));
+			break;
+		}
+		if (pfds[count].revents)
+			break;
+		err = readit_ring(capt);
+		if (err < 0) {
+			logit(LOG_CRIT, "%s: capture failed: %s\n", capt->id, snd_strerror(err));
+			break;
+		}
+		if (snd_pcm_delay(capt->handle, &delay) >= 0)
+			atomic_store(&loop->capt_delay, delay);
+	}
+	if (!atomic_load(&loop->capt_quit))
+		atomic_store(&loop->capt_reinit, 1);
+	free(pfds);
+	return NULL;
+}
+
+static int capture_thread_start(struct loopback *loop)
+{
+	int err;
+
+	atomic_store(&loop->capt_quit, 0);
+	atomic_store(&loop->capt_reinit, 0);
+	atomic_store(&loop->capt_delay, 0);
+	loop->capt_wakefd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	if (loop->capt_wakefd < 0) {
+		err = -errno;
+		logit(LOG_CRIT, "%s: eventfd failed: %s\n", loop->id, strerror(-err));
+		return err;
+	}
+	err = pthread_create(&loop->capt_thread, NULL, capture_thread, loop);
+	if (err) {
+		logit(LOG_CRIT, "%s: unable to create capture thread: %s\n", loop->id, strerror(err));
+		close(loop->capt_wakefd);
+		return -err;
+	}
+	loop->capt_thread_running = 1;
+	return 0;
+}
+
+static void capture_thread_stop(struct loopback *loop)
+{
+	uint64_t val = 1;
+
+	if (!loop->capt_thread_running)
+		return;
+	atomic_store(&loop->capt_quit, 1);
+	if (write(loop->capt_wakefd, &val, sizeof(val)) < 0)
+		logit(LOG_WARNING, "%s: capture thread wakeup failed\n", loop->id);
+	pthread_join(loop->capt_thread, NULL);
+	close(loop->capt_wakefd);
+	loop->capt_wakefd = -1;
+	loop->capt_thread_running = 0;
+}
+
+static int writeit_ring(struct loopback_handle *lhandle)
+{
+	struct loopback *loop = lhandle->loopback;
+	snd_pcm_sframes_t avail;
+	snd_pcm_sframes_t r, res = 0;
+	char *ptr;
+	int err;
+
+	/* silence queued in lhandle->buf by start or xrun sync goes first */
+	if (lhandle->buf_count > 0) {
+		res = writeit(lhandle);
+		if (res < 0 || lhandle->buf_count > 0 ||
+		    lhandle->xrun_pending || loop->reinit)
+			return res;
+	}
+      __again:
+	avail = snd_pcm_avail_update(lhandle->handle);
+	if (avail == -EPIPE) {
+		if ((err = xrun(lhandle)) < 0)
+			return err;
+		return res;
+	} else if (avail == -ESTRPIPE) {
+		if ((err = suspend(lhandle)) < 0)
+			return err;
+		goto __again;
+	}
+	while (avail > 0) {
+		r = ring_read_begin(loop->ring, &ptr);
+		if (r == 0)
+			break;
+		if (r > avail)
+			r = avail;
+		r = snd_pcm_writei(lhandle->handle, ptr, r);
+		if (r <= 0) {
+			if (r == -EPIPE) {
+				if ((err = xrun(lhandle)) < 0)
+					return err;
+				return res;
+			}
+			return res > 0 ? res : r;
+		}
+#ifdef FILE_PWRITE
+		if (loop->pfile)
+			fwrite(ptr, r, lhandle->frame_size, loop->pfile);
+#endif
+		ring_read_commit(loop->ring, r);
+		res += r;
+		lhandle->counter += r;
+		stats_add(&lhandle->stats.frames, r);
+		avail -= r;
+		xrun_profile(loop);
+		if (loop->stop_pending) {
+			loop->stop_count += r;
+			if (loop->stop_count * lhandle->pitch >
+			    loop->latency * 3) {
+				loop->stop_pending = 0;
+				loop->reinit = 1;
+				break;
+			}
+		}
+	}
+	return res;
+}
+
+static int xrun_sync_split(struct loopback *loop)
+{
+	struct loopback_handle *play = loop->play;
+	struct loopback_handle *capt = loop->capt;
+	snd_pcm_uframes_t fill = get_whole_latency(loop);
+	snd_pcm_sframes_t cdelay, delay1, diff;
+	int err;
+
+	play->xrun_pending = 0;
+	sync_pi_restart(&loop->pi);
+	if ((err = snd_pcm_prepare(play->handle)) < 0) {
+		logit(LOG_CRIT, "%s prepare failed: %s\n", play->id, snd_strerror(err));
+		return err;
+	}
+	/* the capture side keeps running, refill to the requested latency */
+	cdelay = atomic_load(&loop->capt_delay);
+	delay1 = (cdelay + ring_count(loop->ring)) * capt->pitch;
+	if (verbose > 5)
+		snd_output_printf(loop->output, "%s: xrun sync split: cdelay=%li, ring=%li, fill=%li\n", loop->id, (long)cdelay, (long)ring_count(loop->ring), (long)fill);
+	if (delay1 > (snd_pcm_sframes_t)fill) {
+		diff = ring_read_skip(loop->ring, (delay1 - fill) / capt->pitch);
+		if (verbose > 6)
+			snd_output_printf(loop->output,
+				"sync: removed %li captured samples\n", (long)diff);
+	} else if (delay1 < (snd_pcm_sframes_t)fill) {
+		/* lhandle->buf holds silence only in split mode */
+		diff = (fill - delay1) / play->pitch;
+		if (diff > (snd_pcm_sframes_t)play->buf_size)
+			diff = play->buf_size;
+		play->buf_pos = 0;
+		play->buf_count = diff;
+		if (verbose > 6)
+			snd_output_printf(loop->output,
+				"sync: playback silence added %li samples\n", (long)diff);
+	}
+	diff = writeit_ring(play);
+	if (verbose > 6)
+		snd_output_printf(loop->output,
+			"sync: playback wrote %li samples\n", (long)diff);
+	if ((err = snd_pcm_start(play->handle)) < 0) {
+		logit(LOG_CRIT, "%s start failed: %s\n", play->id, snd_strerror(err));
+		return err;
+	}
+	loop->xrun_max_proctime = 0;
+	return 0;
+}
+
 static snd_pcm_sframes_t remove_samples(struct loopback *loop,
 					int capture_preferred,
 					snd_pcm_sframes_t count)
@@ -886,9 +1467,7 @@ static int xrun_sync(struct loopback *loop)
 	if (play->buf != capt->buf)
 		cdelay += capt->buf_count;
 	pdelay += play->buf_count;
-#ifdef USE_SAMPLERATE
 	pdelay += loop->src_out_frames;
-#endif
 	cdelay1 = cdelay * capt->pitch;
 	pdelay1 = pdelay * play->pitch;
 	delay1 = cdelay1 + pdelay1;
@@ -896,19 +1475,12 @@ static int xrun_sync(struct loopback *loop)
 	play->total_queued = 0;
 	loop->total_queued_count = 0;
 	loop->pitch_diff = loop->pitch_diff_min = loop->pitch_diff_max = 0;
+	sync_pi_restart(&loop->pi);
 	if (verbose > 6) {
 		snd_output_printf(loop->output,
-			"sync: cdelay=%li(%li), pdelay=%li(%li), fill=%li (delay=%li)"
-#ifdef USE_SAMPLERATE
-			", src_out=%li"
-#endif
-			"\n",
+			"sync: cdelay=%li(%li), pdelay=%li(%li), fill=%li (delay=%li), src_out=%li\n",
 			(long)cdelay, (long)cdelay1, (long)pdelay, (long)pdelay1,
-			(long)fill, (long)delay1
-#ifdef USE_SAMPLERATE
-			, (long)loop->src_out_frames
-#endif
-			);
+			(long)fill, (long)delay1, (long)loop->src_out_frames);
 		snd_output_printf(loop->output,
 			"sync: cbufcount=%li, pbufcount=%li\n",
 			(long)capt->buf_count, (long)play->buf_count);
@@ -1020,9 +1592,7 @@ static int xrun_sync(struct loopback *loop)
 			if (play->buf != capt->buf)
 				cdelay += capt->buf_count;
 			pdelay += play->buf_count;
-#ifdef USE_SAMPLERATE
 			pdelay += loop->src_out_frames;
-#endif
 			cdelay1 = cdelay * capt->pitch;
 			pdelay1 = pdelay * play->pitch;
 			delay1 = cdelay1 + pdelay1;
@@ -1068,41 +1638,42 @@ static int set_rate_shift(struct loopback_handle *lhandle, double pitch)
 	return 0;
 }
 
+static void set_src_ratio(struct loopback *loop, double ratio)
+{
+	loop->src_ratio = ratio;
+#ifdef USE_SAMPLERATE
+	loop->src_data.src_ratio = ratio;
+#endif
+	if (loop->src_native)
+		resampler_set_ratio(loop->src_native, ratio);
+}
+
 void update_pitch(struct loopback *loop)
 {
 	double pitch = loop->pitch;
 
-#ifdef USE_SAMPLERATE
 	if (loop->sync == SYNC_TYPE_SAMPLERATE) {
-		loop->src_data.src_ratio = (double)1.0 / (pitch *
-				loop->play->pitch * loop->capt->pitch);
+		set_src_ratio(loop, loop->capt->pitch /
+				(pitch * loop->play->pitch));
 		if (verbose > 2)
-			snd_output_printf(loop->output, "%s: Samplerate src_ratio update1: %.8f\n", loop->id, loop->src_data.src_ratio);
-	} else
-#endif
-	if (loop->sync == SYNC_TYPE_CAPTRATESHIFT) {
+			snd_output_printf(loop->output, "%s: Samplerate src_ratio update1: %.8f\n", loop->id, loop->src_ratio);
+	} else if (loop->sync == SYNC_TYPE_CAPTRATESHIFT) {
 		set_rate_shift(loop->capt, pitch);
-#ifdef USE_SAMPLERATE
 		if (loop->use_samplerate) {
-			loop->src_data.src_ratio = 
-				(double)1.0 /
-					(loop->play->pitch * loop->capt->pitch);
+			set_src_ratio(loop, loop->capt->pitch /
+					    loop->play->pitch);
 			if (verbose > 2)
-				snd_output_printf(loop->output, "%s: Samplerate src_ratio update2: %.8f\n", loop->id, loop->src_data.src_ratio);
+				snd_output_printf(loop->output, "%s: Samplerate src_ratio update2: %.8f\n", loop->id, loop->src_ratio);
 		}
-#endif
 	}
 	else if (loop->sync == SYNC_TYPE_PLAYRATESHIFT) {
 		set_rate_shift(loop->play, pitch);
-#ifdef USE_SAMPLERATE
 		if (loop->use_samplerate) {
-			loop->src_data.src_ratio = 
-				(double)1.0 /
-					(loop->play->pitch * loop->capt->pitch);
+			set_src_ratio(loop, loop->capt->pitch /
+					    loop->play->pitch);
 			if (verbose > 2)
-				snd_output_printf(loop->output, "%s: Samplerate src_ratio update3: %.8f\n", loop->id, loop->src_data.src_ratio);
+				snd_output_printf(loop->output, "%s: Samplerate src_ratio update3: %.8f\n", loop->id, loop->src_ratio);
 		}
-#endif
 	}
 	if (verbose)
 		snd_output_printf(loop->output, "New pitch for %s: %.8f (min/max samples = %li/%li)\n", loop->id, pitch, loop->pitch_diff_min, loop->pitch_diff_max);
@@ -1234,7 +1805,7 @@ static int openit(struct loopback_handle *lhandle)
 				SND_PCM_STREAM_CAPTURE;
 	int err, card, device, subdevice;
 	pcm_open_lock();
-	err = snd_pcm_open(&lhandle->handle, lhandle->device, stream, SND_PCM_NONBLOCK);
+	err = pcmjob_pcm_open(&lhandle->handle, lhandle->device, stream, SND_PCM_NONBLOCK);
 	pcm_open_unlock();
 	if (err < 0) {
 		logit(LOG_CRIT, "%s open error: %s\n", lhandle->id, snd_strerror(err));
@@ -1300,7 +1871,10 @@ static int init_handle(struct loopback_handle *lhandle, int alloc)
 	snd_pcm_uframes_t lat;
 	lhandle->frame_size = (snd_pcm_format_physical_width(lhandle->format) 
 						/ 8) * lhandle->channels;
-	lhandle->sync_point = lhandle->rate * 15;	/* every 15 seconds */
+	if (lhandle->loopback->sync_pi)
+		lhandle->sync_point = lhandle->rate;	/* every second */
+	else
+		lhandle->sync_point = lhandle->rate * 15;	/* every 15 seconds */
 	lat = lhandle->loopback->latency;
 	if (lhandle->buffer_size > lat)
 		lat = lhandle->buffer_size;
@@ -1331,14 +1905,16 @@ int pcmjob_init(struct loopback *loop)
 	snprintf(id, sizeof(id), "%s/%s", loop->play->id, loop->capt->id);
 	id[sizeof(id)-1] = '\0';
 	loop->id = strdup(id);
+	if (loop->sync == SYNC_TYPE_PI) {
+		loop->sync_pi = 1;
+		loop->sync = SYNC_TYPE_AUTO;
+	}
 	if (loop->sync == SYNC_TYPE_AUTO && loop->capt->ctl_rate_shift)
 		loop->sync = SYNC_TYPE_CAPTRATESHIFT;
 	if (loop->sync == SYNC_TYPE_AUTO && loop->play->ctl_rate_shift)
 		loop->sync = SYNC_TYPE_PLAYRATESHIFT;
-#ifdef USE_SAMPLERATE
 	if (loop->sync == SYNC_TYPE_AUTO && loop->src_enable)
 		loop->sync = SYNC_TYPE_SAMPLERATE;
-#endif
 	if (loop->sync == SYNC_TYPE_AUTO)
 		loop->sync = SYNC_TYPE_SIMPLE;
 	if (loop->slave == SLAVE_TYPE_AUTO &&
@@ -1368,19 +1944,72 @@ int pcmjob_init(struct loopback *loop)
 	return err;
 }
 
-static void freeloop(struct loopback *loop)
+static int src_init(struct loopback *loop)
 {
+	int err;
+
+	loop->src_to_float = convert_get_to_float(loop->capt->format);
+	loop->src_from_float = convert_get_from_float(loop->play->format);
+	if (loop->src_to_float == NULL || loop->src_from_float == NULL) {
+		logit(LOG_CRIT, "samplerate conversion supports only %s, %s, %s, %s or %s formats (play=%s, capt=%s)\n", snd_pcm_format_name(SND_PCM_FORMAT_S16), snd_pcm_format_name(SND_PCM_FORMAT_S24), snd_pcm_format_name(SND_PCM_FORMAT_S24_3LE), snd_pcm_format_name(SND_PCM_FORMAT_S32), snd_pcm_format_name(SND_PCM_FORMAT_FLOAT), snd_pcm_format_name(loop->play->format), snd_pcm_format_name(loop->capt->format));
+		loop->use_samplerate = 0;
+		return -EIO;
+	}
+	loop->src_ratio = (double)loop->play->rate /
+			  (double)loop->capt->rate;
+	loop->src_out_frames = 0;
 #ifdef USE_SAMPLERATE
-	if (loop->use_samplerate) {
-		if (loop->src_state)
-			src_delete(loop->src_state);
-		loop->src_state = NULL;
-		free((void *)loop->src_data.data_in);
-		loop->src_data.data_in = NULL;
-		free(loop->src_data.data_out);
-		loop->src_data.data_out = NULL;
+	if (loop->src_converter_type != SRC_NATIVE) {
+		loop->src_state = src_new(loop->src_converter_type,
+					  loop->play->channels, &err);
+		loop->src_data.data_in = calloc(1, sizeof(float)*loop->capt->channels*loop->capt->buf_size);
+		if (loop->src_data.data_in == NULL)
+			return -ENOMEM;
+		loop->src_data.data_out =  calloc(1, sizeof(float)*loop->play->channels*loop->play->buf_size);
+		if (loop->src_data.data_out == NULL)
+			return -ENOMEM;
+		loop->src_data.src_ratio = loop->src_ratio;
+		loop->src_data.end_of_input = 0;
+	} else
+#endif
+	{
+		err = resampler_new(&loop->src_native,
+				    loop->play->channels,
+				    loop->src_ratio);
+		if (err < 0)
+			return err;
+		loop->src_native_out = malloc(sizeof(float)*loop->play->channels*loop->play->buf_size);
+		if (loop->src_native_out == NULL)
+			return -ENOMEM;
 	}
+	return 0;
+}
+
+static void src_done(struct loopback *loop)
+{
+#ifdef USE_SAMPLERATE
+	if (loop->src_state)
+		src_delete(loop->src_state);
+	loop->src_state = NULL;
+	free((void *)loop->src_data.data_in);
+	loop->src_data.data_in = NULL;
+	free(loop->src_data.data_out);
+	loop->src_data.data_out = NULL;
 #endif
+	resampler_delete(loop->src_native);
+	loop->src_native = NULL;
+	free(loop->src_native_out);
+	loop->src_native_out = NULL;
+}
+
+static void freeloop(struct loopback *loop)
+{
+	effect_chain_done(loop);
+	if (loop->use_samplerate)
+		src_done(loop);
+	ring_delete(loop->ring);
+	loop->ring = NULL;
+	loop->use_split = 0;
 	if (loop->play->buf == loop->capt->buf)
 		loop->play->buf = NULL;
 	freeit(loop->play);
@@ -1389,6 +2018,7 @@ static void freeloop(struct loopback *loop)
 
 int pcmjob_done(struct loopback *loop)
 {
+	capture_thread_stop(loop);
 	control_done(loop);
 	closeit(loop->play);
 	closeit(loop->capt);
@@ -1424,8 +2054,7 @@ static void fix_format(struct loopback *loop, int force)
 
 	if (!force && loop->sync != SYNC_TYPE_SAMPLERATE)
 		return;
-	if (format == SND_PCM_FORMAT_S16 ||
-	    format == SND_PCM_FORMAT_S32)
+	if (convert_supported(format))
 		return;
 	if (snd_pcm_format_width(format) > 16)
 		format = SND_PCM_FORMAT_S32;
@@ -1472,6 +2101,8 @@ int pcmjob_start(struct loopback *loop)
 	}
 	loop->reinit = 0;
 	loop->use_samplerate = 0;
+	loop->use_mmap = 0;
+	loop->fade_len = 0;
 __again:
 	if (loop->latency_req) {
 		loop->latency_reqtime = frames_to_time(loop->play->rate_req,
@@ -1479,8 +2110,18 @@ __again:
 		loop->latency_req = 0;
 	}
 	loop->latency = time_to_frames(loop->play->rate_req, loop->latency_reqtime);
+	loop->play->access = loop->capt->access =
+		loop->mmap && !loop->split ? SND_PCM_ACCESS_MMAP_INTERLEAVED :
+					     SND_PCM_ACCESS_RW_INTERLEAVED;
 	if ((err = setparams(loop, loop->latency/2)) < 0)
 		goto __error;
+	if (loop->play->access != loop->capt->access) {
+		/* mmap is available only on one side */
+		loop->play->access = loop->capt->access =
+						SND_PCM_ACCESS_RW_INTERLEAVED;
+		if ((err = setparams(loop, loop->latency/2)) < 0)
+			goto __error;
+	}
 	if (verbose)
 		showlatency(loop->output, loop->latency, loop->play->rate_req, "Latency");
 	if (loop->play->access == loop->capt->access &&
@@ -1488,8 +2129,28 @@ __again:
 	    loop->play->rate == loop->capt->rate &&
 	    loop->play->channels == loop->capt->channels &&
 	    loop->sync != SYNC_TYPE_SAMPLERATE) {
+		if (loop->split) {
+			snd_pcm_uframes_t size;
+			if (verbose > 1)
+				snd_output_printf(loop->output, "split threads!!!\n");
+			/* play->buf is used only to queue silence */
+			if ((err = init_handle(loop->play, 1)) < 0)
+				goto __error;
+			if ((err = init_handle(loop->capt, 0)) < 0)
+				goto __error;
+			size = loop->play->buf_size;
+			if (size < loop->capt->buf_size)
+				size = loop->capt->buf_size;
+			err = ring_new(&loop->ring, loop->capt->frame_size, size);
+			if (err < 0)
+				goto __error;
+			loop->use_split = 1;
+			goto __buf_done;
+		}
 		if (verbose > 1)
 			snd_output_printf(loop->output, "shared buffer!!!\n");
+		loop->use_mmap = loop->play->access ==
+					SND_PCM_ACCESS_MMAP_INTERLEAVED;
 		if ((err = init_handle(loop->play, 1)) < 0)
 			goto __error;
 		if ((err = init_handle(loop->capt, 0)) < 0)
@@ -1517,6 +2178,10 @@ __again:
 		}
 		loop->capt->buf = loop->play->buf;
 	} else {
+		if (loop->split && verbose)
+			snd_output_printf(loop->output, "%s: split threads need identical stream parameters, disabled\n", loop->id);
+		if (loop->mmap && verbose)
+			snd_output_printf(loop->output, "%s: mmap copy needs identical stream parameters, disabled\n", loop->id);
 		if ((err = init_handle(loop->play, 1)) < 0)
 			goto __error;
 		if ((err = init_handle(loop->capt, 1)) < 0)
@@ -1535,7 +2200,7 @@ __again:
                         }
                 }
 	}
-#ifdef USE_SAMPLERATE
+      __buf_done:
 	if (loop->sync == SYNC_TYPE_SAMPLERATE)
 		loop->use_samplerate = 1;
 	if (loop->use_samplerate && !loop->src_enable) {
@@ -1545,47 +2210,22 @@ __again:
 		goto __error;		
 	}
 	if (loop->use_samplerate) {
-		if ((loop->capt->format != SND_PCM_FORMAT_S16 ||
-		    loop->play->format != SND_PCM_FORMAT_S16) &&
-		    (loop->capt->format != SND_PCM_FORMAT_S32 ||
-		     loop->play->format != SND_PCM_FORMAT_S32)) {
-			logit(LOG_CRIT, "samplerate conversion supports only %s or %s formats (play=%s, capt=%s)\n", snd_pcm_format_name(SND_PCM_FORMAT_S16), snd_pcm_format_name(SND_PCM_FORMAT_S32), snd_pcm_format_name(loop->play->format), snd_pcm_format_name(loop->capt->format));
-			loop->use_samplerate = 0;
-			err = -EIO;
-			goto __error;		
-		}
-		loop->src_state = src_new(loop->src_converter_type,
-					  loop->play->channels, &err);
-		loop->src_data.data_in = calloc(1, sizeof(float)*loop->capt->channels*loop->capt->buf_size);
-		if (loop->src_data.data_in == NULL) {
-			err = -ENOMEM;
-			goto __error;
-		}
-		loop->src_data.data_out =  calloc(1, sizeof(float)*loop->play->channels*loop->play->buf_size);
-		if (loop->src_data.data_out == NULL) {
-			err = -ENOMEM;
+		if ((err = src_init(loop)) < 0)
 			goto __error;
-		}
-		loop->src_data.src_ratio = (double)loop->play->rate /
-					   (double)loop->capt->rate;
-		loop->src_data.end_of_input = 0;
-		loop->src_out_frames = 0;
 	} else {
+#ifdef USE_SAMPLERATE
 		loop->src_state = NULL;
+#endif
+		loop->src_native = NULL;
 	}
-#else
-	if (loop->sync == SYNC_TYPE_SAMPLERATE || loop->use_samplerate) {
-		logit(LOG_CRIT, "alsaloop is compiled without libsamplerate support\n");
-		err = -EIO;
+	err = effect_chain_init(loop, loop->capt->channels, loop->capt->rate,
+				loop->capt->format);
+	if (err < 0)
 		goto __error;
-	}
-#endif
 	if (verbose) {
 		snd_output_printf(loop->output, "%s sync type: %s", loop->id, sync_types[loop->sync]);
-#ifdef USE_SAMPLERATE
 		if (loop->sync == SYNC_TYPE_SAMPLERATE)
 			snd_output_printf(loop->output, " (%s)", src_types[loop->src_converter_type]);
-#endif
 		snd_output_printf(loop->output, "\n");
 	}
 	lhandle_start(loop->play);
@@ -1601,6 +2241,9 @@ __again:
 	loop->pitch = 1.0;
 	update_pitch(loop);
 	loop->pitch_delta = 1.0 / ((double)loop->capt->rate * 4);
+	if (loop->sync_pi)
+		sync_pi_init(&loop->pi, loop->play->rate,
+			     get_whole_latency(loop));
 	loop->total_queued_count = 0;
 	loop->pitch_diff = 0;
 	count = get_whole_latency(loop) / loop->play->pitch;
@@ -1619,6 +2262,10 @@ __again:
 	}
 	loop->running = 1;
 	loop->stop_pending = 0;
+	if (loop->stats_enabled) {
+		atomic_store(&loop->stats.latency, loop->latency);
+		atomic_store(&loop->stats.running, 1);
+	}
 	if (loop->xrun) {
 		getcurtimestamp(&loop->xrun_last_update);
 		loop->xrun_last_pdelay = XRUN_PROFILE_UNKNOWN;
@@ -1635,6 +2282,10 @@ __again:
 			goto __error;
 		}
 	}
+	if (loop->use_split) {
+		if ((err = capture_thread_start(loop)) < 0)
+			goto __error;
+	}
 	return 0;
       __error:
 	pcmjob_stop(loop);
@@ -1645,6 +2296,7 @@ int pcmjob_stop(struct loopback *loop)
 {
 	int err;
 
+	capture_thread_stop(loop);
 	if (loop->running) {
 		if ((err = snd_pcm_drop(loop->capt->handle)) < 0)
 			logit(LOG_WARNING, "pcm drop %s error: %s\n", loop->capt->id, snd_strerror(err));
@@ -1655,6 +2307,7 @@ int pcmjob_stop(struct loopback *loop)
 		if ((err = snd_pcm_hw_free(loop->play->handle)) < 0)
 			logit(LOG_WARNING, "pcm hw_free %s error: %s\n", loop->play->id, snd_strerror(err));
 		loop->running = 0;
+		atomic_store(&loop->stats.running, 0);
 	}
 	freeloop(loop);
 	return 0;
@@ -1669,10 +2322,12 @@ int pcmjob_pollfds_init(struct loopback *loop, struct pollfd *fds)
 		if (err < 0)
 			return err;
 		idx += loop->play->pollfd_count;
-		err = snd_pcm_poll_descriptors(loop->capt->handle, fds + idx, loop->capt->pollfd_count);
-		if (err < 0)
-			return err;
-		idx += loop->capt->pollfd_count;
+		if (!loop->use_split) {
+			err = snd_pcm_poll_descriptors(loop->capt->handle, fds + idx, loop->capt->pollfd_count);
+			if (err < 0)
+				return err;
+			idx += loop->capt->pollfd_count;
+		}
 	}
 	if (loop->play->ctl_pollfd_count > 0 &&
 	    (loop->slave == SLAVE_TYPE_ON || loop->controls)) {
@@ -1701,9 +2356,9 @@ static snd_pcm_sframes_t get_queued_playback_samples(struct loopback *loop)
 		return 0;
 	loop->play->last_delay = delay;
 	delay += loop->play->buf_count;
-#ifdef USE_SAMPLERATE
+	if (loop->use_split)
+		delay += ring_count(loop->ring);
 	delay += loop->src_out_frames;
-#endif
 	return delay;
 }
 
@@ -1712,6 +2367,8 @@ static snd_pcm_sframes_t get_queued_capture_samples(struct loopback *loop)
 	snd_pcm_sframes_t delay;
 	int err;
 
+	if (loop->use_split)
+		return atomic_load(&loop->capt_delay);
 	if ((err = snd_pcm_delay(loop->capt->handle, &delay)) < 0)
 		return 0;
 	loop->capt->last_delay = delay;
@@ -1719,6 +2376,302 @@ static snd_pcm_sframes_t get_queued_capture_samples(struct loopback *loop)
 	return delay;
 }
 
+static void sync_update(struct loopback *loop)
+{
+	struct loopback_handle *play = loop->play;
+	struct loopback_handle *capt = loop->capt;
+	snd_pcm_sframes_t diff, lat = get_whole_latency(loop);
+
+	diff = ((double)(((double)play->total_queued * play->pitch) +
+			 ((double)capt->total_queued * capt->pitch)) /
+		(double)loop->total_queued_count) - lat;
+	/* FIXME: this algorithm may be slightly better */
+	if (verbose > 3)
+		snd_output_printf(loop->output, "%s: sync diff %li old diff %li\n", loop->id, diff, loop->pitch_diff);
+	loop->pitch = sync_simple_update(loop->pitch, loop->pitch_delta,
+					 diff, loop->pitch_diff);
+	loop->pitch_diff = diff;
+	if (loop->pitch_diff_min > diff)
+		loop->pitch_diff_min = diff;
+	if (loop->pitch_diff_max < diff)
+		loop->pitch_diff_max = diff;
+	update_pitch(loop);
+}
+
+/*
+ * The delay is valid at the time of the last pointer update, move it
+ * to the time "now" using the nominal rate.
+ */
+static int get_delay_tstamp(struct loopback_handle *lhandle,
+			    const struct timespec *now,
+			    snd_pcm_sframes_t *delay)
+{
+	snd_pcm_status_t *status;
+	snd_htimestamp_t ts;
+	long long ns;
+	snd_pcm_sframes_t frames;
+	int err;
+
+	snd_pcm_status_alloca(&status);
+	if ((err = snd_pcm_status(lhandle->handle, status)) < 0)
+		return err;
+	if (snd_pcm_status_get_state(status) != SND_PCM_STATE_RUNNING)
+		return -EPIPE;
+	*delay = snd_pcm_status_get_delay(status);
+	snd_pcm_status_get_htstamp(status, &ts);
+	ns = (now->tv_sec - ts.tv_sec) * 1000000000LL +
+	     (now->tv_nsec - ts.tv_nsec);
+	/* other clock source or a stale timestamp, use the delay as is */
+	if (ns <= 0 || ns >= 1000000000LL)
+		return 0;
+	frames = ns * lhandle->rate / 1000000000LL;
+	if (lhandle == lhandle->loopback->play) {
+		*delay -= frames;
+		if (*delay < 0)
+			*delay = 0;
+	} else {
+		*delay += frames;
+	}
+	return 0;
+}
+
+static void sync_sample_pi(struct loopback *loop)
+{
+	struct loopback_handle *play = loop->play;
+	struct loopback_handle *capt = loop->capt;
+	struct timespec now;
+	snd_pcm_sframes_t pqueued, cqueued;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	if (get_delay_tstamp(play, &now, &pqueued) < 0)
+		return;
+	pqueued += play->buf_count + loop->src_out_frames;
+	if (loop->use_split) {
+		/* the capture thread owns the capture handle */
+		pqueued += ring_count(loop->ring);
+		cqueued = atomic_load(&loop->capt_delay);
+	} else {
+		if (get_delay_tstamp(capt, &now, &cqueued) < 0)
+			return;
+		cqueued += capt->buf_count;
+	}
+	if (verbose > 4)
+		snd_output_printf(loop->output, "%s: queued %li/%li samples\n", loop->id, pqueued, cqueued);
+	sync_pi_sample(&loop->pi, now.tv_sec + now.tv_nsec / 1e9,
+		       pqueued * play->pitch + cqueued * capt->pitch);
+	if (loop->stats_enabled) {
+		stats_set(&play->stats.queued, pqueued);
+		stats_set(&capt->stats.queued, cqueued);
+	}
+}
+
+static void sync_update_pi(struct loopback *loop)
+{
+	double pitch, error;
+
+	if (!sync_pi_update(&loop->pi, &pitch, &error))
+		return;
+	if (verbose > 3)
+		snd_output_printf(loop->output, "%s: sync error %.1f ratio %.8f\n", loop->id, error, 1.0 + loop->pi.ratio);
+	loop->pitch = pitch;
+	loop->pitch_diff = lrint(error);
+	if (loop->pitch_diff_min > loop->pitch_diff)
+		loop->pitch_diff_min = loop->pitch_diff;
+	if (loop->pitch_diff_max < loop->pitch_diff)
+		loop->pitch_diff_max = loop->pitch_diff;
+	update_pitch(loop);
+}
+
+/*
+ * Fade out the last len frames queued for the playback. When the most
+ * of them were already passed to the device, the playback is rewound,
+ * the frames are still in play->buf behind buf_pos.
+ */
+static snd_pcm_uframes_t fade_out(struct loopback *loop, snd_pcm_uframes_t len)
+{
+	struct loopback_handle *play = loop->play;
+	snd_pcm_sframes_t r;
+	snd_pcm_uframes_t pos, count, done;
+
+	if (play->buf_count < len) {
+		r = snd_pcm_rewindable(play->handle);
+		if (r > (snd_pcm_sframes_t)(len - play->buf_count))
+			r = len - play->buf_count;
+		if (r > (snd_pcm_sframes_t)buf_avail(play))
+			r = buf_avail(play);
+		if (r > 0)
+			r = snd_pcm_rewind(play->handle, r);
+		if (r > 0) {
+			play->buf_pos += play->buf_size - r;
+			play->buf_pos %= play->buf_size;
+			play->buf_count += r;
+		}
+	}
+	if (len > play->buf_count)
+		len = play->buf_count;
+	pos = (play->buf_pos + play->buf_count - len) % play->buf_size;
+	for (done = 0; done < len; done += count) {
+		count = len - done;
+		if (count > play->buf_size - pos)
+			count = play->buf_size - pos;
+		fade_frames(play->format, play->channels,
+			    play->buf + pos * play->frame_size, count,
+			    done, len, 1);
+		pos = (pos + count) % play->buf_size;
+	}
+	return len;
+}
+
+static snd_pcm_uframes_t queue_silence(struct loopback_handle *lhandle,
+				       snd_pcm_uframes_t count)
+{
+	snd_pcm_uframes_t pos, count1, res = 0;
+
+	if (count > buf_avail(lhandle))
+		count = buf_avail(lhandle);
+	pos = (lhandle->buf_pos + lhandle->buf_count) % lhandle->buf_size;
+	while (count > 0) {
+		count1 = count;
+		if (count1 > lhandle->buf_size - pos)
+			count1 = lhandle->buf_size - pos;
+		snd_pcm_format_set_silence(lhandle->format,
+					   lhandle->buf + pos * lhandle->frame_size,
+					   count1 * lhandle->channels);
+		lhandle->buf_count += count1;
+		pos = (pos + count1) % lhandle->buf_size;
+		count -= count1;
+		res += count1;
+	}
+	return res;
+}
+
+/*
+ * Only the rate of the slave stream changed: reconfigure the capture
+ * side and resample into the running playback stream instead of
+ * restarting both. Everything for the new configuration is allocated
+ * before the capture is stopped, the end of the old stream is faded
+ * out, the gap is covered with silence and the new stream fades in.
+ * Returns 1 when done, 0 when a full restart is required.
+ */
+static int reconfig_capture(struct loopback *loop)
+{
+	struct loopback_handle *play = loop->play;
+	struct loopback_handle *capt = loop->capt;
+	snd_pcm_hw_params_t *ct_params, *c_params;
+	snd_pcm_sw_params_t *c_swparams;
+	snd_pcm_sframes_t count, pdelay;
+	snd_pcm_uframes_t bufsize, faded, silence;
+	int err, format, rate, channels;
+
+	if (!loop->running || loop->slave != SLAVE_TYPE_ON ||
+	    !loop->src_enable || loop->use_split || loop->use_mmap ||
+	    loop->linked || capt->access != SND_PCM_ACCESS_RW_INTERLEAVED ||
+	    capt->channels > FADE_BLOCK)
+		return 0;
+	if (get_active(capt) <= 0)
+		return 0;
+	format = get_format(capt);
+	rate = get_rate(capt);
+	channels = get_channels(capt);
+	if (format != (int)capt->format || channels != (int)capt->channels ||
+	    rate <= 0 || rate == (int)capt->rate ||
+	    !convert_supported(capt->format) ||
+	    !convert_supported(play->format))
+		return 0;
+
+	/* drain what is left from the old stream and fade it out */
+	count = readit(capt);
+	if (count > 0)
+		buf_add(loop, count);
+	faded = fade_out(loop, time_to_frames(play->rate, FADE_TIME));
+	count = writeit(play);
+	if (count < 0)
+		return count;
+	buf_remove(loop, count);
+
+	/* the hw_params refinement works with the old stream still open */
+	snd_pcm_hw_params_alloca(&ct_params);
+	snd_pcm_hw_params_alloca(&c_params);
+	snd_pcm_sw_params_alloca(&c_swparams);
+	capt->rate_req = rate;
+	if ((err = setparams_stream(capt, ct_params)) < 0)
+		return err;
+	/* the playback rate stays the nominal one */
+	capt->rate_req = play->rate_req;
+	capt->pitch = (double)capt->rate_req / (double)capt->rate;
+	bufsize = loop->latency / 2;
+	if ((err = setparams_bufsize(capt, c_params, ct_params, bufsize / capt->pitch)) < 0)
+		return err;
+	effect_chain_done(loop);
+	if (loop->use_samplerate)
+		src_done(loop);
+	if (capt->buf == play->buf)
+		capt->buf = NULL;
+	freeit(capt);
+	if ((err = init_handle(capt, 1)) < 0)
+		return err;
+	loop->use_samplerate = 1;
+	if ((err = src_init(loop)) < 0)
+		return err;
+	err = effect_chain_init(loop, capt->channels, capt->rate, capt->format);
+	if (err < 0)
+		return err;
+
+	/* switch, the playback keeps running */
+	if ((err = snd_pcm_drop(capt->handle)) < 0)
+		logit(LOG_WARNING, "pcm drop %s error: %s\n", capt->id, snd_strerror(err));
+	if ((err = snd_pcm_hw_free(capt->handle)) < 0)
+		logit(LOG_WARNING, "pcm hw_free %s error: %s\n", capt->id, snd_strerror(err));
+	if ((err = setparams_set(capt, c_params, c_swparams, bufsize / capt->pitch)) < 0)
+		return err;
+	if ((err = snd_pcm_prepare(capt->handle)) < 0) {
+		logit(LOG_CRIT, "Prepare %s error: %s\n", capt->id, snd_strerror(err));
+		return err;
+	}
+	lhandle_start(capt);
+	capt->xrun_pending = 0;
+	loop->reinit = 0;
+	/* new sync window, the drift estimate (pitch) is kept */
+	play->counter = 0;
+	play->total_queued = 0;
+	loop->total_queued_count = 0;
+	if (loop->sync_pi)
+		sync_pi_restart(&loop->pi);
+	update_pitch(loop);
+
+	/* cover the time until the first period of the new stream */
+	if (snd_pcm_delay(play->handle, &pdelay) < 0)
+		pdelay = 0;
+	count = loop->latency / play->pitch - pdelay - play->buf_count;
+	silence = count > 0 ? queue_silence(play, count) : 0;
+	count = writeit(play);
+	if (count < 0)
+		return count;
+	loop->fade_pos = 0;
+	loop->fade_len = time_to_frames(capt->rate, FADE_TIME);
+	if ((err = snd_pcm_start(capt->handle)) < 0) {
+		logit(LOG_CRIT, "pcm start %s error: %s\n", capt->id, snd_strerror(err));
+		return err;
+	}
+	if (verbose)
+		snd_output_printf(loop->output, "%s: capture rate changed to %iHz, playback kept running (%li frames faded out, %li frames of silence)\n", loop->id, rate, (long)faded, (long)silence);
+	return 1;
+}
+
+/* stream parameters changed or the capture stream ended */
+static int restart_loop(struct loopback *loop)
+{
+	int err;
+
+	err = reconfig_capture(loop);
+	if (err > 0)
+		return 0;
+	if (err < 0)
+		logit(LOG_WARNING, "%s: capture reconfiguration failed (%s), restarting both streams\n", loop->id, snd_strerror(err));
+	pcmjob_stop(loop);
+	return pcmjob_start(loop);
+}
+
 static int ctl_event_check(snd_ctl_elem_value_t *val, snd_ctl_event_t *ev)
 {
 	snd_ctl_elem_id_t *id1, *id2;
@@ -1785,8 +2738,7 @@ static int handle_ctl_events(struct loopback_handle *lhandle,
 			restart = 1;
 	}
 	if (restart) {
-		pcmjob_stop(loop);
-		err = pcmjob_start(loop);
+		err = restart_loop(loop);
 		if (err < 0)
 			return err;
 	}
@@ -1803,7 +2755,7 @@ int pcmjob_pollfds_handle(struct loopback *loop, struct pollfd *fds)
 
 	if (verbose > 11)
 		snd_output_printf(loop->output, "%s: pollfds handle\n", loop->id);
-	if (verbose > 13 || loop->xrun)
+	if (verbose > 13 || loop->xrun || loop->pool || loop->stats_enabled)
 		getcurtimestamp(&loop->tstamp_start);
 	if (verbose > 12) {
 		snd_pcm_sframes_t pdelay, cdelay;
@@ -1824,12 +2776,16 @@ int pcmjob_pollfds_handle(struct loopback *loop, struct pollfd *fds)
 		if (err < 0)
 			return err;
 		idx += play->pollfd_count;
-		err = snd_pcm_poll_descriptors_revents(capt->handle, fds + idx,
-						       capt->pollfd_count,
-						       &crevents);
-		if (err < 0)
-			return err;
-		idx += capt->pollfd_count;
+		if (loop->use_split) {
+			crevents = 0;
+		} else {
+			err = snd_pcm_poll_descriptors_revents(capt->handle, fds + idx,
+							       capt->pollfd_count,
+							       &crevents);
+			if (err < 0)
+				return err;
+			idx += capt->pollfd_count;
+		}
 		if (loop->xrun) {
 			if (prevents || crevents) {
 				loop->xrun_last_wake = loop->xrun_last_wake0;
@@ -1838,6 +2794,8 @@ int pcmjob_pollfds_handle(struct loopback *loop, struct pollfd *fds)
 			loop->xrun_last_check = loop->xrun_last_check0;
 			loop->xrun_last_check0 = loop->tstamp_start;
 		}
+		if (loop->stats_enabled && prevents)
+			stats_wakeup(play);
 	} else {
 		prevents = crevents = 0;
 	}
@@ -1877,6 +2835,41 @@ int pcmjob_pollfds_handle(struct loopback *loop, struct pollfd *fds)
 		snd_output_printf(loop->output, "%s: prevents = 0x%x, crevents = 0x%x\n", loop->id, prevents, crevents);
 	if (!loop->running)
 		goto __pcm_end;
+	if (loop->use_split) {
+		if (atomic_load(&loop->capt_reinit)) {
+			loop->reinit = 1;
+			goto __xfer_end;
+		}
+		pcount = writeit_ring(play);
+		if (pcount > 0) {
+			play->stall = 0;
+		} else if (prevents != 0) {
+			if (play->stall > 20) {
+				play->stall = 0;
+				increase_playback_avail_min(play);
+			} else {
+				play->stall++;
+			}
+		}
+		goto __xfer_end;
+	}
+	/* queued silence or xrun sync leftovers go through the buffer */
+	if (loop->use_mmap && play->buf_count == 0 && capt->buf_count == 0) {
+		snd_pcm_sframes_t r = copy_mmap(loop);
+		if (r < 0)
+			return r;
+		if (r > 0) {
+			play->stall = 0;
+		} else if (prevents != 0 && crevents == 0) {
+			if (play->stall > 20) {
+				play->stall = 0;
+				increase_playback_avail_min(play);
+			} else {
+				play->stall++;
+			}
+		}
+		goto __xfer_end;
+	}
 	do {
 		ccount = readit(capt);
 		if (prevents != 0 && crevents == 0 &&
@@ -1904,52 +2897,37 @@ int pcmjob_pollfds_handle(struct loopback *loop, struct pollfd *fds)
 			break;
 		loopcount++;
 	} while ((ccount > 0 || pcount > 0) && loopcount > 10);
-	if (play->xrun_pending || capt->xrun_pending) {
+      __xfer_end:
+	if (loop->use_split && play->xrun_pending) {
+		if ((err = xrun_sync_split(loop)) < 0)
+			return err;
+	} else if (play->xrun_pending || capt->xrun_pending) {
 		if ((err = xrun_sync(loop)) < 0)
 			return err;
 	}
 	if (loop->reinit) {
-		err = pcmjob_stop(loop);
-		if (err < 0)
-			return err;
-		err = pcmjob_start(loop);
+		err = restart_loop(loop);
 		if (err < 0)
 			return err;
 	}
 	if (loop->sync != SYNC_TYPE_NONE &&
 	    play->counter >= play->sync_point &&
-	    capt->counter >= play->sync_point) {
-		snd_pcm_sframes_t diff, lat = get_whole_latency(loop);
-		diff = ((double)(((double)play->total_queued * play->pitch) +
-				 ((double)capt->total_queued * capt->pitch)) /
-			(double)loop->total_queued_count) - lat;
-		/* FIXME: this algorithm may be slightly better */
-		if (verbose > 3)
-			snd_output_printf(loop->output, "%s: sync diff %li old diff %li\n", loop->id, diff, loop->pitch_diff);
-		if (diff > 0) {
-			if (diff == loop->pitch_diff)
-				loop->pitch += loop->pitch_delta;
-			else if (diff > loop->pitch_diff)
-				loop->pitch += loop->pitch_delta*2;
-		} else if (diff < 0) {
-			if (diff == loop->pitch_diff)
-				loop->pitch -= loop->pitch_delta;
-			else if (diff < loop->pitch_diff)
-				loop->pitch -= loop->pitch_delta*2;
-		}
-		loop->pitch_diff = diff;
-		if (loop->pitch_diff_min > diff)
-			loop->pitch_diff_min = diff;
-		if (loop->pitch_diff_max < diff)
-			loop->pitch_diff_max = diff;
-		update_pitch(loop);
+	    (loop->use_split || capt->counter >= play->sync_point)) {
+		if (loop->sync_pi)
+			sync_update_pi(loop);
+		else
+			sync_update(loop);
 		play->counter -= play->sync_point;
-		capt->counter -= play->sync_point;
+		/* in split mode capt->counter belongs to the capture thread */
+		if (!loop->use_split)
+			capt->counter -= play->sync_point;
 		play->total_queued = 0;
 		capt->total_queued = 0;
 		loop->total_queued_count = 0;
 	}
-	if (loop->sync != SYNC_TYPE_NONE) {
+	if (loop->sync != SYNC_TYPE_NONE && loop->sync_pi) {
+		sync_sample_pi(loop);
+	} else if (loop->sync != SYNC_TYPE_NONE) {
 		snd_pcm_sframes_t pqueued, cqueued;
 		pqueued = get_queued_playback_samples(loop);
 		cqueued = get_queued_capture_samples(loop);
@@ -1961,6 +2939,10 @@ int pcmjob_pollfds_handle(struct loopback *loop, struct pollfd *fds)
 			capt->total_queued += cqueued;
 		if (pqueued > 0 || cqueued > 0)
 			loop->total_queued_count += 1;
+		if (loop->stats_enabled) {
+			stats_set(&play->stats.queued, pqueued);
+			stats_set(&capt->stats.queued, cqueued);
+		}
 	}
 	if (verbose > 12) {
 		snd_pcm_sframes_t pdelay, cdelay;
@@ -1974,7 +2956,7 @@ int pcmjob_pollfds_handle(struct loopback *loop, struct pollfd *fds)
 			snd_output_printf(loop->output, "%s: end delay %li / %li / %li\n", capt->id, cdelay, capt->buf_size, capt->buf_count);
 	}
       __pcm_end:
-	if (verbose > 13 || loop->xrun) {
+	if (verbose > 13 || loop->xrun || loop->pool || loop->stats_enabled) {
 		long diff;
 		getcurtimestamp(&loop->tstamp_end);
 		diff = timediff(loop->tstamp_end, loop->tstamp_start);
@@ -1982,6 +2964,12 @@ int pcmjob_pollfds_handle(struct loopback *loop, struct pollfd *fds)
 			snd_output_printf(loop->output, "%s: processing time %lius\n", loop->id, diff);
 		if (loop->xrun && loop->xrun_max_proctime < diff)
 			loop->xrun_max_proctime = diff;
+		/* the pool rebalances on the accumulated processing time */
+		if (loop->pool)
+			atomic_fetch_add_explicit(&loop->pool_load, diff,
+						  memory_order_relaxed);
+		if (loop->stats_enabled)
+			stats_update(loop, diff);
 	}
 	return 0;
 }
@@ -2002,8 +2990,8 @@ static void show_handle(struct loopback_handle *lhandle, const char *id)
 		return;
 	OUT("    access = %s, format = %s, rate = %u, channels = %u\n", snd_pcm_access_name(lhandle->access), snd_pcm_format_name(lhandle->format), lhandle->rate, lhandle->channels);
 	OUT("    buffer_size = %u, period_size = %u, avail_min = %li\n", lhandle->buffer_size, lhandle->period_size, lhandle->avail_min);
-	OUT("    xrun_pending = %i\n", lhandle->xrun_pending);
-	OUT("    buf_size = %li, buf_pos = %li, buf_count = %li, buf_over = %li\n", lhandle->buf_size, lhandle->buf_pos, lhandle->buf_count, lhandle->buf_over);
+	OUT("    xrun_pending = %i, xrun_count = %lu\n", lhandle->xrun_pending, lhandle->xrun_count);
+	OUT("    buf_size = %li, buf_pos = %li, buf_count = %li, buf_over = %li\n", lhandle->buf_size, lhandle->buf_pos, lhandle->buf_count, __atomic_load_n(&lhandle->buf_over, __ATOMIC_RELAXED));
 	OUT("    pitch = %.8f\n", lhandle->pitch);
 }
 
@@ -2013,13 +3001,16 @@ void pcmjob_state(struct loopback *loop)
 	pthread_mutex_lock(&state_mutex);
 	OUT("State dump for thread %p job %i: %s:\n", (void *)self, loop->thread, loop->id);
 	OUT("  running = %i\n", loop->running);
-	OUT("  sync = %i\n", loop->sync);
+	OUT("  sync = %i%s\n", loop->sync, loop->sync_pi ? " (pi)" : "");
 	OUT("  slave = %i\n", loop->slave);
 	if (!loop->running)
 		goto __skip;
 	OUT("  pollfd_count = %i\n", loop->pollfd_count);
 	OUT("  pitch = %.8f, delta = %.8f, diff = %li, min = %li, max = %li\n", loop->pitch, loop->pitch_delta, loop->pitch_diff, loop->pitch_diff_min, loop->pitch_diff_max);
 	OUT("  use_samplerate = %i\n", loop->use_samplerate);
+	OUT("  use_mmap = %i\n", loop->use_mmap);
+	if (loop->use_split)
+		OUT("  split: ring_size = %li, ring_count = %li, capt_delay = %li\n", loop->ring->size, ring_count(loop->ring), (long)atomic_load(&loop->capt_delay));
       __skip:
 	show_handle(loop->play, "playback");
 	show_handle(loop->capt, "capture");
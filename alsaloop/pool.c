@@ -0,0 +1,477 @@
+/*
+ *  A simple PCM loopback utility
+ *  Worker pool with per-thread epoll sets and load rebalancing
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <syslog.h>
+#include <signal.h>
+#include <poll.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <alsa/asoundlib.h>
+#include "alsaloop.h"
+
+/*
+ * Every loopback is owned by exactly one worker. The rebalancer (main
+ * thread) only sets pool_target, the owner notices it, drops the
+ * descriptors from its epoll set and hands the loopback over through the
+ * inbox of the new owner. So no loopback is ever touched by two workers.
+ */
+
+#define POOL_REBALANCE_MS	1000
+#define POOL_REBALANCE_MIN	2000	/* us per interval, ignore smaller gaps */
+#define POOL_EVENTS		64
+
+struct pool_worker {
+	int index;
+	pthread_t thread;
+	int epfd;
+	int wakefd;
+	int wake;			/* poll timeout in ms */
+	unsigned long mark;
+	pthread_mutex_t lock;
+	struct loopback **inbox;	/* protected by lock */
+	int inbox_count;
+	struct loopback **loops;
+	int loops_count;
+	struct loopback **ready;
+	struct pollfd *pfds;		/* scratch for pcmjob_pollfds_init() */
+	snd_output_t *output;
+};
+
+static struct pool_worker *workers;
+static int workers_count;
+static struct loopback **pool_loops;
+static int pool_loops_count;
+
+static void pool_wakeup(struct pool_worker *w)
+{
+	uint64_t val = 1;
+
+	if (write(w->wakefd, &val, sizeof(val)) < 0 && verbose > 1)
+		logit(LOG_WARNING, "pool: wakeup failed: %s\n", strerror(errno));
+}
+
+static void pool_unregister(struct pool_worker *w, struct loopback *loop)
+{
+	int i;
+
+	for (i = 0; i < loop->pool_fds_count; i++)
+		epoll_ctl(w->epfd, EPOLL_CTL_DEL, loop->pool_fds[i].fd, NULL);
+	loop->pool_fds_count = 0;
+}
+
+static int pool_register(struct pool_worker *w, struct loopback *loop)
+{
+	struct epoll_event ev;
+	int i, count;
+
+	count = pcmjob_pollfds_init(loop, loop->pool_fds);
+	if (count < 0)
+		return count;
+	for (i = 0; i < count; i++) {
+		/* POLL* and EPOLL* bits share the values */
+		ev.events = loop->pool_fds[i].events;
+		ev.data.u64 = ((uint64_t)loop->pool_index << 32) | i;
+		if (epoll_ctl(w->epfd, EPOLL_CTL_ADD, loop->pool_fds[i].fd, &ev) < 0 &&
+		    errno != EEXIST)
+			return -errno;
+	}
+	loop->pool_fds_count = count;
+	return 0;
+}
+
+/* the descriptor set changes with the stream state (running, slave mode) */
+static int pool_refresh(struct pool_worker *w, struct loopback *loop)
+{
+	int i, count;
+
+	count = pcmjob_pollfds_init(loop, w->pfds);
+	if (count < 0)
+		return count;
+	if (count == loop->pool_fds_count) {
+		for (i = 0; i < count; i++)
+			if (w->pfds[i].fd != loop->pool_fds[i].fd ||
+			    w->pfds[i].events != loop->pool_fds[i].events)
+				break;
+		if (i == count)
+			return 0;
+	}
+	pool_unregister(w, loop);
+	return pool_register(w, loop);
+}
+
+static void pool_update_wake(struct pool_worker *w)
+{
+	int i, wake = 1000000;
+
+	for (i = 0; i < w->loops_count; i++) {
+		if (w->loops[i]->wake > 0 && (int)w->loops[i]->wake < wake)
+			wake = w->loops[i]->wake;
+	}
+	w->wake = wake >= 1000000 ? -1 : wake;
+}
+
+static void pool_adopt(struct pool_worker *w)
+{
+	struct loopback *loop;
+	int i, err;
+
+	pthread_mutex_lock(&w->lock);
+	for (i = 0; i < w->inbox_count; i++) {
+		loop = w->inbox[i];
+		err = pool_register(w, loop);
+		if (err < 0) {
+			logit(LOG_CRIT, "pool: cannot register %s: %s\n", loop->id, snd_strerror(err));
+			exit(EXIT_FAILURE);
+		}
+		atomic_store(&loop->pool_worker, w->index);
+		loop->pool_mark = 0;
+		w->loops[w->loops_count++] = loop;
+		if (verbose > 1)
+			snd_output_printf(w->output, "pool: %s moved to worker %i\n", loop->id, w->index);
+	}
+	if (w->inbox_count > 0)
+		pool_update_wake(w);
+	w->inbox_count = 0;
+	pthread_mutex_unlock(&w->lock);
+}
+
+static void pool_release(struct pool_worker *w)
+{
+	struct pool_worker *dst;
+	struct loopback *loop;
+	int i, target;
+
+	for (i = 0; i < w->loops_count; i++) {
+		loop = w->loops[i];
+		target = atomic_load(&loop->pool_target);
+		if (target == w->index)
+			continue;
+		pool_unregister(w, loop);
+		w->loops[i--] = w->loops[--w->loops_count];
+		dst = &workers[target];
+		pthread_mutex_lock(&dst->lock);
+		dst->inbox[dst->inbox_count++] = loop;
+		pthread_mutex_unlock(&dst->lock);
+		pool_wakeup(dst);
+		pool_update_wake(w);
+	}
+}
+
+static void pool_handle(struct pool_worker *w, struct loopback *loop)
+{
+	int err;
+
+	err = pcmjob_pollfds_handle(loop, loop->pool_fds);
+	if (err < 0) {
+		logit(LOG_CRIT, "pcmjob failed.\n");
+		exit(EXIT_FAILURE);
+	}
+	err = pool_refresh(w, loop);
+	if (err < 0) {
+		logit(LOG_CRIT, "Poll FD initialization failed.\n");
+		exit(EXIT_FAILURE);
+	}
+}
+
+static void *pool_worker_job(void *data)
+{
+	struct pool_worker *w = data;
+	struct epoll_event events[POOL_EVENTS];
+	struct loopback *loop;
+	uint64_t val;
+	int i, j, idx, n, ready;
+
+	setscheduler();
+
+	while (!quit) {
+		n = epoll_wait(w->epfd, events, POOL_EVENTS, w->wake);
+		if (n < 0) {
+			if (errno == EINTR)
+				continue;
+			logit(LOG_CRIT, "Poll failed: %s\n", strerror(errno));
+			exit(EXIT_FAILURE);
+		}
+		w->mark++;
+		ready = 0;
+		for (i = 0; i < n; i++) {
+			if (events[i].data.u64 == UINT64_MAX) {
+				if (read(w->wakefd, &val, sizeof(val)) < 0)
+					val = 0;
+				continue;
+			}
+			loop = pool_loops[events[i].data.u64 >> 32];
+			idx = events[i].data.u64 & 0xffffffff;
+			if (loop->pool_mark != w->mark) {
+				loop->pool_mark = w->mark;
+				for (j = 0; j < loop->pool_fds_count; j++)
+					loop->pool_fds[j].revents = 0;
+				w->ready[ready++] = loop;
+			}
+			if (idx < loop->pool_fds_count)
+				loop->pool_fds[idx].revents = events[i].events;
+		}
+		/* on timeout (or with a wake time) service every loopback */
+		for (i = 0; i < w->loops_count; i++) {
+			loop = w->loops[i];
+			if (loop->pool_mark == w->mark)
+				continue;
+			if (n == 0 || loop->wake > 0) {
+				loop->pool_mark = w->mark;
+				for (j = 0; j < loop->pool_fds_count; j++)
+					loop->pool_fds[j].revents = 0;
+				w->ready[ready++] = loop;
+			}
+		}
+		for (i = 0; i < ready; i++)
+			pool_handle(w, w->ready[i]);
+		pool_release(w);
+		pool_adopt(w);
+	}
+	return NULL;
+}
+
+static void pool_rebalance(void)
+{
+	long load[workers_count], l, diff, best_load;
+	struct loopback *loop, *best;
+	int i, wmax, wmin, owner;
+
+	for (i = 0; i < workers_count; i++)
+		load[i] = 0;
+	for (i = 0; i < pool_loops_count; i++) {
+		loop = pool_loops[i];
+		owner = atomic_load(&loop->pool_worker);
+		/* a move is still in progress */
+		if (owner != atomic_load(&loop->pool_target))
+			return;
+		load[owner] += atomic_load(&loop->pool_load);
+	}
+	wmax = wmin = 0;
+	for (i = 1; i < workers_count; i++) {
+		if (load[i] > load[wmax])
+			wmax = i;
+		if (load[i] < load[wmin])
+			wmin = i;
+	}
+	diff = load[wmax] - load[wmin];
+	best = NULL;
+	best_load = 0;
+	if (diff >= POOL_REBALANCE_MIN) {
+		/*
+		 * Moving a loopback with load l lowers the maximum only if
+		 * l < diff, the best candidate is the one closest to diff / 2.
+		 */
+		for (i = 0; i < pool_loops_count; i++) {
+			loop = pool_loops[i];
+			if (atomic_load(&loop->pool_worker) != wmax)
+				continue;
+			l = atomic_load(&loop->pool_load);
+			if (l <= 0 || l >= diff)
+				continue;
+			if (best == NULL ||
+			    labs(diff / 2 - l) < labs(diff / 2 - best_load)) {
+				best = loop;
+				best_load = l;
+			}
+		}
+	}
+	if (verbose > 2) {
+		for (i = 0; i < workers_count; i++)
+			logit(LOG_INFO, "pool: worker %i load %lius/%ims\n", i, load[i], POOL_REBALANCE_MS);
+	}
+	for (i = 0; i < pool_loops_count; i++)
+		atomic_store(&pool_loops[i]->pool_load, 0);
+	if (best) {
+		if (verbose > 1)
+			logit(LOG_INFO, "pool: moving %s (%lius) from worker %i to %i\n", best->id, best_load, wmax, wmin);
+		atomic_store(&best->pool_target, wmin);
+		pool_wakeup(&workers[wmax]);
+	}
+}
+
+static int pool_worker_init(struct pool_worker *w, int index,
+			    snd_output_t *output)
+{
+	struct epoll_event ev;
+	int i, max = 0;
+
+	w->index = index;
+	w->output = output;
+	w->wake = -1;
+	pthread_mutex_init(&w->lock, NULL);
+	w->inbox = calloc(pool_loops_count, sizeof(struct loopback *));
+	w->loops = calloc(pool_loops_count, sizeof(struct loopback *));
+	w->ready = calloc(pool_loops_count, sizeof(struct loopback *));
+	for (i = 0; i < pool_loops_count; i++)
+		if (pool_loops[i]->pollfd_count > max)
+			max = pool_loops[i]->pollfd_count;
+	w->pfds = calloc(max, sizeof(struct pollfd));
+	if (w->inbox == NULL || w->loops == NULL || w->ready == NULL ||
+	    w->pfds == NULL)
+		return -ENOMEM;
+	w->epfd = epoll_create1(EPOLL_CLOEXEC);
+	if (w->epfd < 0)
+		return -errno;
+	w->wakefd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	if (w->wakefd < 0)
+		return -errno;
+	ev.events = EPOLLIN;
+	ev.data.u64 = UINT64_MAX;
+	if (epoll_ctl(w->epfd, EPOLL_CTL_ADD, w->wakefd, &ev) < 0)
+		return -errno;
+	return 0;
+}
+
+static void pool_worker_done(struct pool_worker *w)
+{
+	if (w->epfd >= 0)
+		close(w->epfd);
+	if (w->wakefd >= 0)
+		close(w->wakefd);
+	free(w->inbox);
+	free(w->loops);
+	free(w->ready);
+	free(w->pfds);
+	pthread_mutex_destroy(&w->lock);
+}
+
+void pool_kill(int sig)
+{
+	int i;
+
+	for (i = 0; i < workers_count; i++)
+		pthread_kill(workers[i].thread, sig);
+}
+
+void pool_state(void)
+{
+	pthread_t self = pthread_self();
+	int i, j;
+
+	for (i = 0; i < workers_count; i++) {
+		if (!pthread_equal(workers[i].thread, self))
+			continue;
+		for (j = 0; j < workers[i].loops_count; j++)
+			pcmjob_state(workers[i].loops[j]);
+	}
+}
+
+/*
+ * Run all loopbacks on a fixed number of workers (0 = number of online
+ * CPUs). Returns after quit was set and all workers finished.
+ */
+int pool_run(struct loopback **loops, int count, int nworkers,
+	     snd_output_t *output)
+{
+	struct loopback *loop;
+	struct pool_worker *w;
+	int i, err;
+
+	if (nworkers <= 0)
+		nworkers = sysconf(_SC_NPROCESSORS_ONLN);
+	if (nworkers <= 0)
+		nworkers = 1;
+	if (nworkers > count)
+		nworkers = count;
+	pool_loops = loops;
+	pool_loops_count = count;
+
+	for (i = 0; i < count; i++) {
+		loop = loops[i];
+		loop->pool = 1;
+		loop->pool_index = i;
+		err = pcmjob_init(loop);
+		if (err < 0) {
+			logit(LOG_CRIT, "Loopback initialization failure.\n");
+			return err;
+		}
+	}
+	for (i = 0; i < count; i++) {
+		loop = loops[i];
+		err = pcmjob_start(loop);
+		if (err < 0) {
+			logit(LOG_CRIT, "Loopback start failure.\n");
+			return err;
+		}
+		loop->pool_fds = calloc(loop->pollfd_count, sizeof(struct pollfd));
+		if (loop->pool_fds == NULL)
+			return -ENOMEM;
+	}
+
+	workers = calloc(nworkers, sizeof(*workers));
+	if (workers == NULL)
+		return -ENOMEM;
+	for (i = 0; i < nworkers; i++) {
+		workers[i].epfd = workers[i].wakefd = -1;
+		err = pool_worker_init(&workers[i], i, output);
+		if (err < 0) {
+			logit(LOG_CRIT, "pool: worker initialization failed: %s\n", strerror(-err));
+			return err;
+		}
+	}
+	/* initial round-robin placement */
+	for (i = 0; i < count; i++) {
+		w = &workers[i % nworkers];
+		atomic_init(&loops[i]->pool_worker, w->index);
+		atomic_init(&loops[i]->pool_target, w->index);
+		atomic_init(&loops[i]->pool_load, 0);
+		w->inbox[w->inbox_count++] = loops[i];
+	}
+	if (verbose)
+		snd_output_printf(output, "pool: %i loopbacks on %i workers\n", count, nworkers);
+	for (i = 0; i < nworkers; i++) {
+		pool_adopt(&workers[i]);
+		err = pthread_create(&workers[i].thread, NULL, pool_worker_job,
+				     &workers[i]);
+		if (err) {
+			logit(LOG_CRIT, "pool: cannot create worker: %s\n", strerror(err));
+			return -err;
+		}
+	}
+	workers_count = nworkers;
+
+	while (!quit) {
+		poll(NULL, 0, POOL_REBALANCE_MS);
+		if (!quit && nworkers > 1)
+			pool_rebalance();
+	}
+
+	for (i = 0; i < nworkers; i++)
+		pool_wakeup(&workers[i]);
+	for (i = 0; i < nworkers; i++)
+		pthread_join(workers[i].thread, NULL);
+	for (i = 0; i < count; i++) {
+		pcmjob_done(loops[i]);
+		free(loops[i]->pool_fds);
+		loops[i]->pool_fds = NULL;
+	}
+	for (i = 0; i < nworkers; i++)
+		pool_worker_done(&workers[i]);
+	workers_count = 0;
+	free(workers);
+	workers = NULL;
+	return 0;
+}
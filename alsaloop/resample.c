@@ -0,0 +1,216 @@
+/*
+ *  A simple PCM loopback utility
+ *  Built-in polyphase resampler with continuously adjustable ratio
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <math.h>
+#include <alsa/asoundlib.h>
+#include "alsaloop.h"
+
+/*
+ * Windowed sinc filter stored as RESAMPLE_PHASES + 1 sub-filters of
+ * RESAMPLE_TAPS coefficients. The input position is a 32.32 fixed point
+ * value, its fraction selects two neighbouring sub-filters which are
+ * linearly interpolated, so any ratio can be set at any time without
+ * recomputing the table.
+ */
+
+#define RESAMPLE_TAPS		32
+#define RESAMPLE_PHASES		128
+#define RESAMPLE_HISTORY	1024	/* input frames kept in float */
+
+struct resampler {
+	unsigned int channels;
+	double ratio;			/* output rate / input rate */
+	uint64_t step;			/* input advance per output frame */
+	uint64_t pos;			/* position in history, 32.32 */
+	snd_pcm_uframes_t filled;	/* frames in history */
+	float *history;			/* RESAMPLE_HISTORY * channels */
+	float *coefs;			/* (RESAMPLE_PHASES + 1) * RESAMPLE_TAPS */
+	float *acc;			/* channels */
+};
+
+static double bessel_i0(double x)
+{
+	double sum = 1.0, term = 1.0, q = x * x / 4.0;
+	int k;
+
+	for (k = 1; k < 32; k++) {
+		term *= q / ((double)k * k);
+		sum += term;
+	}
+	return sum;
+}
+
+static void resampler_make_coefs(struct resampler *r, double cutoff)
+{
+	const double beta = 8.0;
+	const double half = RESAMPLE_TAPS / 2;
+	double d, x, w, sum;
+	unsigned int p, k;
+	float *c;
+
+	for (p = 0; p <= RESAMPLE_PHASES; p++) {
+		c = r->coefs + p * RESAMPLE_TAPS;
+		sum = 0;
+		for (k = 0; k < RESAMPLE_TAPS; k++) {
+			/* distance of tap k from the output position */
+			d = (double)k - (half - 1) - (double)p / RESAMPLE_PHASES;
+			x = d / half;
+			if (x <= -1.0 || x >= 1.0)
+				w = 0;
+			else
+				w = bessel_i0(beta * sqrt(1.0 - x * x)) /
+				    bessel_i0(beta);
+			x = M_PI * cutoff * d;
+			c[k] = w * cutoff * (fabs(x) < 1e-9 ? 1.0 : sin(x) / x);
+			sum += c[k];
+		}
+		/* unity DC gain for every phase */
+		for (k = 0; k < RESAMPLE_TAPS; k++)
+			c[k] /= sum;
+	}
+}
+
+void resampler_set_ratio(struct resampler *r, double ratio)
+{
+	r->ratio = ratio;
+	r->step = (uint64_t)llround(4294967296.0 / ratio);
+}
+
+void resampler_reset(struct resampler *r)
+{
+	/*
+	 * RESAMPLE_TAPS / 2 silent frames of lead-in, the centre tap
+	 * (RESAMPLE_TAPS / 2 - 1) sits on the last of them, so the first
+	 * output frame is centred one frame before the first input frame
+	 */
+	memset(r->history, 0, RESAMPLE_HISTORY * r->channels * sizeof(float));
+	r->filled = RESAMPLE_TAPS / 2;
+	r->pos = 0;
+}
+
+int resampler_new(struct resampler **_r, unsigned int channels, double ratio)
+{
+	struct resampler *r;
+
+	r = calloc(1, sizeof(*r));
+	if (r == NULL)
+		return -ENOMEM;
+	r->channels = channels;
+	r->history = malloc(RESAMPLE_HISTORY * channels * sizeof(float));
+	r->coefs = malloc((RESAMPLE_PHASES + 1) * RESAMPLE_TAPS * sizeof(float));
+	r->acc = malloc(channels * sizeof(float));
+	if (r->history == NULL || r->coefs == NULL || r->acc == NULL) {
+		resampler_delete(r);
+		return -ENOMEM;
+	}
+	/*
+	 * The cutoff follows the nominal ratio, pitch corrections later
+	 * on are small enough to share the table.
+	 */
+	resampler_make_coefs(r, 0.95 * (ratio < 1.0 ? ratio : 1.0));
+	resampler_set_ratio(r, ratio);
+	resampler_reset(r);
+	*_r = r;
+	return 0;
+}
+
+void resampler_delete(struct resampler *r)
+{
+	if (r == NULL)
+		return;
+	free(r->history);
+	free(r->coefs);
+	free(r->acc);
+	free(r);
+}
+
+static inline void resampler_frame(struct resampler *r, float *out)
+{
+	unsigned int channels = r->channels;
+	const float *in = r->history + (r->pos >> 32) * channels;
+	uint32_t frac = r->pos;
+	unsigned int phase = frac >> (32 - 7);	/* RESAMPLE_PHASES == 1 << 7 */
+	float a = (float)(frac & ((1U << (32 - 7)) - 1)) / (1U << (32 - 7));
+	const float *c0 = r->coefs + phase * RESAMPLE_TAPS;
+	const float *c1 = c0 + RESAMPLE_TAPS;
+	float *acc = r->acc;
+	float h;
+	unsigned int k, ch;
+
+	for (ch = 0; ch < channels; ch++)
+		acc[ch] = 0;
+	for (k = 0; k < RESAMPLE_TAPS; k++, in += channels) {
+		h = c0[k] + (c1[k] - c0[k]) * a;
+		for (ch = 0; ch < channels; ch++)
+			acc[ch] += h * in[ch];
+	}
+	memcpy(out, acc, channels * sizeof(float));
+}
+
+/*
+ * Convert up to in_frames interleaved frames with to_float into the
+ * history and produce at most *out_frames frames. Returns the number of
+ * consumed input frames, *out_frames is updated to the produced count.
+ */
+snd_pcm_uframes_t resampler_process(struct resampler *r,
+				    const void *in,
+				    snd_pcm_uframes_t in_frames,
+				    unsigned int in_frame_size,
+				    convert_to_float_t to_float,
+				    float *out,
+				    snd_pcm_uframes_t *out_frames)
+{
+	unsigned int channels = r->channels;
+	snd_pcm_uframes_t used = 0, produced = 0, idx, count;
+
+	while (produced < *out_frames) {
+		idx = r->pos >> 32;
+		if (idx + RESAMPLE_TAPS <= r->filled) {
+			resampler_frame(r, out + produced * channels);
+			produced++;
+			r->pos += r->step;
+			continue;
+		}
+		if (used >= in_frames)
+			break;
+		/* drop the frames no longer needed and refill */
+		if (idx > 0) {
+			if (idx > r->filled)
+				idx = r->filled;
+			memmove(r->history, r->history + idx * channels,
+				(r->filled - idx) * channels * sizeof(float));
+			r->filled -= idx;
+			r->pos -= (uint64_t)idx << 32;
+		}
+		count = RESAMPLE_HISTORY - r->filled;
+		if (count > in_frames - used)
+			count = in_frames - used;
+		to_float((const char *)in + used * in_frame_size,
+			 r->history + r->filled * channels, count * channels);
+		r->filled += count;
+		used += count;
+	}
+	*out_frames = produced;
+	return used;
+}
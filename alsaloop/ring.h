@@ -0,0 +1,170 @@
+/*
+ *  A simple PCM loopback utility
+ *  Lock-free single producer / single consumer frame ring
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#ifndef __ALSALOOP_RING_H
+#define __ALSALOOP_RING_H
+
+#include <stdlib.h>
+#include <errno.h>
+#include <stdatomic.h>
+
+#define RING_CACHELINE	64
+
+/*
+ * The producer owns 'head', the consumer owns 'tail'. Both are free running
+ * frame counters, the position in the buffer is the counter modulo size.
+ * Each side keeps a private copy of the other side's counter, so the shared
+ * cache line is touched only when the cached value does not satisfy the
+ * request.
+ */
+struct loopback_ring {
+	char *buf;
+	snd_pcm_uframes_t size;		/* in frames */
+	unsigned int frame_size;
+	struct {
+		atomic_ulong head;
+		unsigned long tail_cache;
+	} prod __attribute__((aligned(RING_CACHELINE)));
+	struct {
+		atomic_ulong tail;
+		unsigned long head_cache;
+	} cons __attribute__((aligned(RING_CACHELINE)));
+};
+
+static inline int ring_new(struct loopback_ring **_ring,
+			   unsigned int frame_size,
+			   snd_pcm_uframes_t size)
+{
+	struct loopback_ring *ring;
+
+	/* calloc() does not honour the cache line alignment */
+	if (posix_memalign((void **)&ring, RING_CACHELINE, sizeof(*ring)))
+		return -ENOMEM;
+	ring->buf = calloc(size, frame_size);
+	if (ring->buf == NULL) {
+		free(ring);
+		return -ENOMEM;
+	}
+	ring->size = size;
+	ring->frame_size = frame_size;
+	atomic_init(&ring->prod.head, 0);
+	atomic_init(&ring->cons.tail, 0);
+	ring->prod.tail_cache = 0;
+	ring->cons.head_cache = 0;
+	*_ring = ring;
+	return 0;
+}
+
+static inline void ring_delete(struct loopback_ring *ring)
+{
+	if (ring == NULL)
+		return;
+	free(ring->buf);
+	free(ring);
+}
+
+/* may be called from any thread, the result is a snapshot */
+static inline snd_pcm_uframes_t ring_count(struct loopback_ring *ring)
+{
+	unsigned long tail = atomic_load_explicit(&ring->cons.tail,
+						  memory_order_acquire);
+	unsigned long head = atomic_load_explicit(&ring->prod.head,
+						  memory_order_acquire);
+	return head - tail;
+}
+
+/* total number of frames produced so far (capture counter) */
+static inline unsigned long ring_produced(struct loopback_ring *ring)
+{
+	return atomic_load_explicit(&ring->prod.head, memory_order_acquire);
+}
+
+/* producer: contiguous free space starting at *ptr */
+static inline snd_pcm_uframes_t ring_write_begin(struct loopback_ring *ring,
+						 char **ptr)
+{
+	unsigned long head = atomic_load_explicit(&ring->prod.head,
+						  memory_order_relaxed);
+	snd_pcm_uframes_t pos, count;
+
+	if (head - ring->prod.tail_cache >= ring->size)
+		ring->prod.tail_cache =
+			atomic_load_explicit(&ring->cons.tail,
+					     memory_order_acquire);
+	count = ring->size - (head - ring->prod.tail_cache);
+	pos = head % ring->size;
+	if (count > ring->size - pos)
+		count = ring->size - pos;
+	*ptr = ring->buf + pos * ring->frame_size;
+	return count;
+}
+
+static inline void ring_write_commit(struct loopback_ring *ring,
+				     snd_pcm_uframes_t frames)
+{
+	unsigned long head = atomic_load_explicit(&ring->prod.head,
+						  memory_order_relaxed);
+	atomic_store_explicit(&ring->prod.head, head + frames,
+			      memory_order_release);
+}
+
+/* consumer: contiguous filled space starting at *ptr */
+static inline snd_pcm_uframes_t ring_read_begin(struct loopback_ring *ring,
+						char **ptr)
+{
+	unsigned long tail = atomic_load_explicit(&ring->cons.tail,
+						  memory_order_relaxed);
+	snd_pcm_uframes_t pos, count;
+
+	/* ring_read_skip() may move tail past the cached head */
+	if ((long)(ring->cons.head_cache - tail) <= 0)
+		ring->cons.head_cache =
+			atomic_load_explicit(&ring->prod.head,
+					     memory_order_acquire);
+	count = ring->cons.head_cache - tail;
+	pos = tail % ring->size;
+	if (count > ring->size - pos)
+		count = ring->size - pos;
+	*ptr = ring->buf + pos * ring->frame_size;
+	return count;
+}
+
+static inline void ring_read_commit(struct loopback_ring *ring,
+				    snd_pcm_uframes_t frames)
+{
+	unsigned long tail = atomic_load_explicit(&ring->cons.tail,
+						  memory_order_relaxed);
+	atomic_store_explicit(&ring->cons.tail, tail + frames,
+			      memory_order_release);
+}
+
+/* consumer: drop up to frames queued frames */
+static inline snd_pcm_uframes_t ring_read_skip(struct loopback_ring *ring,
+					       snd_pcm_uframes_t frames)
+{
+	snd_pcm_uframes_t count = ring_count(ring);
+
+	if (frames > count)
+		frames = count;
+	ring_read_commit(ring, frames);
+	return frames;
+}
+
+#endif
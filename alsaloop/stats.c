@@ -0,0 +1,249 @@
+/*
+ *  A simple PCM loopback utility
+ *  Statistics export through a local (unix) socket
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+/*
+ * Every connection to the socket gets one JSON document with a snapshot
+ * of all loopbacks, then the socket is closed. The snapshot is built by
+ * a separate thread from the relaxed atomic counters, the audio threads
+ * are never blocked by a slow reader.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <errno.h>
+#include <unistd.h>
+#include <signal.h>
+#include <syslog.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <alsa/asoundlib.h>
+#include "alsaloop.h"
+
+#define OUT(args...) \
+	snd_output_printf(out, ##args)
+
+static struct loopback **stats_loops;
+static int stats_count;
+static int stats_fd = -1;
+static char *stats_path;
+static pthread_t stats_thread;
+
+static unsigned long long ld_ull(atomic_ullong *v)
+{
+	return atomic_load_explicit(v, memory_order_relaxed);
+}
+
+static unsigned long ld_ul(atomic_ulong *v)
+{
+	return atomic_load_explicit(v, memory_order_relaxed);
+}
+
+static long ld_l(atomic_long *v)
+{
+	return atomic_load_explicit(v, memory_order_relaxed);
+}
+
+static void dump_string(snd_output_t *out, const char *str)
+{
+	OUT("\"");
+	for (; *str; str++) {
+		if (*str == '"' || *str == '\\')
+			OUT("\\%c", *str);
+		else if ((unsigned char)*str < 0x20)
+			OUT("\\u%04x", *str);
+		else
+			OUT("%c", *str);
+	}
+	OUT("\"");
+}
+
+static void dump_hist(snd_output_t *out, atomic_ulong *hist)
+{
+	int i;
+
+	OUT("[");
+	for (i = 0; i < STATS_HIST_BUCKETS; i++)
+		OUT("%s%lu", i ? "," : "", ld_ul(&hist[i]));
+	OUT("]");
+}
+
+static void dump_handle(snd_output_t *out, struct loopback_handle *lhandle)
+{
+	OUT("{\"id\":");
+	dump_string(out, lhandle->id);
+	OUT(",\"frames\":%llu,\"xruns\":%lu,\"queued\":%li}",
+	    ld_ull(&lhandle->stats.frames), ld_ul(&lhandle->stats.xruns),
+	    ld_l(&lhandle->stats.queued));
+}
+
+static void dump_loop(snd_output_t *out, struct loopback *loop)
+{
+	struct loopback_stats *stats = &loop->stats;
+	unsigned long long bits = ld_ull(&stats->pitch);
+	double pitch;
+
+	memcpy(&pitch, &bits, sizeof(pitch));
+	OUT("{\"id\":");
+	dump_string(out, loop->id);
+	OUT(",\"running\":%i,\"latency\":%lu",
+	    atomic_load(&stats->running), ld_ul(&stats->latency));
+	/* JSON has no representation of NaN or infinity */
+	if (isfinite(pitch))
+		OUT(",\"pitch\":%.8f", pitch);
+	else
+		OUT(",\"pitch\":null");
+	OUT(",\"pitch_diff\":%li,\"pitch_diff_min\":%li,\"pitch_diff_max\":%li",
+	    ld_l(&stats->pitch_diff), ld_l(&stats->pitch_diff_min),
+	    ld_l(&stats->pitch_diff_max));
+	OUT(",\"playback\":");
+	dump_handle(out, loop->play);
+	OUT(",\"capture\":");
+	dump_handle(out, loop->capt);
+	OUT(",\"proctime_max_us\":%li,\"proctime_us\":",
+	    ld_l(&stats->proctime_max));
+	dump_hist(out, stats->proctime);
+	OUT(",\"wakeup_latency_us\":");
+	dump_hist(out, stats->wakeup);
+	OUT("}");
+}
+
+static void dump(snd_output_t *out)
+{
+	int i;
+
+	OUT("{\"version\":1,\"histogram_bounds_us\":[");
+	for (i = 0; i < STATS_HIST_BUCKETS - 1; i++)
+		OUT("%s%li", i ? "," : "", 1L << i);
+	OUT("],\"loopbacks\":[");
+	for (i = 0; i < stats_count; i++) {
+		if (i)
+			OUT(",");
+		dump_loop(out, stats_loops[i]);
+	}
+	OUT("]}\n");
+}
+
+static void send_all(int fd, const char *buf, size_t size)
+{
+	ssize_t r;
+
+	while (size > 0) {
+		r = send(fd, buf, size, MSG_NOSIGNAL);
+		if (r < 0) {
+			if (errno == EINTR)
+				continue;
+			return;
+		}
+		buf += r;
+		size -= r;
+	}
+}
+
+static void *stats_job(void *data)
+{
+	snd_output_t *out;
+	char *buf;
+	size_t size;
+	int fd;
+
+	if (snd_output_buffer_open(&out) < 0) {
+		logit(LOG_CRIT, "Stats output allocation failed.\n");
+		return NULL;
+	}
+	for (;;) {
+		fd = accept(stats_fd, NULL, NULL);
+		if (fd < 0) {
+			if (errno == EINTR || errno == ECONNABORTED)
+				continue;
+			logit(LOG_WARNING, "Stats socket accept failed: %s\n", strerror(errno));
+			break;
+		}
+		snd_output_flush(out);
+		dump(out);
+		size = snd_output_buffer_string(out, &buf);
+		send_all(fd, buf, size);
+		close(fd);
+	}
+	snd_output_close(out);
+	return NULL;
+}
+
+static void stats_cleanup(void)
+{
+	if (stats_path)
+		unlink(stats_path);
+}
+
+int stats_start(const char *path, struct loopback **loops, int count)
+{
+	struct sockaddr_un addr;
+	sigset_t mask, omask;
+	int i, err;
+
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	if (strlen(path) >= sizeof(addr.sun_path)) {
+		logit(LOG_CRIT, "Stats socket path '%s' is too long\n", path);
+		return -ENAMETOOLONG;
+	}
+	strcpy(addr.sun_path, path);
+	stats_path = strdup(path);
+	if (stats_path == NULL)
+		return -ENOMEM;
+	stats_fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	if (stats_fd < 0) {
+		err = -errno;
+		goto __error;
+	}
+	/* a stale socket from a previous run */
+	unlink(path);
+	if (bind(stats_fd, (struct sockaddr *)&addr, sizeof(addr)) < 0 ||
+	    listen(stats_fd, 4) < 0) {
+		err = -errno;
+		goto __error;
+	}
+	atexit(stats_cleanup);
+	stats_loops = loops;
+	stats_count = count;
+	for (i = 0; i < count; i++)
+		loops[i]->stats_enabled = 1;
+	/* the signals are meant for the loopback threads */
+	sigfillset(&mask);
+	pthread_sigmask(SIG_BLOCK, &mask, &omask);
+	err = -pthread_create(&stats_thread, NULL, stats_job, NULL);
+	pthread_sigmask(SIG_SETMASK, &omask, NULL);
+	if (err < 0)
+		goto __error;
+	pthread_detach(stats_thread);
+	if (verbose)
+		logit(LOG_INFO, "Statistics are available at %s\n", path);
+	return 0;
+      __error:
+	logit(LOG_CRIT, "Unable to create stats socket %s: %s\n", path, strerror(-err));
+	if (stats_fd >= 0)
+		close(stats_fd);
+	stats_fd = -1;
+	free(stats_path);
+	stats_path = NULL;
+	return err;
+}
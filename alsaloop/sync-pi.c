@@ -0,0 +1,132 @@
+/*
+ *  A simple PCM loopback utility
+ *  Controllers for the drift compensation
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+/*
+ * The caller samples the number of queued frames (capture delay, buffered
+ * frames and playback delay, both delays moved to a common instant using
+ * the status timestamps) at every wakeup. Once per window a least squares
+ * line is fitted through the samples: the slope is the residual rate
+ * error of the currently applied pitch, the value at the window end is
+ * the fill error.
+ *
+ * The rate ratio estimate is a low-pass filter of the measured rate
+ * (applied correction + residual), the PI terms on the fill error bring
+ * the latency back to the requested value and absorb a non-unity gain of
+ * the actuator.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include <alsa/asoundlib.h>
+#include "alsaloop.h"
+
+#define PI_KP		(1.0 / 2.0)	/* 1/s, fill error time constant 2s */
+#define PI_KI		(PI_KP * PI_KP / 4.0)	/* critically damped */
+#define PI_ALPHA	0.25		/* rate estimate filter */
+#define PI_MAX		0.01		/* maximal correction (1%) */
+#define PI_MIN_SAMPLES	4
+
+void sync_pi_init(struct sync_pi *pi, double rate, double target)
+{
+	memset(pi, 0, sizeof(*pi));
+	pi->rate = rate;
+	pi->target = target;
+}
+
+/* drop the collected samples, the fill level jumped (xrun) */
+void sync_pi_restart(struct sync_pi *pi)
+{
+	pi->n = 0;
+}
+
+void sync_pi_sample(struct sync_pi *pi, double t, double fill)
+{
+	if (pi->n == 0) {
+		pi->t0 = t;
+		pi->sx = pi->sy = pi->sxx = pi->sxy = 0;
+	}
+	t -= pi->t0;
+	pi->sx += t;
+	pi->sy += fill;
+	pi->sxx += t * t;
+	pi->sxy += t * fill;
+	pi->tn = t;
+	pi->n++;
+}
+
+/* returns 1 when a new pitch was computed */
+int sync_pi_update(struct sync_pi *pi, double *pitch, double *error)
+{
+	double n = pi->n, den, slope, fill, e, corr;
+
+	if (pi->n < PI_MIN_SAMPLES)
+		return 0;
+	den = n * pi->sxx - pi->sx * pi->sx;
+	if (den <= 0)
+		return 0;
+	slope = (n * pi->sxy - pi->sx * pi->sy) / den;
+	fill = (pi->sy - slope * pi->sx) / n + slope * pi->tn;
+	e = fill - pi->target;
+	/* true rate ratio = applied correction + residual */
+	corr = pi->prop + slope / pi->rate;
+	if (!pi->locked) {
+		pi->ratio += corr;
+		pi->locked = 1;
+	} else {
+		pi->ratio += PI_ALPHA * corr;
+	}
+	if (pi->ratio > PI_MAX)
+		pi->ratio = PI_MAX;
+	else if (pi->ratio < -PI_MAX)
+		pi->ratio = -PI_MAX;
+	pi->prop = (PI_KP * e + PI_KI * pi->integ) / pi->rate;
+	/* anti-windup: integrate only when the output is not saturated */
+	if (fabs(pi->ratio + pi->prop) < PI_MAX)
+		pi->integ += e * pi->tn;
+	else
+		pi->prop = copysign(PI_MAX, pi->ratio + pi->prop) - pi->ratio;
+	*pitch = 1.0 + pi->ratio + pi->prop;
+	*error = e;
+	pi->n = 0;
+	return 1;
+}
+
+/*
+ * The simple algorithm: diff is the average fill error over the sync
+ * period, the pitch steps towards the requested fill, twice as fast while
+ * the error grows.
+ */
+double sync_simple_update(double pitch, double delta, long diff,
+			  long last_diff)
+{
+	if (diff > 0) {
+		if (diff == last_diff)
+			pitch += delta;
+		else if (diff > last_diff)
+			pitch += delta * 2;
+	} else if (diff < 0) {
+		if (diff == last_diff)
+			pitch -= delta;
+		else if (diff < last_diff)
+			pitch -= delta * 2;
+	}
+	return pitch;
+}
@@ -0,0 +1,340 @@
+/*
+ *  A simple PCM loopback utility
+ *  Offline simulation of the drift compensation with two drifting clocks
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ *  Build with "make sync-sim". The capture and playback hardware pointers
+ *  advance by periods at slightly different rates, the loop thread wakes
+ *  up with a random delay after each playback period, moves everything
+ *  through an ideal resampler (ratio = 1 / pitch) and samples the delays
+ *  the way pcmjob.c does. Both the simple and the PI algorithm are run on
+ *  the same clocks, the fill error of the real (continuous) positions is
+ *  reported. The exit status is non-zero when an algorithm does not lock,
+ *  causes an xrun, or its fill error in the second half exceeds the bounds
+ *  of the mean (drift) or of the deviation around it (jitter).
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <getopt.h>
+#include <math.h>
+#include <alsa/asoundlib.h>
+#include "alsaloop.h"
+
+struct sim {
+	/* parameters */
+	double rate;
+	double capt_drift, play_drift;	/* ppm */
+	unsigned int capt_period, play_period;
+	double latency;			/* frames */
+	double jitter;			/* max. wakeup delay in us */
+	double irq;			/* max. pointer timestamp delay in us */
+	double offset;			/* initial fill error in frames */
+	double seconds;
+	unsigned int seed;
+	double max_drift;		/* bound of the mean error in frames */
+	double max_jitter;		/* bound of the deviation in frames */
+	int pi;
+	/* state */
+	double t;
+	double capt_read;		/* frames read by the application */
+	double play_written;		/* frames written, playback domain */
+	double pitch;
+	unsigned long xruns;
+	/* simple algorithm */
+	double total_queued;
+	unsigned int total_queued_count;
+	double counter;
+	long pitch_diff;
+	/* results */
+	double lock_time;
+	double err_sum, err_sum2, err_max;
+	unsigned long err_count;
+};
+
+static unsigned int sim_random(struct sim *sim)
+{
+	sim->seed = sim->seed * 1103515245 + 12345;
+	return (sim->seed >> 16) & 0x7fff;
+}
+
+static double capt_rate(struct sim *sim)
+{
+	return sim->rate * (1 + sim->capt_drift / 1e6);
+}
+
+static double play_rate(struct sim *sim)
+{
+	return sim->rate * (1 + sim->play_drift / 1e6);
+}
+
+/* hardware pointer (period granularity) and the time of its update */
+static double hw_ptr(double rate, unsigned int period, double t, double *ts)
+{
+	double periods = floor(t * rate / period);
+
+	*ts = periods * period / rate;
+	return periods * period;
+}
+
+static void sync_simple(struct sim *sim)
+{
+	long diff;
+	double delta = 1.0 / (sim->rate * 4);	/* pitch_delta in pcmjob.c */
+
+	diff = sim->total_queued / sim->total_queued_count - sim->latency;
+	sim->pitch = sync_simple_update(sim->pitch, delta, diff,
+					sim->pitch_diff);
+	sim->pitch_diff = diff;
+	sim->total_queued = 0;
+	sim->total_queued_count = 0;
+}
+
+static void run(struct sim *sim)
+{
+	struct sync_pi pi;
+	double period_time = sim->play_period / play_rate(sim);
+	double next = period_time, t_capt, t_play, cptr, pptr;
+	double cdelay, pdelay, fill, err, frames, pitch, error;
+	unsigned int sync_point = sim->pi ? sim->rate : sim->rate * 15;
+
+	sync_pi_init(&pi, sim->rate, sim->latency);
+	sim->t = 0;
+	sim->capt_read = 0;
+	sim->play_written = sim->latency + sim->offset;	/* silence */
+	sim->pitch = 1.0;
+	sim->lock_time = -1;
+	while (sim->t < sim->seconds) {
+		sim->t = next + sim->jitter * sim_random(sim) / 32768.0 / 1e6;
+		next += period_time;
+		/* the continuous positions, for the error measurement */
+		err = sim->play_written - sim->t * play_rate(sim) +
+		      (sim->t * capt_rate(sim) - sim->capt_read) / sim->pitch -
+		      sim->latency;
+		if (sim->t > sim->seconds / 2) {
+			sim->err_sum += err;
+			sim->err_sum2 += err * err;
+			sim->err_count++;
+			if (fabs(err) > sim->err_max)
+				sim->err_max = fabs(err);
+		}
+		/* locked = within 1ms */
+		if (fabs(err) > sim->rate / 1000) {
+			sim->lock_time = -1;
+		} else if (sim->lock_time < 0) {
+			sim->lock_time = sim->t;
+		}
+		/* transfer */
+		cptr = hw_ptr(capt_rate(sim), sim->capt_period, sim->t, &t_capt);
+		pptr = hw_ptr(play_rate(sim), sim->play_period, sim->t, &t_play);
+		frames = cptr - sim->capt_read;
+		sim->capt_read = cptr;
+		sim->play_written += frames / sim->pitch;
+		sim->counter += frames;
+		if (sim->play_written < pptr) {
+			sim->xruns++;
+			sim->play_written = pptr + sim->latency;
+		}
+		/* measure */
+		pdelay = sim->play_written - pptr;
+		cdelay = 0;
+		/* period granular drivers timestamp in the interrupt */
+		t_capt += sim->irq * sim_random(sim) / 32768.0 / 1e6;
+		t_play += sim->irq * sim_random(sim) / 32768.0 / 1e6;
+		if (t_capt > sim->t)
+			t_capt = sim->t;
+		if (t_play > sim->t)
+			t_play = sim->t;
+		if (sim->pi) {
+			pdelay -= (sim->t - t_play) * sim->rate;
+			cdelay += (sim->t - t_capt) * sim->rate;
+		}
+		fill = pdelay + cdelay;
+		if (sim->pi) {
+			sync_pi_sample(&pi, sim->t, fill);
+		} else {
+			sim->total_queued += fill;
+			sim->total_queued_count++;
+		}
+		if (sim->counter >= sync_point) {
+			sim->counter -= sync_point;
+			if (!sim->pi)
+				sync_simple(sim);
+			else if (sync_pi_update(&pi, &pitch, &error))
+				sim->pitch = pitch;
+		}
+	}
+}
+
+static void help(void)
+{
+	printf(
+"Usage: sync-sim [OPTION]...\n\n"
+"-h,--help      help\n"
+"-r,--rate      nominal rate (48000)\n"
+"-c,--cdrift    capture clock drift in ppm (100)\n"
+"-p,--pdrift    playback clock drift in ppm (-50)\n"
+"-C,--cperiod   capture period in frames (256)\n"
+"-P,--pperiod   playback period in frames (441)\n"
+"-l,--latency   requested latency in frames (2048)\n"
+"-j,--jitter    maximal wakeup delay in us (1000)\n"
+"-i,--irq       maximal pointer timestamp delay in us (100)\n"
+"-o,--offset    initial fill error in frames (256)\n"
+"-s,--seconds   simulated time (300)\n"
+"-S,--seed      random seed\n"
+"-a,--algorithm simple or pi (both)\n"
+"-D,--max-drift bound of the mean fill error in frames (rate / 1000)\n"
+"-J,--max-jitter bound of the fill error deviation in frames (rate / 10000)\n"
+);
+}
+
+int main(int argc, char *argv[])
+{
+	struct option long_option[] =
+	{
+		{"help", 0, NULL, 'h'},
+		{"rate", 1, NULL, 'r'},
+		{"cdrift", 1, NULL, 'c'},
+		{"pdrift", 1, NULL, 'p'},
+		{"cperiod", 1, NULL, 'C'},
+		{"pperiod", 1, NULL, 'P'},
+		{"latency", 1, NULL, 'l'},
+		{"jitter", 1, NULL, 'j'},
+		{"irq", 1, NULL, 'i'},
+		{"offset", 1, NULL, 'o'},
+		{"seconds", 1, NULL, 's'},
+		{"seed", 1, NULL, 'S'},
+		{"algorithm", 1, NULL, 'a'},
+		{"max-drift", 1, NULL, 'D'},
+		{"max-jitter", 1, NULL, 'J'},
+		{NULL, 0, NULL, 0},
+	};
+	struct sim base, sim;
+	double mean, dev;
+	int first = 0, last = 1;
+	int failed = 0;
+	int c;
+
+	memset(&base, 0, sizeof(base));
+	base.rate = 48000;
+	base.capt_drift = 100;
+	base.play_drift = -50;
+	base.capt_period = 256;
+	base.play_period = 441;
+	base.latency = 2048;
+	base.jitter = 1000;
+	base.irq = 100;
+	base.offset = 256;
+	base.seconds = 300;
+	base.seed = 1;
+	base.max_drift = -1;
+	base.max_jitter = -1;
+	while ((c = getopt_long(argc, argv, "hr:c:p:C:P:l:j:i:o:s:S:a:D:J:",
+				long_option, NULL)) >= 0) {
+		switch (c) {
+		case 'h':
+			help();
+			return EXIT_SUCCESS;
+		case 'r':
+			base.rate = atof(optarg);
+			break;
+		case 'c':
+			base.capt_drift = atof(optarg);
+			break;
+		case 'p':
+			base.play_drift = atof(optarg);
+			break;
+		case 'C':
+			base.capt_period = atoi(optarg);
+			break;
+		case 'P':
+			base.play_period = atoi(optarg);
+			break;
+		case 'l':
+			base.latency = atof(optarg);
+			break;
+		case 'j':
+			base.jitter = atof(optarg);
+			break;
+		case 'i':
+			base.irq = atof(optarg);
+			break;
+		case 'o':
+			base.offset = atof(optarg);
+			break;
+		case 's':
+			base.seconds = atof(optarg);
+			break;
+		case 'S':
+			base.seed = atoi(optarg);
+			break;
+		case 'a':
+			if (strcasecmp(optarg, "simple") == 0) {
+				first = last = 0;
+			} else if (strcasecmp(optarg, "pi") == 0) {
+				first = last = 1;
+			} else {
+				help();
+				return EXIT_FAILURE;
+			}
+			break;
+		case 'D':
+			base.max_drift = atof(optarg);
+			break;
+		case 'J':
+			base.max_jitter = atof(optarg);
+			break;
+		default:
+			help();
+			return EXIT_FAILURE;
+		}
+	}
+	if (base.rate <= 0 || base.capt_period == 0 || base.play_period == 0) {
+		help();
+		return EXIT_FAILURE;
+	}
+	if (base.max_drift < 0)
+		base.max_drift = base.rate / 1000;
+	if (base.max_jitter < 0)
+		base.max_jitter = base.rate / 10000;
+	printf("rate %.0f, drift %+.1f/%+.1f ppm, periods %u/%u, latency %.0f%+.0f, jitter %.0f/%.0fus\n",
+	       base.rate, base.capt_drift, base.play_drift,
+	       base.capt_period, base.play_period, base.latency,
+	       base.offset, base.jitter, base.irq);
+	printf("true ratio %.8f\n", (1 + base.capt_drift / 1e6) /
+				    (1 + base.play_drift / 1e6));
+	for (c = first; c <= last; c++) {
+		sim = base;
+		sim.pi = c;
+		run(&sim);
+		mean = sim.err_count ? sim.err_sum / sim.err_count : 0;
+		dev = sim.err_count ? sim.err_sum2 / sim.err_count - mean * mean : 0;
+		dev = dev > 0 ? sqrt(dev) : 0;
+		printf("%-6s: lock %7.1fs, pitch %.8f, error mean %8.2f rms %8.2f max %8.1f frames, xruns %lu\n",
+		       c ? "pi" : "simple", sim.lock_time, sim.pitch, mean,
+		       sim.err_count ? sqrt(sim.err_sum2 / sim.err_count) : 0,
+		       sim.err_max, sim.xruns);
+		if (sim.lock_time < 0 || sim.xruns > 0 ||
+		    fabs(mean) > sim.max_drift || dev > sim.max_jitter) {
+			printf("%-6s: out of bounds (drift %.2f, jitter %.2f frames)\n",
+			       c ? "pi" : "simple", sim.max_drift,
+			       sim.max_jitter);
+			failed = 1;
+		}
+	}
+	return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -40,10 +40,12 @@
 #include <limits.h>
 #include <time.h>
 #include <locale.h>
+#include <math.h>
 #include <alsa/asoundlib.h>
 #include <assert.h>
 #include <termios.h>
 #include <signal.h>
+#include <pthread.h>
 #include <sys/poll.h>
 #include <sys/uio.h>
 #include <sys/time.h>
@@ -52,6 +54,7 @@
 #include <endian.h>
 #include "gettext.h"
 #include "formats.h"
+#include "peak.h"
 #include "version.h"
 
 #ifdef SND_CHMAP_API_VERSION
@@ -89,9 +92,12 @@ static snd_pcm_sframes_t (*writen_func)(snd_pcm_t *handle, void **bufs, snd_pcm_
 enum {
 	VUMETER_NONE,
 	VUMETER_MONO,
-	VUMETER_STEREO
+	VUMETER_STEREO,
+	VUMETER_MULTI
 };
 
+#define VUMETER_MULTI_MAX	72	/* channels in a line */
+
 static char *command;
 static snd_pcm_t *handle;
 static struct {
@@ -137,6 +143,7 @@ static int use_strftime = 0;
 volatile static int recycle_capture_file = 0;
 static long term_c_lflag = -1;
 static int dump_hw_params = 0;
+static int read_ahead_time = 0;
 
 static int fd = -1;
 static off64_t pbrec_count = LLONG_MAX, fdcount;
@@ -225,7 +232,7 @@ _("Usage: %s [OPTION]... [FILE]...\n"
 "                        (relative to buffer size if <= 0)\n"
 "-T, --stop-delay=#      delay for automatic PCM stop is # microseconds from xrun\n"
 "-v, --verbose           show PCM structure and setup (accumulative)\n"
-"-V, --vumeter=TYPE      enable VU meter (TYPE: mono or stereo)\n"
+"-V, --vumeter=TYPE      enable VU meter (TYPE: mono, stereo or multi)\n"
 "-I, --separate-channels one file for each channel\n"
 "-i, --interactive       allow interactive operation from stdin\n"
 "-m, --chmap=ch1,ch2,..  Give the channel map to override or follow\n"
@@ -243,6 +250,7 @@ _("Usage: %s [OPTION]... [FILE]...\n"
 "    --use-strftime      apply the strftime facility to the output file name\n"
 "    --dump-hw-params    dump hw_params of the device\n"
 "    --fatal-errors      treat all errors as fatal\n"
+"    --read-ahead=#      read the file for playback # seconds ahead in a thread\n"
   )
 		, command);
 	printf(_("Recognized sample formats are:"));
@@ -429,6 +437,7 @@ enum {
 	OPT_USE_STRFTIME,
 	OPT_DUMP_HWPARAMS,
 	OPT_FATAL_ERRORS,
+	OPT_READ_AHEAD,
 };
 
 /*
@@ -516,6 +525,7 @@ int main(int argc, char *argv[])
 		{"interactive", 0, 0, 'i'},
 		{"dump-hw-params", 0, 0, OPT_DUMP_HWPARAMS},
 		{"fatal-errors", 0, 0, OPT_FATAL_ERRORS},
+		{"read-ahead", 1, 0, OPT_READ_AHEAD},
 #ifdef CONFIG_SUPPORT_CHMAP
 		{"chmap", 1, 0, 'm'},
 #endif
@@ -728,6 +738,8 @@ int main(int argc, char *argv[])
 		case 'V':
 			if (*optarg == 's')
 				vumeter = VUMETER_STEREO;
+			else if (strncmp(optarg, "mu", 2) == 0)
+				vumeter = VUMETER_MULTI;
 			else if (*optarg == 'm')
 				vumeter = VUMETER_MONO;
 			else
@@ -799,6 +811,17 @@ int main(int argc, char *argv[])
 		case OPT_FATAL_ERRORS:
 			fatal_errors = 1;
 			break;
+		case OPT_READ_AHEAD:
+			read_ahead_time = parse_long(optarg, &err);
+			if (err < 0) {
+				error(_("invalid read ahead argument '%s'"), optarg);
+				return 1;
+			}
+			if (read_ahead_time < 0 || read_ahead_time > 3600) {
+				error(_("value %i for read ahead is invalid"), read_ahead_time);
+				return 1;
+			}
+			break;
 #ifdef CONFIG_SUPPORT_CHMAP
 		case 'm':
 			channel_map = snd_pcm_chmap_parse_string(optarg);
@@ -1469,6 +1492,16 @@ static void set_params(void)
 		if (hwparams.channels != 2 || !interleaved || verbose > 2)
 			vumeter = VUMETER_MONO;
 	}
+	/* ...neither multi-channel one */
+	if (vumeter == VUMETER_MULTI) {
+		if (hwparams.channels > VUMETER_MULTI_MAX || !interleaved || verbose > 2)
+			vumeter = VUMETER_MONO;
+	}
+	if (vumeter && peak_init(hwparams.format) < 0) {
+		fprintf(stderr, _("Unsupported sample format %s for VU meter.\n"),
+			snd_pcm_format_name(hwparams.format));
+		vumeter = VUMETER_NONE;
+	}
 
 	/* show mmap buffer arragment */
 	if (mmap_flag && verbose) {
@@ -1752,147 +1785,111 @@ static void print_vu_meter_stereo(int *perc, int *maxperc)
 	fputs(line, stderr);
 }
 
-static void print_vu_meter(signed int *perc, signed int *maxperc)
+/* one field for each channel; '#' up to RMS, '=' up to peak, '+' for max */
+static void print_vu_meter_multi(int *perc, int *rms, int *maxperc,
+				 int channels)
 {
-	if (vumeter == VUMETER_STEREO)
+	const int bar_length = VUMETER_MULTI_MAX;
+	static const char levels[] = " .:-=+*#";
+	char line[80];
+	int width = bar_length / channels - 1;
+	int separate = channels * 2 <= bar_length;
+	int c, p, q, pos = 0;
+
+	for (c = 0; c < channels; c++) {
+		if (width < 2) {
+			/* too narrow for a bar, only the level of peak */
+			if (maxperc[c] > 99)
+				line[pos++] = '!';
+			else
+				line[pos++] = levels[perc[c] * (sizeof(levels) - 1) / 100];
+		} else {
+			memset(line + pos, ' ', width);
+			p = rms[c] * width / 100;
+			if (p > width)
+				p = width;
+			memset(line + pos, '#', p);
+			q = perc[c] * width / 100;
+			if (q > width)
+				q = width;
+			if (q > p)
+				memset(line + pos + p, '=', q - p);
+			p = maxperc[c] * width / 100;
+			if (p >= width)
+				p = width - 1;
+			if (p >= q)
+				line[pos + p] = '+';
+			pos += width;
+		}
+		if (separate)
+			line[pos++] = '|';
+	}
+	line[pos] = 0;
+	fputs(line, stderr);
+}
+
+static void print_vu_meter(signed int *perc, signed int *rms,
+			   signed int *maxperc, unsigned int channels)
+{
+	if (vumeter == VUMETER_MULTI)
+		print_vu_meter_multi(perc, rms, maxperc, channels);
+	else if (vumeter == VUMETER_STEREO)
 		print_vu_meter_stereo(perc, maxperc);
 	else
 		print_vu_meter_mono(*perc, *maxperc);
 }
 
 /* peak handler */
-static void compute_max_peak(u_char *data, size_t count)
+static void compute_max_peak(u_char *data, size_t frames, unsigned int channels)
 {
-	signed int val, max, perc[2], max_peak[2];
-	static	int	run = 0;
-	size_t ocount = count;
-	int	format_little_endian = snd_pcm_format_little_endian(hwparams.format);	
-	int ichans, c;
-
-	if (vumeter == VUMETER_STEREO)
-		ichans = 2;
-	else
-		ichans = 1;
-
-	memset(max_peak, 0, sizeof(max_peak));
-	switch (bits_per_sample) {
-	case 8: {
-		signed char *valp = (signed char *)data;
-		signed char mask = snd_pcm_format_silence(hwparams.format);
-		c = 0;
-		while (count-- > 0) {
-			val = *valp++ ^ mask;
-			val = abs(val);
-			if (max_peak[c] < val)
-				max_peak[c] = val;
-			if (vumeter == VUMETER_STEREO)
-				c = !c;
-		}
-		break;
-	}
-	case 16: {
-		signed short *valp = (signed short *)data;
-		signed short mask = snd_pcm_format_silence_16(hwparams.format);
-		signed short sval;
+	unsigned int peaks[256], max_peak;
+	double squares[256];
+	signed int val, perc[256], rms[256];
+	unsigned int ichans, c;
 
-		count /= 2;
-		c = 0;
-		while (count-- > 0) {
-			if (format_little_endian)
-				sval = le16toh(*valp);
-			else
-				sval = be16toh(*valp);
-			sval = abs(sval) ^ mask;
-			if (max_peak[c] < sval)
-				max_peak[c] = sval;
-			valp++;
-			if (vumeter == VUMETER_STEREO)
-				c = !c;
-		}
-		break;
-	}
-	case 24: {
-		unsigned char *valp = data;
-		signed int mask = snd_pcm_format_silence_32(hwparams.format);
+	if (frames == 0 || channels > 256)
+		return;
 
-		count /= 3;
-		c = 0;
-		while (count-- > 0) {
-			if (format_little_endian) {
-				val = valp[0] | (valp[1]<<8) | (valp[2]<<16);
-			} else {
-				val = (valp[0]<<16) | (valp[1]<<8) | valp[2];
-			}
-			/* Correct signed bit in 32-bit value */
-			if (val & (1<<(bits_per_sample-1))) {
-				val |= 0xff<<24;	/* Negate upper bits too */
-			}
-			val = abs(val) ^ mask;
-			if (max_peak[c] < val)
-				max_peak[c] = val;
-			valp += 3;
-			if (vumeter == VUMETER_STEREO)
-				c = !c;
-		}
-		break;
-	}
-	case 32: {
-		signed int *valp = (signed int *)data;
-		signed int mask = snd_pcm_format_silence_32(hwparams.format);
+	/* all channels of the chunk in one pass */
+	peak_compute(data, channels, frames, peaks, squares);
 
-		count /= 4;
-		c = 0;
-		while (count-- > 0) {
-			if (format_little_endian)
-				val = le32toh(*valp);
-			else
-				val = be32toh(*valp);
-			val = abs(val) ^ mask;
-			if (max_peak[c] < val)
-				max_peak[c] = val;
-			valp++;
-			if (vumeter == VUMETER_STEREO)
-				c = !c;
+	if (vumeter == VUMETER_MONO) {
+		/* the loudest channel */
+		for (c = 1; c < channels; c++) {
+			if (peaks[c] > peaks[0])
+				peaks[0] = peaks[c];
 		}
-		break;
-	}
-	default:
-		if (run == 0) {
-			fprintf(stderr, _("Unsupported bit size %d.\n"), (int)bits_per_sample);
-			run = 1;
-		}
-		return;
+		ichans = 1;
+	} else {
+		ichans = channels;
 	}
-	max = 1 << (significant_bits_per_sample-1);
-	if (max <= 0)
-		max = 0x7fffffff;
 
+	/* the full scale is 0x80000000 */
 	for (c = 0; c < ichans; c++) {
-		if (bits_per_sample > 16)
-			perc[c] = max_peak[c] / (max / 100);
-		else
-			perc[c] = max_peak[c] * 100 / max;
+		perc[c] = ((unsigned long long)peaks[c] * 100) >> 31;
+		rms[c] = sqrt(squares[c] / frames) * 100;
 	}
 
 	if (interleaved && verbose <= 2) {
-		static int maxperc[2];
+		static int maxperc[256];
 		static time_t t=0;
 		const time_t tt=time(NULL);
 		if(tt>t) {
 			t=tt;
-			maxperc[0] = 0;
-			maxperc[1] = 0;
+			memset(maxperc, 0, sizeof(maxperc));
 		}
 		for (c = 0; c < ichans; c++)
 			if (perc[c] > maxperc[c])
 				maxperc[c] = perc[c];
 
 		putc('\r', stderr);
-		print_vu_meter(perc, maxperc);
+		print_vu_meter(perc, rms, maxperc, ichans);
 		fflush(stderr);
 	}
 	else if(verbose==3) {
-		fprintf(stderr, _("Max peak (%li samples): 0x%08x "), (long)ocount, max_peak[0]);
+		/* in the scale of the format */
+		max_peak = peaks[0] >> (32 - significant_bits_per_sample);
+		fprintf(stderr, _("Max peak (%li samples): 0x%08x "), (long)(frames * channels), max_peak);
 		for (val = 0; val < 20; val++)
 			if (val <= perc[0] / 5)
 				putc('#', stderr);
@@ -2059,7 +2056,7 @@ static ssize_t pcm_write(u_char *data, size_t count)
 		}
 		if (r > 0) {
 			if (vumeter)
-				compute_max_peak(data, r * hwparams.channels);
+				compute_max_peak(data, r, hwparams.channels);
 			result += r;
 			count -= r;
 			data += r * bits_per_frame / 8;
@@ -2108,7 +2105,7 @@ static ssize_t pcm_writev(u_char **data, unsigned int channels, size_t count)
 		if (r > 0) {
 			if (vumeter) {
 				for (channel = 0; channel < channels; channel++)
-					compute_max_peak(data[channel], r);
+					compute_max_peak(data[channel], r, 1);
 			}
 			result += r;
 			count -= r;
@@ -2151,7 +2148,7 @@ static ssize_t pcm_read(u_char *data, size_t rcount)
 		}
 		if (r > 0) {
 			if (vumeter)
-				compute_max_peak(data, r * hwparams.channels);
+				compute_max_peak(data, r, hwparams.channels);
 			result += r;
 			count -= r;
 			data += r * bits_per_frame / 8;
@@ -2196,7 +2193,7 @@ static ssize_t pcm_readv(u_char **data, unsigned int channels, size_t rcount)
 		if (r > 0) {
 			if (vumeter) {
 				for (channel = 0; channel < channels; channel++)
-					compute_max_peak(data[channel], r);
+					compute_max_peak(data[channel], r, 1);
 			}
 			result += r;
 			count -= r;
@@ -2748,6 +2745,176 @@ static void header(int rtype, char *name)
 	}
 }
 
+/*
+ * read-ahead of the file for playback
+ *
+ * A thread reads the file into a ring of blocks of chunk_bytes, so that
+ * a slow read (e.g. network filesystems) doesn't eat the headroom of the
+ * PCM buffer. The PCM thread just consumes the blocks already read.
+ */
+
+static struct {
+	pthread_t thread;
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+	u_char *buf;
+	size_t *lengths;	/* bytes in each block */
+	unsigned int depth;
+	unsigned int head;	/* the first block to play */
+	unsigned int filled;	/* blocks ready to play */
+	int fd;
+	off64_t remain;		/* bytes to read */
+	int eof;
+	int err;
+	int quit;
+} read_ahead;
+
+static void *read_ahead_thread(void *arg)
+{
+	sigset_t mask;
+	unsigned int tail;
+	u_char *block;
+	size_t l, c;
+	ssize_t r;
+
+	/* signals are for the PCM thread */
+	sigfillset(&mask);
+	pthread_sigmask(SIG_BLOCK, &mask, NULL);
+	/* cancelled only while blocking in read(2) at abort */
+	pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, NULL);
+
+	pthread_mutex_lock(&read_ahead.lock);
+	while (!read_ahead.quit && !read_ahead.eof) {
+		if (read_ahead.filled == read_ahead.depth) {
+			pthread_cond_wait(&read_ahead.cond, &read_ahead.lock);
+			continue;
+		}
+		tail = (read_ahead.head + read_ahead.filled) % read_ahead.depth;
+		l = read_ahead.lengths[tail];
+		pthread_mutex_unlock(&read_ahead.lock);
+
+		block = read_ahead.buf + tail * chunk_bytes;
+		c = chunk_bytes - l;
+		if ((off64_t)c > read_ahead.remain)
+			c = read_ahead.remain;
+		pthread_setcancelstate(PTHREAD_CANCEL_ENABLE, NULL);
+		r = safe_read(read_ahead.fd, block + l, c);
+		pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, NULL);
+
+		pthread_mutex_lock(&read_ahead.lock);
+		if (r < 0) {
+			read_ahead.err = errno;
+			read_ahead.eof = 1;
+		} else {
+			fdcount += r;
+			read_ahead.remain -= r;
+			l += r;
+			read_ahead.lengths[tail] = l;
+			if (l > 0)
+				read_ahead.filled++;
+			if ((size_t)r < c || read_ahead.remain == 0)
+				read_ahead.eof = 1;
+		}
+		pthread_cond_broadcast(&read_ahead.cond);
+	}
+	pthread_mutex_unlock(&read_ahead.lock);
+
+	return NULL;
+}
+
+static void read_ahead_go(int fd, size_t loaded, off64_t count, char *name)
+{
+	struct timeval now;
+	struct timespec ts;
+	unsigned int blocks;
+	u_char *block;
+	size_t l;
+	ssize_t r;
+	int err;
+
+	blocks = ((unsigned long long)read_ahead_time * hwparams.rate +
+		  chunk_size - 1) / chunk_size;
+	if (blocks < 2)
+		blocks = 2;
+
+	memset(&read_ahead, 0, sizeof(read_ahead));
+	read_ahead.buf = malloc((size_t)blocks * chunk_bytes);
+	read_ahead.lengths = calloc(blocks, sizeof(*read_ahead.lengths));
+	if (read_ahead.buf == NULL || read_ahead.lengths == NULL) {
+		error(_("not enough memory"));
+		prg_exit(EXIT_FAILURE);
+	}
+	read_ahead.depth = blocks;
+	read_ahead.fd = fd;
+
+	/* the rest of header is at the first block */
+	if ((off64_t)loaded > count)
+		loaded = count;
+	memcpy(read_ahead.buf, audiobuf, loaded);
+	read_ahead.lengths[0] = loaded;
+	read_ahead.remain = count - loaded;
+
+	pthread_cond_init(&read_ahead.cond, NULL);
+	pthread_mutex_init(&read_ahead.lock, NULL);
+
+	err = pthread_create(&read_ahead.thread, NULL, read_ahead_thread, NULL);
+	if (err) {
+		error(_("read ahead thread error: %s"), strerror(err));
+		prg_exit(EXIT_FAILURE);
+	}
+
+	while (!in_aborting) {
+		pthread_mutex_lock(&read_ahead.lock);
+		while (read_ahead.filled == 0 && !read_ahead.eof && !in_aborting) {
+			/* poll the flag of abort by signal handler */
+			gettimeofday(&now, NULL);
+			now.tv_usec += 100000;
+			ts.tv_sec = now.tv_sec + now.tv_usec / 1000000;
+			ts.tv_nsec = (now.tv_usec % 1000000) * 1000;
+			pthread_cond_timedwait(&read_ahead.cond, &read_ahead.lock, &ts);
+		}
+		if (read_ahead.filled == 0) {
+			pthread_mutex_unlock(&read_ahead.lock);
+			break;
+		}
+		block = read_ahead.buf + read_ahead.head * chunk_bytes;
+		l = read_ahead.lengths[read_ahead.head];
+		pthread_mutex_unlock(&read_ahead.lock);
+
+		l = l * 8 / bits_per_frame;
+		r = pcm_write(block, l);
+
+		pthread_mutex_lock(&read_ahead.lock);
+		read_ahead.lengths[read_ahead.head] = 0;
+		read_ahead.head = (read_ahead.head + 1) % read_ahead.depth;
+		read_ahead.filled--;
+		pthread_cond_broadcast(&read_ahead.cond);
+		pthread_mutex_unlock(&read_ahead.lock);
+
+		if ((size_t)r != l)
+			break;
+	}
+
+	pthread_mutex_lock(&read_ahead.lock);
+	read_ahead.quit = 1;
+	pthread_cond_broadcast(&read_ahead.cond);
+	pthread_mutex_unlock(&read_ahead.lock);
+	if (in_aborting)
+		pthread_cancel(read_ahead.thread);
+	pthread_join(read_ahead.thread, NULL);
+
+	if (read_ahead.err && !in_aborting) {
+		errno = read_ahead.err;
+		perror(name);
+		prg_exit(EXIT_FAILURE);
+	}
+
+	pthread_cond_destroy(&read_ahead.cond);
+	pthread_mutex_destroy(&read_ahead.lock);
+	free(read_ahead.lengths);
+	free(read_ahead.buf);
+}
+
 /* playing raw data */
 
 static void playback_go(int fd, size_t loaded, off64_t count, int rtype, char *name)
@@ -2768,6 +2935,11 @@ static void playback_go(int fd, size_t loaded, off64_t count, int rtype, char *n
 	if (written > 0 && loaded > 0)
 		memmove(audiobuf, audiobuf + written, loaded);
 
+	if (read_ahead_time > 0 && written < count && !in_aborting) {
+		read_ahead_go(fd, loaded, count - written, name);
+		goto drain;
+	}
+
 	l = loaded;
 	while (written < count && !in_aborting) {
 		do {
@@ -2803,6 +2975,7 @@ static void playback_go(int fd, size_t loaded, off64_t count, int rtype, char *n
 		written += r;
 		l = 0;
 	}
+drain:
 	snd_pcm_nonblock(handle, 0);
 	snd_pcm_drain(handle);
 	snd_pcm_nonblock(handle, nonblock);
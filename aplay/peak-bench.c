@@ -0,0 +1,77 @@
+/*
+ *  peak-bench.c - micro-benchmark for the peak kernels of the VU meter
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ *  Build with "make peak-bench", run "APLAY_NO_SIMD=1 ./peak-bench"
+ *  to measure the scalar fallback.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <time.h>
+#include <alsa/asoundlib.h>
+#include "peak.h"
+
+#define FRAMES		1024
+#define LOOPS		2000
+
+static double now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+int main(void)
+{
+	static const snd_pcm_format_t formats[] = {
+		SND_PCM_FORMAT_U8,
+		SND_PCM_FORMAT_S16_LE,
+		SND_PCM_FORMAT_S24_3LE,
+		SND_PCM_FORMAT_S24_LE,
+		SND_PCM_FORMAT_S32_LE,
+	};
+	static const unsigned int channels[] = { 2, 6, 32 };
+	static unsigned char buf[4 * 32 * FRAMES];
+	unsigned int peaks[32];
+	double squares[32];
+	unsigned int i, j, l;
+	double t;
+
+	for (i = 0; i < sizeof(buf); i++)
+		buf[i] = rand();
+
+	printf("%d frames in a chunk%s\n", FRAMES,
+	       getenv("APLAY_NO_SIMD") ? " (no SIMD)" : "");
+	for (i = 0; i < sizeof(formats) / sizeof(formats[0]); i++) {
+		if (peak_init(formats[i]) < 0)
+			continue;
+		for (j = 0; j < sizeof(channels) / sizeof(channels[0]); j++) {
+			t = now();
+			for (l = 0; l < LOOPS; l++)
+				peak_compute(buf, channels[j], FRAMES, peaks,
+					     squares);
+			t = now() - t;
+			printf("%-8s %2u channels: %8.2f us/chunk\n",
+			       snd_pcm_format_name(formats[i]), channels[j],
+			       t * 1e6 / LOOPS);
+		}
+	}
+
+	return 0;
+}
@@ -0,0 +1,290 @@
+/*
+ *  peak.c - peak and RMS of each channel for the VU meter
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <endian.h>
+#include <byteswap.h>
+#include <alsa/asoundlib.h>
+#include "peak.h"
+
+/*
+ * GCC vector extensions are lowered to SSE2 on x86-64 and to NEON on
+ * AArch64, or to scalar code on the others.
+ */
+#if defined(__clang__) || (defined(__GNUC__) && __GNUC__ >= 9)
+#define PEAK_VECTOR
+#endif
+
+typedef void (*peak_func_t)(const void *data, unsigned int channels,
+			    unsigned long frames, unsigned int *peaks,
+			    double *squares);
+
+static struct {
+	peak_func_t compute;
+	unsigned int physical;	/* bits in the container */
+	unsigned int shift;	/* to left-justify in the container */
+	uint32_t flip;		/* sign bit of unsigned formats */
+	int swap;
+	int big_endian;
+} peak;
+
+static inline int32_t read_sample(const unsigned char *p)
+{
+	uint16_t s16;
+	uint32_t v;
+
+	switch (peak.physical) {
+	case 8:
+		v = (uint32_t)p[0] << 24;
+		break;
+	case 16:
+		memcpy(&s16, p, sizeof(s16));
+		if (peak.swap)
+			s16 = bswap_16(s16);
+		v = (uint32_t)s16 << 16;
+		break;
+	case 24:
+		if (peak.big_endian)
+			v = ((uint32_t)p[0] << 24) | (p[1] << 16) | (p[2] << 8);
+		else
+			v = ((uint32_t)p[2] << 24) | (p[1] << 16) | (p[0] << 8);
+		break;
+	default:
+		memcpy(&v, p, sizeof(v));
+		if (peak.swap)
+			v = bswap_32(v);
+		break;
+	}
+
+	return (int32_t)((v << peak.shift) ^ peak.flip);
+}
+
+/* accumulate into the peaks and squares given */
+static void peak_c(const void *data, unsigned int channels,
+		   unsigned long frames, unsigned int *peaks, double *squares)
+{
+	const unsigned char *p = data;
+	unsigned int bytes = peak.physical / 8;
+	unsigned long f;
+	unsigned int c, m;
+	int32_t v;
+	double d;
+
+	for (f = 0; f < frames; f++) {
+		for (c = 0; c < channels; c++) {
+			v = read_sample(p);
+			p += bytes;
+			m = v < 0 ? -(uint32_t)v : (uint32_t)v;
+			if (m > peaks[c])
+				peaks[c] = m;
+			d = v * (1.0 / 2147483648.0);
+			squares[c] += d * d;
+		}
+	}
+}
+
+#ifdef PEAK_VECTOR
+
+/*
+ * The lanes are assigned to the channels in the order of interleaved
+ * samples. A row of multiple of lcm(channels, lanes) samples keeps the
+ * assignment, thus each lane accumulates one channel and they are folded
+ * at last.
+ */
+
+#define MAX_LANES	1024
+
+typedef int8_t v16s8 __attribute__((vector_size(16)));
+typedef int16_t v8s16 __attribute__((vector_size(16)));
+typedef float v8f __attribute__((vector_size(32)));
+typedef int32_t v4s32 __attribute__((vector_size(16)));
+typedef float v4f __attribute__((vector_size(16)));
+
+/*
+ * Conversion from 8 bit lanes to float is not vectorized, thus the even
+ * and odd samples are sign-extended in 16 bit lanes instead.
+ */
+static inline void square_s8(v16s8 x, v8f *sq)
+{
+	v8s16 lo = ((v8s16)x << 8) >> 8;
+	v8s16 hi = (v8s16)x >> 8;
+	v8f even, odd;
+
+#if __BYTE_ORDER == __LITTLE_ENDIAN
+	even = __builtin_convertvector(lo, v8f);
+	odd = __builtin_convertvector(hi, v8f);
+#else
+	even = __builtin_convertvector(hi, v8f);
+	odd = __builtin_convertvector(lo, v8f);
+#endif
+	sq[0] += even * even;
+	sq[1] += odd * odd;
+}
+
+static inline float square_lane_s8(const v8f *sq, unsigned int lane)
+{
+	return sq[lane & 1][lane >> 1];
+}
+
+static inline void square_s16(v8s16 x, v8f *sq)
+{
+	v8f xf = __builtin_convertvector(x, v8f);
+
+	sq[0] += xf * xf;
+}
+
+static inline float square_lane_s16(const v8f *sq, unsigned int lane)
+{
+	return sq[0][lane];
+}
+
+static inline void square_s32(v4s32 x, v4f *sq)
+{
+	v4f xf = __builtin_convertvector(x, v4f);
+
+	sq[0] += xf * xf;
+}
+
+static inline float square_lane_s32(const v4f *sq, unsigned int lane)
+{
+	return sq[0][lane];
+}
+
+static unsigned int lcm(unsigned int a, unsigned int b)
+{
+	unsigned int x = a, y = b, t;
+
+	while (y) {
+		t = x % y;
+		x = y;
+		y = t;
+	}
+	return a / x * b;
+}
+
+/* 'nsq' vectors of float keep the squares of a vector of samples */
+#define DEFINE_PEAK_VECTOR(name, stype, vtype, ftype, nsq, lanes, bits)	\
+static void peak_##name##_vector(const void *data, unsigned int channels, \
+				 unsigned long frames, unsigned int *peaks, \
+				 double *squares)			\
+{									\
+	const stype *src = data;					\
+	vtype mx[MAX_LANES / lanes], mn[MAX_LANES / lanes], x, m;	\
+	ftype sq[MAX_LANES / lanes][nsq];				\
+	vtype flip = (vtype){0} + (stype)(peak.flip >> (32 - bits));	\
+	unsigned int count = lcm(channels, lanes) / lanes;		\
+	unsigned long rows, r, done;					\
+	unsigned int i, c, p;						\
+									\
+	/* independent accumulators to hide the latency of addition */ \
+	while (count < 4)						\
+		count *= 2;						\
+	if (count * lanes > MAX_LANES) {				\
+		peak_c(data, channels, frames, peaks, squares);		\
+		return;							\
+	}								\
+	rows = frames * channels / (count * lanes);			\
+									\
+	memset(mx, 0, count * sizeof(*mx));				\
+	memset(mn, 0, count * sizeof(*mn));				\
+	memset(sq, 0, count * sizeof(*sq));				\
+	for (r = 0; r < rows; r++) {					\
+		for (i = 0; i < count; i++) {				\
+			memcpy(&x, src, sizeof(x));			\
+			src += lanes;					\
+			x = (x << peak.shift) ^ flip;			\
+			m = x > mx[i];					\
+			mx[i] = (x & m) | (mx[i] & ~m);			\
+			m = x < mn[i];					\
+			mn[i] = (x & m) | (mn[i] & ~m);			\
+			square_##name(x, sq[i]);			\
+		}							\
+	}								\
+									\
+	for (i = 0; i < count * lanes; i++) {				\
+		c = i % channels;					\
+		p = (uint32_t)mx[i / lanes][i % lanes] << (32 - bits);	\
+		if (p > peaks[c])					\
+			peaks[c] = p;					\
+		p = (uint32_t)-(int64_t)mn[i / lanes][i % lanes] << (32 - bits); \
+		if (p > peaks[c])					\
+			peaks[c] = p;					\
+		squares[c] += square_lane_##name(sq[i / lanes], i % lanes) * \
+			      (1.0 / (1ULL << (2 * (bits - 1))));	\
+	}								\
+									\
+	done = rows * count * lanes / channels;				\
+	peak_c(src, channels, frames - done, peaks, squares);		\
+}
+
+DEFINE_PEAK_VECTOR(s8, int8_t, v16s8, v8f, 2, 16, 8)
+DEFINE_PEAK_VECTOR(s16, int16_t, v8s16, v8f, 1, 8, 16)
+DEFINE_PEAK_VECTOR(s32, int32_t, v4s32, v4f, 1, 4, 32)
+
+#endif /* PEAK_VECTOR */
+
+/* return -EINVAL when the format is not supported */
+int peak_init(snd_pcm_format_t format)
+{
+	int physical = snd_pcm_format_physical_width(format);
+	int width = snd_pcm_format_width(format);
+	int little = snd_pcm_format_little_endian(format);
+	int native;
+
+	if (snd_pcm_format_linear(format) <= 0 || width <= 0)
+		return -EINVAL;
+	if (physical != 8 && physical != 16 && physical != 24 && physical != 32)
+		return -EINVAL;
+
+	peak.physical = physical;
+	peak.shift = physical - width;
+	peak.flip = snd_pcm_format_unsigned(format) > 0 ? 0x80000000 : 0;
+	peak.big_endian = little == 0;
+#if __BYTE_ORDER == __LITTLE_ENDIAN
+	native = physical == 8 || little > 0;
+#else
+	native = physical == 8 || little == 0;
+#endif
+	peak.swap = !native;
+
+	peak.compute = peak_c;
+#ifdef PEAK_VECTOR
+	if (native && !getenv("APLAY_NO_SIMD")) {
+		if (physical == 8)
+			peak.compute = peak_s8_vector;
+		else if (physical == 16)
+			peak.compute = peak_s16_vector;
+		else if (physical == 32)
+			peak.compute = peak_s32_vector;
+	}
+#endif
+
+	return 0;
+}
+
+void peak_compute(const void *data, unsigned int channels,
+		  unsigned long frames, unsigned int *peaks, double *squares)
+{
+	memset(peaks, 0, channels * sizeof(*peaks));
+	memset(squares, 0, channels * sizeof(*squares));
+	peak.compute(data, channels, frames, peaks, squares);
+}
@@ -0,0 +1,19 @@
+#ifndef PEAK_H
+#define PEAK_H		1
+
+#include <alsa/asoundlib.h>
+
+/*
+ * Peak and sum of squares of each channel in interleaved samples.
+ *
+ * The peaks are the magnitude with the sample left-justified in 32 bit,
+ * thus the full scale is 0x80000000 for any format. The squares are
+ * normalized to the full scale, thus the RMS of the channel is
+ * sqrt(squares[c] / frames).
+ */
+
+int peak_init(snd_pcm_format_t format);
+void peak_compute(const void *data, unsigned int channels,
+		  unsigned long frames, unsigned int *peaks, double *squares);
+
+#endif /* PEAK_H */
@@ -0,0 +1,934 @@
+// SPDX-License-Identifier: GPL-2.0
+//
+// container-flac.c - a parser/builder for a container of Free Lossless Audio
+//		      Codec.
+//
+// Licensed under the terms of the GNU General Public License, version 2.
+
+#include "container.h"
+#include "flac.h"
+#include "misc.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <poll.h>
+#include <pthread.h>
+
+// Reference:
+//  * RFC 9639 Free Lossless Audio Codec (FLAC)
+
+#define FLAC_MAGIC		"fLaC"
+#define BLOCK_HEADER_SIZE	4
+#define HEADER_SIZE		(4 + BLOCK_HEADER_SIZE + FLAC_STREAM_INFO_SIZE)
+
+#define BLOCK_TYPE_STREAM_INFO	0
+#define BLOCK_FLAG_LAST		0x80
+
+// The common size of block for the rates supported by this program.
+#define FRAMES_PER_BLOCK	4096
+
+#define MIN_INPUT_SIZE		(64 * 1024)
+#define MAX_WORKER_COUNT	8
+
+// The decoder reads 8 bytes at once.
+#define READ_SLACK		8
+
+static const struct {
+	snd_pcm_format_t format;
+	unsigned int bits_per_sample;
+} format_maps[] = {
+	{SND_PCM_FORMAT_S8,		8},
+	{SND_PCM_FORMAT_S16_LE,		16},
+	{SND_PCM_FORMAT_S24_3LE,	24},
+	{SND_PCM_FORMAT_S32_LE,		32},
+};
+
+#define DEINTERLEAVE(load)						\
+	do {								\
+		for (i = 0; i < frame_count; ++i) {			\
+			for (j = 0; j < channels; ++j) {		\
+				samples[j][i] = (load);			\
+				src += bytes_per_sample;		\
+			}						\
+		}							\
+	} while (0)
+
+// Samples are right-aligned to the width of format.
+static void deinterleave(int32_t **samples, const uint8_t *src,
+			 snd_pcm_format_t format, unsigned int bytes_per_sample,
+			 unsigned int channels, unsigned int frame_count)
+{
+	unsigned int i, j;
+
+	switch (format) {
+	case SND_PCM_FORMAT_U8:
+		DEINTERLEAVE((int8_t)(src[0] ^ 0x80));
+		break;
+	case SND_PCM_FORMAT_S8:
+		DEINTERLEAVE((int8_t)src[0]);
+		break;
+	case SND_PCM_FORMAT_S16_LE:
+		DEINTERLEAVE((int16_t)(src[0] | (src[1] << 8)));
+		break;
+	case SND_PCM_FORMAT_S24_LE:
+	case SND_PCM_FORMAT_S24_3LE:
+		DEINTERLEAVE((int32_t)(((uint32_t)src[0] << 8) |
+				       ((uint32_t)src[1] << 16) |
+				       ((uint32_t)src[2] << 24)) >> 8);
+		break;
+	default:
+		DEINTERLEAVE((int32_t)((uint32_t)src[0] |
+				       ((uint32_t)src[1] << 8) |
+				       ((uint32_t)src[2] << 16) |
+				       ((uint32_t)src[3] << 24)));
+		break;
+	}
+}
+
+static inline void store_sample(uint8_t *dst, unsigned int bytes_per_sample,
+				uint32_t val)
+{
+	switch (bytes_per_sample) {
+	case 4:
+		dst[3] = val >> 24;
+		// Fall through.
+	case 3:
+		dst[2] = val >> 16;
+		// Fall through.
+	case 2:
+		dst[1] = val >> 8;
+		// Fall through.
+	default:
+		dst[0] = val;
+		break;
+	}
+}
+
+struct parser_state {
+	struct flac_stream_info info;
+	struct flac_decoder decoder;
+	unsigned int bytes_per_sample;
+	unsigned int shift;
+
+	uint8_t *buf;
+	unsigned int buf_size;
+	unsigned int head;
+	unsigned int tail;
+	bool input_eof;
+
+	// The decoded block.
+	unsigned int frame_count;
+	unsigned int frame_pos;
+
+	// Statistics.
+	unsigned int skipped_byte_count;
+};
+
+static int read_input(struct container_context *cntr)
+{
+	struct parser_state *state = cntr->private_data;
+	struct pollfd pfd;
+	ssize_t result;
+
+	if (state->head > 0) {
+		memmove(state->buf, state->buf + state->head,
+			state->tail - state->head);
+		state->tail -= state->head;
+		state->head = 0;
+	}
+
+	while (state->tail < state->buf_size) {
+		if (cntr->interrupted || container_context_aborted(cntr))
+			return -EINTR;
+
+		result = read(cntr->fd, state->buf + state->tail,
+			      state->buf_size - state->tail);
+		if (result < 0) {
+			if (errno == EINTR)
+				continue;
+			// The descriptor is in non-blocking mode.
+			if (errno == EAGAIN) {
+				pfd.fd = cntr->fd;
+				pfd.events = POLLIN;
+				poll(&pfd, 1, -1);
+				continue;
+			}
+			return -errno;
+		}
+		// The end of stream is detected by the parser itself.
+		if (result == 0) {
+			state->input_eof = true;
+			break;
+		}
+
+		state->tail += result;
+		break;
+	}
+
+	return 0;
+}
+
+// Decode the next frame. Return -ENODATA at the end of stream.
+static int decode_frame(struct container_context *cntr)
+{
+	struct parser_state *state = cntr->private_data;
+	unsigned int block_size;
+	int result;
+	int err;
+
+	while (1) {
+		result = flac_decoder_decode(&state->decoder,
+					     state->buf + state->head,
+					     state->tail - state->head,
+					     &block_size);
+		if (result > 0) {
+			state->head += result;
+			state->frame_count = block_size;
+			state->frame_pos = 0;
+			return 0;
+		}
+
+		if (result == 0) {
+			// The rest is not a frame.
+			if (state->input_eof) {
+				state->skipped_byte_count +=
+						state->tail - state->head;
+				state->head = state->tail;
+				return -ENODATA;
+			}
+			err = read_input(cntr);
+			if (err < 0)
+				return err;
+			continue;
+		}
+
+		// Lost synchronization. Search the next frame.
+		++state->head;
+		++state->skipped_byte_count;
+	}
+}
+
+static int flac_read(struct container_context *cntr, void *buffer,
+		     unsigned int byte_count)
+{
+	struct parser_state *state = cntr->private_data;
+	unsigned int bytes_per_sample = state->bytes_per_sample;
+	unsigned int channels = state->info.samples_per_frame;
+	unsigned int frame_count;
+	uint8_t *dst = buffer;
+	unsigned int i, j;
+	int err;
+
+	frame_count = byte_count / bytes_per_sample / channels;
+
+	while (frame_count > 0) {
+		unsigned int count;
+
+		if (state->frame_pos == state->frame_count) {
+			err = decode_frame(cntr);
+			if (err == -ENODATA) {
+				// Fill the rest with silence.
+				memset(dst, 0, frame_count * bytes_per_sample *
+					       channels);
+				cntr->eof = true;
+				break;
+			}
+			if (err < 0)
+				return err;
+		}
+
+		count = state->frame_count - state->frame_pos;
+		if (count > frame_count)
+			count = frame_count;
+
+		for (i = 0; i < count; ++i) {
+			unsigned int pos = state->frame_pos + i;
+
+			for (j = 0; j < channels; ++j) {
+				store_sample(dst, bytes_per_sample,
+					(uint32_t)state->decoder.samples[j][pos] <<
+								state->shift);
+				dst += bytes_per_sample;
+			}
+		}
+
+		state->frame_pos += count;
+		frame_count -= count;
+	}
+
+	return 0;
+}
+
+static int flac_parser_flush(struct container_context *cntr)
+{
+	struct parser_state *state = cntr->private_data;
+
+	if (cntr->verbose > 0) {
+		fprintf(stderr, "  FLAC: CRC errors %u, skipped bytes %u\n",
+			state->decoder.crc_error_count,
+			state->skipped_byte_count);
+	}
+
+	return 0;
+}
+
+static void flac_parser_destroy(struct container_context *cntr)
+{
+	struct parser_state *state = cntr->private_data;
+
+	flac_decoder_destroy(&state->decoder);
+	free(state->buf);
+	state->buf = NULL;
+
+	cntr->io_ops = NULL;
+}
+
+static const struct container_io_ops flac_parser_ops = {
+	.flush = flac_parser_flush,
+	.destroy = flac_parser_destroy,
+};
+
+static int skip_bytes(struct container_context *cntr, unsigned int size)
+{
+	char buf[1024];
+	unsigned int count;
+	int err;
+
+	while (size > 0) {
+		count = size;
+		if (count > sizeof(buf))
+			count = sizeof(buf);
+		err = container_recursive_read(cntr, buf, count);
+		if (err < 0)
+			return err;
+		if (cntr->eof)
+			return 0;
+		size -= count;
+	}
+
+	return 0;
+}
+
+static int flac_parser_pre_process(struct container_context *cntr,
+				   snd_pcm_format_t *format,
+				   unsigned int *samples_per_frame,
+				   unsigned int *frames_per_second,
+				   uint64_t *byte_count)
+{
+	struct parser_state *state = cntr->private_data;
+	uint8_t header[BLOCK_HEADER_SIZE];
+	uint8_t buf[FLAC_STREAM_INFO_SIZE];
+	bool found = false;
+	unsigned int size;
+	size_t bound;
+	int i;
+	int err;
+
+	if (memcmp(cntr->magic, FLAC_MAGIC, sizeof(cntr->magic)) != 0)
+		return -EINVAL;
+
+	// Metadata blocks. Just STREAMINFO is used.
+	do {
+		err = container_recursive_read(cntr, header, sizeof(header));
+		if (err < 0)
+			return err;
+		if (cntr->eof)
+			return 0;
+		size = (header[1] << 16) | (header[2] << 8) | header[3];
+
+		if ((header[0] & ~BLOCK_FLAG_LAST) == BLOCK_TYPE_STREAM_INFO &&
+		    size == FLAC_STREAM_INFO_SIZE) {
+			err = container_recursive_read(cntr, buf, sizeof(buf));
+			if (err < 0)
+				return err;
+			if (cntr->eof)
+				return 0;
+			err = flac_parse_stream_info(&state->info, buf);
+			if (err < 0)
+				return err;
+			found = true;
+		} else {
+			err = skip_bytes(cntr, size);
+			if (err < 0)
+				return err;
+			if (cntr->eof)
+				return 0;
+		}
+	} while (!(header[0] & BLOCK_FLAG_LAST));
+
+	if (!found)
+		return -EINVAL;
+
+	for (i = 0; i < ARRAY_SIZE(format_maps); ++i) {
+		if (format_maps[i].bits_per_sample >= state->info.bits_per_sample)
+			break;
+	}
+	if (i == ARRAY_SIZE(format_maps))
+		return -EINVAL;
+
+	// Samples are aligned to MSB of the format.
+	*format = format_maps[i].format;
+	*samples_per_frame = state->info.samples_per_frame;
+	*frames_per_second = state->info.frames_per_second;
+	state->bytes_per_sample = snd_pcm_format_physical_width(*format) / 8;
+	state->shift = format_maps[i].bits_per_sample -
+		       state->info.bits_per_sample;
+
+	if (state->info.total_frame_count > 0) {
+		*byte_count = state->info.total_frame_count *
+			      state->bytes_per_sample * *samples_per_frame;
+	} else {
+		*byte_count = UINT64_MAX;
+	}
+
+	cntr->io_ops = &flac_parser_ops;
+
+	err = flac_decoder_init(&state->decoder, &state->info);
+	if (err < 0)
+		return err;
+
+	// Several frames are buffered.
+	bound = flac_frame_size_bound(state->info.samples_per_frame,
+				      state->info.bits_per_sample,
+				      state->info.max_block_size);
+	state->buf_size = 2 * bound;
+	if (state->buf_size < MIN_INPUT_SIZE)
+		state->buf_size = MIN_INPUT_SIZE;
+	state->buf = calloc(1, state->buf_size + READ_SLACK);
+	if (state->buf == NULL)
+		return -ENOMEM;
+
+	cntr->process_bytes = flac_read;
+
+	return 0;
+}
+
+enum block_state {
+	BLOCK_STATE_FREE = 0,
+	BLOCK_STATE_FILLED,
+	BLOCK_STATE_ENCODING,
+	BLOCK_STATE_ENCODED,
+};
+
+struct block {
+	enum block_state state;
+	uint8_t *frames;
+	unsigned int frame_count;
+	uint64_t index;
+
+	uint8_t *encoded;
+	int encoded_size;
+};
+
+struct worker {
+	struct container_context *cntr;
+	pthread_t thread;
+	struct flac_encoder encoder;
+};
+
+// The blocks of frames are encoded by workers in parallel, then written in
+// order by the writer thread.
+struct builder_state {
+	snd_pcm_format_t format;
+	unsigned int bytes_per_sample;
+	unsigned int samples_per_frame;
+	unsigned int bits_per_sample;
+	unsigned int frames_per_second;
+
+	pthread_mutex_t lock;
+	pthread_cond_t filled;
+	pthread_cond_t encoded;
+	pthread_cond_t released;
+	bool closing;
+	int err;
+
+	struct block *blocks;
+	unsigned int block_count;
+	unsigned int fill;	// The block to be filled.
+	unsigned int encode;	// The next block to be encoded.
+	unsigned int write;	// The next block to be written.
+	unsigned int count;	// The number of blocks in flight.
+	uint64_t block_index;
+	size_t encoded_size;
+
+	struct worker *workers;
+	unsigned int worker_count;
+	unsigned int running_worker_count;
+	pthread_t writer;
+	bool writer_running;
+
+	// For STREAMINFO.
+	unsigned int min_frame_size;
+	unsigned int max_frame_size;
+
+	// Statistics.
+	unsigned int stall_count;
+};
+
+static void *worker_thread(void *arg)
+{
+	struct worker *worker = arg;
+	struct container_context *cntr = worker->cntr;
+	struct builder_state *state = cntr->private_data;
+	struct block *block;
+
+	pthread_mutex_lock(&state->lock);
+	while (1) {
+		while (state->blocks[state->encode].state != BLOCK_STATE_FILLED &&
+		       !state->closing)
+			pthread_cond_wait(&state->filled, &state->lock);
+		if (state->blocks[state->encode].state != BLOCK_STATE_FILLED)
+			break;
+		block = &state->blocks[state->encode];
+		block->state = BLOCK_STATE_ENCODING;
+		state->encode = (state->encode + 1) % state->block_count;
+		pthread_mutex_unlock(&state->lock);
+
+		deinterleave(worker->encoder.samples, block->frames,
+			     state->format, state->bytes_per_sample,
+			     state->samples_per_frame, block->frame_count);
+
+		block->encoded_size = flac_encoder_encode(&worker->encoder,
+				block->index, block->frame_count,
+				block->encoded, state->encoded_size);
+
+		pthread_mutex_lock(&state->lock);
+		block->state = BLOCK_STATE_ENCODED;
+		pthread_cond_signal(&state->encoded);
+	}
+	pthread_mutex_unlock(&state->lock);
+
+	return NULL;
+}
+
+static int write_all(struct container_context *cntr, const uint8_t *buf,
+		     unsigned int size)
+{
+	struct pollfd pfd;
+	ssize_t result;
+	unsigned int pos = 0;
+
+	while (pos < size) {
+		result = write(cntr->fd, buf + pos, size - pos);
+		if (result < 0) {
+			if (errno == EINTR)
+				continue;
+			// The descriptor is in non-blocking mode. Unix signals
+			// are blocked in this thread, thus the flag to abort
+			// is checked periodically.
+			if (errno == EAGAIN) {
+				if (container_context_aborted(cntr))
+					return -EINTR;
+				pfd.fd = cntr->fd;
+				pfd.events = POLLOUT;
+				poll(&pfd, 1, CONTAINER_ABORT_CHECK_MSEC);
+				continue;
+			}
+			return -errno;
+		}
+		pos += result;
+	}
+
+	return 0;
+}
+
+static void *writer_thread(void *arg)
+{
+	struct container_context *cntr = arg;
+	struct builder_state *state = cntr->private_data;
+	struct block *block;
+	bool failed;
+	int err;
+
+	pthread_mutex_lock(&state->lock);
+	while (1) {
+		while (state->blocks[state->write].state != BLOCK_STATE_ENCODED &&
+		       !(state->closing && state->count == 0))
+			pthread_cond_wait(&state->encoded, &state->lock);
+		if (state->blocks[state->write].state != BLOCK_STATE_ENCODED)
+			break;
+		block = &state->blocks[state->write];
+		failed = state->err < 0;
+		pthread_mutex_unlock(&state->lock);
+
+		// After any error, blocks are just released not to stall the
+		// caller.
+		err = 0;
+		if (!failed) {
+			if (block->encoded_size < 0)
+				err = block->encoded_size;
+			else
+				err = write_all(cntr, block->encoded,
+						block->encoded_size);
+		}
+
+		pthread_mutex_lock(&state->lock);
+		if (err < 0) {
+			state->err = err;
+		} else if (!failed) {
+			if (state->min_frame_size == 0 ||
+			    block->encoded_size < state->min_frame_size)
+				state->min_frame_size = block->encoded_size;
+			if (block->encoded_size > state->max_frame_size)
+				state->max_frame_size = block->encoded_size;
+		}
+		block->frame_count = 0;
+		block->state = BLOCK_STATE_FREE;
+		state->write = (state->write + 1) % state->block_count;
+		--state->count;
+		pthread_cond_signal(&state->released);
+	}
+	pthread_mutex_unlock(&state->lock);
+
+	return NULL;
+}
+
+static int queue_block(struct builder_state *state)
+{
+	struct block *block = &state->blocks[state->fill];
+	bool stalled = false;
+	int err;
+
+	pthread_mutex_lock(&state->lock);
+	block->index = state->block_index++;
+	block->state = BLOCK_STATE_FILLED;
+	++state->count;
+	pthread_cond_signal(&state->filled);
+
+	state->fill = (state->fill + 1) % state->block_count;
+
+	// No block is available to be filled.
+	while (state->blocks[state->fill].state != BLOCK_STATE_FREE) {
+		stalled = true;
+		pthread_cond_wait(&state->released, &state->lock);
+	}
+	if (stalled)
+		++state->stall_count;
+	err = state->err;
+	pthread_mutex_unlock(&state->lock);
+
+	return err;
+}
+
+static int flac_write(struct container_context *cntr, void *buffer,
+		      unsigned int byte_count)
+{
+	struct builder_state *state = cntr->private_data;
+	unsigned int bytes_per_frame;
+	const uint8_t *src = buffer;
+	struct block *block;
+	unsigned int count;
+	int err;
+
+	bytes_per_frame = state->bytes_per_sample * state->samples_per_frame;
+
+	while (byte_count >= bytes_per_frame) {
+		block = &state->blocks[state->fill];
+		count = FRAMES_PER_BLOCK - block->frame_count;
+		if (count > byte_count / bytes_per_frame)
+			count = byte_count / bytes_per_frame;
+		memcpy(block->frames + block->frame_count * bytes_per_frame,
+		       src, count * bytes_per_frame);
+		block->frame_count += count;
+		src += count * bytes_per_frame;
+		byte_count -= count * bytes_per_frame;
+
+		if (block->frame_count == FRAMES_PER_BLOCK) {
+			err = queue_block(state);
+			if (err < 0)
+				return err;
+		}
+	}
+
+	return 0;
+}
+
+static void stop_threads(struct builder_state *state)
+{
+	unsigned int i;
+
+	pthread_mutex_lock(&state->lock);
+	state->closing = true;
+	pthread_cond_broadcast(&state->filled);
+	pthread_cond_broadcast(&state->encoded);
+	pthread_mutex_unlock(&state->lock);
+
+	for (i = 0; i < state->running_worker_count; ++i)
+		pthread_join(state->workers[i].thread, NULL);
+	state->running_worker_count = 0;
+
+	if (state->writer_running) {
+		pthread_join(state->writer, NULL);
+		state->writer_running = false;
+	}
+}
+
+static int flac_builder_flush(struct container_context *cntr)
+{
+	struct builder_state *state = cntr->private_data;
+
+	// The last block can be shorter than the others.
+	if (state->blocks[state->fill].frame_count > 0)
+		queue_block(state);
+
+	pthread_mutex_lock(&state->lock);
+	while (state->count > 0)
+		pthread_cond_wait(&state->released, &state->lock);
+	pthread_mutex_unlock(&state->lock);
+
+	stop_threads(state);
+
+	if (cntr->verbose > 0) {
+		fprintf(stderr, "  FLAC: %lu blocks by %u workers, stalls %u\n",
+			state->block_index, state->worker_count,
+			state->stall_count);
+	}
+
+	return state->err;
+}
+
+static void flac_builder_destroy(struct container_context *cntr)
+{
+	struct builder_state *state = cntr->private_data;
+	unsigned int i;
+
+	stop_threads(state);
+
+	pthread_cond_destroy(&state->released);
+	pthread_cond_destroy(&state->encoded);
+	pthread_cond_destroy(&state->filled);
+	pthread_mutex_destroy(&state->lock);
+
+	if (state->workers) {
+		for (i = 0; i < state->worker_count; ++i)
+			flac_encoder_destroy(&state->workers[i].encoder);
+		free(state->workers);
+		state->workers = NULL;
+	}
+
+	if (state->blocks) {
+		for (i = 0; i < state->block_count; ++i) {
+			free(state->blocks[i].frames);
+			free(state->blocks[i].encoded);
+		}
+		free(state->blocks);
+		state->blocks = NULL;
+	}
+
+	cntr->io_ops = NULL;
+}
+
+static const struct container_io_ops flac_builder_ops = {
+	.flush = flac_builder_flush,
+	.destroy = flac_builder_destroy,
+};
+
+static int write_container_header(struct container_context *cntr,
+				  uint64_t frame_count)
+{
+	struct builder_state *state = cntr->private_data;
+	struct flac_stream_info info = {0};
+	uint8_t header[HEADER_SIZE];
+
+	info.min_block_size = FRAMES_PER_BLOCK;
+	info.max_block_size = FRAMES_PER_BLOCK;
+	info.min_frame_size = state->min_frame_size;
+	info.max_frame_size = state->max_frame_size;
+	info.frames_per_second = state->frames_per_second;
+	info.samples_per_frame = state->samples_per_frame;
+	info.bits_per_sample = state->bits_per_sample;
+	info.total_frame_count = frame_count;
+
+	memcpy(header, FLAC_MAGIC, 4);
+	header[4] = BLOCK_FLAG_LAST | BLOCK_TYPE_STREAM_INFO;
+	header[5] = 0;
+	header[6] = 0;
+	header[7] = FLAC_STREAM_INFO_SIZE;
+	flac_build_stream_info(&info, header + 4 + BLOCK_HEADER_SIZE);
+
+	return container_recursive_write(cntr, header, sizeof(header));
+}
+
+static unsigned int count_workers(void)
+{
+	long count;
+
+	// One of processors is left for the transmission.
+	count = sysconf(_SC_NPROCESSORS_ONLN) - 1;
+	if (count < 1)
+		count = 1;
+	if (count > MAX_WORKER_COUNT)
+		count = MAX_WORKER_COUNT;
+
+	return count;
+}
+
+static int start_threads(struct container_context *cntr)
+{
+	struct builder_state *state = cntr->private_data;
+	unsigned int bytes_per_frame;
+	sigset_t mask, prev;
+	unsigned int i;
+	int err;
+
+	pthread_mutex_init(&state->lock, NULL);
+	pthread_cond_init(&state->filled, NULL);
+	pthread_cond_init(&state->encoded, NULL);
+	pthread_cond_init(&state->released, NULL);
+	cntr->io_ops = &flac_builder_ops;
+
+	state->worker_count = count_workers();
+	state->workers = calloc(state->worker_count, sizeof(*state->workers));
+	if (state->workers == NULL)
+		return -ENOMEM;
+	for (i = 0; i < state->worker_count; ++i) {
+		state->workers[i].cntr = cntr;
+		err = flac_encoder_init(&state->workers[i].encoder,
+					state->samples_per_frame,
+					state->bits_per_sample,
+					state->frames_per_second,
+					FRAMES_PER_BLOCK);
+		if (err < 0)
+			return err;
+	}
+
+	// Enough for the workers to be busy while the writer is blocked.
+	state->block_count = 2 * state->worker_count + 2;
+	state->blocks = calloc(state->block_count, sizeof(*state->blocks));
+	if (state->blocks == NULL)
+		return -ENOMEM;
+	bytes_per_frame = state->bytes_per_sample * state->samples_per_frame;
+	state->encoded_size = flac_frame_size_bound(state->samples_per_frame,
+						    state->bits_per_sample,
+						    FRAMES_PER_BLOCK);
+	for (i = 0; i < state->block_count; ++i) {
+		state->blocks[i].frames = malloc(FRAMES_PER_BLOCK *
+						 bytes_per_frame);
+		state->blocks[i].encoded = malloc(state->encoded_size);
+		if (state->blocks[i].frames == NULL ||
+		    state->blocks[i].encoded == NULL)
+			return -ENOMEM;
+	}
+
+	// UNIX signals are handled by the main thread.
+	sigfillset(&mask);
+	pthread_sigmask(SIG_BLOCK, &mask, &prev);
+	err = -pthread_create(&state->writer, NULL, writer_thread, cntr);
+	if (err == 0) {
+		state->writer_running = true;
+		for (i = 0; i < state->worker_count; ++i) {
+			err = -pthread_create(&state->workers[i].thread, NULL,
+					      worker_thread,
+					      state->workers + i);
+			if (err < 0)
+				break;
+			++state->running_worker_count;
+		}
+	}
+	pthread_sigmask(SIG_SETMASK, &prev, NULL);
+	if (err < 0)
+		return err;
+
+	cntr->process_bytes = flac_write;
+
+	if (cntr->verbose > 0) {
+		fprintf(stderr, "  FLAC: %u workers, %u blocks of %u frames\n",
+			state->worker_count, state->block_count,
+			FRAMES_PER_BLOCK);
+	}
+
+	return 0;
+}
+
+static int flac_builder_pre_process(struct container_context *cntr,
+				    snd_pcm_format_t *format,
+				    unsigned int *samples_per_frame,
+				    unsigned int *frames_per_second,
+				    uint64_t *byte_count)
+{
+	struct builder_state *state = cntr->private_data;
+	int err;
+
+	// Samples in big endian are converted by mapper.
+	switch (*format) {
+	case SND_PCM_FORMAT_S16_BE:
+		*format = SND_PCM_FORMAT_S16_LE;
+		break;
+	case SND_PCM_FORMAT_S24_BE:
+		*format = SND_PCM_FORMAT_S24_LE;
+		break;
+	case SND_PCM_FORMAT_S24_3BE:
+		*format = SND_PCM_FORMAT_S24_3LE;
+		break;
+	case SND_PCM_FORMAT_S32_BE:
+		*format = SND_PCM_FORMAT_S32_LE;
+		break;
+	default:
+		break;
+	}
+
+	switch (*format) {
+	case SND_PCM_FORMAT_S8:
+	case SND_PCM_FORMAT_U8:
+	case SND_PCM_FORMAT_S16_LE:
+	case SND_PCM_FORMAT_S24_LE:
+	case SND_PCM_FORMAT_S24_3LE:
+	case SND_PCM_FORMAT_S32_LE:
+		break;
+	default:
+		return -EINVAL;
+	}
+	if (*samples_per_frame == 0 || *samples_per_frame > FLAC_MAX_CHANNELS)
+		return -EINVAL;
+	// 20 bits field in STREAMINFO.
+	if (*frames_per_second == 0 || *frames_per_second >= (1u << 20))
+		return -EINVAL;
+
+	state->format = *format;
+	state->bytes_per_sample = snd_pcm_format_physical_width(*format) / 8;
+	state->samples_per_frame = *samples_per_frame;
+	state->bits_per_sample = snd_pcm_format_width(*format);
+	state->frames_per_second = *frames_per_second;
+
+	err = write_container_header(cntr, 0);
+	if (err < 0)
+		return err;
+
+	return start_threads(cntr);
+}
+
+static int flac_builder_post_process(struct container_context *cntr,
+				     uint64_t handled_byte_count)
+{
+	struct builder_state *state = cntr->private_data;
+	int err;
+
+	err = container_seek_offset(cntr, 0);
+	if (err < 0)
+		return err;
+
+	return write_container_header(cntr, handled_byte_count /
+			state->bytes_per_sample / state->samples_per_frame);
+}
+
+const struct container_parser container_parser_flac = {
+	.format = CONTAINER_FORMAT_FLAC,
+	.magic = FLAC_MAGIC,
+	.max_size = UINT64_MAX,
+	.ops = {
+		.pre_process = flac_parser_pre_process,
+	},
+	.private_size = sizeof(struct parser_state),
+};
+
+const struct container_builder container_builder_flac = {
+	.format = CONTAINER_FORMAT_FLAC,
+	.max_size = UINT64_MAX,
+	.ops = {
+		.pre_process	= flac_builder_pre_process,
+		.post_process	= flac_builder_post_process,
+	},
+	.private_size = sizeof(struct builder_state),
+};
@@ -0,0 +1,474 @@
+// SPDX-License-Identifier: GPL-2.0
+//
+// container-io-uring.c - asynchronous I/O of sample data by io_uring.
+//
+// Licensed under the terms of the GNU General Public License, version 2.
+
+#include "container.h"
+#include "misc.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+
+// The size of one request. Data frames are gathered/scattered by this unit so
+// that the number of requests is independent of the size of period.
+#define IO_BLOCK_SIZE	(64 * 1024)
+
+struct block {
+	char *buf;
+	off64_t offset;		// File offset of the request.
+	unsigned int pos;	// Filled bytes for builder, consumed for parser.
+	int result;		// Result of the last completed request.
+	bool busy;
+};
+
+struct io_uring_state {
+	int fd;
+
+	// Submission queue.
+	void *sq_ring;
+	size_t sq_ring_size;
+	unsigned int *sq_head;
+	unsigned int *sq_tail;
+	unsigned int sq_mask;
+	unsigned int *sq_array;
+	struct io_uring_sqe *sqes;
+	size_t sqes_size;
+
+	// Completion queue.
+	void *cq_ring;
+	size_t cq_ring_size;
+	unsigned int *cq_head;
+	unsigned int *cq_tail;
+	unsigned int cq_mask;
+	struct io_uring_cqe *cqes;
+
+	struct block *blocks;
+	unsigned int block_count;
+	unsigned int index;
+	off64_t offset;
+};
+
+static int ring_setup(struct io_uring_state *state, unsigned int entries)
+{
+	struct io_uring_params params = {0};
+	char *ptr;
+
+	state->fd = syscall(__NR_io_uring_setup, entries, &params);
+	if (state->fd < 0)
+		return -errno;
+
+	state->sq_ring_size = params.sq_off.array +
+			      params.sq_entries * sizeof(unsigned int);
+	state->cq_ring_size = params.cq_off.cqes +
+			      params.cq_entries * sizeof(struct io_uring_cqe);
+	if (params.features & IORING_FEAT_SINGLE_MMAP) {
+		if (state->cq_ring_size > state->sq_ring_size)
+			state->sq_ring_size = state->cq_ring_size;
+		state->cq_ring_size = state->sq_ring_size;
+	}
+
+	state->sq_ring = mmap(NULL, state->sq_ring_size,
+			      PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+			      state->fd, IORING_OFF_SQ_RING);
+	if (state->sq_ring == MAP_FAILED) {
+		state->sq_ring = NULL;
+		return -errno;
+	}
+	if (params.features & IORING_FEAT_SINGLE_MMAP) {
+		state->cq_ring = state->sq_ring;
+	} else {
+		state->cq_ring = mmap(NULL, state->cq_ring_size,
+				      PROT_READ | PROT_WRITE,
+				      MAP_SHARED | MAP_POPULATE, state->fd,
+				      IORING_OFF_CQ_RING);
+		if (state->cq_ring == MAP_FAILED) {
+			state->cq_ring = NULL;
+			return -errno;
+		}
+	}
+
+	state->sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+	state->sqes = mmap(NULL, state->sqes_size, PROT_READ | PROT_WRITE,
+			   MAP_SHARED | MAP_POPULATE, state->fd,
+			   IORING_OFF_SQES);
+	if (state->sqes == MAP_FAILED) {
+		state->sqes = NULL;
+		return -errno;
+	}
+
+	ptr = state->sq_ring;
+	state->sq_head = (unsigned int *)(ptr + params.sq_off.head);
+	state->sq_tail = (unsigned int *)(ptr + params.sq_off.tail);
+	state->sq_mask = *(unsigned int *)(ptr + params.sq_off.ring_mask);
+	state->sq_array = (unsigned int *)(ptr + params.sq_off.array);
+
+	ptr = state->cq_ring;
+	state->cq_head = (unsigned int *)(ptr + params.cq_off.head);
+	state->cq_tail = (unsigned int *)(ptr + params.cq_off.tail);
+	state->cq_mask = *(unsigned int *)(ptr + params.cq_off.ring_mask);
+	state->cqes = (struct io_uring_cqe *)(ptr + params.cq_off.cqes);
+
+	return 0;
+}
+
+static void ring_release(struct io_uring_state *state)
+{
+	if (state->sqes)
+		munmap(state->sqes, state->sqes_size);
+	if (state->cq_ring && state->cq_ring != state->sq_ring)
+		munmap(state->cq_ring, state->cq_ring_size);
+	if (state->sq_ring)
+		munmap(state->sq_ring, state->sq_ring_size);
+	if (state->fd >= 0)
+		close(state->fd);
+}
+
+static int submit_block(struct container_context *cntr, unsigned int index,
+			unsigned int byte_count, off64_t offset)
+{
+	struct io_uring_state *state = cntr->io_private_data;
+	struct block *block = &state->blocks[index];
+	struct io_uring_sqe *sqe;
+	unsigned int tail;
+	int err;
+
+	tail = *state->sq_tail;
+	sqe = &state->sqes[tail & state->sq_mask];
+	memset(sqe, 0, sizeof(*sqe));
+	if (cntr->type == CONTAINER_TYPE_BUILDER)
+		sqe->opcode = IORING_OP_WRITE;
+	else
+		sqe->opcode = IORING_OP_READ;
+	sqe->fd = cntr->fd;
+	sqe->addr = (unsigned long)block->buf;
+	sqe->len = byte_count;
+	sqe->off = offset;
+	sqe->user_data = index;
+	block->offset = offset;
+	state->sq_array[tail & state->sq_mask] = tail & state->sq_mask;
+	__atomic_store_n(state->sq_tail, tail + 1, __ATOMIC_RELEASE);
+
+	while (1) {
+		err = syscall(__NR_io_uring_enter, state->fd, 1, 0, 0, NULL, 0);
+		if (err >= 0)
+			break;
+		if (errno != EINTR)
+			return -errno;
+	}
+
+	block->busy = true;
+	return 0;
+}
+
+// Reap completions until the block is available.
+static int wait_block(struct container_context *cntr, struct block *block)
+{
+	struct io_uring_state *state = cntr->io_private_data;
+	struct io_uring_cqe *cqe;
+	unsigned int head;
+	int err;
+
+	while (block->busy) {
+		head = *state->cq_head;
+		if (head == __atomic_load_n(state->cq_tail, __ATOMIC_ACQUIRE)) {
+			err = syscall(__NR_io_uring_enter, state->fd, 0, 1,
+				      IORING_ENTER_GETEVENTS, NULL, 0);
+			if (err < 0 && errno != EINTR)
+				return -errno;
+			continue;
+		}
+
+		cqe = &state->cqes[head & state->cq_mask];
+		state->blocks[cqe->user_data].result = cqe->res;
+		state->blocks[cqe->user_data].busy = false;
+		__atomic_store_n(state->cq_head, head + 1, __ATOMIC_RELEASE);
+	}
+
+	return 0;
+}
+
+// Check result of a write request. A short write is completed synchronously,
+// it is expected not to happen for regular files unless the disk is full.
+static int complete_write(struct container_context *cntr, struct block *block)
+{
+	ssize_t result;
+	unsigned int pos;
+	int err;
+
+	err = wait_block(cntr, block);
+	if (err < 0)
+		return err;
+	if (block->result < 0)
+		return block->result;
+
+	pos = block->result;
+	while (pos < block->pos) {
+		result = pwrite64(cntr->fd, block->buf + pos, block->pos - pos,
+				  block->offset + pos);
+		if (result < 0) {
+			if (errno == EINTR)
+				continue;
+			return -errno;
+		}
+		if (result == 0)
+			return -ENOSPC;
+		pos += result;
+	}
+	block->pos = 0;
+
+	return 0;
+}
+
+static int io_uring_write(struct container_context *cntr, void *buffer,
+			  unsigned int byte_count)
+{
+	struct io_uring_state *state = cntr->io_private_data;
+	char *src = buffer;
+	struct block *block;
+	unsigned int size;
+	int err;
+
+	while (byte_count > 0) {
+		block = &state->blocks[state->index];
+		if (block->busy) {
+			// The oldest request in flight.
+			err = complete_write(cntr, block);
+			if (err < 0)
+				return err;
+		}
+
+		size = IO_BLOCK_SIZE - block->pos;
+		if (size > byte_count)
+			size = byte_count;
+		memcpy(block->buf + block->pos, src, size);
+		block->pos += size;
+		src += size;
+		byte_count -= size;
+
+		if (block->pos == IO_BLOCK_SIZE) {
+			err = submit_block(cntr, state->index, IO_BLOCK_SIZE,
+					   state->offset);
+			if (err < 0)
+				return err;
+			state->offset += IO_BLOCK_SIZE;
+			state->index = (state->index + 1) % state->block_count;
+		}
+	}
+
+	return 0;
+}
+
+static int io_uring_read(struct container_context *cntr, void *buffer,
+			 unsigned int byte_count)
+{
+	struct io_uring_state *state = cntr->io_private_data;
+	char *dst = buffer;
+	struct block *block;
+	unsigned int size;
+	int err;
+
+	while (byte_count > 0 && !cntr->interrupted) {
+		block = &state->blocks[state->index];
+		err = wait_block(cntr, block);
+		if (err < 0)
+			return err;
+		if (block->result < 0)
+			return block->result;
+
+		if (block->pos == block->result) {
+			// Reach EOF.
+			cntr->eof = true;
+			return 0;
+		}
+
+		size = block->result - block->pos;
+		if (size > byte_count)
+			size = byte_count;
+		memcpy(dst, block->buf + block->pos, size);
+		block->pos += size;
+		dst += size;
+		byte_count -= size;
+
+		// Queue the consumed block again for the next part of file.
+		if (block->pos == IO_BLOCK_SIZE) {
+			block->pos = 0;
+			err = submit_block(cntr, state->index, IO_BLOCK_SIZE,
+					   state->offset);
+			if (err < 0)
+				return err;
+			state->offset += IO_BLOCK_SIZE;
+			state->index = (state->index + 1) % state->block_count;
+		}
+	}
+
+	if (cntr->interrupted)
+		return -EINTR;
+
+	return 0;
+}
+
+static int io_uring_flush(struct container_context *cntr)
+{
+	struct io_uring_state *state = cntr->io_private_data;
+	struct block *block;
+	unsigned int i;
+	int err = 0;
+	int result;
+
+	if (cntr->type == CONTAINER_TYPE_BUILDER) {
+		// Write out the partially filled block.
+		block = &state->blocks[state->index];
+		if (!block->busy && block->pos > 0) {
+			result = submit_block(cntr, state->index, block->pos,
+					      state->offset);
+			if (result < 0)
+				return result;
+			state->offset += block->pos;
+			state->index = (state->index + 1) % state->block_count;
+		}
+	}
+
+	for (i = 0; i < state->block_count; ++i) {
+		block = &state->blocks[i];
+		if (cntr->type == CONTAINER_TYPE_BUILDER && block->busy)
+			result = complete_write(cntr, block);
+		else
+			result = wait_block(cntr, block);
+		if (result < 0 && err == 0)
+			err = result;
+	}
+
+	// The post-process of builders rewrites the header by usual I/O.
+	if (cntr->type == CONTAINER_TYPE_BUILDER &&
+	    lseek64(cntr->fd, state->offset, SEEK_SET) < 0 && err == 0)
+		err = -errno;
+
+	return err;
+}
+
+static void io_uring_destroy(struct container_context *cntr)
+{
+	struct io_uring_state *state = cntr->io_private_data;
+	unsigned int i;
+
+	if (state->blocks) {
+		for (i = 0; i < state->block_count; ++i) {
+			if (state->blocks[i].busy)
+				wait_block(cntr, &state->blocks[i]);
+			free(state->blocks[i].buf);
+		}
+		free(state->blocks);
+	}
+	ring_release(state);
+	free(state);
+
+	cntr->io_ops = NULL;
+	cntr->io_private_data = NULL;
+}
+
+static const struct container_io_ops io_uring_ops = {
+	.flush = io_uring_flush,
+	.destroy = io_uring_destroy,
+};
+
+int container_context_attach_io_uring(struct container_context *cntr,
+				      unsigned int depth)
+{
+	struct io_uring_state *state;
+	struct stat st;
+	unsigned int i;
+	int err;
+
+	assert(cntr);
+
+	if (depth == 0)
+		return 0;
+
+	// Encoded frames in FLAC are handled by own I/O of the container.
+	if (cntr->format == CONTAINER_FORMAT_FLAC)
+		return 0;
+
+	assert(cntr->io_ops == NULL);
+
+	// Requests in flight are not ordered for pipes and character devices.
+	if (cntr->stdio || fstat(cntr->fd, &st) < 0 || !S_ISREG(st.st_mode)) {
+		if (cntr->verbose > 0)
+			fprintf(stderr, "  io_uring: not a regular file, use "
+				"blocking I/O\n");
+		return 0;
+	}
+
+	state = calloc(1, sizeof(*state));
+	if (state == NULL)
+		return -ENOMEM;
+	state->fd = -1;
+	cntr->io_ops = &io_uring_ops;
+	cntr->io_private_data = state;
+
+	state->offset = lseek64(cntr->fd, 0, SEEK_CUR);
+	if (state->offset < 0) {
+		err = -errno;
+		goto error;
+	}
+
+	state->blocks = calloc(depth, sizeof(*state->blocks));
+	if (state->blocks == NULL) {
+		err = -ENOMEM;
+		goto error;
+	}
+	state->block_count = depth;
+	for (i = 0; i < depth; ++i) {
+		err = posix_memalign((void **)&state->blocks[i].buf, 4096,
+				     IO_BLOCK_SIZE);
+		if (err > 0) {
+			state->blocks[i].buf = NULL;
+			err = -err;
+			goto error;
+		}
+	}
+
+	err = ring_setup(state, depth);
+	if (err < 0) {
+		// The running kernel has no io_uring, rejects the parameters,
+		// disables it by sysctl or seccomp filter, or the locked
+		// memory is limited for the rings of older kernels.
+		if (err == -ENOSYS || err == -EINVAL || err == -EPERM ||
+		    err == -ENOMEM) {
+			if (cntr->verbose > 0)
+				fprintf(stderr, "  io_uring: unavailable (%s), "
+					"use blocking I/O\n", strerror(-err));
+			io_uring_destroy(cntr);
+			return 0;
+		}
+		goto error;
+	}
+
+	if (cntr->type == CONTAINER_TYPE_PARSER) {
+		// Read ahead with all of blocks.
+		for (i = 0; i < depth; ++i) {
+			err = submit_block(cntr, i, IO_BLOCK_SIZE, state->offset);
+			if (err < 0)
+				goto error;
+			state->offset += IO_BLOCK_SIZE;
+		}
+		cntr->process_bytes = io_uring_read;
+	} else {
+		cntr->process_bytes = io_uring_write;
+	}
+
+	if (cntr->verbose > 0) {
+		fprintf(stderr, "  io_uring: %u blocks of %u bytes\n",
+			depth, IO_BLOCK_SIZE);
+	}
+
+	return 0;
+error:
+	io_uring_destroy(cntr);
+	return err;
+}
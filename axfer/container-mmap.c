@@ -0,0 +1,188 @@
+// SPDX-License-Identifier: GPL-2.0
+//
+// container-mmap.c - read sample data from memory mapped file.
+//
+// Licensed under the terms of the GNU General Public License, version 2.
+
+#include "container.h"
+#include "misc.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+// The size of window to read ahead. The kernel is advised to read the next
+// window when the half of current one is consumed.
+#define READ_AHEAD_SIZE	(2 * 1024 * 1024)
+
+struct mmap_state {
+	char *addr;
+	off64_t size;
+	off64_t pos;
+	off64_t ra_end;
+};
+
+static void read_ahead(struct mmap_state *state)
+{
+	off64_t size;
+
+	if (state->ra_end >= state->size ||
+	    state->pos + READ_AHEAD_SIZE / 2 < state->ra_end)
+		return;
+
+	size = state->size - state->ra_end;
+	if (size > READ_AHEAD_SIZE)
+		size = READ_AHEAD_SIZE;
+	madvise(state->addr + state->ra_end, size, MADV_WILLNEED);
+	state->ra_end += size;
+}
+
+static int mmap_read(struct container_context *cntr, void *buffer,
+		     unsigned int byte_count)
+{
+	struct mmap_state *state = cntr->io_private_data;
+
+	if (byte_count > state->size - state->pos) {
+		byte_count = state->size - state->pos;
+		cntr->eof = true;
+	}
+
+	memcpy(buffer, state->addr + state->pos, byte_count);
+	state->pos += byte_count;
+	read_ahead(state);
+
+	return 0;
+}
+
+static int mmap_flush(struct container_context *cntr)
+{
+	return 0;
+}
+
+static void mmap_destroy(struct container_context *cntr)
+{
+	struct mmap_state *state = cntr->io_private_data;
+
+	if (state->addr)
+		munmap(state->addr, state->size);
+	free(state);
+
+	cntr->io_ops = NULL;
+	cntr->io_private_data = NULL;
+}
+
+static const struct container_io_ops mmap_ops = {
+	.flush = mmap_flush,
+	.destroy = mmap_destroy,
+};
+
+int container_context_map_frames(struct container_context *cntr,
+				 void **frame_buffer,
+				 unsigned int *frame_count)
+{
+	struct mmap_state *state = cntr->io_private_data;
+	unsigned int bytes_per_frame;
+	uint64_t byte_count;
+
+	assert(cntr);
+	assert(frame_buffer);
+	assert(frame_count);
+
+	if (cntr->io_ops != &mmap_ops)
+		return -ENXIO;
+
+	bytes_per_frame = cntr->bytes_per_sample * cntr->samples_per_frame;
+	byte_count = (uint64_t)*frame_count * bytes_per_frame;
+
+	// The same limitation as the usual I/O.
+	if (cntr->handled_byte_count > cntr->max_size - byte_count)
+		byte_count = cntr->max_size - cntr->handled_byte_count;
+	if (byte_count > state->size - state->pos) {
+		byte_count = state->size - state->pos;
+		cntr->eof = true;
+	}
+	byte_count -= byte_count % bytes_per_frame;
+
+	*frame_buffer = state->addr + state->pos;
+	state->pos += byte_count;
+	read_ahead(state);
+
+	cntr->handled_byte_count += byte_count;
+	if (cntr->handled_byte_count == cntr->max_size)
+		cntr->eof = true;
+
+	*frame_count = byte_count / bytes_per_frame;
+
+	return 0;
+}
+
+int container_context_attach_mmap(struct container_context *cntr)
+{
+	struct mmap_state *state;
+	struct stat st;
+	off64_t pos;
+	void *addr;
+
+	assert(cntr);
+	assert(cntr->type == CONTAINER_TYPE_PARSER);
+
+	// Encoded frames in FLAC are decoded by the parser.
+	if (cntr->format == CONTAINER_FORMAT_FLAC)
+		return 0;
+
+	assert(cntr->io_ops == NULL);
+
+	if (cntr->stdio || fstat(cntr->fd, &st) < 0 || !S_ISREG(st.st_mode))
+		goto fallback;
+
+	// Data frames in Creative Voice file can be split into several blocks.
+	if (cntr->format == CONTAINER_FORMAT_VOC)
+		goto fallback;
+
+	pos = lseek64(cntr->fd, 0, SEEK_CUR);
+	if (pos < 0)
+		return -errno;
+
+	// The first 4 bytes were already read to detect raw container. They
+	// are available in the mapped area.
+	if (cntr->format == CONTAINER_FORMAT_RAW && !cntr->magic_handled)
+		pos -= sizeof(cntr->magic);
+
+	if (st.st_size <= pos)
+		goto fallback;
+
+	addr = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, cntr->fd, 0);
+	if (addr == MAP_FAILED)
+		goto fallback;
+
+	state = calloc(1, sizeof(*state));
+	if (state == NULL) {
+		munmap(addr, st.st_size);
+		return -ENOMEM;
+	}
+	state->addr = addr;
+	state->size = st.st_size;
+	state->pos = pos;
+	state->ra_end = pos & ~((off64_t)sysconf(_SC_PAGESIZE) - 1);
+
+	madvise(state->addr, state->size, MADV_SEQUENTIAL);
+	read_ahead(state);
+
+	cntr->io_ops = &mmap_ops;
+	cntr->io_private_data = state;
+	cntr->process_bytes = mmap_read;
+	cntr->magic_handled = true;
+
+	if (cntr->verbose > 0) {
+		fprintf(stderr, "  mmap: %lu bytes\n",
+			(unsigned long)state->size);
+	}
+
+	return 0;
+fallback:
+	if (cntr->verbose > 0)
+		fprintf(stderr, "  mmap: not available, use usual I/O\n");
+	return 0;
+}
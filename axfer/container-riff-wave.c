@@ -18,15 +18,45 @@
 // - RFC 2361 'WAVE and AVI Codec Registries' at ietf.org
 // - 'mmreg.h' in Wine project
 // - 'mmreg.h' in ReactOS project
+// - EBU Tech 3306 'RF64: An extended File Format for Audio' at tech.ebu.ch
+// - 'Sony Wave64' in 'libsndfile' project
 
 #define RIFF_MAGIC		"RIF"	// A common part.
+#define RF64_MAGIC		"RF64"
+#define W64_MAGIC		"riff"
 
 #define RIFF_CHUNK_ID_LE	"RIFF"
 #define RIFF_CHUNK_ID_BE	"RIFX"
+#define RIFF_CHUNK_ID_RF64	"RF64"
 #define RIFF_FORM_WAVE		"WAVE"
+#define DS64_SUBCHUNK_ID	"ds64"
 #define FMT_SUBCHUNK_ID		"fmt "
 #define DATA_SUBCHUNK_ID	"data"
 
+// The size in 32 bit fields of RF64 to refer to ds64 subchunk.
+#define RF64_SIZE_IN_DS64	UINT32_MAX
+
+// Chunks of Wave64 are identified by GUID, and aligned to 8 bytes.
+#define W64_GUID_SIZE		16
+#define W64_ALIGN		8
+
+static const uint8_t w64_guid_riff[W64_GUID_SIZE] = {
+	'r', 'i', 'f', 'f', 0x2e, 0x91, 0xcf, 0x11,
+	0xa5, 0xd6, 0x28, 0xdb, 0x04, 0xc1, 0x00, 0x00,
+};
+static const uint8_t w64_guid_wave[W64_GUID_SIZE] = {
+	'w', 'a', 'v', 'e', 0xf3, 0xac, 0xd3, 0x11,
+	0x8c, 0xd1, 0x00, 0xc0, 0x4f, 0x8e, 0xdb, 0x8a,
+};
+static const uint8_t w64_guid_fmt[W64_GUID_SIZE] = {
+	'f', 'm', 't', ' ', 0xf3, 0xac, 0xd3, 0x11,
+	0x8c, 0xd1, 0x00, 0xc0, 0x4f, 0x8e, 0xdb, 0x8a,
+};
+static const uint8_t w64_guid_data[W64_GUID_SIZE] = {
+	'd', 'a', 't', 'a', 0xf3, 0xac, 0xd3, 0x11,
+	0x8c, 0xd1, 0x00, 0xc0, 0x4f, 0x8e, 0xdb, 0x8a,
+};
+
 // See 'WAVE and AVI Codec Registries (Historic Registry)' in 'iana.org'.
 // https://www.iana.org/assignments/wave-avi-codec-registry/
 enum wave_format {
@@ -113,8 +143,33 @@ struct wave_data_subchunk {
 	uint8_t frames[0];
 };
 
+// The table of chunk sizes is not used.
+struct rf64_ds64_subchunk {
+	uint8_t id[4];
+	uint32_t size;
+
+	uint32_t riff_size_low;
+	uint32_t riff_size_high;
+	uint32_t data_size_low;
+	uint32_t data_size_high;
+	uint32_t sample_count_low;
+	uint32_t sample_count_high;
+	uint32_t table_length;
+	uint8_t table[0];
+};
+
+// The size includes the header itself.
+struct w64_chunk {
+	uint8_t guid[W64_GUID_SIZE];
+	uint64_t size;
+
+	uint8_t data[0];
+};
+
 struct parser_state {
 	bool be;
+	bool rf64;
+	uint64_t ds64_data_size;
 	enum wave_format format;
 	unsigned int samples_per_frame;
 	unsigned int frames_per_second;
@@ -122,7 +177,7 @@ struct parser_state {
 	unsigned int bytes_per_frame;
 	unsigned int bytes_per_sample;
 	unsigned int avail_bits_in_sample;
-	unsigned int byte_count;
+	uint64_t byte_count;
 };
 
 static int parse_riff_chunk_header(struct parser_state *state,
@@ -133,6 +188,8 @@ static int parse_riff_chunk_header(struct parser_state *state,
 		state->be = true;
 	else if (!memcmp(chunk->id, RIFF_CHUNK_ID_LE, sizeof(chunk->id)))
 		state->be = false;
+	else if (!memcmp(chunk->id, RIFF_CHUNK_ID_RF64, sizeof(chunk->id)))
+		state->rf64 = true;
 	else
 		return -EINVAL;
 
@@ -220,6 +277,19 @@ static int parse_wave_data_subchunk(struct parser_state *state,
 	else
 		state->byte_count = le32toh(subchunk->size);
 
+	// The actual size is in ds64 subchunk.
+	if (state->rf64 && state->byte_count == RF64_SIZE_IN_DS64)
+		state->byte_count = state->ds64_data_size;
+
+	return 0;
+}
+
+static int parse_rf64_ds64_subchunk(struct parser_state *state,
+				    struct rf64_ds64_subchunk *subchunk)
+{
+	state->ds64_data_size = ((uint64_t)le32toh(subchunk->data_size_high) << 32) |
+				le32toh(subchunk->data_size_low);
+
 	return 0;
 }
 
@@ -229,11 +299,13 @@ static int parse_wave_subchunk(struct container_context *cntr)
 		struct riff_subchunk subchunk;
 		struct wave_fmt_subchunk fmt_subchunk;
 		struct wave_data_subchunk data_subchunk;
+		struct rf64_ds64_subchunk ds64_subchunk;
 	} buf = {0};
 	enum {
 		SUBCHUNK_TYPE_UNKNOWN = -1,
 		SUBCHUNK_TYPE_FMT,
 		SUBCHUNK_TYPE_DATA,
+		SUBCHUNK_TYPE_DS64,
 	} subchunk_type;
 	struct parser_state *state = cntr->private_data;
 	unsigned int required_size;
@@ -261,6 +333,10 @@ static int parse_wave_subchunk(struct container_context *cntr)
 		} else if (!memcmp(buf.subchunk.id, DATA_SUBCHUNK_ID,
 				   sizeof(buf.subchunk.id))) {
 			subchunk_type = SUBCHUNK_TYPE_DATA;
+		} else if (state->rf64 &&
+			   !memcmp(buf.subchunk.id, DS64_SUBCHUNK_ID,
+				   sizeof(buf.subchunk.id))) {
+			subchunk_type = SUBCHUNK_TYPE_DS64;
 		} else {
 			subchunk_type = SUBCHUNK_TYPE_UNKNOWN;
 		}
@@ -271,6 +347,10 @@ static int parse_wave_subchunk(struct container_context *cntr)
 				required_size =
 					sizeof(struct wave_fmt_subchunk) -
 					sizeof(struct riff_chunk);
+			} else if (subchunk_type == SUBCHUNK_TYPE_DS64) {
+				required_size =
+					sizeof(struct rf64_ds64_subchunk) -
+					sizeof(struct riff_chunk);
 			} else {
 				required_size =
 					sizeof(struct wave_data_subchunk)-
@@ -294,6 +374,9 @@ static int parse_wave_subchunk(struct container_context *cntr)
 			} else if (subchunk_type == SUBCHUNK_TYPE_DATA) {
 				err = parse_wave_data_subchunk(state,
 							 &buf.data_subchunk);
+			} else {
+				err = parse_rf64_ds64_subchunk(state,
+							 &buf.ds64_subchunk);
 			}
 			if (err < 0)
 				return err;
@@ -340,6 +423,113 @@ static int parse_riff_wave_format(struct container_context *cntr)
 	return 0;
 }
 
+static int skip_w64_chunk_data(struct container_context *cntr, uint64_t size)
+{
+	uint8_t buf[64];
+	unsigned int consume;
+	int err;
+
+	while (size > 0) {
+		if (size > sizeof(buf))
+			consume = sizeof(buf);
+		else
+			consume = size;
+
+		err = container_recursive_read(cntr, buf, consume);
+		if (err < 0)
+			return err;
+		if (cntr->eof)
+			return 0;
+		size -= consume;
+	}
+
+	return 0;
+}
+
+static int parse_w64_format(struct container_context *cntr)
+{
+	struct parser_state *state = cntr->private_data;
+	union {
+		struct w64_chunk chunk;
+		struct wave_fmt_subchunk fmt_subchunk;
+	} buf = {0};
+	unsigned int required_size;
+	uint64_t chunk_size;
+	uint64_t data_size;
+	int err;
+
+	// Chunk header. 4 bytes were alread read to detect container type.
+	memcpy(buf.chunk.guid, cntr->magic, sizeof(cntr->magic));
+	err = container_recursive_read(cntr,
+				       (char *)&buf.chunk + sizeof(cntr->magic),
+				       sizeof(buf.chunk) - sizeof(cntr->magic));
+	if (err < 0)
+		return err;
+	if (cntr->eof)
+		return 0;
+	if (memcmp(buf.chunk.guid, w64_guid_riff, W64_GUID_SIZE))
+		return -EINVAL;
+
+	// Chunk data header.
+	err = container_recursive_read(cntr, &buf, W64_GUID_SIZE);
+	if (err < 0)
+		return err;
+	if (cntr->eof)
+		return 0;
+	if (memcmp(buf.chunk.guid, w64_guid_wave, W64_GUID_SIZE))
+		return -EINVAL;
+
+	while (1) {
+		err = container_recursive_read(cntr, &buf, sizeof(buf.chunk));
+		if (err < 0)
+			return err;
+		if (cntr->eof)
+			return 0;
+
+		chunk_size = le64toh(buf.chunk.size);
+		if (chunk_size < sizeof(struct w64_chunk))
+			return -EINVAL;
+		data_size = chunk_size - sizeof(struct w64_chunk);
+
+		// Found frame data.
+		if (!memcmp(buf.chunk.guid, w64_guid_data, W64_GUID_SIZE)) {
+			state->byte_count = data_size;
+			break;
+		}
+
+		if (!memcmp(buf.chunk.guid, w64_guid_fmt, W64_GUID_SIZE)) {
+			required_size = sizeof(struct wave_fmt_subchunk) -
+					sizeof(struct riff_subchunk);
+			if (data_size < required_size)
+				return -EINVAL;
+
+			err = container_recursive_read(cntr,
+						&buf.fmt_subchunk.format,
+						required_size);
+			if (err < 0)
+				return err;
+			if (cntr->eof)
+				return 0;
+			data_size -= required_size;
+
+			err = parse_wave_fmt_subchunk(state, &buf.fmt_subchunk);
+			if (err < 0)
+				return err;
+		}
+
+		// Go to next chunk aligned to 8 bytes.
+		if (chunk_size % W64_ALIGN)
+			data_size += W64_ALIGN - chunk_size % W64_ALIGN;
+		err = skip_w64_chunk_data(cntr, data_size);
+		if (err < 0)
+			return err;
+		if (cntr->eof)
+			return 0;
+	}
+
+	return 0;
+}
+
 static int wave_parser_pre_process(struct container_context *cntr,
 				   snd_pcm_format_t *format,
 				   unsigned int *samples_per_frame,
@@ -352,9 +542,14 @@ static int wave_parser_pre_process(struct container_context *cntr,
 	int i;
 	int err;
 
-	err = parse_riff_wave_format(cntr);
+	if (cntr->format == CONTAINER_FORMAT_W64)
+		err = parse_w64_format(cntr);
+	else
+		err = parse_riff_wave_format(cntr);
 	if (err < 0)
 		return err;
+	if (cntr->eof)
+		return 0;
 
 	phys_width = 8 * state->average_bytes_per_second /
 		     state->samples_per_frame / state->frames_per_second;
@@ -508,6 +703,141 @@ static int write_riff_chunk_for_wave(struct container_context *cntr,
 	return container_recursive_write(cntr, &buf, sizeof(buf.data_subchunk));
 }
 
+// Add the size of headers without overflow.
+static uint64_t add_header_size(uint64_t byte_count, uint64_t header_size)
+{
+	if (byte_count > UINT64_MAX - header_size)
+		return UINT64_MAX;
+	return byte_count + header_size;
+}
+
+static int write_rf64_chunk_for_wave(struct container_context *cntr,
+				     uint64_t byte_count)
+{
+	struct builder_state *state = cntr->private_data;
+	union {
+		struct riff_chunk chunk;
+		struct riff_chunk_data chunk_data;
+		struct rf64_ds64_subchunk ds64_subchunk;
+		struct wave_fmt_subchunk fmt_subchunk;
+		struct wave_data_subchunk data_subchunk;
+	} buf = {0};
+	uint64_t riff_size;
+	uint64_t frame_count;
+	int err;
+
+	// Chunk header. The size is in ds64 subchunk.
+	memcpy(buf.chunk.id, RIFF_CHUNK_ID_RF64, sizeof(buf.chunk.id));
+	buf.chunk.size = htole32(RF64_SIZE_IN_DS64);
+	err = container_recursive_write(cntr, &buf, sizeof(buf.chunk));
+	if (err < 0)
+		return err;
+
+	// Chunk data header.
+	memcpy(buf.chunk_data.id, RIFF_FORM_WAVE, sizeof(buf.chunk_data.id));
+	err = container_recursive_write(cntr, &buf, sizeof(buf.chunk_data));
+	if (err < 0)
+		return err;
+
+	// The first subchunk should have the actual sizes.
+	riff_size = add_header_size(byte_count,
+				    sizeof(struct riff_chunk_data) +
+				    sizeof(struct rf64_ds64_subchunk) +
+				    sizeof(struct wave_fmt_subchunk) +
+				    sizeof(struct wave_data_subchunk));
+	frame_count = byte_count /
+		      (state->bytes_per_sample * state->samples_per_frame);
+	memset(&buf, 0, sizeof(buf));
+	build_subchunk_header((struct riff_subchunk *)&buf.ds64_subchunk,
+			      DS64_SUBCHUNK_ID,
+			      sizeof(struct rf64_ds64_subchunk) -
+			      sizeof(struct riff_subchunk), false);
+	buf.ds64_subchunk.riff_size_low = htole32(riff_size);
+	buf.ds64_subchunk.riff_size_high = htole32(riff_size >> 32);
+	buf.ds64_subchunk.data_size_low = htole32(byte_count);
+	buf.ds64_subchunk.data_size_high = htole32(byte_count >> 32);
+	buf.ds64_subchunk.sample_count_low = htole32(frame_count);
+	buf.ds64_subchunk.sample_count_high = htole32(frame_count >> 32);
+	err = container_recursive_write(cntr, &buf, sizeof(buf.ds64_subchunk));
+	if (err < 0)
+		return err;
+
+	// A subchunk in the chunk data for WAVE format.
+	build_wave_format_subchunk(&buf.fmt_subchunk, state);
+	err = container_recursive_write(cntr, &buf, sizeof(buf.fmt_subchunk));
+	if (err < 0)
+		return err;
+
+	// A subchunk in the chunk data for WAVE data.
+	build_wave_data_subchunk(&buf.data_subchunk, RF64_SIZE_IN_DS64, false);
+	return container_recursive_write(cntr, &buf, sizeof(buf.data_subchunk));
+}
+
+static int write_w64_chunk_for_wave(struct container_context *cntr,
+				    uint64_t byte_count)
+{
+	struct builder_state *state = cntr->private_data;
+	union {
+		struct w64_chunk chunk;
+		struct wave_fmt_subchunk fmt_subchunk;
+	} buf = {0};
+	unsigned int fmt_size;
+	uint64_t size;
+	int err;
+
+	// No extensions. The size is multiples of 8.
+	fmt_size = sizeof(struct wave_fmt_subchunk) -
+		   sizeof(struct riff_subchunk);
+
+	// Chunk header.
+	size = add_header_size(byte_count,
+			       sizeof(struct w64_chunk) + W64_GUID_SIZE +
+			       sizeof(struct w64_chunk) + fmt_size +
+			       sizeof(struct w64_chunk));
+	memcpy(buf.chunk.guid, w64_guid_riff, W64_GUID_SIZE);
+	buf.chunk.size = htole64(size);
+	err = container_recursive_write(cntr, &buf, sizeof(buf.chunk));
+	if (err < 0)
+		return err;
+
+	// Chunk data header.
+	err = container_recursive_write(cntr, (void *)w64_guid_wave,
+					W64_GUID_SIZE);
+	if (err < 0)
+		return err;
+
+	// A chunk for WAVE format.
+	memcpy(buf.chunk.guid, w64_guid_fmt, W64_GUID_SIZE);
+	buf.chunk.size = htole64(sizeof(struct w64_chunk) + fmt_size);
+	err = container_recursive_write(cntr, &buf, sizeof(buf.chunk));
+	if (err < 0)
+		return err;
+	build_wave_format_subchunk(&buf.fmt_subchunk, state);
+	err = container_recursive_write(cntr, &buf.fmt_subchunk.format,
+					fmt_size);
+	if (err < 0)
+		return err;
+
+	// A chunk for WAVE data.
+	memcpy(buf.chunk.guid, w64_guid_data, W64_GUID_SIZE);
+	buf.chunk.size = htole64(add_header_size(byte_count,
+						 sizeof(struct w64_chunk)));
+	return container_recursive_write(cntr, &buf, sizeof(buf.chunk));
+}
+
+static int write_container_header(struct container_context *cntr,
+				  uint64_t byte_count)
+{
+	switch (cntr->format) {
+	case CONTAINER_FORMAT_RF64:
+		return write_rf64_chunk_for_wave(cntr, byte_count);
+	case CONTAINER_FORMAT_W64:
+		return write_w64_chunk_for_wave(cntr, byte_count);
+	default:
+		return write_riff_chunk_for_wave(cntr, byte_count);
+	}
+}
+
 static int wave_builder_pre_process(struct container_context *cntr,
 				    snd_pcm_format_t *format,
 				    unsigned int *samples_per_frame,
@@ -533,7 +863,11 @@ static int wave_builder_pre_process(struct container_context *cntr,
 
 	state->be = (snd_pcm_format_big_endian(*format) == 1);
 
-	return write_riff_chunk_for_wave(cntr, *byte_count);
+	// RF64 and Wave64 have no variant for big endian.
+	if (state->be && cntr->format != CONTAINER_FORMAT_RIFF_WAVE)
+		return -EINVAL;
+
+	return write_container_header(cntr, *byte_count);
 }
 
 static int wave_builder_post_process(struct container_context *cntr,
@@ -545,7 +879,8 @@ static int wave_builder_post_process(struct container_context *cntr,
 	if (err < 0)
 		return err;
 
-	return write_riff_chunk_for_wave(cntr, handled_byte_count);
+	// Just the header is rewritten.
+	return write_container_header(cntr, handled_byte_count);
 }
 
 const struct container_parser container_parser_riff_wave = {
@@ -573,3 +908,44 @@ const struct container_builder container_builder_riff_wave = {
 	},
 	.private_size = sizeof(struct builder_state),
 };
+
+// The sizes are 64 bit, thus no limitation in practice.
+const struct container_parser container_parser_rf64 = {
+	.format = CONTAINER_FORMAT_RF64,
+	.magic = RF64_MAGIC,
+	.max_size = UINT64_MAX,
+	.ops = {
+		.pre_process	= wave_parser_pre_process,
+	},
+	.private_size = sizeof(struct parser_state),
+};
+
+const struct container_builder container_builder_rf64 = {
+	.format = CONTAINER_FORMAT_RF64,
+	.max_size = UINT64_MAX,
+	.ops = {
+		.pre_process	= wave_builder_pre_process,
+		.post_process	= wave_builder_post_process,
+	},
+	.private_size = sizeof(struct builder_state),
+};
+
+const struct container_parser container_parser_w64 = {
+	.format = CONTAINER_FORMAT_W64,
+	.magic = W64_MAGIC,
+	.max_size = UINT64_MAX,
+	.ops = {
+		.pre_process	= wave_parser_pre_process,
+	},
+	.private_size = sizeof(struct parser_state),
+};
+
+const struct container_builder container_builder_w64 = {
+	.format = CONTAINER_FORMAT_W64,
+	.max_size = UINT64_MAX,
+	.ops = {
+		.pre_process	= wave_builder_pre_process,
+		.post_process	= wave_builder_post_process,
+	},
+	.private_size = sizeof(struct builder_state),
+};
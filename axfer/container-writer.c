@@ -0,0 +1,294 @@
+// SPDX-License-Identifier: GPL-2.0
+//
+// container-writer.c - a thread to write sample data to a built container.
+//
+// Licensed under the terms of the GNU General Public License, version 2.
+
+#include "container.h"
+#include "misc.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <poll.h>
+#include <pthread.h>
+
+// The caller of 'process_bytes' only copies data frames to a ring of blocks.
+// The blocks are written by a dedicated thread so that stalls of filesystem
+// such as writeback of page cache don't delay the transmission of PCM frames.
+
+struct block {
+	char *buf;
+	unsigned int size;
+};
+
+struct writer_state {
+	pthread_t thread;
+	pthread_mutex_t lock;
+	pthread_cond_t filled;
+	pthread_cond_t released;
+	bool running;
+	bool closing;
+	int err;
+
+	struct block *blocks;
+	unsigned int block_count;
+	unsigned int block_size;
+	unsigned int head;	// The oldest block to be written.
+	unsigned int tail;	// The block to be filled.
+	unsigned int count;	// The number of blocks to be written.
+
+	// Statistics.
+	unsigned int peak_count;
+	unsigned int stall_count;
+};
+
+static int write_block(struct container_context *cntr, struct block *block)
+{
+	struct pollfd pfd;
+	ssize_t result;
+	unsigned int pos = 0;
+
+	while (pos < block->size) {
+		result = write(cntr->fd, block->buf + pos, block->size - pos);
+		if (result < 0) {
+			if (errno == EINTR)
+				continue;
+			// The descriptor is in non-blocking mode. Unix signals
+			// are blocked in this thread, thus the flag to abort
+			// is checked periodically.
+			if (errno == EAGAIN) {
+				if (container_context_aborted(cntr))
+					return -EINTR;
+				pfd.fd = cntr->fd;
+				pfd.events = POLLOUT;
+				poll(&pfd, 1, CONTAINER_ABORT_CHECK_MSEC);
+				continue;
+			}
+			return -errno;
+		}
+		pos += result;
+	}
+
+	return 0;
+}
+
+static void *writer_thread(void *arg)
+{
+	struct container_context *cntr = arg;
+	struct writer_state *state = cntr->io_private_data;
+	struct block *block;
+	bool failed;
+	int err;
+
+	pthread_mutex_lock(&state->lock);
+	while (1) {
+		while (state->count == 0 && !state->closing)
+			pthread_cond_wait(&state->filled, &state->lock);
+		if (state->count == 0)
+			break;
+		block = &state->blocks[state->head];
+		failed = state->err < 0;
+		pthread_mutex_unlock(&state->lock);
+
+		// After any error, blocks are just released not to stall the
+		// caller.
+		err = 0;
+		if (!failed)
+			err = write_block(cntr, block);
+		block->size = 0;
+
+		pthread_mutex_lock(&state->lock);
+		if (err < 0)
+			state->err = err;
+		state->head = (state->head + 1) % state->block_count;
+		--state->count;
+		pthread_cond_signal(&state->released);
+	}
+	pthread_mutex_unlock(&state->lock);
+
+	return NULL;
+}
+
+static int queue_block(struct writer_state *state)
+{
+	bool stalled = false;
+	int err;
+
+	pthread_mutex_lock(&state->lock);
+	++state->count;
+	if (state->count > state->peak_count)
+		state->peak_count = state->count;
+	pthread_cond_signal(&state->filled);
+
+	// No block is available to be filled.
+	while (state->count == state->block_count) {
+		stalled = true;
+		pthread_cond_wait(&state->released, &state->lock);
+	}
+	if (stalled)
+		++state->stall_count;
+	err = state->err;
+	pthread_mutex_unlock(&state->lock);
+
+	state->tail = (state->tail + 1) % state->block_count;
+
+	return err;
+}
+
+static int writer_write(struct container_context *cntr, void *buffer,
+			unsigned int byte_count)
+{
+	struct writer_state *state = cntr->io_private_data;
+	char *src = buffer;
+	struct block *block;
+	unsigned int size;
+	int err;
+
+	while (byte_count > 0) {
+		block = &state->blocks[state->tail];
+		size = state->block_size - block->size;
+		if (size > byte_count)
+			size = byte_count;
+		memcpy(block->buf + block->size, src, size);
+		block->size += size;
+		src += size;
+		byte_count -= size;
+
+		if (block->size == state->block_size) {
+			err = queue_block(state);
+			if (err < 0)
+				return err;
+		}
+	}
+
+	return 0;
+}
+
+static void stop_thread(struct writer_state *state)
+{
+	pthread_mutex_lock(&state->lock);
+	state->closing = true;
+	pthread_cond_signal(&state->filled);
+	pthread_mutex_unlock(&state->lock);
+
+	pthread_join(state->thread, NULL);
+	state->running = false;
+}
+
+static int writer_flush(struct container_context *cntr)
+{
+	struct writer_state *state = cntr->io_private_data;
+
+	if (state->blocks[state->tail].size > 0)
+		queue_block(state);
+
+	stop_thread(state);
+
+	if (cntr->verbose > 0) {
+		fprintf(stderr, "  writer: peak %u/%u blocks, stalls %u\n",
+			state->peak_count, state->block_count,
+			state->stall_count);
+	}
+
+	return state->err;
+}
+
+static void writer_destroy(struct container_context *cntr)
+{
+	struct writer_state *state = cntr->io_private_data;
+	unsigned int i;
+
+	if (state->running)
+		stop_thread(state);
+
+	pthread_cond_destroy(&state->released);
+	pthread_cond_destroy(&state->filled);
+	pthread_mutex_destroy(&state->lock);
+
+	if (state->blocks) {
+		for (i = 0; i < state->block_count; ++i)
+			free(state->blocks[i].buf);
+		free(state->blocks);
+	}
+	free(state);
+
+	cntr->io_ops = NULL;
+	cntr->io_private_data = NULL;
+}
+
+static const struct container_io_ops writer_ops = {
+	.flush = writer_flush,
+	.destroy = writer_destroy,
+};
+
+int container_context_attach_writer(struct container_context *cntr,
+				    unsigned int depth,
+				    unsigned int block_size)
+{
+	struct writer_state *state;
+	sigset_t mask, prev;
+	unsigned int i;
+	int err;
+
+	assert(cntr);
+
+	if (depth == 0)
+		return 0;
+
+	// The builder of FLAC has own threads to encode and write frames.
+	if (cntr->format == CONTAINER_FORMAT_FLAC)
+		return 0;
+
+	assert(cntr->type == CONTAINER_TYPE_BUILDER);
+	assert(cntr->io_ops == NULL);
+	assert(block_size > 0);
+
+	state = calloc(1, sizeof(*state));
+	if (state == NULL)
+		return -ENOMEM;
+	pthread_mutex_init(&state->lock, NULL);
+	pthread_cond_init(&state->filled, NULL);
+	pthread_cond_init(&state->released, NULL);
+	cntr->io_ops = &writer_ops;
+	cntr->io_private_data = state;
+
+	state->blocks = calloc(depth, sizeof(*state->blocks));
+	if (state->blocks == NULL) {
+		err = -ENOMEM;
+		goto error;
+	}
+	state->block_count = depth;
+	state->block_size = block_size;
+	for (i = 0; i < depth; ++i) {
+		state->blocks[i].buf = malloc(block_size);
+		if (state->blocks[i].buf == NULL) {
+			err = -ENOMEM;
+			goto error;
+		}
+		// Touch all of pages in advance.
+		memset(state->blocks[i].buf, 0, block_size);
+	}
+
+	// UNIX signals are handled by the main thread.
+	sigfillset(&mask);
+	pthread_sigmask(SIG_BLOCK, &mask, &prev);
+	err = -pthread_create(&state->thread, NULL, writer_thread, cntr);
+	pthread_sigmask(SIG_SETMASK, &prev, NULL);
+	if (err < 0)
+		goto error;
+	state->running = true;
+
+	cntr->process_bytes = writer_write;
+
+	if (cntr->verbose > 0) {
+		fprintf(stderr, "  writer: %u blocks of %u bytes\n",
+			depth, block_size);
+	}
+
+	return 0;
+error:
+	writer_destroy(cntr);
+	return err;
+}
@@ -13,6 +13,8 @@
 #include <errno.h>
 #include <string.h>
 #include <fcntl.h>
+#include <sys/stat.h>
+#include <time.h>
 
 static const char *const cntr_type_labels[] = {
 	[CONTAINER_TYPE_PARSER] = "parser",
@@ -21,15 +23,21 @@ static const char *const cntr_type_labels[] = {
 
 static const char *const cntr_format_labels[] = {
 	[CONTAINER_FORMAT_RIFF_WAVE] = "riff/wave",
+	[CONTAINER_FORMAT_RF64] = "rf64",
+	[CONTAINER_FORMAT_W64] = "wave64",
 	[CONTAINER_FORMAT_AU] = "au",
 	[CONTAINER_FORMAT_VOC] = "voc",
+	[CONTAINER_FORMAT_FLAC] = "flac",
 	[CONTAINER_FORMAT_RAW] = "raw",
 };
 
 static const char *const suffixes[] = {
 	[CONTAINER_FORMAT_RIFF_WAVE]	= ".wav",
+	[CONTAINER_FORMAT_RF64]		= ".rf64",
+	[CONTAINER_FORMAT_W64]		= ".w64",
 	[CONTAINER_FORMAT_AU]		= ".au",
 	[CONTAINER_FORMAT_VOC]		= ".voc",
+	[CONTAINER_FORMAT_FLAC]		= ".flac",
 	[CONTAINER_FORMAT_RAW]		= "",
 };
 
@@ -38,6 +46,11 @@ const char *const container_suffix_from_format(enum container_format format)
 	return suffixes[format];
 }
 
+bool container_context_aborted(struct container_context *cntr)
+{
+	return cntr->abort_flag != NULL && *cntr->abort_flag;
+}
+
 int container_recursive_read(struct container_context *cntr, void *buf,
 			     unsigned int byte_count)
 {
@@ -52,8 +65,11 @@ int container_recursive_read(struct container_context *cntr, void *buf,
 			// mode. EINTR is not cought when get any interrupts.
 			if (cntr->interrupted)
 				return -EINTR;
-			if (errno == EAGAIN)
+			if (errno == EAGAIN) {
+				if (container_context_aborted(cntr))
+					return -EINTR;
 				continue;
+			}
 			return -errno;
 		}
 		// Reach EOF.
@@ -82,8 +98,11 @@ int container_recursive_write(struct container_context *cntr, void *buf,
 			// mode. EINTR is not cought when get any interrupts.
 			if (cntr->interrupted)
 				return -EINTR;
-			if (errno == EAGAIN)
+			if (errno == EAGAIN) {
+				if (container_context_aborted(cntr))
+					return -EINTR;
 				continue;
+			}
 			return -errno;
 		}
 
@@ -147,8 +166,11 @@ int container_parser_init(struct container_context *cntr,
 {
 	const struct container_parser *parsers[] = {
 		[CONTAINER_FORMAT_RIFF_WAVE] = &container_parser_riff_wave,
+		[CONTAINER_FORMAT_RF64] = &container_parser_rf64,
+		[CONTAINER_FORMAT_W64] = &container_parser_w64,
 		[CONTAINER_FORMAT_AU] = &container_parser_au,
 		[CONTAINER_FORMAT_VOC] = &container_parser_voc,
+		[CONTAINER_FORMAT_FLAC] = &container_parser_flac,
 	};
 	const struct container_parser *parser;
 	unsigned int size;
@@ -230,8 +252,11 @@ int container_builder_init(struct container_context *cntr,
 {
 	const struct container_builder *builders[] = {
 		[CONTAINER_FORMAT_RIFF_WAVE] = &container_builder_riff_wave,
+		[CONTAINER_FORMAT_RF64] = &container_builder_rf64,
+		[CONTAINER_FORMAT_W64] = &container_builder_w64,
 		[CONTAINER_FORMAT_AU] = &container_builder_au,
 		[CONTAINER_FORMAT_VOC] = &container_builder_voc,
+		[CONTAINER_FORMAT_FLAC] = &container_builder_flac,
 		[CONTAINER_FORMAT_RAW] = &container_builder_raw,
 	};
 	const struct container_builder *builder;
@@ -340,7 +365,7 @@ int container_context_pre_process(struct container_context *cntr,
 
 	bytes_per_frame = cntr->bytes_per_sample * *samples_per_frame;
 	*frame_count = byte_count / bytes_per_frame;
-	cntr->max_size -= cntr->max_size / bytes_per_frame;
+	cntr->max_size -= cntr->max_size % bytes_per_frame;
 
 	if (cntr->verbose > 0) {
 		fprintf(stderr, "Container: %s\n",
@@ -375,6 +400,7 @@ int container_context_process_frames(struct container_context *cntr,
 	unsigned int bytes_per_frame;
 	unsigned int byte_count;
 	unsigned int target_byte_count;
+	struct timespec begin, end;
 	int err;
 
 	assert(cntr);
@@ -401,9 +427,19 @@ int container_context_process_frames(struct container_context *cntr,
 	if (cntr->handled_byte_count > cntr->max_size - byte_count)
 		byte_count = cntr->max_size - cntr->handled_byte_count;
 
+	if (cntr->timed)
+		clock_gettime(CLOCK_MONOTONIC, &begin);
+
 	// All of supported containers include interleaved PCM frames.
 	// TODO: process frames for truncate case.
 	err = cntr->process_bytes(cntr, buf, byte_count);
+
+	if (cntr->timed) {
+		clock_gettime(CLOCK_MONOTONIC, &end);
+		cntr->io_nsec += (end.tv_sec - begin.tv_sec) * 1000000000ull +
+				 end.tv_nsec - begin.tv_nsec;
+	}
+
 	if (err < 0) {
 		*frame_count = 0;
 		return err;
@@ -418,6 +454,34 @@ int container_context_process_frames(struct container_context *cntr,
 	return 0;
 }
 
+int container_context_preallocate(struct container_context *cntr,
+				  uint64_t byte_count)
+{
+	off64_t pos;
+
+	assert(cntr);
+	assert(cntr->type == CONTAINER_TYPE_BUILDER);
+
+	// The size of compressed data is unknown.
+	if (cntr->stdio || cntr->format == CONTAINER_FORMAT_FLAC ||
+	    byte_count == 0)
+		return 0;
+
+	pos = lseek64(cntr->fd, 0, SEEK_CUR);
+	if (pos < 0)
+		return -errno;
+
+	if (fallocate64(cntr->fd, FALLOC_FL_KEEP_SIZE, pos, byte_count) < 0) {
+		// Not supported by the filesystem or the type of file.
+		if (errno == EOPNOTSUPP || errno == ENODEV || errno == ESPIPE)
+			return 0;
+		return -errno;
+	}
+	cntr->preallocated = true;
+
+	return 0;
+}
+
 int container_context_post_process(struct container_context *cntr,
 				   uint64_t *frame_count)
 {
@@ -431,6 +495,13 @@ int container_context_post_process(struct container_context *cntr,
 			cntr->handled_byte_count);
 	}
 
+	// Complete requests in flight before the header is updated.
+	if (cntr->io_ops) {
+		err = cntr->io_ops->flush(cntr);
+		if (err < 0)
+			return err;
+	}
+
 	// NOTE* we cannot seek when using standard input/output.
 	if (!cntr->stdio && cntr->ops && cntr->ops->post_process) {
 		// Usually, need to write out processed bytes in container
@@ -440,6 +511,15 @@ int container_context_post_process(struct container_context *cntr,
 		err = cntr->ops->post_process(cntr, cntr->handled_byte_count);
 	}
 
+	// Release the reserved blocks beyond the end of file.
+	if (cntr->preallocated && err == 0) {
+		struct stat st;
+
+		if (fstat(cntr->fd, &st) < 0 ||
+		    ftruncate(cntr->fd, st.st_size) < 0)
+			err = -errno;
+	}
+
 	// Ensure to perform write-back from disk cache.
 	if (cntr->type == CONTAINER_TYPE_BUILDER)
 		fsync(cntr->fd);
@@ -462,6 +542,8 @@ void container_context_destroy(struct container_context *cntr)
 {
 	assert(cntr);
 
+	if (cntr->io_ops)
+		cntr->io_ops->destroy(cntr);
 	close(cntr->fd);
 	if (cntr->private_data)
 		free(cntr->private_data);
@@ -15,6 +15,7 @@
 
 #include <stdbool.h>
 #include <stdint.h>
+#include <signal.h>
 
 #include <alsa/asoundlib.h>
 
@@ -26,13 +27,17 @@ enum container_type {
 
 enum container_format {
 	CONTAINER_FORMAT_RIFF_WAVE = 0,
+	CONTAINER_FORMAT_RF64,
+	CONTAINER_FORMAT_W64,
 	CONTAINER_FORMAT_AU,
 	CONTAINER_FORMAT_VOC,
+	CONTAINER_FORMAT_FLAC,
 	CONTAINER_FORMAT_RAW,
 	CONTAINER_FORMAT_COUNT,
 };
 
 struct container_ops;
+struct container_io_ops;
 
 struct container_context {
 	enum container_type type;
@@ -43,6 +48,7 @@ struct container_context {
 	bool eof;
 	bool interrupted;
 	bool stdio;
+	bool preallocated;
 
 	enum container_format format;
 	uint64_t max_size;
@@ -57,8 +63,24 @@ struct container_context {
 
 	unsigned int verbose;
 	uint64_t handled_byte_count;
+
+	// Duration of I/O for sample data in nanoseconds, accumulated when
+	// 'timed' is set.
+	bool timed;
+	uint64_t io_nsec;
+
+	// Optional backend for I/O of sample data, attached after pre-process.
+	const struct container_io_ops *io_ops;
+	void *io_private_data;
+
+	// Optional flag set asynchronously, e.g. by a handler of Unix signal,
+	// to abort I/O waiting for the descriptor.
+	volatile sig_atomic_t *abort_flag;
 };
 
+// The interval to check the flag to abort in threads which block Unix signals.
+#define CONTAINER_ABORT_CHECK_MSEC	100
+
 const char *const container_suffix_from_format(enum container_format format);
 enum container_format container_format_from_path(const char *path);
 int container_parser_init(struct container_context *cntr,
@@ -67,6 +89,7 @@ int container_builder_init(struct container_context *cntr,
 			   const char *const path, enum container_format format,
 			   unsigned int verbose);
 void container_context_destroy(struct container_context *cntr);
+bool container_context_aborted(struct container_context *cntr);
 int container_context_pre_process(struct container_context *cntr,
 				  snd_pcm_format_t *format,
 				  unsigned int *samples_per_frame,
@@ -78,6 +101,28 @@ int container_context_process_frames(struct container_context *cntr,
 int container_context_post_process(struct container_context *cntr,
 				   uint64_t *frame_count);
 
+// Available when compiled with io_uring support.
+int container_context_attach_io_uring(struct container_context *cntr,
+				      unsigned int depth);
+
+// For builders. The data is written by a thread with a ring of blocks.
+int container_context_attach_writer(struct container_context *cntr,
+				    unsigned int depth,
+				    unsigned int block_size);
+
+// For builders. The blocks of storage are reserved for the given size of
+// sample data without changing the size of file. The rest of them is released
+// in post-process.
+int container_context_preallocate(struct container_context *cntr,
+				  uint64_t byte_count);
+
+// For parsers. The data is read from memory mapped file, and the mapped frames
+// are available without copying them.
+int container_context_attach_mmap(struct container_context *cntr);
+int container_context_map_frames(struct container_context *cntr,
+				 void **frame_buffer,
+				 unsigned int *frame_count);
+
 // For internal use in 'container' module.
 
 struct container_ops {
@@ -105,6 +150,12 @@ struct container_builder {
 	unsigned int private_size;
 };
 
+// The backend replaces 'process_bytes' member of the context.
+struct container_io_ops {
+	int (*flush)(struct container_context *cntr);
+	void (*destroy)(struct container_context *cntr);
+};
+
 int container_recursive_read(struct container_context *cntr, void *buf,
 			     unsigned int byte_count);
 int container_recursive_write(struct container_context *cntr, void *buf,
@@ -114,12 +165,21 @@ int container_seek_offset(struct container_context *cntr, off64_t offset);
 extern const struct container_parser container_parser_riff_wave;
 extern const struct container_builder container_builder_riff_wave;
 
+extern const struct container_parser container_parser_rf64;
+extern const struct container_builder container_builder_rf64;
+
+extern const struct container_parser container_parser_w64;
+extern const struct container_builder container_builder_w64;
+
 extern const struct container_parser container_parser_au;
 extern const struct container_builder container_builder_au;
 
 extern const struct container_parser container_parser_voc;
 extern const struct container_builder container_builder_voc;
 
+extern const struct container_parser container_parser_flac;
+extern const struct container_builder container_builder_flac;
+
 const struct container_parser container_parser_raw;
 const struct container_builder container_builder_raw;
 
@@ -0,0 +1,1240 @@
+// SPDX-License-Identifier: GPL-2.0
+//
+// flac.c - an encoder/decoder for frames of Free Lossless Audio Codec.
+//
+// Licensed under the terms of the GNU General Public License, version 2.
+
+#include "flac.h"
+#include "misc.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <pthread.h>
+#include <assert.h>
+
+// Reference:
+//  * RFC 9639 Free Lossless Audio Codec (FLAC)
+
+#define MAX_FIXED_ORDER		4
+#define MAX_PARTITION_ORDER	8
+#define MAX_RICE_PARAM		30
+
+enum subframe_type {
+	SUBFRAME_TYPE_CONSTANT = 0x00,
+	SUBFRAME_TYPE_VERBATIM = 0x01,
+	SUBFRAME_TYPE_FIXED = 0x08,
+	SUBFRAME_TYPE_LPC = 0x20,
+};
+
+enum channel_assignment {
+	// 0-7 for independent channels.
+	CHANNEL_ASSIGNMENT_LEFT_SIDE = 8,
+	CHANNEL_ASSIGNMENT_SIDE_RIGHT = 9,
+	CHANNEL_ASSIGNMENT_MID_SIDE = 10,
+};
+
+static const unsigned int rate_codes[] = {
+	[1] = 88200,
+	[2] = 176400,
+	[3] = 192000,
+	[4] = 8000,
+	[5] = 16000,
+	[6] = 22050,
+	[7] = 24000,
+	[8] = 32000,
+	[9] = 44100,
+	[10] = 48000,
+	[11] = 96000,
+};
+
+static const unsigned int sample_size_codes[] = {
+	[1] = 8,
+	[2] = 12,
+	[4] = 16,
+	[5] = 20,
+	[6] = 24,
+	[7] = 32,
+};
+
+static uint8_t crc8_table[256];
+static uint16_t crc16_table[256];
+static pthread_once_t crc_table_once = PTHREAD_ONCE_INIT;
+
+static void init_crc_tables(void)
+{
+	unsigned int i, j;
+	unsigned int crc;
+
+	for (i = 0; i < 256; ++i) {
+		// x^8 + x^2 + x^1 + x^0.
+		crc = i;
+		for (j = 0; j < 8; ++j)
+			crc = (crc & 0x80) ? (crc << 1) ^ 0x07 : crc << 1;
+		crc8_table[i] = crc & 0xff;
+
+		// x^16 + x^15 + x^2 + x^0.
+		crc = i << 8;
+		for (j = 0; j < 8; ++j)
+			crc = (crc & 0x8000) ? (crc << 1) ^ 0x8005 : crc << 1;
+		crc16_table[i] = crc & 0xffff;
+	}
+}
+
+static uint8_t calculate_crc8(const uint8_t *buf, size_t size)
+{
+	uint8_t crc = 0;
+	size_t i;
+
+	for (i = 0; i < size; ++i)
+		crc = crc8_table[crc ^ buf[i]];
+
+	return crc;
+}
+
+static uint16_t calculate_crc16(const uint8_t *buf, size_t size)
+{
+	uint16_t crc = 0;
+	size_t i;
+
+	for (i = 0; i < size; ++i)
+		crc = (crc << 8) ^ crc16_table[(crc >> 8) ^ buf[i]];
+
+	return crc;
+}
+
+void flac_build_stream_info(const struct flac_stream_info *info, uint8_t *buf)
+{
+	uint64_t val;
+
+	buf[0] = info->min_block_size >> 8;
+	buf[1] = info->min_block_size;
+	buf[2] = info->max_block_size >> 8;
+	buf[3] = info->max_block_size;
+	buf[4] = info->min_frame_size >> 16;
+	buf[5] = info->min_frame_size >> 8;
+	buf[6] = info->min_frame_size;
+	buf[7] = info->max_frame_size >> 16;
+	buf[8] = info->max_frame_size >> 8;
+	buf[9] = info->max_frame_size;
+
+	// 20 bits for rate, 3 bits for channels, 5 bits for bits per sample and
+	// 36 bits for total number of frames.
+	val = (uint64_t)info->frames_per_second << 44;
+	val |= (uint64_t)(info->samples_per_frame - 1) << 41;
+	val |= (uint64_t)(info->bits_per_sample - 1) << 36;
+	if (info->total_frame_count < (1ull << 36))
+		val |= info->total_frame_count;
+	buf[10] = val >> 56;
+	buf[11] = val >> 48;
+	buf[12] = val >> 40;
+	buf[13] = val >> 32;
+	buf[14] = val >> 24;
+	buf[15] = val >> 16;
+	buf[16] = val >> 8;
+	buf[17] = val;
+
+	// MD5 signature of unencoded samples is not calculated.
+	memset(buf + 18, 0, 16);
+}
+
+int flac_parse_stream_info(struct flac_stream_info *info, const uint8_t *buf)
+{
+	uint64_t val;
+	int i;
+
+	info->min_block_size = (buf[0] << 8) | buf[1];
+	info->max_block_size = (buf[2] << 8) | buf[3];
+	info->min_frame_size = (buf[4] << 16) | (buf[5] << 8) | buf[6];
+	info->max_frame_size = (buf[7] << 16) | (buf[8] << 8) | buf[9];
+
+	val = 0;
+	for (i = 0; i < 8; ++i)
+		val = (val << 8) | buf[10 + i];
+	info->frames_per_second = val >> 44;
+	info->samples_per_frame = ((val >> 41) & 0x07) + 1;
+	info->bits_per_sample = ((val >> 36) & 0x1f) + 1;
+	info->total_frame_count = val & ((1ull << 36) - 1);
+
+	if (info->frames_per_second == 0 || info->bits_per_sample < 4 ||
+	    info->max_block_size < 16)
+		return -EINVAL;
+
+	return 0;
+}
+
+size_t flac_frame_size_bound(unsigned int samples_per_frame,
+			     unsigned int bits_per_sample,
+			     unsigned int block_size)
+{
+	// Verbatim subframes with one more bit for side channel, and headers.
+	return 32 + samples_per_frame *
+		    (8 + ((size_t)block_size * (bits_per_sample + 1) + 7) / 8);
+}
+
+// Encoder.
+
+struct bit_writer {
+	uint8_t *buf;
+	size_t size;
+	size_t pos;
+	uint64_t acc;
+	unsigned int bits;
+};
+
+static inline void put_bits(struct bit_writer *writer, uint32_t val,
+			    unsigned int count)
+{
+	if (count == 0)
+		return;
+
+	writer->acc = (writer->acc << count) | (val & (0xffffffffu >> (32 - count)));
+	writer->bits += count;
+	while (writer->bits >= 8) {
+		writer->bits -= 8;
+		if (writer->pos < writer->size)
+			writer->buf[writer->pos] = writer->acc >> writer->bits;
+		++writer->pos;
+	}
+}
+
+static inline void put_unary(struct bit_writer *writer, uint32_t count)
+{
+	while (count > 31) {
+		put_bits(writer, 0, 32);
+		count -= 32;
+	}
+	put_bits(writer, 1, count + 1);
+}
+
+static inline void put_rice(struct bit_writer *writer, int32_t val,
+			    unsigned int param)
+{
+	uint32_t folded = ((uint32_t)val << 1) ^ (uint32_t)(val >> 31);
+	uint32_t quotient = folded >> param;
+
+	if (quotient + 1 + param <= 32) {
+		put_bits(writer, (1u << param) | (folded & ((1u << param) - 1)),
+			 quotient + 1 + param);
+	} else {
+		put_unary(writer, quotient);
+		put_bits(writer, folded, param);
+	}
+}
+
+static void put_utf8(struct bit_writer *writer, uint64_t val)
+{
+	unsigned int count;
+	int i;
+
+	if (val < 0x80) {
+		put_bits(writer, val, 8);
+		return;
+	}
+
+	// The number of continuation bytes.
+	if (val < 0x800)
+		count = 1;
+	else if (val < 0x10000)
+		count = 2;
+	else if (val < 0x200000)
+		count = 3;
+	else if (val < 0x4000000)
+		count = 4;
+	else if (val < 0x80000000)
+		count = 5;
+	else
+		count = 6;
+
+	put_bits(writer, ((0xff00 >> (count + 1)) & 0xff) |
+			 (uint32_t)(val >> (6 * count)), 8);
+	for (i = count - 1; i >= 0; --i)
+		put_bits(writer, 0x80 | ((val >> (6 * i)) & 0x3f), 8);
+}
+
+static void align_writer(struct bit_writer *writer)
+{
+	if (writer->bits > 0)
+		put_bits(writer, 0, 8 - writer->bits);
+}
+
+struct subframe_plan {
+	enum subframe_type type;
+	unsigned int order;
+	unsigned int wasted_bits;
+	unsigned int bits_per_sample;
+	const int32_t *signal;
+	unsigned int partition_order;
+	unsigned int method;
+	uint8_t params[1 << MAX_PARTITION_ORDER];
+	uint64_t bit_count;
+};
+
+static inline uint32_t fold(int32_t val)
+{
+	return ((uint32_t)val << 1) ^ (uint32_t)(val >> 31);
+}
+
+static unsigned int select_rice_param(uint64_t sum, unsigned int count,
+				      uint64_t *bit_count)
+{
+	uint64_t mean;
+	uint64_t best = UINT64_MAX;
+	uint64_t bits;
+	unsigned int param = 0;
+	int begin, end, k;
+
+	if (count == 0) {
+		*bit_count = 0;
+		return 0;
+	}
+
+	// Around the logarithm of the mean.
+	mean = sum / count;
+	begin = 0;
+	if (mean > 0)
+		begin = 63 - __builtin_clzll(mean) - 1;
+	if (begin < 0)
+		begin = 0;
+	end = begin + 2;
+	if (end > MAX_RICE_PARAM)
+		end = MAX_RICE_PARAM;
+
+	for (k = begin; k <= end; ++k) {
+		bits = (uint64_t)count * (k + 1) + (sum >> k);
+		if (bits < best) {
+			best = bits;
+			param = k;
+		}
+	}
+
+	*bit_count = best;
+	return param;
+}
+
+// Decide partitions and Rice parameters for the residual, then return the
+// number of bits exactly.
+static uint64_t plan_residual(struct subframe_plan *plan,
+			      const int32_t *residual, unsigned int count)
+{
+	uint64_t sums[1 << MAX_PARTITION_ORDER];
+	uint8_t params[1 << MAX_PARTITION_ORDER];
+	unsigned int order = plan->order;
+	unsigned int max_order;
+	unsigned int partition_count;
+	unsigned int partition_size;
+	unsigned int begin, end;
+	uint64_t best = UINT64_MAX;
+	uint64_t total;
+	uint64_t bits;
+	unsigned int max_param;
+	unsigned int p, i, j;
+
+	max_order = 0;
+	while (max_order < MAX_PARTITION_ORDER &&
+	       !(count & ((2u << max_order) - 1)) &&
+	       (count >> (max_order + 1)) > order)
+		++max_order;
+
+	// The sum of folded residuals in each partition for the finest order.
+	partition_count = 1u << max_order;
+	partition_size = count >> max_order;
+	for (i = 0; i < partition_count; ++i) {
+		begin = i * partition_size;
+		if (begin < order)
+			begin = order;
+		end = (i + 1) * partition_size;
+		sums[i] = 0;
+		for (j = begin; j < end; ++j)
+			sums[i] += fold(residual[j]);
+	}
+
+	for (p = max_order; ; --p) {
+		partition_count = 1u << p;
+		partition_size = count >> p;
+
+		total = 0;
+		max_param = 0;
+		for (i = 0; i < partition_count; ++i) {
+			unsigned int n = partition_size;
+
+			if (i == 0)
+				n -= order;
+			params[i] = select_rice_param(sums[i], n, &bits);
+			if (params[i] > max_param)
+				max_param = params[i];
+			total += bits;
+		}
+		// Coding method and the order, then parameters.
+		total += 2 + 4 + partition_count * (max_param > 14 ? 5 : 4);
+
+		if (total < best) {
+			best = total;
+			plan->partition_order = p;
+			plan->method = max_param > 14 ? 1 : 0;
+			memcpy(plan->params, params, partition_count);
+		}
+
+		if (p == 0)
+			break;
+
+		// Merge to coarser partitions.
+		for (i = 0; i < partition_count / 2; ++i)
+			sums[i] = sums[2 * i] + sums[2 * i + 1];
+	}
+
+	// Count bits exactly since the above is estimation.
+	partition_count = 1u << plan->partition_order;
+	partition_size = count >> plan->partition_order;
+	total = 2 + 4 + partition_count * (plan->method ? 5 : 4);
+	for (i = 0; i < partition_count; ++i) {
+		unsigned int param = plan->params[i];
+
+		begin = i * partition_size;
+		if (begin < order)
+			begin = order;
+		end = (i + 1) * partition_size;
+		total += (uint64_t)(end - begin) * (param + 1);
+		for (j = begin; j < end; ++j)
+			total += fold(residual[j]) >> param;
+	}
+
+	return total;
+}
+
+// Choose the order of fixed predictor with the least sum of absolute residuals.
+// The order is invalid when any residual doesn't fit in 32 bit.
+static unsigned int select_fixed_order(const int32_t *x, unsigned int count)
+{
+	uint64_t sums[MAX_FIXED_ORDER + 1] = {0};
+	bool valid[MAX_FIXED_ORDER + 1] = {true, true, true, true, true};
+	int64_t e[MAX_FIXED_ORDER + 1];
+	unsigned int order;
+	unsigned int i, j, k;
+
+	// Too short to compare.
+	if (count <= MAX_FIXED_ORDER)
+		return 0;
+
+	// The residuals are coded from the index of order, thus the ones
+	// before the maximum order are validated as well. They're differences
+	// of the samples up to the index.
+	for (i = 1; i < MAX_FIXED_ORDER; ++i) {
+		for (j = 0; j <= i; ++j)
+			e[j] = x[j];
+		for (k = 1; k <= i; ++k) {
+			for (j = i; j >= k; --j)
+				e[j] -= e[j - 1];
+			if (e[i] != (int32_t)e[i])
+				valid[k] = false;
+		}
+	}
+
+	// Start with the sample which all of orders have warm-up for.
+	for (i = MAX_FIXED_ORDER; i < count; ++i) {
+		e[0] = x[i];
+		e[1] = e[0] - x[i - 1];
+		e[2] = e[1] - ((int64_t)x[i - 1] - x[i - 2]);
+		e[3] = e[2] - ((int64_t)x[i - 1] - 2 * (int64_t)x[i - 2] +
+			       x[i - 3]);
+		e[4] = e[3] - ((int64_t)x[i - 1] - 3 * (int64_t)x[i - 2] +
+			       3 * (int64_t)x[i - 3] - x[i - 4]);
+
+		for (j = 0; j <= MAX_FIXED_ORDER; ++j) {
+			sums[j] += e[j] < 0 ? -e[j] : e[j];
+			if (e[j] != (int32_t)e[j])
+				valid[j] = false;
+		}
+	}
+
+	order = 0;
+	for (i = 1; i <= MAX_FIXED_ORDER; ++i) {
+		if (valid[i] && sums[i] < sums[order])
+			order = i;
+	}
+
+	return order;
+}
+
+static void compute_fixed_residual(const int32_t *signal, unsigned int count,
+				   unsigned int order, int32_t *residual)
+{
+	const int32_t *x = signal;
+	unsigned int i;
+
+	switch (order) {
+	case 0:
+		for (i = 0; i < count; ++i)
+			residual[i] = x[i];
+		break;
+	case 1:
+		for (i = 1; i < count; ++i)
+			residual[i] = (int64_t)x[i] - x[i - 1];
+		break;
+	case 2:
+		for (i = 2; i < count; ++i)
+			residual[i] = (int64_t)x[i] - 2 * (int64_t)x[i - 1] +
+				      x[i - 2];
+		break;
+	case 3:
+		for (i = 3; i < count; ++i)
+			residual[i] = (int64_t)x[i] - 3 * (int64_t)x[i - 1] +
+				      3 * (int64_t)x[i - 2] - x[i - 3];
+		break;
+	default:
+		for (i = 4; i < count; ++i)
+			residual[i] = (int64_t)x[i] - 4 * (int64_t)x[i - 1] +
+				      6 * (int64_t)x[i - 2] -
+				      4 * (int64_t)x[i - 3] + x[i - 4];
+		break;
+	}
+}
+
+static void plan_subframe(struct subframe_plan *plan, const int32_t *signal,
+			  unsigned int count, unsigned int bits_per_sample,
+			  int32_t *work, int32_t *residual)
+{
+	uint32_t mask = 0;
+	uint64_t verbatim_bits;
+	uint64_t fixed_bits;
+	unsigned int header_bits;
+	bool constant = true;
+	unsigned int i;
+
+	memset(plan, 0, sizeof(*plan));
+	plan->signal = signal;
+	plan->bits_per_sample = bits_per_sample;
+
+	for (i = 0; i < count; ++i) {
+		mask |= (uint32_t)signal[i];
+		if (signal[i] != signal[0])
+			constant = false;
+	}
+
+	if (constant) {
+		plan->type = SUBFRAME_TYPE_CONSTANT;
+		plan->bit_count = 8 + bits_per_sample;
+		return;
+	}
+
+	// Remove bits which are always zero, e.g. for 24 bit samples captured
+	// from 16 bit converter.
+	plan->wasted_bits = __builtin_ctz(mask);
+	if (plan->wasted_bits > 0) {
+		for (i = 0; i < count; ++i)
+			work[i] = signal[i] >> plan->wasted_bits;
+		plan->signal = work;
+		plan->bits_per_sample -= plan->wasted_bits;
+	}
+	header_bits = 8 + plan->wasted_bits;
+
+	verbatim_bits = header_bits + (uint64_t)count * plan->bits_per_sample;
+
+	plan->order = select_fixed_order(plan->signal, count);
+	compute_fixed_residual(plan->signal, count, plan->order, residual);
+	fixed_bits = header_bits + plan->order * plan->bits_per_sample +
+		     plan_residual(plan, residual, count);
+
+	if (fixed_bits < verbatim_bits) {
+		plan->type = SUBFRAME_TYPE_FIXED;
+		plan->bit_count = fixed_bits;
+	} else {
+		plan->type = SUBFRAME_TYPE_VERBATIM;
+		plan->order = 0;
+		plan->bit_count = verbatim_bits;
+	}
+}
+
+static void write_subframe(struct bit_writer *writer,
+			   const struct subframe_plan *plan,
+			   const int32_t *residual, unsigned int count)
+{
+	unsigned int partition_count;
+	unsigned int partition_size;
+	unsigned int begin, end;
+	unsigned int i, j;
+
+	// Zero bit padding, type and flag of wasted bits.
+	put_bits(writer, (plan->type | plan->order) << 1 | !!plan->wasted_bits,
+		 8);
+	if (plan->wasted_bits > 0)
+		put_unary(writer, plan->wasted_bits - 1);
+
+	switch (plan->type) {
+	case SUBFRAME_TYPE_CONSTANT:
+		put_bits(writer, plan->signal[0], plan->bits_per_sample);
+		break;
+	case SUBFRAME_TYPE_VERBATIM:
+		for (i = 0; i < count; ++i)
+			put_bits(writer, plan->signal[i], plan->bits_per_sample);
+		break;
+	default:
+		for (i = 0; i < plan->order; ++i)
+			put_bits(writer, plan->signal[i], plan->bits_per_sample);
+
+		put_bits(writer, plan->method, 2);
+		put_bits(writer, plan->partition_order, 4);
+		partition_count = 1u << plan->partition_order;
+		partition_size = count >> plan->partition_order;
+		for (i = 0; i < partition_count; ++i) {
+			put_bits(writer, plan->params[i], plan->method ? 5 : 4);
+			begin = i * partition_size;
+			if (begin < plan->order)
+				begin = plan->order;
+			end = (i + 1) * partition_size;
+			for (j = begin; j < end; ++j)
+				put_rice(writer, residual[j], plan->params[i]);
+		}
+		break;
+	}
+}
+
+int flac_encoder_init(struct flac_encoder *encoder,
+		      unsigned int samples_per_frame,
+		      unsigned int bits_per_sample,
+		      unsigned int frames_per_second,
+		      unsigned int max_block_size)
+{
+	unsigned int i;
+
+	if (samples_per_frame == 0 || samples_per_frame > FLAC_MAX_CHANNELS ||
+	    bits_per_sample < 4 || bits_per_sample > 32 ||
+	    max_block_size < 16 || max_block_size > FLAC_MAX_BLOCK_SIZE)
+		return -EINVAL;
+
+	pthread_once(&crc_table_once, init_crc_tables);
+
+	memset(encoder, 0, sizeof(*encoder));
+	encoder->samples_per_frame = samples_per_frame;
+	encoder->bits_per_sample = bits_per_sample;
+	encoder->frames_per_second = frames_per_second;
+	encoder->max_block_size = max_block_size;
+
+	for (i = 0; i < samples_per_frame; ++i) {
+		encoder->samples[i] = calloc(max_block_size, sizeof(int32_t));
+		if (encoder->samples[i] == NULL)
+			goto error;
+	}
+	for (i = 0; i < 2; ++i) {
+		encoder->signals[i] = calloc(max_block_size, sizeof(int32_t));
+		if (encoder->signals[i] == NULL)
+			goto error;
+	}
+	for (i = 0; i < samples_per_frame + 2; ++i) {
+		encoder->works[i] = calloc(max_block_size, sizeof(int32_t));
+		encoder->residuals[i] = calloc(max_block_size, sizeof(int32_t));
+		if (encoder->works[i] == NULL || encoder->residuals[i] == NULL)
+			goto error;
+	}
+
+	return 0;
+error:
+	flac_encoder_destroy(encoder);
+	return -ENOMEM;
+}
+
+static unsigned int block_size_code(unsigned int block_size)
+{
+	unsigned int i;
+
+	if (block_size == 192)
+		return 1;
+	for (i = 2; i <= 5; ++i) {
+		if (block_size == 576u << (i - 2))
+			return i;
+	}
+	for (i = 8; i <= 15; ++i) {
+		if (block_size == 256u << (i - 8))
+			return i;
+	}
+	if (block_size <= 256)
+		return 6;
+	return 7;
+}
+
+static unsigned int find_code(const unsigned int *table, unsigned int count,
+			      unsigned int val)
+{
+	unsigned int i;
+
+	for (i = 1; i < count; ++i) {
+		if (table[i] == val)
+			return i;
+	}
+
+	// Refer to STREAMINFO.
+	return 0;
+}
+
+// Encode a frame of the block, then return the size of encoded frame.
+int flac_encoder_encode(struct flac_encoder *encoder, uint64_t frame_index,
+			unsigned int block_size, uint8_t *buf, size_t size)
+{
+	struct subframe_plan plans[FLAC_MAX_CHANNELS + 2];
+	struct subframe_plan *chosen[FLAC_MAX_CHANNELS];
+	const int32_t *residuals[FLAC_MAX_CHANNELS];
+	struct bit_writer writer = {0};
+	unsigned int channels = encoder->samples_per_frame;
+	unsigned int bps = encoder->bits_per_sample;
+	unsigned int assignment;
+	unsigned int bs_code;
+	uint16_t crc16;
+	unsigned int i;
+
+	assert(block_size > 0);
+	assert(block_size <= encoder->max_block_size);
+
+	for (i = 0; i < channels; ++i) {
+		plan_subframe(plans + i, encoder->samples[i], block_size, bps,
+			      encoder->works[i], encoder->residuals[i]);
+		chosen[i] = plans + i;
+		residuals[i] = encoder->residuals[i];
+	}
+	assignment = channels - 1;
+
+	// Stereo decorrelation. Side channel requires one more bit, therefore
+	// unavailable for 32 bit samples.
+	if (channels == 2 && bps < 32) {
+		const int32_t *left = encoder->samples[0];
+		const int32_t *right = encoder->samples[1];
+		int32_t *side = encoder->signals[0];
+		int32_t *mid = encoder->signals[1];
+		uint64_t bits[4];
+
+		for (i = 0; i < block_size; ++i) {
+			side[i] = left[i] - right[i];
+			mid[i] = (int32_t)(((int64_t)left[i] + right[i]) >> 1);
+		}
+		plan_subframe(plans + 2, side, block_size, bps + 1,
+			      encoder->works[2], encoder->residuals[2]);
+		plan_subframe(plans + 3, mid, block_size, bps,
+			      encoder->works[3], encoder->residuals[3]);
+
+		bits[0] = plans[0].bit_count + plans[1].bit_count;
+		bits[1] = plans[0].bit_count + plans[2].bit_count;
+		bits[2] = plans[2].bit_count + plans[1].bit_count;
+		bits[3] = plans[3].bit_count + plans[2].bit_count;
+
+		if (bits[1] < bits[0] && bits[1] <= bits[2] &&
+		    bits[1] <= bits[3]) {
+			assignment = CHANNEL_ASSIGNMENT_LEFT_SIDE;
+			chosen[1] = plans + 2;
+			residuals[1] = encoder->residuals[2];
+		} else if (bits[2] < bits[0] && bits[2] <= bits[3]) {
+			assignment = CHANNEL_ASSIGNMENT_SIDE_RIGHT;
+			chosen[0] = plans + 2;
+			residuals[0] = encoder->residuals[2];
+		} else if (bits[3] < bits[0]) {
+			assignment = CHANNEL_ASSIGNMENT_MID_SIDE;
+			chosen[0] = plans + 3;
+			residuals[0] = encoder->residuals[3];
+			chosen[1] = plans + 2;
+			residuals[1] = encoder->residuals[2];
+		}
+	}
+
+	writer.buf = buf;
+	writer.size = size;
+
+	// Frame header. Sync code, reserved bit and fixed block size.
+	put_bits(&writer, 0xfff8, 16);
+	bs_code = block_size_code(block_size);
+	put_bits(&writer, bs_code, 4);
+	put_bits(&writer, find_code(rate_codes, ARRAY_SIZE(rate_codes),
+				    encoder->frames_per_second), 4);
+	put_bits(&writer, assignment, 4);
+	put_bits(&writer, find_code(sample_size_codes,
+				    ARRAY_SIZE(sample_size_codes), bps), 3);
+	put_bits(&writer, 0, 1);
+	put_utf8(&writer, frame_index);
+	if (bs_code == 6)
+		put_bits(&writer, block_size - 1, 8);
+	else if (bs_code == 7)
+		put_bits(&writer, block_size - 1, 16);
+	if (writer.pos > writer.size)
+		return -ENOSPC;
+	put_bits(&writer, calculate_crc8(buf, writer.pos), 8);
+
+	for (i = 0; i < channels; ++i)
+		write_subframe(&writer, chosen[i], residuals[i], block_size);
+
+	align_writer(&writer);
+	if (writer.pos + 2 > writer.size)
+		return -ENOSPC;
+	crc16 = calculate_crc16(buf, writer.pos);
+	put_bits(&writer, crc16, 16);
+
+	return writer.pos;
+}
+
+void flac_encoder_destroy(struct flac_encoder *encoder)
+{
+	unsigned int i;
+
+	for (i = 0; i < FLAC_MAX_CHANNELS; ++i)
+		free(encoder->samples[i]);
+	for (i = 0; i < 2; ++i)
+		free(encoder->signals[i]);
+	for (i = 0; i < FLAC_MAX_CHANNELS + 2; ++i) {
+		free(encoder->works[i]);
+		free(encoder->residuals[i]);
+	}
+	memset(encoder, 0, sizeof(*encoder));
+}
+
+// Decoder.
+
+// The buffer should have 8 bytes readable after its end.
+struct bit_reader {
+	const uint8_t *buf;
+	size_t size;
+	size_t pos;
+};
+
+static inline bool reader_overrun(const struct bit_reader *reader)
+{
+	return reader->pos > reader->size * 8;
+}
+
+static inline uint64_t peek_bits(const struct bit_reader *reader)
+{
+	const uint8_t *ptr = reader->buf + reader->pos / 8;
+	uint64_t val = 0;
+	int i;
+
+	if (reader_overrun(reader))
+		return 0;
+
+	for (i = 0; i < 8; ++i)
+		val = (val << 8) | ptr[i];
+
+	return val << (reader->pos % 8);
+}
+
+static inline uint32_t get_bits(struct bit_reader *reader, unsigned int count)
+{
+	uint32_t val;
+
+	if (count == 0)
+		return 0;
+
+	val = peek_bits(reader) >> (64 - count);
+	reader->pos += count;
+
+	return val;
+}
+
+static inline int32_t get_signed(struct bit_reader *reader, unsigned int count)
+{
+	uint32_t val;
+
+	if (count == 0)
+		return 0;
+
+	val = get_bits(reader, count) << (32 - count);
+	return (int32_t)val >> (32 - count);
+}
+
+static inline uint32_t get_unary(struct bit_reader *reader)
+{
+	uint32_t count = 0;
+	uint64_t val;
+	unsigned int zeros;
+
+	while (!reader_overrun(reader)) {
+		val = peek_bits(reader);
+		// At least 57 bits are valid in the value.
+		if (val != 0) {
+			zeros = __builtin_clzll(val);
+			if (zeros < 57) {
+				reader->pos += zeros + 1;
+				return count + zeros;
+			}
+		}
+		reader->pos += 56;
+		count += 56;
+	}
+
+	return count;
+}
+
+static int get_utf8(struct bit_reader *reader, uint64_t *val)
+{
+	uint32_t byte = get_bits(reader, 8);
+	unsigned int count;
+
+	if (!(byte & 0x80)) {
+		*val = byte;
+		return 0;
+	}
+
+	for (count = 0; count < 7 && (byte & (0x40 >> count)); ++count)
+		;
+	if (count == 0 || count > 6)
+		return -EINVAL;
+	*val = byte & (0x3f >> count);
+
+	while (count-- > 0) {
+		byte = get_bits(reader, 8);
+		if (reader_overrun(reader))
+			return -ENODATA;
+		if ((byte & 0xc0) != 0x80)
+			return -EINVAL;
+		*val = (*val << 6) | (byte & 0x3f);
+	}
+
+	return 0;
+}
+
+static int read_residual(struct bit_reader *reader, int32_t *residual,
+			 unsigned int count, unsigned int order)
+{
+	unsigned int method;
+	unsigned int partition_order;
+	unsigned int partition_count;
+	unsigned int partition_size;
+	unsigned int param_bits;
+	unsigned int escape;
+	unsigned int param;
+	unsigned int begin, end;
+	uint32_t folded;
+	unsigned int i, j;
+
+	method = get_bits(reader, 2);
+	if (method > 1)
+		return -EINVAL;
+	param_bits = method ? 5 : 4;
+	escape = (1u << param_bits) - 1;
+
+	partition_order = get_bits(reader, 4);
+	partition_count = 1u << partition_order;
+	partition_size = count >> partition_order;
+	if (partition_size << partition_order != count ||
+	    partition_size < order)
+		return -EINVAL;
+
+	for (i = 0; i < partition_count; ++i) {
+		param = get_bits(reader, param_bits);
+		begin = i * partition_size;
+		if (begin < order)
+			begin = order;
+		end = (i + 1) * partition_size;
+
+		if (param == escape) {
+			param = get_bits(reader, 5);
+			for (j = begin; j < end; ++j)
+				residual[j] = get_signed(reader, param);
+		} else {
+			for (j = begin; j < end; ++j) {
+				folded = get_unary(reader) << param;
+				folded |= get_bits(reader, param);
+				residual[j] = (int32_t)(folded >> 1) ^
+					      -(int32_t)(folded & 1);
+			}
+		}
+
+		// Not enough data in the buffer.
+		if (reader_overrun(reader))
+			return -ENODATA;
+	}
+
+	return 0;
+}
+
+// The sample out of 32 bit means that the residual was wrapped around by
+// encoder.
+static int restore_fixed(int32_t *x, unsigned int count, unsigned int order)
+{
+	int64_t v;
+	unsigned int i;
+
+	for (i = order; i < count; ++i) {
+		switch (order) {
+		case 1:
+			v = (int64_t)x[i] + x[i - 1];
+			break;
+		case 2:
+			v = (int64_t)x[i] + 2 * (int64_t)x[i - 1] - x[i - 2];
+			break;
+		case 3:
+			v = (int64_t)x[i] + 3 * (int64_t)x[i - 1] -
+			    3 * (int64_t)x[i - 2] + x[i - 3];
+			break;
+		default:
+			v = (int64_t)x[i] + 4 * (int64_t)x[i - 1] -
+			    6 * (int64_t)x[i - 2] + 4 * (int64_t)x[i - 3] -
+			    x[i - 4];
+			break;
+		}
+		if (v != (int32_t)v)
+			return -EINVAL;
+		x[i] = v;
+	}
+
+	return 0;
+}
+
+static void restore_lpc(int32_t *x, unsigned int count, unsigned int order,
+			const int32_t *coefs, unsigned int shift)
+{
+	int64_t sum;
+	unsigned int i, j;
+
+	for (i = order; i < count; ++i) {
+		sum = 0;
+		for (j = 0; j < order; ++j)
+			sum += (int64_t)coefs[j] * x[i - 1 - j];
+		x[i] = (int64_t)x[i] + (sum >> shift);
+	}
+}
+
+static int read_subframe(struct bit_reader *reader, int32_t *x,
+			 unsigned int count, unsigned int bits_per_sample)
+{
+	int32_t coefs[32];
+	unsigned int type;
+	unsigned int wasted_bits = 0;
+	unsigned int order;
+	unsigned int precision;
+	int shift;
+	unsigned int i;
+	int err;
+
+	// Zero bit padding.
+	if (get_bits(reader, 1))
+		return -EINVAL;
+	type = get_bits(reader, 6);
+	if (get_bits(reader, 1)) {
+		wasted_bits = get_unary(reader) + 1;
+		if (wasted_bits >= bits_per_sample)
+			return -EINVAL;
+		bits_per_sample -= wasted_bits;
+	}
+	if (bits_per_sample > 32)
+		return -ENOTSUP;
+
+	if (type == SUBFRAME_TYPE_CONSTANT) {
+		int32_t val = get_signed(reader, bits_per_sample);
+
+		for (i = 0; i < count; ++i)
+			x[i] = val;
+	} else if (type == SUBFRAME_TYPE_VERBATIM) {
+		for (i = 0; i < count; ++i)
+			x[i] = get_signed(reader, bits_per_sample);
+	} else if ((type & 0x38) == SUBFRAME_TYPE_FIXED) {
+		order = type & 0x07;
+		if (order > MAX_FIXED_ORDER || order > count)
+			return -EINVAL;
+		for (i = 0; i < order; ++i)
+			x[i] = get_signed(reader, bits_per_sample);
+		err = read_residual(reader, x, count, order);
+		if (err < 0)
+			return err;
+		err = restore_fixed(x, count, order);
+		if (err < 0)
+			return err;
+	} else if (type & SUBFRAME_TYPE_LPC) {
+		order = (type & 0x1f) + 1;
+		if (order > count)
+			return -EINVAL;
+		for (i = 0; i < order; ++i)
+			x[i] = get_signed(reader, bits_per_sample);
+		precision = get_bits(reader, 4) + 1;
+		if (precision == 16)
+			return -EINVAL;
+		shift = get_signed(reader, 5);
+		if (shift < 0)
+			return -EINVAL;
+		for (i = 0; i < order; ++i)
+			coefs[i] = get_signed(reader, precision);
+		err = read_residual(reader, x, count, order);
+		if (err < 0)
+			return err;
+		restore_lpc(x, count, order, coefs, shift);
+	} else {
+		return -EINVAL;
+	}
+
+	if (reader_overrun(reader))
+		return -ENODATA;
+
+	if (wasted_bits > 0) {
+		for (i = 0; i < count; ++i)
+			x[i] = (int32_t)((uint32_t)x[i] << wasted_bits);
+	}
+
+	return 0;
+}
+
+int flac_decoder_init(struct flac_decoder *decoder,
+		      const struct flac_stream_info *info)
+{
+	unsigned int i;
+
+	if (info->samples_per_frame > FLAC_MAX_CHANNELS ||
+	    info->bits_per_sample > 32)
+		return -EINVAL;
+
+	pthread_once(&crc_table_once, init_crc_tables);
+
+	memset(decoder, 0, sizeof(*decoder));
+	decoder->samples_per_frame = info->samples_per_frame;
+	decoder->bits_per_sample = info->bits_per_sample;
+	decoder->max_block_size = info->max_block_size;
+
+	for (i = 0; i < decoder->samples_per_frame; ++i) {
+		decoder->samples[i] = calloc(decoder->max_block_size,
+					     sizeof(int32_t));
+		if (decoder->samples[i] == NULL) {
+			flac_decoder_destroy(decoder);
+			return -ENOMEM;
+		}
+	}
+
+	return 0;
+}
+
+// Decode a frame at the head of buffer. Return the size of frame, 0 when the
+// buffer doesn't include whole the frame, or negative value when the head is
+// not a frame.
+int flac_decoder_decode(struct flac_decoder *decoder, const uint8_t *buf,
+			size_t size, unsigned int *block_size)
+{
+	struct bit_reader reader = {
+		.buf = buf,
+		.size = size,
+	};
+	unsigned int bs_code;
+	unsigned int rate_code;
+	unsigned int assignment;
+	unsigned int ss_code;
+	unsigned int channels;
+	unsigned int bps;
+	unsigned int count;
+	uint64_t index;
+	size_t header_size;
+	unsigned int i;
+	int err;
+
+	if (size < 2)
+		return 0;
+
+	// Sync code and reserved bit.
+	if (get_bits(&reader, 15) != 0x7ffc)
+		return -EINVAL;
+	// Both of blocking strategies are acceptable.
+	get_bits(&reader, 1);
+
+	bs_code = get_bits(&reader, 4);
+	rate_code = get_bits(&reader, 4);
+	assignment = get_bits(&reader, 4);
+	ss_code = get_bits(&reader, 3);
+	if (get_bits(&reader, 1))
+		return -EINVAL;
+	if (bs_code == 0 || rate_code == 15 || assignment > 10 || ss_code == 3)
+		return -EINVAL;
+
+	err = get_utf8(&reader, &index);
+	if (err == -ENODATA)
+		return 0;
+	if (err < 0)
+		return err;
+
+	if (bs_code == 1)
+		count = 192;
+	else if (bs_code <= 5)
+		count = 576u << (bs_code - 2);
+	else if (bs_code == 6)
+		count = get_bits(&reader, 8) + 1;
+	else if (bs_code == 7)
+		count = get_bits(&reader, 16) + 1;
+	else
+		count = 256u << (bs_code - 8);
+
+	if (rate_code == 12)
+		get_bits(&reader, 8);
+	else if (rate_code == 13 || rate_code == 14)
+		get_bits(&reader, 16);
+
+	if (reader_overrun(&reader) || reader.pos / 8 + 1 > size)
+		return 0;
+	header_size = reader.pos / 8;
+	if (calculate_crc8(buf, header_size) != get_bits(&reader, 8))
+		return -EINVAL;
+
+	if (count > decoder->max_block_size)
+		return -EINVAL;
+
+	if (assignment < 8)
+		channels = assignment + 1;
+	else
+		channels = 2;
+	if (channels != decoder->samples_per_frame)
+		return -EINVAL;
+
+	bps = decoder->bits_per_sample;
+	if (ss_code != 0) {
+		bps = sample_size_codes[ss_code];
+		if (bps != decoder->bits_per_sample)
+			return -EINVAL;
+	}
+
+	for (i = 0; i < channels; ++i) {
+		unsigned int bits = bps;
+
+		// Side channel has one more bit.
+		if ((assignment == CHANNEL_ASSIGNMENT_LEFT_SIDE && i == 1) ||
+		    (assignment == CHANNEL_ASSIGNMENT_SIDE_RIGHT && i == 0) ||
+		    (assignment == CHANNEL_ASSIGNMENT_MID_SIDE && i == 1))
+			++bits;
+
+		err = read_subframe(&reader, decoder->samples[i], count, bits);
+		if (err == -ENODATA)
+			return 0;
+		if (err < 0)
+			return err;
+	}
+
+	// Zero padding, then CRC-16.
+	reader.pos = (reader.pos + 7) / 8 * 8;
+	if (reader.pos / 8 + 2 > size)
+		return 0;
+	if (calculate_crc16(buf, reader.pos / 8) != get_bits(&reader, 16)) {
+		++decoder->crc_error_count;
+		for (i = 0; i < channels; ++i)
+			memset(decoder->samples[i], 0, count * sizeof(int32_t));
+	} else if (assignment >= 8) {
+		int32_t *a = decoder->samples[0];
+		int32_t *b = decoder->samples[1];
+		int32_t mid;
+
+		for (i = 0; i < count; ++i) {
+			switch (assignment) {
+			case CHANNEL_ASSIGNMENT_LEFT_SIDE:
+				b[i] = a[i] - b[i];
+				break;
+			case CHANNEL_ASSIGNMENT_SIDE_RIGHT:
+				a[i] = a[i] + b[i];
+				break;
+			default:
+				mid = (int32_t)((uint32_t)a[i] << 1) | (b[i] & 1);
+				a[i] = ((int64_t)mid + b[i]) >> 1;
+				b[i] = ((int64_t)mid - b[i]) >> 1;
+				break;
+			}
+		}
+	}
+
+	*block_size = count;
+
+	return reader.pos / 8;
+}
+
+void flac_decoder_destroy(struct flac_decoder *decoder)
+{
+	unsigned int i;
+
+	for (i = 0; i < FLAC_MAX_CHANNELS; ++i)
+		free(decoder->samples[i]);
+	memset(decoder, 0, sizeof(*decoder));
+}
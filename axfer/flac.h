@@ -0,0 +1,81 @@
+// SPDX-License-Identifier: GPL-2.0
+//
+// flac.h - an encoder/decoder for frames of Free Lossless Audio Codec.
+//
+// Licensed under the terms of the GNU General Public License, version 2.
+
+#ifndef __ALSA_UTILS_AXFER_FLAC__H_
+#define __ALSA_UTILS_AXFER_FLAC__H_
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stddef.h>
+
+#define FLAC_MAX_CHANNELS		8
+#define FLAC_MAX_BLOCK_SIZE		65535
+#define FLAC_STREAM_INFO_SIZE		34
+
+struct flac_stream_info {
+	unsigned int min_block_size;
+	unsigned int max_block_size;
+	unsigned int min_frame_size;
+	unsigned int max_frame_size;
+	unsigned int frames_per_second;
+	unsigned int samples_per_frame;
+	unsigned int bits_per_sample;
+	// Zero means unknown.
+	uint64_t total_frame_count;
+};
+
+void flac_build_stream_info(const struct flac_stream_info *info, uint8_t *buf);
+int flac_parse_stream_info(struct flac_stream_info *info, const uint8_t *buf);
+
+// The size of buffer enough for a frame of the block.
+size_t flac_frame_size_bound(unsigned int samples_per_frame,
+			     unsigned int bits_per_sample,
+			     unsigned int block_size);
+
+struct flac_encoder {
+	unsigned int samples_per_frame;
+	unsigned int bits_per_sample;
+	unsigned int frames_per_second;
+	unsigned int max_block_size;
+
+	// Filled by caller. Samples are right-aligned for 'bits_per_sample'.
+	int32_t *samples[FLAC_MAX_CHANNELS];
+
+	// Scratch for stereo decorrelation, shifted samples and residuals.
+	int32_t *signals[2];
+	int32_t *works[FLAC_MAX_CHANNELS + 2];
+	int32_t *residuals[FLAC_MAX_CHANNELS + 2];
+};
+
+int flac_encoder_init(struct flac_encoder *encoder,
+		      unsigned int samples_per_frame,
+		      unsigned int bits_per_sample,
+		      unsigned int frames_per_second,
+		      unsigned int max_block_size);
+int flac_encoder_encode(struct flac_encoder *encoder, uint64_t frame_index,
+			unsigned int block_size, uint8_t *buf, size_t size);
+void flac_encoder_destroy(struct flac_encoder *encoder);
+
+struct flac_decoder {
+	unsigned int samples_per_frame;
+	unsigned int bits_per_sample;
+	unsigned int max_block_size;
+
+	// Decoded samples, right-aligned for 'bits_per_sample'.
+	int32_t *samples[FLAC_MAX_CHANNELS];
+
+	// The number of frames failed at check of CRC. The samples are
+	// silenced.
+	unsigned int crc_error_count;
+};
+
+int flac_decoder_init(struct flac_decoder *decoder,
+		      const struct flac_stream_info *info);
+int flac_decoder_decode(struct flac_decoder *decoder, const uint8_t *buf,
+			size_t size, unsigned int *block_size);
+void flac_decoder_destroy(struct flac_decoder *decoder);
+
+#endif
@@ -8,41 +8,78 @@
 
 #include "frame-cache.h"
 
-static void align_frames_in_i(struct frame_cache *cache,
-			      unsigned int consumed_count)
+static void update_pointers_in_i(struct frame_cache *cache)
 {
-	char *buf = cache->buf;
-	unsigned int offset;
-	unsigned int size;
+	char *storage = cache->storage;
+	unsigned int bytes_per_frame = cache->bytes_per_sample *
+				       cache->samples_per_frame;
 
-	cache->remained_count -= consumed_count;
-
-	offset = cache->bytes_per_sample * cache->samples_per_frame *
-		 consumed_count;
-	size = cache->bytes_per_sample * cache->samples_per_frame *
-	       cache->remained_count;
-	memmove(buf, buf + offset, size);
-
-	cache->buf_ptr = buf + size;
+	cache->buf = storage + bytes_per_frame * cache->head;
+	cache->buf_ptr = storage + bytes_per_frame * cache->tail;
 }
 
-static void align_frames_in_n(struct frame_cache *cache,
-			      unsigned int consumed_count)
+static void update_pointers_in_n(struct frame_cache *cache)
 {
+	char **storages = cache->storage;
 	char **bufs = cache->buf;
 	char **buf_ptrs = cache->buf_ptr;
-	unsigned int offset;
-	unsigned int size;
 	int i;
 
-	cache->remained_count -= consumed_count;
-
 	for (i = 0; i < cache->samples_per_frame; ++i) {
-		offset = cache->bytes_per_sample * consumed_count;
-		size = cache->bytes_per_sample * cache->remained_count;
-		memmove(bufs[i], bufs[i] + offset, size);
-		buf_ptrs[i] = bufs[i] + size;
+		bufs[i] = storages[i] + cache->bytes_per_sample * cache->head;
+		buf_ptrs[i] = storages[i] + cache->bytes_per_sample * cache->tail;
+	}
+}
+
+static void rotate(char *storage, unsigned int head, unsigned int size,
+		   char *tmp)
+{
+	memcpy(tmp, storage, head);
+	memmove(storage, storage + head, size - head);
+	memcpy(storage + size - head, tmp, head);
+}
+
+// Move cached frames to the beginning of storage so that all of them and the
+// rest of space are contiguous. This is just for backends which require a span
+// longer than the contiguous one.
+int frame_cache_linearize(struct frame_cache *cache)
+{
+	unsigned int bytes_per_frame;
+	unsigned int count = cache->remained_count;
+	char *tmp;
+	int i;
+
+	if (cache->head == 0)
+		return 0;
+
+	if (cache->access == SND_PCM_ACCESS_RW_INTERLEAVED)
+		bytes_per_frame = cache->bytes_per_sample *
+				  cache->samples_per_frame;
+	else
+		bytes_per_frame = cache->bytes_per_sample;
+
+	tmp = malloc(bytes_per_frame * cache->head);
+	if (tmp == NULL)
+		return -ENOMEM;
+
+	if (cache->access == SND_PCM_ACCESS_RW_INTERLEAVED) {
+		rotate(cache->storage, bytes_per_frame * cache->head,
+		       bytes_per_frame * cache->frames_per_cache, tmp);
+	} else {
+		char **storages = cache->storage;
+
+		for (i = 0; i < cache->samples_per_frame; ++i) {
+			rotate(storages[i], bytes_per_frame * cache->head,
+			       bytes_per_frame * cache->frames_per_cache, tmp);
+		}
 	}
+	free(tmp);
+
+	cache->head = 0;
+	cache->tail = count % cache->frames_per_cache;
+	cache->update_pointers(cache);
+
+	return 0;
 }
 
 int frame_cache_init(struct frame_cache *cache, snd_pcm_access_t access,
@@ -55,11 +92,13 @@ int frame_cache_init(struct frame_cache *cache, snd_pcm_access_t access,
 	cache->bytes_per_sample = bytes_per_sample;
 	cache->samples_per_frame = samples_per_frame;
 	cache->frames_per_cache = frames_per_cache;
+	cache->head = 0;
+	cache->tail = 0;
 
 	if (access == SND_PCM_ACCESS_RW_INTERLEAVED)
-		cache->align_frames = align_frames_in_i;
+		cache->update_pointers = update_pointers_in_i;
 	else if (access == SND_PCM_ACCESS_RW_NONINTERLEAVED)
-		cache->align_frames = align_frames_in_n;
+		cache->update_pointers = update_pointers_in_n;
 	else
 		return -EINVAL;
 
@@ -70,25 +109,26 @@ int frame_cache_init(struct frame_cache *cache, snd_pcm_access_t access,
 			     bytes_per_sample * samples_per_frame);
 		if (buf == NULL)
 			goto nomem;
-		cache->buf = buf;
-		cache->buf_ptr = buf;
+		cache->storage = buf;
 	} else {
+		char **storages = calloc(samples_per_frame, sizeof(*storages));
 		char **bufs = calloc(samples_per_frame, sizeof(*bufs));
 		char **buf_ptrs = calloc(samples_per_frame, sizeof(*buf_ptrs));
 		int i;
 
+		cache->storage = storages;
 		cache->buf = bufs;
 		cache->buf_ptr = buf_ptrs;
-		if (bufs == NULL || buf_ptrs == NULL)
+		if (storages == NULL || bufs == NULL || buf_ptrs == NULL)
 			goto nomem;
 		for (i = 0; i < samples_per_frame; ++i) {
-			bufs[i] = calloc(frames_per_cache, bytes_per_sample);
-			if (bufs[i] == NULL)
+			storages[i] = calloc(frames_per_cache, bytes_per_sample);
+			if (storages[i] == NULL)
 				goto nomem;
-			buf_ptrs[i] = bufs[i];
 		}
 	}
 
+	cache->update_pointers(cache);
 
 	return 0;
 
@@ -100,14 +140,15 @@ nomem:
 void frame_cache_destroy(struct frame_cache *cache)
 {
 	if (cache->access == SND_PCM_ACCESS_RW_NONINTERLEAVED) {
-		char **bufs = cache->buf;
-		if (bufs) {
+		char **storages = cache->storage;
+		if (storages) {
 			int i;
 			for (i = 0; i < cache->samples_per_frame; ++i)
-				free(bufs[i]);
+				free(storages[i]);
 		}
+		free(cache->buf);
 		free(cache->buf_ptr);
 	}
-	free(cache->buf);
+	free(cache->storage);
 	memset(cache, 0, sizeof(*cache));
 }
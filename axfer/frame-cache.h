@@ -8,6 +8,11 @@
 
 #include <alsa/asoundlib.h>
 
+// The cache is a ring of frames. The 'buf' points to the oldest cached frame
+// and the 'buf_ptr' points to the position for next frames. For
+// non-interleaved access, both are arrays of pointers for each channel. Frames
+// are never moved in the cache, thus the cached frames and the free space can
+// be split into two segments at the end of storage.
 struct frame_cache {
 	void *buf;
 	void *buf_ptr;
@@ -19,8 +24,11 @@ struct frame_cache {
 	unsigned int samples_per_frame;
 	unsigned int frames_per_cache;
 
-	void (*align_frames)(struct frame_cache *cache,
-			     unsigned int consumed_count);
+	void *storage;
+	unsigned int head;
+	unsigned int tail;
+
+	void (*update_pointers)(struct frame_cache *cache);
 };
 
 int frame_cache_init(struct frame_cache *cache, snd_pcm_access_t access,
@@ -28,20 +36,50 @@ int frame_cache_init(struct frame_cache *cache, snd_pcm_access_t access,
 		     unsigned int samples_per_frame,
 		     unsigned int frames_per_cache);
 void frame_cache_destroy(struct frame_cache *cache);
+int frame_cache_linearize(struct frame_cache *cache);
 
 static inline unsigned int frame_cache_get_count(struct frame_cache *cache)
 {
 	return cache->remained_count;
 }
 
+// The number of cached frames available at 'buf' without wrap around.
+static inline unsigned int
+frame_cache_get_contiguous_count(struct frame_cache *cache)
+{
+	if (cache->head + cache->remained_count > cache->frames_per_cache)
+		return cache->frames_per_cache - cache->head;
+	return cache->remained_count;
+}
+
+// The number of frames which can be stored at 'buf_ptr' without wrap around.
+static inline unsigned int frame_cache_get_space(struct frame_cache *cache)
+{
+	if (cache->remained_count == cache->frames_per_cache)
+		return 0;
+	if (cache->tail < cache->head)
+		return cache->head - cache->tail;
+	return cache->frames_per_cache - cache->tail;
+}
+
 static inline void frame_cache_increase_count(struct frame_cache *cache,
 					      unsigned int frame_count)
 {
 	cache->remained_count += frame_count;
+	cache->tail = (cache->tail + frame_count) % cache->frames_per_cache;
+	cache->update_pointers(cache);
 }
 
 static inline void frame_cache_reduce(struct frame_cache *cache,
 				      unsigned int consumed_count)
 {
-	cache->align_frames(cache, consumed_count);
+	cache->remained_count -= consumed_count;
+	cache->head = (cache->head + consumed_count) % cache->frames_per_cache;
+
+	// Rewind to keep the space contiguous as long as possible.
+	if (cache->remained_count == 0) {
+		cache->head = 0;
+		cache->tail = 0;
+	}
+	cache->update_pointers(cache);
 }
@@ -0,0 +1,358 @@
+// SPDX-License-Identifier: GPL-2.0
+//
+// latency.c - records of latency in each iteration of transfer.
+//
+// Licensed under the terms of the GNU General Public License, version 2.
+
+#include "latency.h"
+#include "misc.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+
+enum latency_item {
+	LATENCY_ITEM_INTERVAL = 0,
+	LATENCY_ITEM_IO,
+	LATENCY_ITEM_AVAIL,
+	LATENCY_ITEM_DELAY,
+	LATENCY_ITEM_COUNT,
+};
+
+static const char *const item_labels[] = {
+	[LATENCY_ITEM_INTERVAL] = "interval_nsec",
+	[LATENCY_ITEM_IO] = "io_nsec",
+	[LATENCY_ITEM_AVAIL] = "avail",
+	[LATENCY_ITEM_DELAY] = "delay",
+};
+
+// In thousandths.
+static const unsigned int percentiles[] = {500, 900, 990, 999};
+
+struct latency_summary {
+	unsigned int count;
+	int64_t min;
+	int64_t max;
+	int64_t values[ARRAY_SIZE(percentiles)];
+};
+
+static uint64_t get_nsec(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+int latency_context_init(struct latency_context *lat, unsigned int depth)
+{
+	assert(lat);
+	assert(depth > 0);
+
+	memset(lat, 0, sizeof(*lat));
+
+	// Touch the pages in advance so that no page fault occurs in the
+	// iterations.
+	lat->records = calloc(depth, sizeof(*lat->records));
+	if (lat->records == NULL)
+		return -ENOMEM;
+	memset(lat->records, 0xff, depth * sizeof(*lat->records));
+	lat->depth = depth;
+
+	return 0;
+}
+
+void latency_context_destroy(struct latency_context *lat)
+{
+	assert(lat);
+
+	free(lat->records);
+	lat->records = NULL;
+	lat->depth = 0;
+}
+
+void latency_context_begin(struct latency_context *lat)
+{
+	uint64_t now = get_nsec();
+
+	if (lat->count == 0 && lat->origin_nsec == 0)
+		lat->origin_nsec = now;
+
+	memset(&lat->curr, 0, sizeof(lat->curr));
+	lat->curr.wakeup_nsec = now - lat->origin_nsec;
+}
+
+void latency_context_wakeup(struct latency_context *lat)
+{
+	lat->curr.wakeup_nsec = get_nsec() - lat->origin_nsec;
+}
+
+void latency_context_set_status(struct latency_context *lat,
+				snd_pcm_sframes_t avail,
+				snd_pcm_sframes_t delay)
+{
+	lat->curr.avail = avail;
+	lat->curr.delay = delay;
+	lat->curr.has_status = true;
+}
+
+void latency_context_commit(struct latency_context *lat,
+			    unsigned int frame_count, uint64_t io_nsec)
+{
+	lat->curr.frame_count = frame_count;
+	lat->curr.io_nsec = io_nsec;
+
+	lat->records[lat->count % lat->depth] = lat->curr;
+	++lat->count;
+}
+
+void latency_context_copy(struct latency_context *dst,
+			  const struct latency_context *src)
+{
+	unsigned int count;
+
+	assert(dst->depth == src->depth);
+
+	count = src->count > src->depth ? src->depth : (unsigned int)src->count;
+	memcpy(dst->records, src->records, count * sizeof(*src->records));
+	dst->count = src->count;
+	dst->origin_nsec = src->origin_nsec;
+}
+
+// The oldest record in the ring is the first.
+static const struct latency_record *get_record(struct latency_context *lat,
+					       unsigned int index)
+{
+	uint64_t first = 0;
+
+	if (lat->count > lat->depth)
+		first = lat->count - lat->depth;
+
+	return &lat->records[(first + index) % lat->depth];
+}
+
+static unsigned int get_record_count(struct latency_context *lat)
+{
+	if (lat->count > lat->depth)
+		return lat->depth;
+	return (unsigned int)lat->count;
+}
+
+static int compare_values(const void *a, const void *b)
+{
+	int64_t l = *(const int64_t *)a;
+	int64_t r = *(const int64_t *)b;
+
+	return (l > r) - (l < r);
+}
+
+static int summarize(struct latency_context *lat,
+		     struct latency_summary summaries[LATENCY_ITEM_COUNT])
+{
+	unsigned int record_count = get_record_count(lat);
+	int64_t *values;
+	enum latency_item item;
+	int i;
+
+	memset(summaries, 0, sizeof(*summaries) * LATENCY_ITEM_COUNT);
+	if (record_count == 0)
+		return 0;
+
+	values = malloc(record_count * sizeof(*values));
+	if (values == NULL)
+		return -ENOMEM;
+
+	for (item = 0; item < LATENCY_ITEM_COUNT; ++item) {
+		struct latency_summary *summary = &summaries[item];
+		unsigned int count = 0;
+
+		for (i = 0; i < record_count; ++i) {
+			const struct latency_record *rec = get_record(lat, i);
+
+			switch (item) {
+			case LATENCY_ITEM_INTERVAL:
+				if (i == 0)
+					continue;
+				values[count++] = rec->wakeup_nsec -
+					get_record(lat, i - 1)->wakeup_nsec;
+				break;
+			case LATENCY_ITEM_IO:
+				values[count++] = rec->io_nsec;
+				break;
+			case LATENCY_ITEM_AVAIL:
+				if (rec->has_status)
+					values[count++] = rec->avail;
+				break;
+			case LATENCY_ITEM_DELAY:
+				if (rec->has_status)
+					values[count++] = rec->delay;
+				break;
+			default:
+				break;
+			}
+		}
+		if (count == 0)
+			continue;
+
+		qsort(values, count, sizeof(*values), compare_values);
+		summary->count = count;
+		summary->min = values[0];
+		summary->max = values[count - 1];
+		for (i = 0; i < ARRAY_SIZE(percentiles); ++i) {
+			summary->values[i] =
+				values[(uint64_t)(count - 1) * percentiles[i] / 1000];
+		}
+	}
+
+	free(values);
+
+	return 0;
+}
+
+static void dump_csv(struct latency_context *lat, FILE *out)
+{
+	unsigned int record_count = get_record_count(lat);
+	uint64_t first = lat->count - record_count;
+	int i;
+
+	fprintf(out, "iteration,wakeup_nsec,interval_nsec,avail,delay,frames,"
+		     "io_nsec\n");
+	for (i = 0; i < record_count; ++i) {
+		const struct latency_record *rec = get_record(lat, i);
+
+		fprintf(out, "%lu,%lu,", first + i, rec->wakeup_nsec);
+		if (i > 0) {
+			fprintf(out, "%lu", rec->wakeup_nsec -
+				get_record(lat, i - 1)->wakeup_nsec);
+		}
+		if (rec->has_status)
+			fprintf(out, ",%ld,%ld", rec->avail, rec->delay);
+		else
+			fprintf(out, ",,");
+		fprintf(out, ",%u,%lu\n", rec->frame_count, rec->io_nsec);
+	}
+}
+
+static void dump_json(struct latency_context *lat,
+		      const struct latency_summary *summaries, FILE *out)
+{
+	unsigned int record_count = get_record_count(lat);
+	uint64_t first = lat->count - record_count;
+	enum latency_item item;
+	int i, j;
+
+	fprintf(out, "{\n  \"iterations\": %lu,\n  \"records\": [\n",
+		lat->count);
+	for (i = 0; i < record_count; ++i) {
+		const struct latency_record *rec = get_record(lat, i);
+
+		fprintf(out, "    {\"iteration\": %lu, \"wakeup_nsec\": %lu, "
+			"\"interval_nsec\": ", first + i, rec->wakeup_nsec);
+		if (i > 0) {
+			fprintf(out, "%lu", rec->wakeup_nsec -
+				get_record(lat, i - 1)->wakeup_nsec);
+		} else {
+			fprintf(out, "null");
+		}
+		if (rec->has_status) {
+			fprintf(out, ", \"avail\": %ld, \"delay\": %ld",
+				rec->avail, rec->delay);
+		} else {
+			fprintf(out, ", \"avail\": null, \"delay\": null");
+		}
+		fprintf(out, ", \"frames\": %u, \"io_nsec\": %lu}%s\n",
+			rec->frame_count, rec->io_nsec,
+			i + 1 < record_count ? "," : "");
+	}
+	fprintf(out, "  ],\n  \"summary\": {\n");
+	for (item = 0; item < LATENCY_ITEM_COUNT; ++item) {
+		const struct latency_summary *summary = &summaries[item];
+
+		fprintf(out, "    \"%s\": {\"count\": %u", item_labels[item],
+			summary->count);
+		if (summary->count > 0) {
+			fprintf(out, ", \"min\": %ld", summary->min);
+			for (j = 0; j < ARRAY_SIZE(percentiles); ++j) {
+				fprintf(out, ", \"p%g\": %ld",
+					percentiles[j] / 10.0,
+					summary->values[j]);
+			}
+			fprintf(out, ", \"max\": %ld", summary->max);
+		}
+		fprintf(out, "}%s\n", item + 1 < LATENCY_ITEM_COUNT ? "," : "");
+	}
+	fprintf(out, "  }\n}\n");
+}
+
+int latency_context_dump(struct latency_context *lat, const char *path)
+{
+	struct latency_summary summaries[LATENCY_ITEM_COUNT];
+	const char *suffix;
+	FILE *out;
+	int err = 0;
+
+	assert(lat);
+	assert(path);
+
+	out = fopen(path, "w");
+	if (out == NULL)
+		return -errno;
+
+	suffix = strrchr(path, '.');
+	if (suffix && !strcasecmp(suffix, ".json")) {
+		err = summarize(lat, summaries);
+		if (err >= 0)
+			dump_json(lat, summaries, out);
+	} else {
+		dump_csv(lat, out);
+	}
+
+	if (fclose(out) != 0 && err >= 0)
+		err = -errno;
+
+	return err;
+}
+
+void latency_context_summarize(struct latency_context *lat, FILE *out)
+{
+	static const struct {
+		const char *label;
+		unsigned int divisor;
+	} formats[] = {
+		[LATENCY_ITEM_INTERVAL] = {"interval [usec]", 1000},
+		[LATENCY_ITEM_IO] = {"I/O [usec]", 1000},
+		[LATENCY_ITEM_AVAIL] = {"avail [frames]", 1},
+		[LATENCY_ITEM_DELAY] = {"delay [frames]", 1},
+	};
+	struct latency_summary summaries[LATENCY_ITEM_COUNT];
+	enum latency_item item;
+	int i;
+
+	assert(lat);
+	assert(out);
+
+	if (summarize(lat, summaries) < 0)
+		return;
+
+	fprintf(out, "Latency in %lu iterations (the last %u are used):\n",
+		lat->count, get_record_count(lat));
+	fprintf(out, "  %-16s %10s", "", "min");
+	for (i = 0; i < ARRAY_SIZE(percentiles); ++i)
+		fprintf(out, " %9g%%", percentiles[i] / 10.0);
+	fprintf(out, " %10s\n", "max");
+
+	for (item = 0; item < LATENCY_ITEM_COUNT; ++item) {
+		const struct latency_summary *summary = &summaries[item];
+		double divisor = formats[item].divisor;
+
+		if (summary->count == 0)
+			continue;
+
+		fprintf(out, "  %-16s %10.1f", formats[item].label,
+			summary->min / divisor);
+		for (i = 0; i < ARRAY_SIZE(percentiles); ++i)
+			fprintf(out, " %10.1f", summary->values[i] / divisor);
+		fprintf(out, " %10.1f\n", summary->max / divisor);
+	}
+}
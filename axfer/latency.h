@@ -0,0 +1,57 @@
+// SPDX-License-Identifier: GPL-2.0
+//
+// latency.h - a header for records of latency in each iteration of transfer.
+//
+// Licensed under the terms of the GNU General Public License, version 2.
+
+#ifndef __ALSA_UTILS_AXFER_LATENCY__H_
+#define __ALSA_UTILS_AXFER_LATENCY__H_
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include <alsa/asoundlib.h>
+
+struct latency_record {
+	uint64_t wakeup_nsec;	// Since the first iteration.
+	uint64_t io_nsec;
+	snd_pcm_sframes_t avail;
+	snd_pcm_sframes_t delay;
+	unsigned int frame_count;
+	bool has_status;	// For avail and delay.
+};
+
+// The records are kept in a ring allocated in advance, thus the latest ones
+// are available when the ring is wrapped around.
+struct latency_context {
+	struct latency_record *records;
+	unsigned int depth;
+	uint64_t count;
+
+	uint64_t origin_nsec;
+	struct latency_record curr;
+};
+
+int latency_context_init(struct latency_context *lat, unsigned int depth);
+void latency_context_destroy(struct latency_context *lat);
+
+// For each iteration. The time of wakeup is the beginning of iteration unless
+// the backend reports it.
+void latency_context_begin(struct latency_context *lat);
+void latency_context_wakeup(struct latency_context *lat);
+void latency_context_set_status(struct latency_context *lat,
+				snd_pcm_sframes_t avail,
+				snd_pcm_sframes_t delay);
+void latency_context_commit(struct latency_context *lat,
+			    unsigned int frame_count, uint64_t io_nsec);
+
+// The destination has the same depth as the source.
+void latency_context_copy(struct latency_context *dst,
+			  const struct latency_context *src);
+
+// In JSON when the path has '.json' suffix, else in CSV.
+int latency_context_dump(struct latency_context *lat, const char *path);
+void latency_context_summarize(struct latency_context *lat, FILE *out);
+
+#endif
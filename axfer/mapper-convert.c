@@ -0,0 +1,281 @@
+// SPDX-License-Identifier: GPL-2.0
+//
+// mapper-convert.c - conversion of sample format between PCM buffer and
+//		      containers.
+//
+// Licensed under the terms of the GNU General Public License, version 2.
+
+#include "mapper.h"
+#include "misc.h"
+
+#include <endian.h>
+#include <byteswap.h>
+
+// Samples are converted via 32 bit signed integer aligned to MSB. The block is
+// small enough to stay in L1 cache between the two passes.
+#define SAMPLES_PER_BLOCK	256
+
+// The largest value of single precision floating point less than 2^31.
+#define FLOAT_S32_MAX		2147483520.0f
+#define FLOAT_S32_MIN		-2147483648.0f
+
+static inline uint16_t load_16(const char *src)
+{
+	uint16_t val;
+
+	memcpy(&val, src, sizeof(val));
+	return val;
+}
+
+static inline uint32_t load_32(const char *src)
+{
+	uint32_t val;
+
+	memcpy(&val, src, sizeof(val));
+	return val;
+}
+
+static inline void store_16(char *dst, uint16_t val)
+{
+	memcpy(dst, &val, sizeof(val));
+}
+
+static inline void store_32(char *dst, uint32_t val)
+{
+	memcpy(dst, &val, sizeof(val));
+}
+
+static inline int32_t from_float(uint32_t bits)
+{
+	float val;
+
+	memcpy(&val, &bits, sizeof(val));
+	val *= 2147483648.0f;
+	if (val != val)
+		val = 0.0f;
+	if (val > FLOAT_S32_MAX)
+		val = FLOAT_S32_MAX;
+	if (val < FLOAT_S32_MIN)
+		val = FLOAT_S32_MIN;
+
+	return (int32_t)val;
+}
+
+static inline uint32_t to_float(int32_t sample)
+{
+	float val = (float)sample * (1.0f / 2147483648.0f);
+	uint32_t bits;
+
+	memcpy(&bits, &val, sizeof(bits));
+	return bits;
+}
+
+// The loaders return sample aligned to MSB of 32 bit signed integer. The
+// storers receive it.
+
+#define load_u8(src)		((int32_t)((uint32_t)(*(uint8_t *)(src) ^ 0x80) << 24))
+#define load_s8(src)		((int32_t)((uint32_t)*(uint8_t *)(src) << 24))
+#define load_s16_le(src)	((int32_t)((uint32_t)le16toh(load_16(src)) << 16))
+#define load_s16_be(src)	((int32_t)((uint32_t)be16toh(load_16(src)) << 16))
+#define load_s24_le(src)	((int32_t)(le32toh(load_32(src)) << 8))
+#define load_s24_be(src)	((int32_t)(be32toh(load_32(src)) << 8))
+#define load_s24_3le(src)						\
+	((int32_t)(((uint32_t)((uint8_t *)(src))[0] << 8) |		\
+		   ((uint32_t)((uint8_t *)(src))[1] << 16) |		\
+		   ((uint32_t)((uint8_t *)(src))[2] << 24)))
+#define load_s24_3be(src)						\
+	((int32_t)(((uint32_t)((uint8_t *)(src))[2] << 8) |		\
+		   ((uint32_t)((uint8_t *)(src))[1] << 16) |		\
+		   ((uint32_t)((uint8_t *)(src))[0] << 24)))
+#define load_s32_le(src)	((int32_t)le32toh(load_32(src)))
+#define load_s32_be(src)	((int32_t)be32toh(load_32(src)))
+#define load_float_le(src)	from_float(le32toh(load_32(src)))
+#define load_float_be(src)	from_float(be32toh(load_32(src)))
+
+#define store_u8(dst, val)	(*(uint8_t *)(dst) = ((uint32_t)(val) >> 24) ^ 0x80)
+#define store_s8(dst, val)	(*(uint8_t *)(dst) = (uint32_t)(val) >> 24)
+#define store_s16_le(dst, val)	store_16(dst, htole16((uint32_t)(val) >> 16))
+#define store_s16_be(dst, val)	store_16(dst, htobe16((uint32_t)(val) >> 16))
+#define store_s24_le(dst, val)	store_32(dst, htole32((val) >> 8))
+#define store_s24_be(dst, val)	store_32(dst, htobe32((val) >> 8))
+#define store_s24_3le(dst, val)						\
+	do {								\
+		((uint8_t *)(dst))[0] = (uint32_t)(val) >> 8;		\
+		((uint8_t *)(dst))[1] = (uint32_t)(val) >> 16;		\
+		((uint8_t *)(dst))[2] = (uint32_t)(val) >> 24;		\
+	} while (0)
+#define store_s24_3be(dst, val)						\
+	do {								\
+		((uint8_t *)(dst))[2] = (uint32_t)(val) >> 8;		\
+		((uint8_t *)(dst))[1] = (uint32_t)(val) >> 16;		\
+		((uint8_t *)(dst))[0] = (uint32_t)(val) >> 24;		\
+	} while (0)
+#define store_s32_le(dst, val)	store_32(dst, htole32(val))
+#define store_s32_be(dst, val)	store_32(dst, htobe32(val))
+#define store_float_le(dst, val) store_32(dst, htole32(to_float(val)))
+#define store_float_be(dst, val) store_32(dst, htobe32(to_float(val)))
+
+// Each kernel has constant size of sample and no branch in its loop, thus
+// compilers can vectorize it.
+#define DEFINE_KERNELS(name, size)					\
+static void decode_##name(int32_t *dst, const char *src,		\
+			  unsigned int count)				\
+{									\
+	unsigned int i;							\
+									\
+	for (i = 0; i < count; ++i)					\
+		dst[i] = load_##name(src + size * i);			\
+}									\
+static void encode_##name(char *dst, const int32_t *src,		\
+			  unsigned int count)				\
+{									\
+	unsigned int i;							\
+									\
+	for (i = 0; i < count; ++i)					\
+		store_##name(dst + size * i, src[i]);			\
+}
+
+DEFINE_KERNELS(u8, 1)
+DEFINE_KERNELS(s8, 1)
+DEFINE_KERNELS(s16_le, 2)
+DEFINE_KERNELS(s16_be, 2)
+DEFINE_KERNELS(s24_le, 4)
+DEFINE_KERNELS(s24_be, 4)
+DEFINE_KERNELS(s24_3le, 3)
+DEFINE_KERNELS(s24_3be, 3)
+DEFINE_KERNELS(s32_le, 4)
+DEFINE_KERNELS(s32_be, 4)
+DEFINE_KERNELS(float_le, 4)
+DEFINE_KERNELS(float_be, 4)
+
+// For the formats different just in byte order.
+static void swap_16(char *dst, const char *src, unsigned int count)
+{
+	unsigned int i;
+
+	for (i = 0; i < count; ++i)
+		store_16(dst + 2 * i, bswap_16(load_16(src + 2 * i)));
+}
+
+static void swap_24(char *dst, const char *src, unsigned int count)
+{
+	unsigned int i;
+	char byte;
+
+	for (i = 0; i < count; ++i) {
+		// The source and destination can be the same.
+		byte = src[3 * i];
+		dst[3 * i + 1] = src[3 * i + 1];
+		dst[3 * i] = src[3 * i + 2];
+		dst[3 * i + 2] = byte;
+	}
+}
+
+static void swap_32(char *dst, const char *src, unsigned int count)
+{
+	unsigned int i;
+
+	for (i = 0; i < count; ++i)
+		store_32(dst + 4 * i, bswap_32(load_32(src + 4 * i)));
+}
+
+static const struct {
+	snd_pcm_format_t format;
+	void (*decode)(int32_t *dst, const char *src, unsigned int count);
+	void (*encode)(char *dst, const int32_t *src, unsigned int count);
+} entries[] = {
+	{SND_PCM_FORMAT_U8,		decode_u8,	encode_u8},
+	{SND_PCM_FORMAT_S8,		decode_s8,	encode_s8},
+	{SND_PCM_FORMAT_S16_LE,		decode_s16_le,	encode_s16_le},
+	{SND_PCM_FORMAT_S16_BE,		decode_s16_be,	encode_s16_be},
+	{SND_PCM_FORMAT_S24_LE,		decode_s24_le,	encode_s24_le},
+	{SND_PCM_FORMAT_S24_BE,		decode_s24_be,	encode_s24_be},
+	{SND_PCM_FORMAT_S24_3LE,	decode_s24_3le,	encode_s24_3le},
+	{SND_PCM_FORMAT_S24_3BE,	decode_s24_3be,	encode_s24_3be},
+	{SND_PCM_FORMAT_S32_LE,		decode_s32_le,	encode_s32_le},
+	{SND_PCM_FORMAT_S32_BE,		decode_s32_be,	encode_s32_be},
+	{SND_PCM_FORMAT_FLOAT_LE,	decode_float_le, encode_float_le},
+	{SND_PCM_FORMAT_FLOAT_BE,	decode_float_be, encode_float_be},
+};
+
+static int find_entry(snd_pcm_format_t format)
+{
+	int i;
+
+	for (i = 0; i < ARRAY_SIZE(entries); ++i) {
+		if (entries[i].format == format)
+			return i;
+	}
+
+	return -1;
+}
+
+bool mapper_format_is_convertible(snd_pcm_format_t format)
+{
+	return find_entry(format) >= 0;
+}
+
+int mapper_converter_init(struct mapper_converter *conv,
+			  snd_pcm_format_t src, snd_pcm_format_t dst)
+{
+	int src_index;
+	int dst_index;
+
+	assert(conv);
+
+	src_index = find_entry(src);
+	dst_index = find_entry(dst);
+	if (src_index < 0 || dst_index < 0)
+		return -EINVAL;
+
+	memset(conv, 0, sizeof(*conv));
+	conv->src_bytes_per_sample = snd_pcm_format_physical_width(src) / 8;
+	conv->dst_bytes_per_sample = snd_pcm_format_physical_width(dst) / 8;
+
+	// The same sample in different byte order.
+	if (src != dst &&
+	    snd_pcm_format_width(src) == snd_pcm_format_width(dst) &&
+	    conv->src_bytes_per_sample == conv->dst_bytes_per_sample &&
+	    snd_pcm_format_float(src) == snd_pcm_format_float(dst) &&
+	    snd_pcm_format_signed(src) == snd_pcm_format_signed(dst) &&
+	    snd_pcm_format_little_endian(src) !=
+					snd_pcm_format_little_endian(dst)) {
+		if (conv->src_bytes_per_sample == 2)
+			conv->swap = swap_16;
+		else if (conv->src_bytes_per_sample == 3)
+			conv->swap = swap_24;
+		else
+			conv->swap = swap_32;
+		return 0;
+	}
+
+	conv->decode = entries[src_index].decode;
+	conv->encode = entries[dst_index].encode;
+
+	return 0;
+}
+
+void mapper_converter_convert(const struct mapper_converter *conv, void *dst,
+			      const void *src, unsigned int count)
+{
+	int32_t block[SAMPLES_PER_BLOCK];
+	unsigned int size;
+
+	if (conv->swap) {
+		conv->swap(dst, src, count);
+		return;
+	}
+
+	while (count > 0) {
+		size = count;
+		if (size > SAMPLES_PER_BLOCK)
+			size = SAMPLES_PER_BLOCK;
+
+		conv->decode(block, src, size);
+		conv->encode(dst, block, size);
+
+		src = (const char *)src + conv->src_bytes_per_sample * size;
+		dst = (char *)dst + conv->dst_bytes_per_sample * size;
+		count -= size;
+	}
+}
@@ -9,64 +9,122 @@
 #include "mapper.h"
 #include "misc.h"
 
+// The number of bytes for a block of frames. Samples are shuffled per block so
+// that both of source and destination stay in cache for many channels.
+#define BYTES_PER_BLOCK	16384
+
 struct multiple_state {
-	void (*align_frames)(void *frame_buf, unsigned int frame_count,
-			     char **buf, unsigned int bytes_per_sample,
+	void (*align_frames)(struct multiple_state *state, void *frame_buf,
+			     unsigned int frame_count, char **buf,
+			     unsigned int bytes_per_sample,
 			     struct container_context *cntrs,
 			     unsigned int cntr_count);
+	void (*copy_samples)(char *dst, unsigned int dst_stride,
+			     const char *src, unsigned int src_stride,
+			     unsigned int count, unsigned int bytes_per_sample);
+	unsigned int frames_per_block;
 	char **bufs;
 	unsigned int cntr_count;
 };
 
-static void align_to_i(void *frame_buf, unsigned int frame_count,
-		       char **src_bufs, unsigned int bytes_per_sample,
+// The size of sample is constant in each kernel, thus the copy is compiled to
+// a load and a store.
+#define DEFINE_COPY_SAMPLES(size)					\
+static void copy_samples_##size(char *dst, unsigned int dst_stride,	\
+				const char *src,			\
+				unsigned int src_stride,		\
+				unsigned int count,			\
+				unsigned int bytes_per_sample)		\
+{									\
+	unsigned int i;							\
+									\
+	for (i = 0; i < count; ++i) {					\
+		memcpy(dst, src, size);					\
+		dst += dst_stride;					\
+		src += src_stride;					\
+	}								\
+}
+
+DEFINE_COPY_SAMPLES(1)
+DEFINE_COPY_SAMPLES(2)
+DEFINE_COPY_SAMPLES(3)
+DEFINE_COPY_SAMPLES(4)
+DEFINE_COPY_SAMPLES(8)
+
+static void copy_samples(char *dst, unsigned int dst_stride, const char *src,
+			 unsigned int src_stride, unsigned int count,
+			 unsigned int bytes_per_sample)
+{
+	unsigned int i;
+
+	for (i = 0; i < count; ++i) {
+		memcpy(dst, src, bytes_per_sample);
+		dst += dst_stride;
+		src += src_stride;
+	}
+}
+
+static void align_to_i(struct multiple_state *state, void *frame_buf,
+		       unsigned int frame_count, char **src_bufs,
+		       unsigned int bytes_per_sample,
 		       struct container_context *cntrs, unsigned int cntr_count)
 {
 	char *dst = frame_buf;
-	char *src;
-	unsigned int dst_pos;
-	unsigned int src_pos;
+	unsigned int dst_stride = bytes_per_sample * cntr_count;
+	unsigned int src_stride;
+	unsigned int count;
 	struct container_context *cntr;
-	int i, j;
+	unsigned int i, j;
 
 	// src: first channel in each of interleaved buffers in containers =>
 	// dst:interleaved.
-	for (i = 0; i < cntr_count; ++i) {
-		src = src_bufs[i];
-		cntr = cntrs + i;
+	for (j = 0; j < frame_count; j += count) {
+		count = frame_count - j;
+		if (count > state->frames_per_block)
+			count = state->frames_per_block;
 
-		for (j = 0; j < frame_count; ++j) {
-			// Use first src channel for each of dst channel.
-			src_pos = bytes_per_sample * cntr->samples_per_frame * j;
-			dst_pos = bytes_per_sample * (cntr_count * j + i);
+		for (i = 0; i < cntr_count; ++i) {
+			cntr = cntrs + i;
 
-			memcpy(dst + dst_pos, src + src_pos, bytes_per_sample);
+			// Use first src channel for each of dst channel.
+			src_stride = bytes_per_sample * cntr->samples_per_frame;
+			state->copy_samples(dst + dst_stride * j +
+					    bytes_per_sample * i, dst_stride,
+					    src_bufs[i] + src_stride * j,
+					    src_stride, count,
+					    bytes_per_sample);
 		}
 	}
 }
 
-static void align_from_i(void *frame_buf, unsigned int frame_count,
-			 char **dst_bufs, unsigned int bytes_per_sample,
+static void align_from_i(struct multiple_state *state, void *frame_buf,
+			 unsigned int frame_count, char **dst_bufs,
+			 unsigned int bytes_per_sample,
 			 struct container_context *cntrs,
 			 unsigned int cntr_count)
 {
 	char *src = frame_buf;
-	char *dst;
-	unsigned int src_pos;
-	unsigned int dst_pos;
+	unsigned int src_stride = bytes_per_sample * cntr_count;
+	unsigned int dst_stride;
+	unsigned int count;
 	struct container_context *cntr;
-	int i, j;
+	unsigned int i, j;
 
-	for (i = 0; i < cntr_count; ++i) {
-		dst = dst_bufs[i];
-		cntr = cntrs + i;
+	for (j = 0; j < frame_count; j += count) {
+		count = frame_count - j;
+		if (count > state->frames_per_block)
+			count = state->frames_per_block;
 
-		for (j = 0; j < frame_count; ++j) {
-			// Use first src channel for each of dst channel.
-			src_pos = bytes_per_sample * (cntr_count * j + i);
-			dst_pos = bytes_per_sample * cntr->samples_per_frame * j;
+		for (i = 0; i < cntr_count; ++i) {
+			cntr = cntrs + i;
 
-			memcpy(dst + dst_pos, src + src_pos, bytes_per_sample);
+			// Use first src channel for each of dst channel.
+			dst_stride = bytes_per_sample * cntr->samples_per_frame;
+			state->copy_samples(dst_bufs[i] + dst_stride * j,
+					    dst_stride,
+					    src + src_stride * j +
+					    bytes_per_sample * i, src_stride,
+					    count, bytes_per_sample);
 		}
 	}
 }
@@ -110,6 +168,32 @@ static int multiple_pre_process(struct mapper_context *mapper,
 	}
 
 	if (state->align_frames) {
+		switch (mapper->bytes_per_sample) {
+		case 1:
+			state->copy_samples = copy_samples_1;
+			break;
+		case 2:
+			state->copy_samples = copy_samples_2;
+			break;
+		case 3:
+			state->copy_samples = copy_samples_3;
+			break;
+		case 4:
+			state->copy_samples = copy_samples_4;
+			break;
+		case 8:
+			state->copy_samples = copy_samples_8;
+			break;
+		default:
+			state->copy_samples = copy_samples;
+			break;
+		}
+
+		state->frames_per_block = BYTES_PER_BLOCK /
+				(mapper->bytes_per_sample * cntr_count);
+		if (state->frames_per_block == 0)
+			state->frames_per_block = 1;
+
 		// Furthermore, in demuxer case, each container should be
 		// configured to store one sample per frame.
 		if (mapper->type == MAPPER_TYPE_DEMUXER) {
@@ -191,7 +275,7 @@ static int multiple_muxer_process_frames(struct mapper_context *mapper,
 
 	// Unlikely.
 	if (src_bufs != frame_buf && *frame_count > 0) {
-		state->align_frames(frame_buf, *frame_count, src_bufs,
+		state->align_frames(state, frame_buf, *frame_count, src_bufs,
 				    mapper->bytes_per_sample, cntrs,
 				    cntr_count);
 	}
@@ -215,7 +299,7 @@ static int multiple_demuxer_process_frames(struct mapper_context *mapper,
 		dst_bufs = frame_buf;
 	} else {
 		dst_bufs = state->bufs;
-		state->align_frames(frame_buf, *frame_count, dst_bufs,
+		state->align_frames(state, frame_buf, *frame_count, dst_bufs,
 				    mapper->bytes_per_sample, cntrs,
 				    cntr_count);
 	}
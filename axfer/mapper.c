@@ -68,6 +68,70 @@ int mapper_context_init(struct mapper_context *mapper,
 	return 0;
 }
 
+// Samples are converted between the sample format of PCM substream and the one
+// of containers. Available after initialization and before pre-process.
+int mapper_context_attach_converter(struct mapper_context *mapper,
+				    snd_pcm_format_t format,
+				    snd_pcm_format_t cntr_format)
+{
+	int err;
+
+	assert(mapper);
+	assert(mapper->ops);
+
+	if (format == cntr_format)
+		return 0;
+
+	if (mapper->type == MAPPER_TYPE_MUXER)
+		err = mapper_converter_init(&mapper->converter, cntr_format,
+					    format);
+	else
+		err = mapper_converter_init(&mapper->converter, format,
+					    cntr_format);
+	if (err < 0)
+		return err;
+
+	mapper->convert = true;
+	mapper->format = format;
+	mapper->cntr_format = cntr_format;
+
+	return 0;
+}
+
+static bool is_interleaved(snd_pcm_access_t access)
+{
+	return access == SND_PCM_ACCESS_RW_INTERLEAVED ||
+	       access == SND_PCM_ACCESS_MMAP_INTERLEAVED;
+}
+
+// The intermediate buffer has the same layout as the buffer of PCM substream,
+// with samples in the format of containers.
+static int allocate_convert_buffers(struct mapper_context *mapper)
+{
+	unsigned int bytes_per_channel;
+	int i;
+
+	bytes_per_channel = mapper->bytes_per_sample *
+			    mapper->frames_per_buffer;
+	mapper->convert_buf = malloc(bytes_per_channel *
+				     mapper->samples_per_frame);
+	if (mapper->convert_buf == NULL)
+		return -ENOMEM;
+
+	if (!is_interleaved(mapper->access)) {
+		mapper->convert_bufs = calloc(mapper->samples_per_frame,
+					      sizeof(*mapper->convert_bufs));
+		if (mapper->convert_bufs == NULL)
+			return -ENOMEM;
+		for (i = 0; i < mapper->samples_per_frame; ++i) {
+			mapper->convert_bufs[i] = mapper->convert_buf +
+						  bytes_per_channel * i;
+		}
+	}
+
+	return 0;
+}
+
 int mapper_context_pre_process(struct mapper_context *mapper,
 			       snd_pcm_access_t access,
 			       unsigned int bytes_per_sample,
@@ -95,6 +159,19 @@ int mapper_context_pre_process(struct mapper_context *mapper,
 	mapper->samples_per_frame = samples_per_frame;
 	mapper->frames_per_buffer = frames_per_buffer;
 
+	if (mapper->convert) {
+		if (bytes_per_sample !=
+		    snd_pcm_format_physical_width(mapper->format) / 8)
+			return -EINVAL;
+
+		// Muxer/demuxer handles samples in the format of containers.
+		mapper->bytes_per_sample =
+			snd_pcm_format_physical_width(mapper->cntr_format) / 8;
+		err = allocate_convert_buffers(mapper);
+		if (err < 0)
+			return err;
+	}
+
 	err = mapper->ops->pre_process(mapper, cntrs, mapper->cntr_count);
 	if (err < 0)
 		return err;
@@ -112,15 +189,84 @@ int mapper_context_pre_process(struct mapper_context *mapper,
 			mapper->samples_per_frame);
 		fprintf(stderr, "  frames/buffer: %lu\n",
 			mapper->frames_per_buffer);
+		if (mapper->convert) {
+			fprintf(stderr, "  conversion: %s (PCM), %s (file)\n",
+				snd_pcm_format_name(mapper->format),
+				snd_pcm_format_name(mapper->cntr_format));
+		}
 	}
 
 	return 0;
 }
 
+static void convert_frames(struct mapper_context *mapper, void *dst,
+			   void *src, unsigned int frame_count)
+{
+	char **dst_bufs;
+	char **src_bufs;
+	int i;
+
+	if (is_interleaved(mapper->access)) {
+		mapper_converter_convert(&mapper->converter, dst, src,
+					 frame_count * mapper->samples_per_frame);
+	} else {
+		dst_bufs = dst;
+		src_bufs = src;
+		for (i = 0; i < mapper->samples_per_frame; ++i) {
+			mapper_converter_convert(&mapper->converter,
+						 dst_bufs[i], src_bufs[i],
+						 frame_count);
+		}
+	}
+}
+
 int mapper_context_process_frames(struct mapper_context *mapper,
 				  void *frame_buffer,
 				  unsigned int *frame_count,
 				  struct container_context *cntrs)
+{
+	void *buf;
+	int err;
+
+	assert(mapper);
+	assert(frame_buffer);
+	assert(frame_count);
+	assert(*frame_count <= mapper->frames_per_buffer);
+	assert(cntrs);
+
+	if (!mapper->convert) {
+		// The most likely.
+		return mapper->ops->process_frames(mapper, frame_buffer,
+						   frame_count, cntrs,
+						   mapper->cntr_count);
+	}
+
+	if (is_interleaved(mapper->access))
+		buf = mapper->convert_buf;
+	else
+		buf = mapper->convert_bufs;
+
+	if (mapper->type == MAPPER_TYPE_MUXER) {
+		err = mapper->ops->process_frames(mapper, buf, frame_count,
+						  cntrs, mapper->cntr_count);
+		if (err < 0)
+			return err;
+		convert_frames(mapper, frame_buffer, buf, *frame_count);
+	} else {
+		convert_frames(mapper, buf, frame_buffer, *frame_count);
+		err = mapper->ops->process_frames(mapper, buf, frame_count,
+						  cntrs, mapper->cntr_count);
+	}
+
+	return err;
+}
+
+// Retrieve a pointer to data frames in the container instead of copying them.
+// Available for the muxer of single container with interleaved frames.
+int mapper_context_map_frames(struct mapper_context *mapper,
+			      void **frame_buffer,
+			      unsigned int *frame_count,
+			      struct container_context *cntrs)
 {
 	assert(mapper);
 	assert(frame_buffer);
@@ -128,8 +274,14 @@ int mapper_context_process_frames(struct mapper_context *mapper,
 	assert(*frame_count <= mapper->frames_per_buffer);
 	assert(cntrs);
 
-	return mapper->ops->process_frames(mapper, frame_buffer, frame_count,
-					    cntrs, mapper->cntr_count);
+	if (mapper->type != MAPPER_TYPE_MUXER ||
+	    mapper->target != MAPPER_TARGET_SINGLE || mapper->convert)
+		return -ENXIO;
+	if (mapper->access != SND_PCM_ACCESS_RW_INTERLEAVED &&
+	    mapper->access != SND_PCM_ACCESS_MMAP_INTERLEAVED)
+		return -ENXIO;
+
+	return container_context_map_frames(cntrs, frame_buffer, frame_count);
 }
 
 void mapper_context_post_process(struct mapper_context *mapper)
@@ -138,6 +290,11 @@ void mapper_context_post_process(struct mapper_context *mapper)
 
 	if (mapper->ops && mapper->ops->post_process)
 		mapper->ops->post_process(mapper);
+
+	free(mapper->convert_bufs);
+	mapper->convert_bufs = NULL;
+	free(mapper->convert_buf);
+	mapper->convert_buf = NULL;
 }
 
 void mapper_context_destroy(struct mapper_context *mapper)
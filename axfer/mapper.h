@@ -26,6 +26,15 @@ enum mapper_target {
 
 struct mapper_ops;
 
+// Conversion of sample format.
+struct mapper_converter {
+	void (*decode)(int32_t *dst, const char *src, unsigned int count);
+	void (*encode)(char *dst, const int32_t *src, unsigned int count);
+	void (*swap)(char *dst, const char *src, unsigned int count);
+	unsigned int src_bytes_per_sample;
+	unsigned int dst_bytes_per_sample;
+};
+
 struct mapper_context {
 	enum mapper_type type;
 	enum mapper_target target;
@@ -41,12 +50,24 @@ struct mapper_context {
 	unsigned int samples_per_frame;
 	snd_pcm_uframes_t frames_per_buffer;
 
+	// Available when sample format of containers is different from the one
+	// of PCM substream.
+	bool convert;
+	snd_pcm_format_t format;
+	snd_pcm_format_t cntr_format;
+	struct mapper_converter converter;
+	char *convert_buf;
+	char **convert_bufs;
+
 	unsigned int verbose;
 };
 
 int mapper_context_init(struct mapper_context *mapper,
 			enum mapper_type type, unsigned int cntr_count,
 			unsigned int verbose);
+int mapper_context_attach_converter(struct mapper_context *mapper,
+				    snd_pcm_format_t format,
+				    snd_pcm_format_t cntr_format);
 int mapper_context_pre_process(struct mapper_context *mapper,
 			       snd_pcm_access_t access,
 			       unsigned int bytes_per_sample,
@@ -57,9 +78,15 @@ int mapper_context_process_frames(struct mapper_context *mapper,
 				  void *frame_buffer,
 				  unsigned int *frame_count,
 				  struct container_context *cntrs);
+int mapper_context_map_frames(struct mapper_context *mapper,
+			      void **frame_buffer,
+			      unsigned int *frame_count,
+			      struct container_context *cntrs);
 void mapper_context_post_process(struct mapper_context *mapper);
 void mapper_context_destroy(struct mapper_context *mapper);
 
+bool mapper_format_is_convertible(snd_pcm_format_t format);
+
 // For internal use in 'mapper' module.
 
 struct mapper_ops {
@@ -84,4 +111,9 @@ extern const struct mapper_data mapper_demuxer_single;
 extern const struct mapper_data mapper_muxer_multiple;
 extern const struct mapper_data mapper_demuxer_multiple;
 
+int mapper_converter_init(struct mapper_converter *conv,
+			  snd_pcm_format_t src, snd_pcm_format_t dst);
+void mapper_converter_convert(const struct mapper_converter *conv, void *dst,
+			      const void *src, unsigned int count);
+
 #endif
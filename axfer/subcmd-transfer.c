@@ -11,30 +11,120 @@
 #include "misc.h"
 
 #include <signal.h>
+#include <pthread.h>
+#include <limits.h>
+#include <sys/stat.h>
+
+// The files are switched at the boundary of segment in capture. The next files
+// are opened and their headers are written by a thread before the boundary,
+// then the previous files are finalized by the thread.
+struct rotation {
+	pthread_t thread;
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+
+	uint64_t frames_per_segment;
+	uint64_t lead_frame_count;
+
+	// Used by the transfer thread only.
+	uint64_t handled_frame_count;
+	bool requested;
+
+	// Protected by the lock.
+	unsigned int index;
+	struct container_context *next_cntrs;
+	struct container_context *prev_cntrs;
+	unsigned int prev_index;
+	bool prepare;
+	bool quit;
+	int err;
+};
+
+// Prepare the next files in advance up to this seconds.
+#define ROTATION_LEAD_SECONDS	10
+
+// The threads for several PCM nodes wait for the main thread to open this
+// gate, or to abort when it fails to prepare all of them.
+enum start_gate_state {
+	START_GATE_WAIT = 0,
+	START_GATE_GO,
+	START_GATE_ABORT,
+};
+
+struct start_gate {
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+	enum start_gate_state state;
+};
+
+// The records of latency are dumped by this thread from a snapshot, since
+// writing the file in the loop of transmission causes XRUN.
+struct latency_dumper {
+	pthread_t thread;
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+	struct latency_context snapshot;
+
+	// Protected by the lock.
+	bool busy;
+	bool quit;
+};
 
 struct context {
 	struct xfer_context xfer;
 	struct mapper_context mapper;
 	struct container_context *cntrs;
 	unsigned int cntr_count;
+	snd_pcm_format_t cntr_format;
+	snd_pcm_uframes_t frames_per_buffer;
+	struct rotation *rotation;
+
+	// For instrumentation of each iteration.
+	struct latency_context *latency;
+	struct latency_dumper *dumper;
+	bool dump_requested;
 
 	// NOTE: To handling Unix signal.
 	bool interrupted;
 	int signal;
+
+	// For several PCM nodes in one process.
+	pthread_t thread;
+	struct start_gate *gate;
+	bool linked;
+	snd_pcm_stream_t direction;
+	uint64_t expected_frame_count;
+	uint64_t actual_frame_count;
+	int err;
 };
 
 // NOTE: To handling Unix signal.
 static struct context *ctx_ptr;
+static unsigned int ctx_count;
+static volatile sig_atomic_t aborted;
 
+// The containers are swapped by the transfer thread in rotation, thus they're
+// not touched here. Any container points to the flag to abort I/O in flight,
+// and the transfer thread tells the interruption to them.
 static void handle_unix_signal_for_finish(int sig)
 {
+	struct context *ctx;
 	int i;
 
-	for (i = 0; i < ctx_ptr->cntr_count; ++i)
-		ctx_ptr->cntrs[i].interrupted = true;
+	aborted = 1;
+	for (i = 0; i < ctx_count; ++i) {
+		ctx = ctx_ptr + i;
+		ctx->signal = sig;
+		ctx->interrupted = true;
+	}
+}
+
+static void pause_all(bool enable)
+{
+	int i;
 
-	ctx_ptr->signal = sig;
-	ctx_ptr->interrupted = true;
+	for (i = 0; i < ctx_count; ++i)
+		xfer_context_pause(&ctx_ptr[i].xfer, enable);
 }
 
 static void handle_unix_signal_for_suspend(int sig)
@@ -43,7 +133,7 @@ static void handle_unix_signal_for_suspend(int sig)
 	struct sigaction sa = {0};
 
 	// 1. suspend substream.
-	xfer_context_pause(&ctx_ptr->xfer, true);
+	pause_all(true);
 
 	// 2. Prepare for default handler(SIG_DFL) of SIGTSTP to stop this
 	// process.
@@ -89,10 +179,18 @@ static void handle_unix_signal_for_suspend(int sig)
 	}
 
 	// 4. Continue the PCM substream.
-	xfer_context_pause(&ctx_ptr->xfer, false);
+	pause_all(false);
 }
 
-static int prepare_signal_handler(struct context *ctx)
+static void handle_unix_signal_for_dump(int sig)
+{
+	int i;
+
+	for (i = 0; i < ctx_count; ++i)
+		ctx_ptr[i].dump_requested = true;
+}
+
+static int prepare_signal_handler(struct context *ctx, unsigned int count)
 {
 	struct sigaction sa = {0};
 
@@ -112,6 +210,21 @@ static int prepare_signal_handler(struct context *ctx)
 		return -errno;
 
 	ctx_ptr = ctx;
+	ctx_count = count;
+
+	return 0;
+}
+
+// The records of latency are dumped without finishing transmission.
+static int prepare_signal_handler_for_dump(void)
+{
+	struct sigaction sa = {0};
+
+	sigemptyset(&sa.sa_mask);
+	sa.sa_flags = SA_RESTART;
+	sa.sa_handler = handle_unix_signal_for_dump;
+	if (sigaction(SIGUSR1, &sa, NULL) < 0)
+		return -errno;
 
 	return 0;
 }
@@ -122,6 +235,7 @@ static int context_init(struct context *ctx, snd_pcm_stream_t direction,
 	const char *xfer_type_literal;
 	enum xfer_type xfer_type;
 	int i;
+	int err;
 
 	// Decide transfer backend before option parser runs.
 	xfer_type_literal = NULL;
@@ -142,50 +256,112 @@ static int context_init(struct context *ctx, snd_pcm_stream_t direction,
 	}
 
 	// Initialize transfer.
-	return xfer_context_init(&ctx->xfer, xfer_type, direction, argc, argv);
+	err = xfer_context_init(&ctx->xfer, xfer_type, direction, argc, argv);
+	if (err < 0)
+		return err;
+
+	if (ctx->xfer.latency_log_path) {
+		ctx->latency = malloc(sizeof(*ctx->latency));
+		if (ctx->latency == NULL)
+			return -ENOMEM;
+		err = latency_context_init(ctx->latency,
+					   ctx->xfer.latency_depth);
+		if (err < 0) {
+			free(ctx->latency);
+			ctx->latency = NULL;
+			return err;
+		}
+		ctx->xfer.latency = ctx->latency;
+	}
+
+	return 0;
 }
 
-static int capture_pre_process(struct context *ctx, snd_pcm_access_t *access,
-			       snd_pcm_uframes_t *frames_per_buffer,
-			       uint64_t *total_frame_count)
+// Like '<path>-<number>[.suffix]'.
+static char *insert_number_to_path(const char *path, const char *format,
+				   unsigned int number)
+{
+	const char *suffix;
+	char label[16];
+	unsigned int len;
+	char *buf;
+
+	snprintf(label, sizeof(label), format, number);
+
+	// Separate filename and suffix.
+	suffix = path + strlen(path);
+	while (suffix > path && *suffix != '.' && *suffix != '/')
+		--suffix;
+	if (*suffix != '.')
+		suffix = path + strlen(path);
+
+	len = strlen(path) + strlen(label) + 1;
+	buf = malloc(len);
+	if (buf == NULL)
+		return NULL;
+	snprintf(buf, len, "%.*s%s%s", (int)(suffix - path), path, label,
+		 suffix);
+
+	return buf;
+}
+
+// In the same way as aplay(1), the number of file is inserted before the suffix
+// of the path. Files which are not regular files, such as '/dev/null', are
+// reused.
+static char *generate_segment_path(const char *path, unsigned int index)
+{
+	struct stat st;
+
+	if (stat(path, &st) == 0 && !S_ISREG(st.st_mode))
+		return strdup(path);
+
+	return insert_number_to_path(path, "-%02u", index + 1);
+}
+
+static int build_containers(struct context *ctx,
+			    struct container_context *cntrs, unsigned int index,
+			    snd_pcm_format_t *format,
+			    uint64_t *total_frame_count)
 {
-	snd_pcm_format_t sample_format = SND_PCM_FORMAT_UNKNOWN;
-	unsigned int samples_per_frame = 0;
-	unsigned int frames_per_second = 0;
 	unsigned int channels;
+	unsigned int frames_per_second;
 	int i;
 	int err;
 
-	err = xfer_context_pre_process(&ctx->xfer, &sample_format,
-				       &samples_per_frame, &frames_per_second,
-				       access, frames_per_buffer);
-	if (err < 0)
-		return err;
-
-	// Prepare for containers.
-	ctx->cntrs = calloc(ctx->xfer.path_count, sizeof(*ctx->cntrs));
-	if (ctx->cntrs == NULL)
-		return -ENOMEM;
-	ctx->cntr_count = ctx->xfer.path_count;
-
 	if (ctx->cntr_count > 1)
 		channels = 1;
 	else
-		channels = samples_per_frame;
+		channels = ctx->xfer.samples_per_frame;
+	frames_per_second = ctx->xfer.frames_per_second;
 
 	*total_frame_count = 0;
 	for (i = 0; i < ctx->cntr_count; ++i) {
+		unsigned int bytes_per_frame;
 		uint64_t frame_count;
+		char *path;
 
-		err = container_builder_init(ctx->cntrs + i,
-					     ctx->xfer.paths[i],
-					     ctx->xfer.cntr_format,
-					     ctx->xfer.verbose > 1);
+		if (index == 0) {
+			err = container_builder_init(cntrs + i,
+						     ctx->xfer.paths[i],
+						     ctx->xfer.cntr_format,
+						     ctx->xfer.verbose > 1);
+		} else {
+			path = generate_segment_path(ctx->xfer.paths[i],
+						     index);
+			if (path == NULL)
+				return -ENOMEM;
+			err = container_builder_init(cntrs + i, path,
+						     ctx->xfer.cntr_format,
+						     ctx->xfer.verbose > 1);
+			free(path);
+		}
 		if (err < 0)
 			return err;
+		cntrs[i].timed = ctx->latency != NULL;
+		cntrs[i].abort_flag = &aborted;
 
-		err = container_context_pre_process(ctx->cntrs + i,
-						    &sample_format, &channels,
+		err = container_context_pre_process(cntrs + i, format,
+						    &channels,
 						    &frames_per_second,
 						    &frame_count);
 		if (err < 0)
@@ -195,6 +371,351 @@ static int capture_pre_process(struct context *ctx, snd_pcm_access_t *access,
 			*total_frame_count = frame_count;
 		if (frame_count < *total_frame_count)
 			*total_frame_count = frame_count;
+
+		bytes_per_frame = cntrs[i].bytes_per_sample *
+				  cntrs[i].samples_per_frame;
+
+		if (ctx->rotation) {
+			if (frame_count > ctx->rotation->frames_per_segment)
+				frame_count = ctx->rotation->frames_per_segment;
+			err = container_context_preallocate(cntrs + i,
+						frame_count * bytes_per_frame);
+			if (err < 0)
+				return err;
+		}
+
+#if WITH_IO_URING
+		err = container_context_attach_io_uring(cntrs + i,
+						ctx->xfer.io_uring_depth);
+		if (err < 0)
+			return err;
+#endif
+
+		if (ctx->xfer.writer_depth > 0) {
+			unsigned int frames_per_block;
+
+			// The size of period, or the default one when the
+			// backend doesn't have it.
+			frames_per_block = ctx->xfer.frames_per_period;
+			if (frames_per_block == 0)
+				frames_per_block = ctx->frames_per_buffer / 4;
+			if (frames_per_block == 0)
+				frames_per_block = 1;
+			err = container_context_attach_writer(cntrs + i,
+					ctx->xfer.writer_depth,
+					frames_per_block * bytes_per_frame);
+			if (err < 0)
+				return err;
+		}
+	}
+
+	return 0;
+}
+
+// The files are removed as well.
+static void discard_containers(struct context *ctx,
+			       struct container_context *cntrs,
+			       unsigned int index)
+{
+	char *path;
+	int i;
+
+	for (i = 0; i < ctx->cntr_count; ++i) {
+		// Not opened yet.
+		if (cntrs[i].fd <= 0)
+			continue;
+		container_context_destroy(cntrs + i);
+
+		path = generate_segment_path(ctx->xfer.paths[i], index);
+		if (path == NULL)
+			continue;
+		if (strcmp(path, ctx->xfer.paths[i]))
+			unlink(path);
+		free(path);
+	}
+	free(cntrs);
+}
+
+static int prepare_containers(struct context *ctx, unsigned int index,
+			      struct container_context **cntrs)
+{
+	snd_pcm_format_t format = ctx->cntr_format;
+	uint64_t frame_count;
+	int err;
+
+	*cntrs = calloc(ctx->cntr_count, sizeof(**cntrs));
+	if (*cntrs == NULL)
+		return -ENOMEM;
+
+	err = build_containers(ctx, *cntrs, index, &format, &frame_count);
+	if (err < 0) {
+		discard_containers(ctx, *cntrs, index);
+		*cntrs = NULL;
+		return err;
+	}
+
+	if (ctx->xfer.verbose > 0)
+		fprintf(stderr, "Prepared files for segment %u\n", index);
+
+	return 0;
+}
+
+static int finalize_containers(struct context *ctx,
+			       struct container_context *cntrs,
+			       unsigned int index)
+{
+	uint64_t frame_count;
+	char *path;
+	int i;
+	int err = 0;
+
+	for (i = 0; i < ctx->cntr_count; ++i) {
+		int e = container_context_post_process(cntrs + i,
+						       &frame_count);
+		if (e < 0 && err == 0)
+			err = e;
+		container_context_destroy(cntrs + i);
+
+		// As aplay(1) does, the first file is renamed when the second
+		// one is used.
+		if (index > 0)
+			continue;
+		path = generate_segment_path(ctx->xfer.paths[i], index);
+		if (path == NULL) {
+			if (err == 0)
+				err = -ENOMEM;
+			continue;
+		}
+		if (strcmp(path, ctx->xfer.paths[i]) &&
+		    rename(ctx->xfer.paths[i], path) < 0 && err == 0)
+			err = -errno;
+		free(path);
+	}
+	free(cntrs);
+
+	return err;
+}
+
+static void *rotation_thread(void *arg)
+{
+	struct context *ctx = arg;
+	struct rotation *rot = ctx->rotation;
+	struct container_context *cntrs;
+	unsigned int index;
+	int err;
+
+	pthread_mutex_lock(&rot->lock);
+	while (1) {
+		if (rot->prev_cntrs) {
+			cntrs = rot->prev_cntrs;
+			index = rot->prev_index;
+			pthread_mutex_unlock(&rot->lock);
+
+			err = finalize_containers(ctx, cntrs, index);
+
+			pthread_mutex_lock(&rot->lock);
+			rot->prev_cntrs = NULL;
+			if (err < 0 && rot->err == 0)
+				rot->err = err;
+			pthread_cond_broadcast(&rot->cond);
+		} else if (rot->quit) {
+			break;
+		} else if (rot->prepare) {
+			rot->prepare = false;
+			index = rot->index + 1;
+			pthread_mutex_unlock(&rot->lock);
+
+			err = prepare_containers(ctx, index, &cntrs);
+
+			pthread_mutex_lock(&rot->lock);
+			if (err < 0) {
+				if (rot->err == 0)
+					rot->err = err;
+			} else {
+				rot->next_cntrs = cntrs;
+			}
+			pthread_cond_broadcast(&rot->cond);
+		} else {
+			pthread_cond_wait(&rot->cond, &rot->lock);
+		}
+	}
+	pthread_mutex_unlock(&rot->lock);
+
+	return NULL;
+}
+
+static int rotation_init(struct context *ctx)
+{
+	struct rotation *rot;
+	uint64_t frame_count;
+	unsigned int channels;
+	unsigned int bytes_per_frame;
+	sigset_t mask, prev;
+	int err;
+
+	rot = calloc(1, sizeof(*rot));
+	if (rot == NULL)
+		return -ENOMEM;
+
+	if (ctx->xfer.max_file_seconds > 0) {
+		rot->frames_per_segment = (uint64_t)ctx->xfer.max_file_seconds *
+					  ctx->xfer.frames_per_second;
+	}
+	if (ctx->xfer.max_file_bytes > 0) {
+		if (ctx->cntr_count > 1)
+			channels = 1;
+		else
+			channels = ctx->xfer.samples_per_frame;
+		bytes_per_frame = channels *
+			snd_pcm_format_physical_width(ctx->cntr_format) / 8;
+		frame_count = ctx->xfer.max_file_bytes / bytes_per_frame;
+		if (frame_count == 0) {
+			fprintf(stderr,
+				"The size of file is too small for one frame.\n");
+			free(rot);
+			return -EINVAL;
+		}
+		if (rot->frames_per_segment == 0 ||
+		    frame_count < rot->frames_per_segment)
+			rot->frames_per_segment = frame_count;
+	}
+
+	pthread_mutex_init(&rot->lock, NULL);
+	pthread_cond_init(&rot->cond, NULL);
+	ctx->rotation = rot;
+
+	// UNIX signals are handled by the main thread.
+	sigfillset(&mask);
+	pthread_sigmask(SIG_BLOCK, &mask, &prev);
+	err = -pthread_create(&rot->thread, NULL, rotation_thread, ctx);
+	pthread_sigmask(SIG_SETMASK, &prev, NULL);
+	if (err < 0) {
+		pthread_cond_destroy(&rot->cond);
+		pthread_mutex_destroy(&rot->lock);
+		free(rot);
+		ctx->rotation = NULL;
+	}
+
+	return err;
+}
+
+static void rotation_destroy(struct context *ctx)
+{
+	struct rotation *rot = ctx->rotation;
+
+	// The previous files are finalized before the thread finishes.
+	pthread_mutex_lock(&rot->lock);
+	rot->quit = true;
+	pthread_cond_broadcast(&rot->cond);
+	pthread_mutex_unlock(&rot->lock);
+	pthread_join(rot->thread, NULL);
+
+	// The next files are unused.
+	if (rot->next_cntrs)
+		discard_containers(ctx, rot->next_cntrs, rot->index + 1);
+
+	pthread_cond_destroy(&rot->cond);
+	pthread_mutex_destroy(&rot->lock);
+	free(rot);
+	ctx->rotation = NULL;
+}
+
+// Switch the files at the boundary of segment. The frames are already handled
+// up to the boundary.
+static int rotate_containers(struct context *ctx, unsigned int frame_count)
+{
+	struct rotation *rot = ctx->rotation;
+	int err;
+
+	rot->handled_frame_count += frame_count;
+
+	if (!rot->requested && rot->handled_frame_count +
+			rot->lead_frame_count >= rot->frames_per_segment) {
+		pthread_mutex_lock(&rot->lock);
+		rot->prepare = true;
+		pthread_cond_broadcast(&rot->cond);
+		pthread_mutex_unlock(&rot->lock);
+		rot->requested = true;
+	}
+
+	if (rot->handled_frame_count < rot->frames_per_segment)
+		return 0;
+
+	pthread_mutex_lock(&rot->lock);
+	// Usually the next files are already prepared.
+	while (rot->next_cntrs == NULL && rot->err == 0)
+		pthread_cond_wait(&rot->cond, &rot->lock);
+	err = rot->err;
+	if (err == 0) {
+		rot->prev_cntrs = ctx->cntrs;
+		rot->prev_index = rot->index;
+		ctx->cntrs = rot->next_cntrs;
+		rot->next_cntrs = NULL;
+		++rot->index;
+		pthread_cond_broadcast(&rot->cond);
+	}
+	pthread_mutex_unlock(&rot->lock);
+
+	rot->handled_frame_count = 0;
+	rot->requested = false;
+
+	return err;
+}
+
+static int capture_pre_process(struct context *ctx, snd_pcm_access_t *access,
+			       snd_pcm_uframes_t *frames_per_buffer,
+			       uint64_t *total_frame_count)
+{
+	snd_pcm_format_t sample_format = SND_PCM_FORMAT_UNKNOWN;
+	unsigned int samples_per_frame = 0;
+	unsigned int frames_per_second = 0;
+	int err;
+
+	// The given format is kept for files even if the PCM substream uses
+	// the other format.
+	ctx->cntr_format = ctx->xfer.sample_format;
+
+	err = xfer_context_pre_process(&ctx->xfer, &sample_format,
+				       &samples_per_frame, &frames_per_second,
+				       access, frames_per_buffer);
+	if (err < 0)
+		return err;
+
+	if (ctx->cntr_format == SND_PCM_FORMAT_UNKNOWN ||
+	    !mapper_format_is_convertible(ctx->cntr_format) ||
+	    !mapper_format_is_convertible(sample_format))
+		ctx->cntr_format = sample_format;
+	ctx->frames_per_buffer = *frames_per_buffer;
+
+	// Prepare for containers.
+	ctx->cntrs = calloc(ctx->xfer.path_count, sizeof(*ctx->cntrs));
+	if (ctx->cntrs == NULL)
+		return -ENOMEM;
+	ctx->cntr_count = ctx->xfer.path_count;
+
+	if (ctx->xfer.max_file_seconds > 0 || ctx->xfer.max_file_bytes > 0) {
+		err = rotation_init(ctx);
+		if (err < 0)
+			return err;
+	}
+
+	err = build_containers(ctx, ctx->cntrs, 0, &ctx->cntr_format,
+			       total_frame_count);
+	if (err < 0)
+		return err;
+
+	if (ctx->rotation) {
+		struct rotation *rot = ctx->rotation;
+
+		// The limitation of container is for each file.
+		if (*total_frame_count < rot->frames_per_segment)
+			rot->frames_per_segment = *total_frame_count;
+		*total_frame_count = UINT64_MAX;
+
+		rot->lead_frame_count = (uint64_t)ROTATION_LEAD_SECONDS *
+					ctx->xfer.frames_per_second;
+		if (rot->lead_frame_count > rot->frames_per_segment / 2)
+			rot->lead_frame_count = rot->frames_per_segment / 2;
 	}
 
 	return 0;
@@ -227,6 +748,8 @@ static int playback_pre_process(struct context *ctx, snd_pcm_access_t *access,
 					    ctx->xfer.verbose > 1);
 		if (err < 0)
 			return err;
+		ctx->cntrs[i].timed = ctx->latency != NULL;
+		ctx->cntrs[i].abort_flag = &aborted;
 
 		if (i == 0) {
 			// For a raw container.
@@ -279,17 +802,155 @@ static int playback_pre_process(struct context *ctx, snd_pcm_access_t *access,
 			if (frame_count < *total_frame_count)
 				*total_frame_count = frame_count;
 		}
+
+#if WITH_IO_URING
+		err = container_context_attach_io_uring(ctx->cntrs + i,
+						ctx->xfer.io_uring_depth);
+		if (err < 0)
+			return err;
+#endif
+
+		if (ctx->xfer.mmap_file) {
+			err = container_context_attach_mmap(ctx->cntrs + i);
+			if (err < 0)
+				return err;
+		}
 	}
 
 	if (ctx->cntr_count > 1)
 		samples_per_frame = ctx->cntr_count;
 
+	// The format of PCM substream can be different when the samples are
+	// converted by mapper.
+	ctx->cntr_format = sample_format;
+
 	// Configure hardware with these parameters.
 	return xfer_context_pre_process(&ctx->xfer, &sample_format,
 					&samples_per_frame, &frames_per_second,
 					access, frames_per_buffer);
 }
 
+static void dump_latency(struct context *ctx, struct latency_context *lat)
+{
+	const char *path = ctx->xfer.latency_log_path;
+	char *buf = NULL;
+	int err;
+
+	// Each node has its own log.
+	if (ctx->xfer.device_count > 1) {
+		buf = insert_number_to_path(path, "-%u",
+					    ctx->xfer.device_index);
+		if (buf == NULL)
+			return;
+		path = buf;
+	}
+
+	err = latency_context_dump(lat, path);
+	if (err < 0) {
+		fprintf(stderr, "Fail to dump records of latency to %s: %s\n",
+			path, strerror(-err));
+	}
+
+	free(buf);
+}
+
+static void *latency_dumper_thread(void *arg)
+{
+	struct context *ctx = arg;
+	struct latency_dumper *dumper = ctx->dumper;
+
+	pthread_mutex_lock(&dumper->lock);
+	while (1) {
+		if (dumper->busy) {
+			pthread_mutex_unlock(&dumper->lock);
+
+			dump_latency(ctx, &dumper->snapshot);
+
+			pthread_mutex_lock(&dumper->lock);
+			dumper->busy = false;
+		} else if (dumper->quit) {
+			break;
+		} else {
+			pthread_cond_wait(&dumper->cond, &dumper->lock);
+		}
+	}
+	pthread_mutex_unlock(&dumper->lock);
+
+	return NULL;
+}
+
+static int latency_dumper_init(struct context *ctx)
+{
+	struct latency_dumper *dumper;
+	sigset_t mask, prev;
+	int err;
+
+	dumper = calloc(1, sizeof(*dumper));
+	if (dumper == NULL)
+		return -ENOMEM;
+
+	err = latency_context_init(&dumper->snapshot, ctx->latency->depth);
+	if (err < 0) {
+		free(dumper);
+		return err;
+	}
+
+	pthread_mutex_init(&dumper->lock, NULL);
+	pthread_cond_init(&dumper->cond, NULL);
+	ctx->dumper = dumper;
+
+	// UNIX signals are handled by the main thread.
+	sigfillset(&mask);
+	pthread_sigmask(SIG_BLOCK, &mask, &prev);
+	err = -pthread_create(&dumper->thread, NULL, latency_dumper_thread,
+			      ctx);
+	pthread_sigmask(SIG_SETMASK, &prev, NULL);
+	if (err < 0) {
+		pthread_cond_destroy(&dumper->cond);
+		pthread_mutex_destroy(&dumper->lock);
+		latency_context_destroy(&dumper->snapshot);
+		free(dumper);
+		ctx->dumper = NULL;
+	}
+
+	return err;
+}
+
+static void latency_dumper_destroy(struct context *ctx)
+{
+	struct latency_dumper *dumper = ctx->dumper;
+
+	// The requested dump is finished before the thread finishes.
+	pthread_mutex_lock(&dumper->lock);
+	dumper->quit = true;
+	pthread_cond_broadcast(&dumper->cond);
+	pthread_mutex_unlock(&dumper->lock);
+	pthread_join(dumper->thread, NULL);
+
+	pthread_cond_destroy(&dumper->cond);
+	pthread_mutex_destroy(&dumper->lock);
+	latency_context_destroy(&dumper->snapshot);
+	free(dumper);
+	ctx->dumper = NULL;
+}
+
+// Copying the records is cheaper than writing them. The request is dropped
+// while the previous one is still written.
+static void request_latency_dump(struct context *ctx)
+{
+	struct latency_dumper *dumper = ctx->dumper;
+
+	pthread_mutex_lock(&dumper->lock);
+	if (!dumper->busy) {
+		latency_context_copy(&dumper->snapshot, ctx->latency);
+		dumper->busy = true;
+		pthread_cond_broadcast(&dumper->cond);
+	} else if (ctx->xfer.verbose > 0) {
+		fprintf(stderr, "The previous dump of latency is not finished.\n");
+	}
+	pthread_mutex_unlock(&dumper->lock);
+}
+
 static int context_pre_process(struct context *ctx, snd_pcm_stream_t direction,
 			       uint64_t *total_frame_count)
 {
@@ -317,6 +978,12 @@ static int context_pre_process(struct context *ctx, snd_pcm_stream_t direction,
 	if (err < 0)
 		return err;
 
+	err = mapper_context_attach_converter(&ctx->mapper,
+					      ctx->xfer.sample_format,
+					      ctx->cntr_format);
+	if (err < 0)
+		return err;
+
 	bytes_per_sample =
 		snd_pcm_format_physical_width(ctx->xfer.sample_format) / 8;
 	if (bytes_per_sample <= 0)
@@ -329,9 +996,25 @@ static int context_pre_process(struct context *ctx, snd_pcm_stream_t direction,
 
 	xfer_options_calculate_duration(&ctx->xfer, total_frame_count);
 
+	if (ctx->latency)
+		return latency_dumper_init(ctx);
+
 	return 0;
 }
 
+static void commit_latency(struct context *ctx, unsigned int frame_count)
+{
+	uint64_t io_nsec = 0;
+	int i;
+
+	for (i = 0; i < ctx->cntr_count; ++i) {
+		io_nsec += ctx->cntrs[i].io_nsec;
+		ctx->cntrs[i].io_nsec = 0;
+	}
+
+	latency_context_commit(ctx->latency, frame_count, io_nsec);
+}
+
 static int context_process_frames(struct context *ctx,
 				  snd_pcm_stream_t direction,
 				  uint64_t expected_frame_count,
@@ -360,9 +1043,24 @@ static int context_process_frames(struct context *ctx,
 	*actual_frame_count = 0;
 	while (!ctx->interrupted) {
 		struct container_context *cntr;
+		uint64_t remain;
 
 		// Tell remains to expected frame count.
-		frame_count = expected_frame_count - *actual_frame_count;
+		remain = expected_frame_count - *actual_frame_count;
+		if (ctx->rotation) {
+			// Up to the boundary of segment.
+			if (remain > ctx->rotation->frames_per_segment -
+				     ctx->rotation->handled_frame_count) {
+				remain = ctx->rotation->frames_per_segment -
+					 ctx->rotation->handled_frame_count;
+			}
+		}
+		if (remain > UINT_MAX)
+			remain = UINT_MAX;
+		frame_count = (unsigned int)remain;
+
+		if (ctx->latency)
+			latency_context_begin(ctx->latency);
 		err = xfer_context_process_frames(&ctx->xfer, &ctx->mapper,
 						  ctx->cntrs, &frame_count);
 		if (err < 0) {
@@ -370,10 +1068,27 @@ static int context_process_frames(struct context *ctx,
 				continue;
 			break;
 		}
+		if (ctx->latency) {
+			commit_latency(ctx, frame_count);
+			if (ctx->dump_requested) {
+				ctx->dump_requested = false;
+				request_latency_dump(ctx);
+			}
+		}
 		if (verbose) {
 			fprintf(stderr,
 				"  handled: %u\n", frame_count);
 		}
+
+		// The files reaching the boundary of segment are switched
+		// before checking the end of them.
+		if (ctx->rotation &&
+		    *actual_frame_count + frame_count < expected_frame_count) {
+			err = rotate_containers(ctx, frame_count);
+			if (err < 0)
+				break;
+		}
+
 		for (i = 0; i < ctx->cntr_count; ++i) {
 			cntr = &ctx->cntrs[i];
 			if (cntr->eof)
@@ -387,6 +1102,11 @@ static int context_process_frames(struct context *ctx,
 			break;
 	}
 
+	if (ctx->interrupted) {
+		for (i = 0; i < ctx->cntr_count; ++i)
+			ctx->cntrs[i].interrupted = true;
+	}
+
 	if (!ctx->xfer.quiet) {
 		fprintf(stderr,
 			"%s: Expected %lu frames, Actual %lu frames\n",
@@ -410,6 +1130,9 @@ static void context_post_process(struct context *ctx,
 
 	xfer_context_post_process(&ctx->xfer);
 
+	if (ctx->rotation)
+		rotation_destroy(ctx);
+
 	if (ctx->cntrs) {
 		for (i = 0; i < ctx->cntr_count; ++i) {
 			container_context_post_process(ctx->cntrs + i,
@@ -421,21 +1144,190 @@ static void context_post_process(struct context *ctx,
 
 	mapper_context_post_process(&ctx->mapper);
 	mapper_context_destroy(&ctx->mapper);
+
+	if (ctx->dumper)
+		latency_dumper_destroy(ctx);
+
+	if (ctx->latency && ctx->latency->count > 0) {
+		dump_latency(ctx, ctx->latency);
+		if (!ctx->xfer.quiet)
+			latency_context_summarize(ctx->latency, stderr);
+	}
 }
 
 static void context_destroy(struct context *ctx)
 {
+	if (ctx->latency) {
+		latency_context_destroy(ctx->latency);
+		free(ctx->latency);
+	}
 	xfer_context_destroy(&ctx->xfer);
 }
 
+static void open_start_gate(struct start_gate *gate,
+			    enum start_gate_state state)
+{
+	pthread_mutex_lock(&gate->lock);
+	gate->state = state;
+	pthread_cond_broadcast(&gate->cond);
+	pthread_mutex_unlock(&gate->lock);
+}
+
+static void *transfer_thread(void *arg)
+{
+	struct context *ctx = arg;
+	enum start_gate_state state;
+
+	// Start transmission at the same time as the others.
+	pthread_mutex_lock(&ctx->gate->lock);
+	while (ctx->gate->state == START_GATE_WAIT)
+		pthread_cond_wait(&ctx->gate->cond, &ctx->gate->lock);
+	state = ctx->gate->state;
+	pthread_mutex_unlock(&ctx->gate->lock);
+
+	if (state == START_GATE_ABORT)
+		return NULL;
+
+	ctx->err = context_process_frames(ctx, ctx->direction,
+					  ctx->expected_frame_count,
+					  &ctx->actual_frame_count);
+
+	// The others recover XRUN of the group without this node.
+	if (ctx->linked)
+		xfer_context_unlink(&ctx->xfer);
+
+	return NULL;
+}
+
+// Each node has its own containers, mapper and thread. The nodes are linked
+// to the first one if possible so that they start at the same time.
+static int transfer_devices(int argc, char *const *argv,
+			    snd_pcm_stream_t direction, unsigned int count)
+{
+	struct context *ctxs;
+	struct start_gate gate = {
+		.lock = PTHREAD_MUTEX_INITIALIZER,
+		.cond = PTHREAD_COND_INITIALIZER,
+		.state = START_GATE_WAIT,
+	};
+	sigset_t mask, prev;
+	unsigned int started = 0;
+	int i;
+	int err;
+
+	ctxs = calloc(count, sizeof(*ctxs));
+	if (ctxs == NULL)
+		return -ENOMEM;
+
+	err = prepare_signal_handler(ctxs, count);
+	if (err < 0)
+		goto end;
+
+	for (i = 0; i < count; ++i) {
+		struct context *ctx = ctxs + i;
+
+		// The option parser selects the node and the file for the
+		// index.
+		ctx->xfer.device_index = i;
+		err = context_init(ctx, direction, argc, argv);
+		if (err < 0)
+			goto end;
+		if (ctx->xfer.help || ctx->xfer.dump_hw_params)
+			goto end;
+		if (ctx->xfer.multiple_cntrs) {
+			fprintf(stderr,
+				"Separate channels are not available with "
+				"several devices.\n");
+			err = -EINVAL;
+			goto end;
+		}
+		if (ctx->latency) {
+			err = prepare_signal_handler_for_dump();
+			if (err < 0)
+				goto end;
+		}
+
+		ctx->direction = direction;
+		err = context_pre_process(ctx, direction,
+					  &ctx->expected_frame_count);
+		if (err < 0)
+			goto end;
+
+		if (i > 0) {
+			err = xfer_context_link(&ctx->xfer, &ctxs[0].xfer);
+			if (err < 0 && ctx->xfer.verbose > 0) {
+				fprintf(stderr,
+					"Device %u is not linked to device 0: "
+					"%s\n", i, snd_strerror(err));
+			}
+			ctx->linked = err >= 0;
+			if (ctx->linked)
+				ctxs[0].linked = true;
+		}
+	}
+
+	// The linked nodes for playback are filled in advance, then started
+	// by the master.
+	if (direction == SND_PCM_STREAM_PLAYBACK && ctxs[0].linked) {
+		for (i = 0; i < count; ++i) {
+			if (!ctxs[i].linked)
+				continue;
+			err = xfer_context_prefill(&ctxs[i].xfer);
+			if (err < 0)
+				goto end;
+		}
+	}
+
+	// UNIX signals are handled by the main thread.
+	sigfillset(&mask);
+	pthread_sigmask(SIG_BLOCK, &mask, &prev);
+	for (i = 0; i < count; ++i) {
+		ctxs[i].gate = &gate;
+		err = -pthread_create(&ctxs[i].thread, NULL, transfer_thread,
+				      ctxs + i);
+		if (err < 0)
+			break;
+		++started;
+	}
+	pthread_sigmask(SIG_SETMASK, &prev, NULL);
+
+	// The linked nodes in both directions are started by the master at once
+	// so that none of the threads sees the others in the middle of start.
+	if (started == count && ctxs[0].linked)
+		err = xfer_context_start(&ctxs[0].xfer);
+
+	// The started threads return immediately when the others are not
+	// available.
+	if (started < count || err < 0)
+		open_start_gate(&gate, START_GATE_ABORT);
+	else
+		open_start_gate(&gate, START_GATE_GO);
+
+	for (i = 0; i < started; ++i) {
+		pthread_join(ctxs[i].thread, NULL);
+		if (ctxs[i].err < 0 && err == 0)
+			err = ctxs[i].err;
+	}
+end:
+	for (i = 0; i < count; ++i) {
+		context_post_process(ctxs + i, ctxs[i].actual_frame_count);
+		context_destroy(ctxs + i);
+	}
+	ctx_count = 0;
+	free(ctxs);
+
+	return err;
+}
+
 int subcmd_transfer(int argc, char *const *argv, snd_pcm_stream_t direction)
 {
 	struct context ctx = {0};
 	uint64_t expected_frame_count = 0;
 	uint64_t actual_frame_count = 0;
+	unsigned int device_count;
 	int err = 0;
 
-	err = prepare_signal_handler(&ctx);
+	err = prepare_signal_handler(&ctx, 1);
 	if (err < 0)
 		return err;
 
@@ -445,6 +1337,20 @@ int subcmd_transfer(int argc, char *const *argv, snd_pcm_stream_t direction)
 	if (ctx.xfer.help || ctx.xfer.dump_hw_params)
 		goto end;
 
+	// The option parser counts the given nodes.
+	if (ctx.xfer.device_count > 1) {
+		device_count = ctx.xfer.device_count;
+		context_post_process(&ctx, 0);
+		context_destroy(&ctx);
+		return transfer_devices(argc, argv, direction, device_count);
+	}
+
+	if (ctx.latency) {
+		err = prepare_signal_handler_for_dump();
+		if (err < 0)
+			goto end;
+	}
+
 	err = context_pre_process(&ctx, direction, &expected_frame_count);
 	if (err < 0)
 		goto end;
@@ -6,7 +6,10 @@
 //
 // Licensed under the terms of the GNU General Public License, version 2.
 
+#include "aconfig.h"
+
 #include "../container.h"
+#include "../flac.h"
 #include "../misc.h"
 
 #include "generator.h"
@@ -31,6 +34,7 @@ static void test_builder(struct container_context *cntr,
 			 unsigned int samples_per_frame,
 			 unsigned int frames_per_second,
 			 void *frame_buffer, unsigned int frame_count,
+			 unsigned int io_uring_depth, unsigned int writer_depth,
 			 bool verbose)
 {
 	snd_pcm_format_t sample;
@@ -56,6 +60,14 @@ static void test_builder(struct container_context *cntr,
 	assert(rate == frames_per_second);
 	assert(max_frame_count > 0);
 
+#if WITH_IO_URING
+	err = container_context_attach_io_uring(cntr, io_uring_depth);
+	assert(err == 0);
+#endif
+	// The size of block is not aligned to frame intentionally.
+	err = container_context_attach_writer(cntr, writer_depth, 65537);
+	assert(err == 0);
+
 	handled_frame_count = frame_count;
 	err = container_context_process_frames(cntr, frame_buffer,
 					       &handled_frame_count);
@@ -77,6 +89,7 @@ static void test_parser(struct container_context *cntr,
 		        unsigned int samples_per_frame,
 		        unsigned int frames_per_second,
 		        void *frame_buffer, unsigned int frame_count,
+			unsigned int io_uring_depth, bool use_mmap,
 			bool verbose)
 {
 	snd_pcm_format_t sample;
@@ -84,6 +97,7 @@ static void test_parser(struct container_context *cntr,
 	unsigned int rate;
 	uint64_t total_frame_count;
 	unsigned int handled_frame_count;
+	void *mapped;
 	int err;
 
 	err = container_parser_init(cntr, name, verbose);
@@ -101,9 +115,31 @@ static void test_parser(struct container_context *cntr,
 	assert(rate == frames_per_second);
 	assert(total_frame_count == frame_count);
 
+#if WITH_IO_URING
+	err = container_context_attach_io_uring(cntr, io_uring_depth);
+	assert(err == 0);
+#endif
+
 	handled_frame_count = total_frame_count;
-	err = container_context_process_frames(cntr, frame_buffer,
-					       &handled_frame_count);
+	if (!use_mmap) {
+		err = container_context_process_frames(cntr, frame_buffer,
+						       &handled_frame_count);
+	} else {
+		err = container_context_attach_mmap(cntr);
+		assert(err == 0);
+
+		err = container_context_map_frames(cntr, &mapped,
+						   &handled_frame_count);
+		// Unavailable for Creative Voice file.
+		if (err == -ENXIO) {
+			err = container_context_process_frames(cntr,
+					frame_buffer, &handled_frame_count);
+		} else if (err == 0) {
+			memcpy(frame_buffer, mapped, handled_frame_count *
+			       samples_per_frame *
+			       snd_pcm_format_physical_width(sample_format) / 8);
+		}
+	}
 	assert(err == 0);
 	assert(handled_frame_count == frame_count);
 
@@ -130,6 +166,8 @@ static int callback(struct test_generator *gen, snd_pcm_access_t access,
 	};
 	struct container_trial *trial = gen->private_data;
 	unsigned int frames_per_second;
+	unsigned int io_uring_depth;
+	unsigned int writer_depth;
 	const char *const name = "hoge";
 	unsigned int size;
 	void *buf;
@@ -147,15 +185,20 @@ static int callback(struct test_generator *gen, snd_pcm_access_t access,
 
 	for (i = 0; i < ARRAY_SIZE(entries); ++i) {
 		frames_per_second = entries[i];
+		// Odd trials transfer sample data by io_uring if available,
+		// the others write it by a thread and read it from mapped file.
+		io_uring_depth = (i % 2) ? 4 : 0;
+		writer_depth = (i % 2) ? 0 : 3;
 
 		test_builder(&trial->cntr, trial->format, name, access,
 			     sample_format, samples_per_frame,
 			     frames_per_second, frame_buffer, frame_count,
-			     trial->verbose);
+			     io_uring_depth, writer_depth, trial->verbose);
 
 		test_parser(&trial->cntr, trial->format, name, access,
 			    sample_format, samples_per_frame, frames_per_second,
-			    buf, frame_count, trial->verbose);
+			    buf, frame_count, io_uring_depth, !io_uring_depth,
+			    trial->verbose);
 
 		err = memcmp(buf, frame_buffer, size);
 		assert(err == 0);
@@ -168,6 +211,52 @@ static int callback(struct test_generator *gen, snd_pcm_access_t access,
 	return 0;
 }
 
+// Full scale samples of 32 bit let residuals of fixed predictors overflow,
+// including the ones just after warm-up samples.
+static void test_flac_full_scale(bool verbose)
+{
+	static const unsigned int frame_count = 4500;
+	static const unsigned int samples_per_frame = 2;
+	struct container_context cntr = {0};
+	const char *const name = "hoge";
+	unsigned int size;
+	int32_t *frames;
+	void *buf;
+	int i;
+	int err;
+
+	size = frame_count * samples_per_frame * sizeof(*frames);
+	frames = malloc(size);
+	buf = malloc(size);
+	assert(frames != NULL && buf != NULL);
+
+	// The step from the first frame is the largest residual.
+	for (i = 0; i < frame_count * samples_per_frame; ++i) {
+		if (i < samples_per_frame)
+			frames[i] = INT32_MIN;
+		else
+			frames[i] = INT32_MAX;
+	}
+
+	unlink(name);
+
+	test_builder(&cntr, CONTAINER_FORMAT_FLAC, name,
+		     SND_PCM_ACCESS_RW_INTERLEAVED, SND_PCM_FORMAT_S32_LE,
+		     samples_per_frame, 48000, frames, frame_count, 0, 0,
+		     verbose);
+	test_parser(&cntr, CONTAINER_FORMAT_FLAC, name,
+		    SND_PCM_ACCESS_RW_INTERLEAVED, SND_PCM_FORMAT_S32_LE,
+		    samples_per_frame, 48000, buf, frame_count, 0, false,
+		    verbose);
+
+	err = memcmp(buf, frames, size);
+	assert(err == 0);
+
+	unlink(name);
+	free(buf);
+	free(frames);
+}
+
 int main(int argc, const char *argv[])
 {
 	static const uint64_t sample_format_masks[] = {
@@ -191,6 +280,30 @@ int main(int argc, const char *argv[])
 			(1ul << SND_PCM_FORMAT_S20_3BE) |
 			(1ul << SND_PCM_FORMAT_S18_3LE) |
 			(1ul << SND_PCM_FORMAT_S18_3BE),
+		[CONTAINER_FORMAT_RF64] =
+			(1ul << SND_PCM_FORMAT_U8) |
+			(1ul << SND_PCM_FORMAT_S16_LE) |
+			(1ul << SND_PCM_FORMAT_S24_LE) |
+			(1ul << SND_PCM_FORMAT_S32_LE) |
+			(1ul << SND_PCM_FORMAT_FLOAT_LE) |
+			(1ul << SND_PCM_FORMAT_FLOAT64_LE) |
+			(1ul << SND_PCM_FORMAT_MU_LAW) |
+			(1ul << SND_PCM_FORMAT_A_LAW) |
+			(1ul << SND_PCM_FORMAT_S24_3LE) |
+			(1ul << SND_PCM_FORMAT_S20_3LE) |
+			(1ul << SND_PCM_FORMAT_S18_3LE),
+		[CONTAINER_FORMAT_W64] =
+			(1ul << SND_PCM_FORMAT_U8) |
+			(1ul << SND_PCM_FORMAT_S16_LE) |
+			(1ul << SND_PCM_FORMAT_S24_LE) |
+			(1ul << SND_PCM_FORMAT_S32_LE) |
+			(1ul << SND_PCM_FORMAT_FLOAT_LE) |
+			(1ul << SND_PCM_FORMAT_FLOAT64_LE) |
+			(1ul << SND_PCM_FORMAT_MU_LAW) |
+			(1ul << SND_PCM_FORMAT_A_LAW) |
+			(1ul << SND_PCM_FORMAT_S24_3LE) |
+			(1ul << SND_PCM_FORMAT_S20_3LE) |
+			(1ul << SND_PCM_FORMAT_S18_3LE),
 		[CONTAINER_FORMAT_AU] =
 			(1ul << SND_PCM_FORMAT_S8) |
 			(1ul << SND_PCM_FORMAT_S16_BE) |
@@ -204,6 +317,11 @@ int main(int argc, const char *argv[])
 			(1ul << SND_PCM_FORMAT_S16_LE) |
 			(1ul << SND_PCM_FORMAT_MU_LAW) |
 			(1ul << SND_PCM_FORMAT_A_LAW),
+		[CONTAINER_FORMAT_FLAC] =
+			(1ul << SND_PCM_FORMAT_S8) |
+			(1ul << SND_PCM_FORMAT_S16_LE) |
+			(1ul << SND_PCM_FORMAT_S24_3LE) |
+			(1ul << SND_PCM_FORMAT_S32_LE),
 		[CONTAINER_FORMAT_RAW] =
 			(1ul << SND_PCM_FORMAT_S8) |
 			(1ul << SND_PCM_FORMAT_U8) |
@@ -250,6 +368,7 @@ int main(int argc, const char *argv[])
 		(1ul << SND_PCM_ACCESS_RW_INTERLEAVED);
 	struct test_generator gen = {0};
 	struct container_trial *trial;
+	unsigned int max_channels;
 	int i;
 	int begin;
 	int end;
@@ -273,9 +392,14 @@ int main(int argc, const char *argv[])
 	}
 
 	for (i = begin; i < end; ++i) {
+		// FLAC supports up to 8 channels.
+		max_channels = 128;
+		if (i == CONTAINER_FORMAT_FLAC)
+			max_channels = FLAC_MAX_CHANNELS;
+
 		err = generator_context_init(&gen, access_mask,
 					     sample_format_masks[i],
-					     1, 128, 23, 4500, 1024,
+					     1, max_channels, 23, 4500, 1024,
 					     sizeof(struct container_trial));
 		if (err >= 0) {
 			trial = gen.private_data;
@@ -288,6 +412,9 @@ int main(int argc, const char *argv[])
 
 		if (err < 0)
 			break;
+
+		if (i == CONTAINER_FORMAT_FLAC)
+			test_flac_full_scale(verbose);
 	}
 
 	if (err < 0) {
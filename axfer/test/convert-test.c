@@ -0,0 +1,195 @@
+// SPDX-License-Identifier: GPL-2.0
+//
+// convert-test.c - a unit test for conversion of sample format in mapper.
+//
+// Licensed under the terms of the GNU General Public License, version 2.
+
+#include "../mapper.h"
+#include "../misc.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+
+#include <assert.h>
+
+#define SAMPLE_COUNT	1000
+
+static const snd_pcm_format_t formats[] = {
+	SND_PCM_FORMAT_U8,
+	SND_PCM_FORMAT_S8,
+	SND_PCM_FORMAT_S16_LE,
+	SND_PCM_FORMAT_S16_BE,
+	SND_PCM_FORMAT_S24_LE,
+	SND_PCM_FORMAT_S24_BE,
+	SND_PCM_FORMAT_S24_3LE,
+	SND_PCM_FORMAT_S24_3BE,
+	SND_PCM_FORMAT_S32_LE,
+	SND_PCM_FORMAT_S32_BE,
+	SND_PCM_FORMAT_FLOAT_LE,
+	SND_PCM_FORMAT_FLOAT_BE,
+};
+
+// Significant bits preserved by the format for integer samples.
+static unsigned int significant_bits(snd_pcm_format_t format)
+{
+	// Single precision floating point has 24 bits mantissa.
+	if (snd_pcm_format_float(format) > 0)
+		return 24;
+	return snd_pcm_format_width(format);
+}
+
+static void fill_samples(char *buf, snd_pcm_format_t format,
+			 unsigned int count)
+{
+	unsigned int bytes_per_sample = snd_pcm_format_physical_width(format) / 8;
+	struct mapper_converter conv;
+	int32_t *samples;
+	unsigned int i;
+	int err;
+
+	samples = calloc(count, sizeof(*samples));
+	assert(samples);
+
+	// Samples within the range of format, including both edges. The lower 8
+	// bits are cleared so that single precision floating point represents
+	// them exactly.
+	for (i = 0; i < count; ++i)
+		samples[i] = (int32_t)((uint32_t)random() << 1 ^ random());
+	samples[0] = INT32_MIN;
+	samples[1] = INT32_MAX;
+	samples[2] = 0;
+	for (i = 0; i < count; ++i)
+		samples[i] &= ~0xff;
+
+	err = mapper_converter_init(&conv, SND_PCM_FORMAT_S32_LE, format);
+	assert(err == 0);
+	memset(buf, 0, count * bytes_per_sample);
+	mapper_converter_convert(&conv, buf, samples, count);
+
+	free(samples);
+}
+
+// Converting to the format with the same or more significant bits, then back
+// to the original format, should give the same samples.
+static void test_round_trip(snd_pcm_format_t src, snd_pcm_format_t dst)
+{
+	unsigned int src_bytes = snd_pcm_format_physical_width(src) / 8;
+	unsigned int dst_bytes = snd_pcm_format_physical_width(dst) / 8;
+	struct mapper_converter forward;
+	struct mapper_converter backward;
+	char *orig, *tmp, *result;
+	int err;
+
+	orig = calloc(SAMPLE_COUNT, src_bytes);
+	tmp = calloc(SAMPLE_COUNT, dst_bytes);
+	result = calloc(SAMPLE_COUNT, src_bytes);
+	assert(orig && tmp && result);
+
+	fill_samples(orig, src, SAMPLE_COUNT);
+
+	err = mapper_converter_init(&forward, src, dst);
+	assert(err == 0);
+	err = mapper_converter_init(&backward, dst, src);
+	assert(err == 0);
+
+	mapper_converter_convert(&forward, tmp, orig, SAMPLE_COUNT);
+	mapper_converter_convert(&backward, result, tmp, SAMPLE_COUNT);
+
+	if (memcmp(orig, result, SAMPLE_COUNT * src_bytes)) {
+		printf("%s -> %s -> %s mismatch\n", snd_pcm_format_name(src),
+		       snd_pcm_format_name(dst), snd_pcm_format_name(src));
+		exit(EXIT_FAILURE);
+	}
+
+	free(orig);
+	free(tmp);
+	free(result);
+}
+
+static void test_value(snd_pcm_format_t src, const void *src_buf,
+		       snd_pcm_format_t dst, const void *expected)
+{
+	unsigned int bytes = snd_pcm_format_physical_width(dst) / 8;
+	struct mapper_converter conv;
+	char buf[8];
+	int err;
+
+	err = mapper_converter_init(&conv, src, dst);
+	assert(err == 0);
+	mapper_converter_convert(&conv, buf, src_buf, 1);
+	if (memcmp(buf, expected, bytes)) {
+		printf("%s -> %s: unexpected value\n",
+		       snd_pcm_format_name(src), snd_pcm_format_name(dst));
+		exit(EXIT_FAILURE);
+	}
+}
+
+static void test_values(void)
+{
+	static const uint8_t s16_le_half[] = {0x00, 0x40};
+	static const uint8_t s16_be_min[] = {0x80, 0x00};
+	static const uint8_t s24_3le_min[] = {0x00, 0x00, 0x80};
+	static const uint8_t s24_le_minus_one[] = {0xff, 0xff, 0xff, 0x00};
+	static const uint8_t s32_le_minus_256[] = {0x00, 0xff, 0xff, 0xff};
+	static const uint8_t u8_zero[] = {0x80};
+	static const uint8_t s8_zero[] = {0x00};
+	float half = 0.5f;
+	float over = 2.0f;
+	uint8_t s32_le_max[] = {0xff, 0xff, 0xff, 0x7f};
+	uint8_t float_le_half[4];
+	uint8_t s16_le_max[] = {0xff, 0x7f};
+
+	memcpy(float_le_half, &half, sizeof(half));
+	if (snd_pcm_format_cpu_endian(SND_PCM_FORMAT_FLOAT_LE) != 1) {
+		uint8_t tmp[4];
+		memcpy(tmp, float_le_half, 4);
+		float_le_half[0] = tmp[3];
+		float_le_half[1] = tmp[2];
+		float_le_half[2] = tmp[1];
+		float_le_half[3] = tmp[0];
+	}
+
+	test_value(SND_PCM_FORMAT_S16_LE, s16_le_half,
+		   SND_PCM_FORMAT_FLOAT_LE, float_le_half);
+	test_value(SND_PCM_FORMAT_FLOAT_LE, float_le_half,
+		   SND_PCM_FORMAT_S16_LE, s16_le_half);
+	test_value(SND_PCM_FORMAT_S16_BE, s16_be_min,
+		   SND_PCM_FORMAT_S24_3LE, s24_3le_min);
+	test_value(SND_PCM_FORMAT_S24_LE, s24_le_minus_one,
+		   SND_PCM_FORMAT_S32_LE, s32_le_minus_256);
+	test_value(SND_PCM_FORMAT_U8, u8_zero, SND_PCM_FORMAT_S8, s8_zero);
+
+	// Saturation.
+	if (snd_pcm_format_cpu_endian(SND_PCM_FORMAT_FLOAT_LE) == 1) {
+		test_value(SND_PCM_FORMAT_FLOAT_LE, &over,
+			   SND_PCM_FORMAT_S16_LE, s16_le_max);
+		s32_le_max[0] = 0x80;
+		s32_le_max[1] = 0xff;
+		test_value(SND_PCM_FORMAT_FLOAT_LE, &over,
+			   SND_PCM_FORMAT_S32_LE, s32_le_max);
+	}
+}
+
+int main(int argc, const char *argv[])
+{
+	int i, j;
+
+	for (i = 0; i < ARRAY_SIZE(formats); ++i) {
+		assert(mapper_format_is_convertible(formats[i]));
+
+		for (j = 0; j < ARRAY_SIZE(formats); ++j) {
+			if (significant_bits(formats[j]) <
+			    significant_bits(formats[i]))
+				continue;
+			test_round_trip(formats[i], formats[j]);
+		}
+	}
+
+	assert(!mapper_format_is_convertible(SND_PCM_FORMAT_MU_LAW));
+
+	test_values();
+
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,135 @@
+// SPDX-License-Identifier: GPL-2.0
+//
+// frame-cache-test.c - a unit test for cache of data frames.
+//
+// Licensed under the terms of the GNU General Public License, version 2.
+
+#include "../frame-cache.h"
+#include "../misc.h"
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#include <assert.h>
+
+// Each sample has the serial number of frame and the index of channel.
+static uint32_t sample_value(unsigned int frame, unsigned int ch)
+{
+	return (frame << 8) | ch;
+}
+
+static void *sample_addr(struct frame_cache *cache, bool producer,
+			 unsigned int frame, unsigned int ch)
+{
+	void *buf = producer ? cache->buf_ptr : cache->buf;
+
+	if (cache->access == SND_PCM_ACCESS_RW_INTERLEAVED) {
+		uint32_t *samples = buf;
+		return samples + cache->samples_per_frame * frame + ch;
+	} else {
+		uint32_t **samples = buf;
+		return samples[ch] + frame;
+	}
+}
+
+static void produce(struct frame_cache *cache, unsigned int *serial,
+		    unsigned int frame_count)
+{
+	unsigned int i, ch;
+
+	for (i = 0; i < frame_count; ++i) {
+		for (ch = 0; ch < cache->samples_per_frame; ++ch) {
+			uint32_t *sample = sample_addr(cache, true, i, ch);
+			*sample = sample_value(*serial + i, ch);
+		}
+	}
+	frame_cache_increase_count(cache, frame_count);
+	*serial += frame_count;
+}
+
+static void consume(struct frame_cache *cache, unsigned int *serial,
+		    unsigned int frame_count)
+{
+	unsigned int i, ch;
+
+	for (i = 0; i < frame_count; ++i) {
+		for (ch = 0; ch < cache->samples_per_frame; ++ch) {
+			uint32_t *sample = sample_addr(cache, false, i, ch);
+			assert(*sample == sample_value(*serial + i, ch));
+		}
+	}
+	frame_cache_reduce(cache, frame_count);
+	*serial += frame_count;
+}
+
+static void test_cache(snd_pcm_access_t access, unsigned int samples_per_frame,
+		       unsigned int frames_per_cache)
+{
+	struct frame_cache cache = {0};
+	unsigned int produced = 0;
+	unsigned int consumed = 0;
+	unsigned int count;
+	int i;
+	int err;
+
+	err = frame_cache_init(&cache, access, sizeof(uint32_t),
+			       samples_per_frame, frames_per_cache);
+	assert(err == 0);
+
+	for (i = 0; i < 10000; ++i) {
+		assert(frame_cache_get_count(&cache) == produced - consumed);
+		assert(frame_cache_get_space(&cache) <=
+		       frames_per_cache - frame_cache_get_count(&cache));
+		assert(frame_cache_get_contiguous_count(&cache) <=
+		       frame_cache_get_count(&cache));
+
+		// Partial operations in both sides.
+		count = frame_cache_get_space(&cache);
+		if (count > 0)
+			produce(&cache, &produced, random() % count + 1);
+
+		count = frame_cache_get_contiguous_count(&cache);
+		if (count > 0)
+			consume(&cache, &consumed, random() % count + 1);
+
+		// The whole cached frames are contiguous after linearized.
+		if (i % 97 == 0) {
+			count = frame_cache_get_count(&cache);
+			err = frame_cache_linearize(&cache);
+			assert(err == 0);
+			assert(frame_cache_get_contiguous_count(&cache) ==
+			       count);
+			assert(frame_cache_get_space(&cache) ==
+			       frames_per_cache - count);
+		}
+	}
+
+	// Drain.
+	while ((count = frame_cache_get_contiguous_count(&cache)) > 0)
+		consume(&cache, &consumed, count);
+	assert(produced == consumed);
+	assert(frame_cache_get_space(&cache) == frames_per_cache);
+
+	frame_cache_destroy(&cache);
+}
+
+int main(int argc, const char *argv[])
+{
+	static const snd_pcm_access_t accesses[] = {
+		SND_PCM_ACCESS_RW_INTERLEAVED,
+		SND_PCM_ACCESS_RW_NONINTERLEAVED,
+	};
+	static const unsigned int counts[] = {1, 2, 6, 32};
+	static const unsigned int sizes[] = {1, 7, 64, 1024};
+	int i, j, k;
+
+	for (i = 0; i < ARRAY_SIZE(accesses); ++i) {
+		for (j = 0; j < ARRAY_SIZE(counts); ++j) {
+			for (k = 0; k < ARRAY_SIZE(sizes); ++k)
+				test_cache(accesses[i], counts[j], sizes[k]);
+		}
+	}
+
+	return EXIT_SUCCESS;
+}
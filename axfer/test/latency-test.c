@@ -0,0 +1,133 @@
+// SPDX-License-Identifier: GPL-2.0
+//
+// latency-test.c - a unit test for records of latency.
+//
+// Licensed under the terms of the GNU General Public License, version 2.
+
+#include "../latency.h"
+#include "../misc.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <assert.h>
+
+static char *dump(struct latency_context *lat, const char *suffix)
+{
+	char path[] = "/tmp/axfer-latency-XXXXXX.json";
+	unsigned int suffix_len = strlen(".json");
+	char *buf;
+	FILE *fp;
+	long size;
+	int fd;
+	int err;
+
+	if (strcmp(suffix, ".json")) {
+		// Without suffix for CSV.
+		path[strlen(path) - suffix_len] = '\0';
+		suffix_len = 0;
+	}
+	fd = mkstemps(path, suffix_len);
+	assert(fd >= 0);
+	close(fd);
+
+	err = latency_context_dump(lat, path);
+	assert(err == 0);
+
+	fp = fopen(path, "r");
+	assert(fp != NULL);
+	fseek(fp, 0, SEEK_END);
+	size = ftell(fp);
+	fseek(fp, 0, SEEK_SET);
+	buf = calloc(size + 1, 1);
+	assert(buf != NULL);
+	assert(fread(buf, 1, size, fp) == size);
+	fclose(fp);
+	unlink(path);
+
+	return buf;
+}
+
+static unsigned int count_lines(const char *buf)
+{
+	unsigned int count = 0;
+
+	while ((buf = strchr(buf, '\n')) != NULL) {
+		++count;
+		++buf;
+	}
+
+	return count;
+}
+
+// The oldest records are overwritten when the ring is wrapped around.
+static void test_ring(void)
+{
+	struct latency_context lat;
+	char *buf;
+	int i;
+	int err;
+
+	err = latency_context_init(&lat, 10);
+	assert(err == 0);
+
+	for (i = 0; i < 25; ++i) {
+		latency_context_begin(&lat);
+		latency_context_commit(&lat, i, 0);
+	}
+	assert(lat.count == 25);
+
+	buf = dump(&lat, ".csv");
+	// Header and records.
+	assert(count_lines(buf) == 11);
+	assert(strstr(buf, "\n15,") != NULL);
+	assert(strstr(buf, "\n24,") != NULL);
+	assert(strstr(buf, "\n14,") == NULL);
+	free(buf);
+
+	latency_context_destroy(&lat);
+}
+
+static void test_summary(void)
+{
+	struct latency_context lat;
+	char *buf;
+	int i;
+	int err;
+
+	err = latency_context_init(&lat, 128);
+	assert(err == 0);
+
+	// In reverse order to check sorting.
+	for (i = 99; i >= 0; --i) {
+		latency_context_begin(&lat);
+		latency_context_wakeup(&lat);
+		latency_context_set_status(&lat, i, -i);
+		latency_context_commit(&lat, 256, 1000 * i);
+	}
+
+	buf = dump(&lat, ".json");
+	assert(strstr(buf, "\"iterations\": 100,") != NULL);
+	assert(strstr(buf, "\"avail\": {\"count\": 100, \"min\": 0, "
+			   "\"p50\": 49, \"p90\": 89, \"p99\": 98, "
+			   "\"p99.9\": 98, \"max\": 99}") != NULL);
+	assert(strstr(buf, "\"delay\": {\"count\": 100, \"min\": -99, "
+			   "\"p50\": -50, \"p90\": -10, \"p99\": -1, "
+			   "\"p99.9\": -1, \"max\": 0}") != NULL);
+	assert(strstr(buf, "\"io_nsec\": {\"count\": 100, \"min\": 0, "
+			   "\"p50\": 49000,") != NULL);
+	// The first record has no interval.
+	assert(strstr(buf, "\"interval_nsec\": {\"count\": 99,") != NULL);
+	free(buf);
+
+	latency_context_destroy(&lat);
+}
+
+int main(int argc, const char *argv[])
+{
+	test_ring();
+	test_summary();
+
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,183 @@
+// SPDX-License-Identifier: GPL-2.0
+//
+// mapper-bench.c - a benchmark of channel (de)interleave for multiple
+//		    containers.
+//
+// Licensed under the terms of the GNU General Public License, version 2.
+//
+// Build with "make mapper-bench". The kernels of mapper-multiple are compared
+// to the loop with one memcpy(3) per sample for each size of sample and
+// several numbers of channels. The results of both are checked to be the same.
+
+// The kernels are static. This file is built without the object of it.
+#include "../mapper-multiple.c"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include <assert.h>
+
+#define FRAMES_PER_BUFFER	4096
+
+static void reference_to_i(void *frame_buf, unsigned int frame_count,
+			   char **src_bufs, unsigned int bytes_per_sample,
+			   unsigned int cntr_count)
+{
+	char *dst = frame_buf;
+	unsigned int i, j;
+
+	for (i = 0; i < cntr_count; ++i) {
+		for (j = 0; j < frame_count; ++j) {
+			memcpy(dst + bytes_per_sample * (cntr_count * j + i),
+			       src_bufs[i] + bytes_per_sample * j,
+			       bytes_per_sample);
+		}
+	}
+}
+
+static void reference_from_i(void *frame_buf, unsigned int frame_count,
+			     char **dst_bufs, unsigned int bytes_per_sample,
+			     unsigned int cntr_count)
+{
+	char *src = frame_buf;
+	unsigned int i, j;
+
+	for (i = 0; i < cntr_count; ++i) {
+		for (j = 0; j < frame_count; ++j) {
+			memcpy(dst_bufs[i] + bytes_per_sample * j,
+			       src + bytes_per_sample * (cntr_count * j + i),
+			       bytes_per_sample);
+		}
+	}
+}
+
+static double now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// Return nano seconds per frame.
+static double run(struct mapper_context *mapper, struct multiple_state *state,
+		  bool reference, char *frame_buf, char **bufs,
+		  struct container_context *cntrs, unsigned int cntr_count,
+		  unsigned int iterations)
+{
+	unsigned int bytes_per_sample = mapper->bytes_per_sample;
+	double begin;
+	int i;
+
+	begin = now();
+	for (i = 0; i < iterations; ++i) {
+		if (!reference) {
+			state->align_frames(state, frame_buf,
+					    FRAMES_PER_BUFFER, bufs,
+					    bytes_per_sample, cntrs,
+					    cntr_count);
+		} else if (mapper->type == MAPPER_TYPE_MUXER) {
+			reference_to_i(frame_buf, FRAMES_PER_BUFFER, bufs,
+				       bytes_per_sample, cntr_count);
+		} else {
+			reference_from_i(frame_buf, FRAMES_PER_BUFFER, bufs,
+					 bytes_per_sample, cntr_count);
+		}
+	}
+
+	return (now() - begin) * 1e9 / iterations / FRAMES_PER_BUFFER;
+}
+
+static void bench(enum mapper_type type, unsigned int bytes_per_sample,
+		  unsigned int cntr_count)
+{
+	struct mapper_context mapper = {0};
+	struct multiple_state state = {0};
+	struct container_context *cntrs;
+	unsigned int frame_bytes = bytes_per_sample * FRAMES_PER_BUFFER;
+	unsigned int iterations;
+	char *frame_buf, *expected;
+	char **bufs;
+	double ref, opt;
+	int i, err;
+
+	cntrs = calloc(cntr_count, sizeof(*cntrs));
+	bufs = calloc(cntr_count, sizeof(*bufs));
+	frame_buf = malloc(frame_bytes * cntr_count);
+	expected = malloc(frame_bytes * cntr_count);
+	assert(cntrs && bufs && frame_buf && expected);
+
+	for (i = 0; i < cntr_count; ++i) {
+		cntrs[i].bytes_per_sample = bytes_per_sample;
+		cntrs[i].samples_per_frame = 1;
+		bufs[i] = malloc(frame_bytes);
+		assert(bufs[i]);
+	}
+	for (i = 0; i < frame_bytes * cntr_count; ++i)
+		frame_buf[i] = random();
+	for (i = 0; i < cntr_count; ++i)
+		memcpy(bufs[i], frame_buf + frame_bytes * i, frame_bytes);
+
+	mapper.type = type;
+	mapper.access = SND_PCM_ACCESS_RW_INTERLEAVED;
+	mapper.bytes_per_sample = bytes_per_sample;
+	mapper.samples_per_frame = cntr_count;
+	mapper.frames_per_buffer = FRAMES_PER_BUFFER;
+	mapper.private_data = &state;
+	err = multiple_pre_process(&mapper, cntrs, cntr_count);
+	assert(err == 0);
+
+	// Both of them should give the same result.
+	if (type == MAPPER_TYPE_MUXER) {
+		reference_to_i(expected, FRAMES_PER_BUFFER, bufs,
+			       bytes_per_sample, cntr_count);
+		state.align_frames(&state, frame_buf, FRAMES_PER_BUFFER, bufs,
+				   bytes_per_sample, cntrs, cntr_count);
+		assert(!memcmp(expected, frame_buf, frame_bytes * cntr_count));
+	} else {
+		state.align_frames(&state, frame_buf, FRAMES_PER_BUFFER,
+				   state.bufs, bytes_per_sample, cntrs,
+				   cntr_count);
+		reference_from_i(frame_buf, FRAMES_PER_BUFFER, bufs,
+				 bytes_per_sample, cntr_count);
+		for (i = 0; i < cntr_count; ++i)
+			assert(!memcmp(bufs[i], state.bufs[i], frame_bytes));
+	}
+
+	// Around 64 MiB for each.
+	iterations = (64 << 20) / (frame_bytes * cntr_count) + 1;
+	ref = run(&mapper, &state, true, frame_buf, bufs, cntrs, cntr_count,
+		  iterations);
+	opt = run(&mapper, &state, false, frame_buf,
+		  type == MAPPER_TYPE_MUXER ? bufs : state.bufs, cntrs,
+		  cntr_count, iterations);
+
+	printf("%-12s %u bytes %3u ch: %9.2f -> %9.2f ns/frame (x%.1f)\n",
+	       type == MAPPER_TYPE_MUXER ? "interleave" : "deinterleave",
+	       bytes_per_sample, cntr_count, ref, opt, ref / opt);
+
+	multiple_post_process(&mapper);
+	for (i = 0; i < cntr_count; ++i)
+		free(bufs[i]);
+	free(bufs);
+	free(cntrs);
+	free(frame_buf);
+	free(expected);
+}
+
+int main(int argc, const char *argv[])
+{
+	static const unsigned int sizes[] = {1, 2, 3, 4};
+	static const unsigned int counts[] = {2, 8, 32, 64};
+	int i, j;
+
+	for (i = 0; i < ARRAY_SIZE(sizes); ++i) {
+		for (j = 0; j < ARRAY_SIZE(counts); ++j) {
+			bench(MAPPER_TYPE_MUXER, sizes[i], counts[j]);
+			bench(MAPPER_TYPE_DEMUXER, sizes[i], counts[j]);
+		}
+	}
+
+	return EXIT_SUCCESS;
+}
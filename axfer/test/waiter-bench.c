@@ -0,0 +1,176 @@
+// SPDX-License-Identifier: GPL-2.0
+//
+// waiter-bench.c - a benchmark of wakeup latency for each type of waiter.
+//
+// Licensed under the terms of the GNU General Public License, version 2.
+//
+// Build with "make waiter-bench". Pipes stand in for descriptors of PCM
+// substream. A thread writes one byte to one of them, then the latency till
+// the waiter returns is measured. The distribution is printed for each type.
+
+#include "../waiter.h"
+#include "../misc.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <unistd.h>
+#include <time.h>
+#include <pthread.h>
+#include <semaphore.h>
+
+#include <assert.h>
+
+#define ITERATIONS	4000
+
+struct bench {
+	int (*pipes)[2];
+	unsigned int pipe_count;
+
+	sem_t ready;
+	uint64_t written_nsec;
+};
+
+static uint64_t now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static void *notifier(void *arg)
+{
+	struct bench *bench = arg;
+	struct timespec interval = { .tv_nsec = 100000 };
+	unsigned int i;
+	char byte = 0;
+
+	for (i = 0; i < ITERATIONS; ++i) {
+		sem_wait(&bench->ready);
+
+		// Let the waiter sleep.
+		nanosleep(&interval, NULL);
+
+		__atomic_store_n(&bench->written_nsec, now(), __ATOMIC_RELEASE);
+		if (write(bench->pipes[i % bench->pipe_count][1], &byte, 1) != 1)
+			break;
+	}
+
+	return NULL;
+}
+
+static int compare(const void *a, const void *b)
+{
+	uint64_t x = *(const uint64_t *)a;
+	uint64_t y = *(const uint64_t *)b;
+
+	return (x > y) - (x < y);
+}
+
+static void run(struct bench *bench, enum waiter_type type)
+{
+	struct waiter_context waiter = {0};
+	uint64_t *latencies;
+	pthread_t thread;
+	unsigned int i, j;
+	unsigned int count;
+	char byte;
+	int err;
+
+	err = waiter_context_init(&waiter, type, bench->pipe_count);
+	if (err < 0) {
+		printf("%-10s not available\n", waiter_label_from_type(type));
+		return;
+	}
+	for (i = 0; i < bench->pipe_count; ++i) {
+		waiter.pfds[i].fd = bench->pipes[i][0];
+		waiter.pfds[i].events = POLLIN;
+	}
+	err = waiter_context_prepare(&waiter);
+	if (err < 0) {
+		printf("%-10s not available\n", waiter_label_from_type(type));
+		goto end;
+	}
+
+	latencies = calloc(ITERATIONS, sizeof(*latencies));
+	assert(latencies);
+
+	sem_init(&bench->ready, 0, 0);
+	err = pthread_create(&thread, NULL, notifier, bench);
+	assert(err == 0);
+
+	for (i = 0; i < ITERATIONS; ++i) {
+		sem_post(&bench->ready);
+
+		// Some types return 0 even if any event occurs.
+		do {
+			err = waiter_context_wait_event(&waiter, -1);
+			assert(err >= 0);
+			count = 0;
+			for (j = 0; j < bench->pipe_count; ++j) {
+				if (waiter.pfds[j].revents & POLLIN)
+					++count;
+			}
+		} while (count == 0);
+		latencies[i] = now() - __atomic_load_n(&bench->written_nsec,
+						       __ATOMIC_ACQUIRE);
+
+		for (j = 0; j < bench->pipe_count; ++j) {
+			if (waiter.pfds[j].revents & POLLIN) {
+				err = read(waiter.pfds[j].fd, &byte, 1);
+				assert(err == 1);
+			}
+		}
+	}
+
+	pthread_join(thread, NULL);
+	sem_destroy(&bench->ready);
+
+	qsort(latencies, ITERATIONS, sizeof(*latencies), compare);
+	printf("%-10s %3u fds: min %7.1f, p50 %7.1f, p99 %7.1f, "
+	       "max %8.1f usec\n",
+	       waiter_label_from_type(type), bench->pipe_count,
+	       latencies[0] / 1e3, latencies[ITERATIONS / 2] / 1e3,
+	       latencies[ITERATIONS * 99 / 100] / 1e3,
+	       latencies[ITERATIONS - 1] / 1e3);
+
+	free(latencies);
+	waiter_context_release(&waiter);
+end:
+	waiter_context_destroy(&waiter);
+}
+
+int main(int argc, const char *argv[])
+{
+	static const unsigned int counts[] = {1, 4, 32};
+	struct bench bench = {0};
+	enum waiter_type type;
+	int i, j;
+
+	for (i = 0; i < ARRAY_SIZE(counts); ++i) {
+		bench.pipe_count = counts[i];
+		bench.pipes = calloc(counts[i], sizeof(*bench.pipes));
+		assert(bench.pipes);
+		for (j = 0; j < counts[i]; ++j) {
+			if (pipe(bench.pipes[j]) < 0) {
+				perror("pipe(2)");
+				return EXIT_FAILURE;
+			}
+		}
+
+		for (type = WAITER_TYPE_POLL; type < WAITER_TYPE_COUNT; ++type) {
+			if (waiter_label_from_type(type) != NULL)
+				run(&bench, type);
+		}
+
+		for (j = 0; j < counts[i]; ++j) {
+			close(bench.pipes[j][0]);
+			close(bench.pipes[j][1]);
+		}
+		free(bench.pipes);
+	}
+
+	return EXIT_SUCCESS;
+}
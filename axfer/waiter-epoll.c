@@ -56,6 +56,8 @@ static int epoll_wait_event(struct waiter_context *waiter, int timeout_msec)
 	int err;
 
 	memset(state->events, 0, state->ev_count * sizeof(*state->events));
+	for (i = 0; i < waiter->pfd_count; ++i)
+		waiter->pfds[i].revents = 0;
 	err = epoll_wait(state->epfd, state->events, state->ev_count,
 			 timeout_msec);
 	if (err < 0)
@@ -67,8 +69,8 @@ static int epoll_wait_event(struct waiter_context *waiter, int timeout_msec)
 		for (i = 0; i < ev_count; ++i) {
 			struct epoll_event *ev = &state->events[i];
 			for (j = 0; j < waiter->pfd_count; ++j) {
-				if (waiter->pfds[i].fd == ev->data.fd) {
-					waiter->pfds[i].revents = ev->events;
+				if (waiter->pfds[j].fd == ev->data.fd) {
+					waiter->pfds[j].revents = ev->events;
 					break;
 				}
 			}
@@ -0,0 +1,254 @@
+// SPDX-License-Identifier: GPL-2.0
+//
+// waiter-io-uring.c - Waiter for event notification by io_uring.
+//
+// Licensed under the terms of the GNU General Public License, version 2.
+
+#include "waiter.h"
+#include "misc.h"
+
+#include <stdlib.h>
+#include <stdbool.h>
+#include <unistd.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+
+// A request of IORING_OP_POLL_ADD is one-shot. The requests for descriptors
+// which have events are queued again and submitted in the same system call to
+// wait for the next event. Requests for the other descriptors stay in kernel.
+
+struct io_uring_state {
+	int fd;
+	bool ext_arg;
+
+	void *ring;
+	size_t ring_size;
+	unsigned int *sq_tail;
+	unsigned int sq_mask;
+	unsigned int *sq_array;
+	struct io_uring_sqe *sqes;
+	size_t sqes_size;
+	unsigned int *cq_head;
+	unsigned int *cq_tail;
+	unsigned int cq_mask;
+	struct io_uring_cqe *cqes;
+
+	bool *armed;
+	unsigned int queued_count;
+};
+
+static int ring_setup(struct io_uring_state *state, unsigned int entries)
+{
+	struct io_uring_params params = {0};
+	size_t cq_ring_size;
+	char *ptr;
+
+	state->fd = syscall(__NR_io_uring_setup, entries, &params);
+	if (state->fd < 0)
+		return -errno;
+
+	// Any kernel which supports IORING_OP_READ/WRITE (v5.6) has the feature.
+	if (!(params.features & IORING_FEAT_SINGLE_MMAP))
+		return -ENOSYS;
+#ifdef IORING_FEAT_EXT_ARG
+	state->ext_arg = !!(params.features & IORING_FEAT_EXT_ARG);
+#endif
+
+	state->ring_size = params.sq_off.array +
+			   params.sq_entries * sizeof(unsigned int);
+	cq_ring_size = params.cq_off.cqes +
+		       params.cq_entries * sizeof(struct io_uring_cqe);
+	if (cq_ring_size > state->ring_size)
+		state->ring_size = cq_ring_size;
+
+	state->ring = mmap(NULL, state->ring_size, PROT_READ | PROT_WRITE,
+			   MAP_SHARED | MAP_POPULATE, state->fd,
+			   IORING_OFF_SQ_RING);
+	if (state->ring == MAP_FAILED) {
+		state->ring = NULL;
+		return -errno;
+	}
+
+	state->sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+	state->sqes = mmap(NULL, state->sqes_size, PROT_READ | PROT_WRITE,
+			   MAP_SHARED | MAP_POPULATE, state->fd,
+			   IORING_OFF_SQES);
+	if (state->sqes == MAP_FAILED) {
+		state->sqes = NULL;
+		return -errno;
+	}
+
+	ptr = state->ring;
+	state->sq_tail = (unsigned int *)(ptr + params.sq_off.tail);
+	state->sq_mask = *(unsigned int *)(ptr + params.sq_off.ring_mask);
+	state->sq_array = (unsigned int *)(ptr + params.sq_off.array);
+	state->cq_head = (unsigned int *)(ptr + params.cq_off.head);
+	state->cq_tail = (unsigned int *)(ptr + params.cq_off.tail);
+	state->cq_mask = *(unsigned int *)(ptr + params.cq_off.ring_mask);
+	state->cqes = (struct io_uring_cqe *)(ptr + params.cq_off.cqes);
+
+	return 0;
+}
+
+static void queue_poll(struct waiter_context *waiter, unsigned int index)
+{
+	struct io_uring_state *state = waiter->private_data;
+	struct io_uring_sqe *sqe;
+	unsigned int tail;
+
+	tail = *state->sq_tail;
+	sqe = &state->sqes[tail & state->sq_mask];
+	memset(sqe, 0, sizeof(*sqe));
+	sqe->opcode = IORING_OP_POLL_ADD;
+	sqe->fd = waiter->pfds[index].fd;
+	// The field is compatible to both endianness for 16 bit events.
+	sqe->poll_events = waiter->pfds[index].events;
+	sqe->user_data = index;
+	state->sq_array[tail & state->sq_mask] = tail & state->sq_mask;
+	__atomic_store_n(state->sq_tail, tail + 1, __ATOMIC_RELEASE);
+
+	state->armed[index] = true;
+	++state->queued_count;
+}
+
+static int io_uring_prepare(struct waiter_context *waiter)
+{
+	struct io_uring_state *state = waiter->private_data;
+	int err;
+
+	state->fd = -1;
+	state->armed = calloc(waiter->pfd_count, sizeof(*state->armed));
+	if (state->armed == NULL)
+		return -ENOMEM;
+
+	// One entry per descriptor is enough because one request per
+	// descriptor is in flight at most.
+	err = ring_setup(state, waiter->pfd_count);
+	if (err < 0)
+		return err;
+
+	return 0;
+}
+
+// The queued requests are submitted and events are waited at once.
+static int enter(struct io_uring_state *state, bool wait, int timeout_msec)
+{
+	unsigned int flags = 0;
+	void *arg = NULL;
+	size_t arg_size = 0;
+#ifdef IORING_ENTER_EXT_ARG
+	struct io_uring_getevents_arg ext = {0};
+	struct __kernel_timespec ts;
+#endif
+	int err;
+
+	if (wait) {
+		flags |= IORING_ENTER_GETEVENTS;
+#ifdef IORING_ENTER_EXT_ARG
+		if (timeout_msec >= 0) {
+			ts.tv_sec = timeout_msec / 1000;
+			ts.tv_nsec = (timeout_msec % 1000) * 1000000;
+			ext.ts = (unsigned long)&ts;
+			flags |= IORING_ENTER_EXT_ARG;
+			arg = &ext;
+			arg_size = sizeof(ext);
+		}
+#endif
+	}
+
+	err = syscall(__NR_io_uring_enter, state->fd, state->queued_count,
+		      wait ? 1 : 0, flags, arg, arg_size);
+	if (err < 0) {
+		// Timeout is not an error for waiter.
+		if (errno == ETIME || errno == EINTR)
+			return 0;
+		return -errno;
+	}
+	state->queued_count -= err;
+
+	return 0;
+}
+
+static int io_uring_wait_event(struct waiter_context *waiter, int timeout_msec)
+{
+	struct io_uring_state *state = waiter->private_data;
+	struct io_uring_cqe *cqe;
+	struct pollfd *pfd;
+	unsigned int head;
+	unsigned int count;
+	int i;
+	int err;
+
+	for (i = 0; i < waiter->pfd_count; ++i) {
+		waiter->pfds[i].revents = 0;
+		if (!state->armed[i])
+			queue_poll(waiter, i);
+	}
+
+	if (timeout_msec >= 0 && !state->ext_arg) {
+		// No way to give timeout to the system call. Just submit
+		// requests, then poll(2) instead of them.
+		err = enter(state, false, 0);
+		if (err < 0)
+			return err;
+		err = poll(waiter->pfds, waiter->pfd_count, timeout_msec);
+		if (err < 0)
+			return -errno;
+	} else {
+		err = enter(state, true, timeout_msec);
+		if (err < 0)
+			return err;
+	}
+
+	// Reap all of completions.
+	count = 0;
+	head = *state->cq_head;
+	while (head != __atomic_load_n(state->cq_tail, __ATOMIC_ACQUIRE)) {
+		cqe = &state->cqes[head & state->cq_mask];
+		pfd = &waiter->pfds[cqe->user_data];
+		state->armed[cqe->user_data] = false;
+		if (cqe->res < 0)
+			pfd->revents |= POLLERR;
+		else
+			pfd->revents |= cqe->res;
+		++head;
+	}
+	__atomic_store_n(state->cq_head, head, __ATOMIC_RELEASE);
+
+	for (i = 0; i < waiter->pfd_count; ++i) {
+		if (waiter->pfds[i].revents)
+			++count;
+	}
+
+	return count;
+}
+
+static void io_uring_release(struct waiter_context *waiter)
+{
+	struct io_uring_state *state = waiter->private_data;
+
+	// Requests in flight are canceled when closing the ring.
+	if (state->sqes)
+		munmap(state->sqes, state->sqes_size);
+	if (state->ring)
+		munmap(state->ring, state->ring_size);
+	if (state->fd > 0)
+		close(state->fd);
+	free(state->armed);
+
+	memset(state, 0, sizeof(*state));
+	state->fd = -1;
+}
+
+const struct waiter_data waiter_io_uring = {
+	.ops = {
+		.prepare	= io_uring_prepare,
+		.wait_event	= io_uring_wait_event,
+		.release	= io_uring_release,
+	},
+	.private_size = sizeof(struct io_uring_state),
+};
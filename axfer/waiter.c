@@ -6,6 +6,7 @@
 //
 // Licensed under the terms of the GNU General Public License, version 2.
 
+#include "aconfig.h"
 #include "waiter.h"
 
 #include <stdlib.h>
@@ -19,6 +20,9 @@ static const char *const waiter_type_labels[] = {
 	[WAITER_TYPE_POLL] = "poll",
 	[WAITER_TYPE_SELECT] = "select",
 	[WAITER_TYPE_EPOLL] = "epoll",
+#if WITH_IO_URING
+	[WAITER_TYPE_IO_URING] = "io_uring",
+#endif
 };
 
 enum waiter_type waiter_type_from_label(const char *label)
@@ -35,6 +39,9 @@ enum waiter_type waiter_type_from_label(const char *label)
 
 const char *waiter_label_from_type(enum waiter_type type)
 {
+	// Some types are not available according to configuration.
+	if (type >= ARRAY_SIZE(waiter_type_labels))
+		return NULL;
 	return waiter_type_labels[type];
 }
 
@@ -48,6 +55,9 @@ int waiter_context_init(struct waiter_context *waiter,
 		{WAITER_TYPE_POLL,	&waiter_poll},
 		{WAITER_TYPE_SELECT,	&waiter_select},
 		{WAITER_TYPE_EPOLL,	&waiter_epoll},
+#if WITH_IO_URING
+		{WAITER_TYPE_IO_URING,	&waiter_io_uring},
+#endif
 	};
 	int i;
 
@@ -194,16 +194,19 @@ static int irq_mmap_r_process_frames(struct libasound_state *state,
 
 	// TODO: if reporting something, do here with the status data.
 
-	// For capture direction, need to start stream explicitly.
+	// For capture direction, need to start stream explicitly. The linked
+	// nodes are started together by the master.
 	if (s != SND_PCM_STATE_RUNNING) {
 		if (s != SND_PCM_STATE_PREPARED) {
 			err = -EPIPE;
 			goto error;
 		}
 
-		err = snd_pcm_start(state->handle);
-		if (err < 0)
-			goto error;
+		if (!state->linked) {
+			err = snd_pcm_start(state->handle);
+			if (err < 0)
+				goto error;
+		}
 	}
 
 	err = irq_mmap_process_frames(state, frame_count, mapper, cntrs);
@@ -237,16 +240,19 @@ static int irq_mmap_w_process_frames(struct libasound_state *state,
 	if (err < 0)
 		goto error;
 
-	// Need to start playback stream explicitly
+	// Need to start playback stream explicitly, except for the linked nodes
+	// started together by the master.
 	if (s != SND_PCM_STATE_RUNNING) {
 		if (s != SND_PCM_STATE_PREPARED) {
 			err = -EPIPE;
 			goto error;
 		}
 
-		err = snd_pcm_start(state->handle);
-		if (err < 0)
-			goto error;
+		if (!state->linked) {
+			err = snd_pcm_start(state->handle);
+			if (err < 0)
+				goto error;
+		}
 	}
 
 	return 0;
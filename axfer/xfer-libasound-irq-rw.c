@@ -26,45 +26,71 @@ static int read_frames(struct libasound_state *state, unsigned int *frame_count,
 	struct rw_closure *closure = state->private_data;
 	snd_pcm_sframes_t handled_frame_count;
 	unsigned int consumed_count;
+	unsigned int count;
+	unsigned int total;
+	int i;
 	int err;
 
 	// Trim according up to expected frame count.
 	if (*frame_count < avail_count)
 		avail_count = *frame_count;
 
-	// Cache required amount of frames.
-	if (avail_count > frame_cache_get_count(&closure->cache)) {
-		avail_count -= frame_cache_get_count(&closure->cache);
+	// Cache required amount of frames. The space of cache is split into two
+	// segments at most.
+	for (i = 0; i < 2; ++i) {
+		if (avail_count <= frame_cache_get_count(&closure->cache))
+			break;
+		count = avail_count - frame_cache_get_count(&closure->cache);
+		if (count > frame_cache_get_space(&closure->cache))
+			count = frame_cache_get_space(&closure->cache);
+		if (count == 0)
+			break;
 
 		// Execute write operation according to the shape of buffer.
 		// These operations automatically start the substream.
 		if (closure->access == SND_PCM_ACCESS_RW_INTERLEAVED) {
 			handled_frame_count = snd_pcm_readi(state->handle,
 							closure->cache.buf_ptr,
-							avail_count);
+							count);
 		} else {
 			handled_frame_count = snd_pcm_readn(state->handle,
 							closure->cache.buf_ptr,
-							avail_count);
+							count);
 		}
 		if (handled_frame_count < 0) {
+			// Frames in the first segment are processed at first.
+			if (i > 0)
+				break;
 			err = handled_frame_count;
 			return err;
 		}
 		frame_cache_increase_count(&closure->cache, handled_frame_count);
-		avail_count = frame_cache_get_count(&closure->cache);
+		if (handled_frame_count < count)
+			break;
 	}
+	if (avail_count > frame_cache_get_count(&closure->cache))
+		avail_count = frame_cache_get_count(&closure->cache);
 
-	// Write out to file descriptors.
-	consumed_count = avail_count;
-	err = mapper_context_process_frames(mapper, closure->cache.buf,
-					    &consumed_count, cntrs);
-	if (err < 0)
-		return err;
+	// Write out to file descriptors for each contiguous segment.
+	total = 0;
+	for (i = 0; i < 2 && total < avail_count; ++i) {
+		count = frame_cache_get_contiguous_count(&closure->cache);
+		if (count > avail_count - total)
+			count = avail_count - total;
 
-	frame_cache_reduce(&closure->cache, consumed_count);
+		consumed_count = count;
+		err = mapper_context_process_frames(mapper, closure->cache.buf,
+						    &consumed_count, cntrs);
+		if (err < 0)
+			return err;
 
-	*frame_count = consumed_count;
+		frame_cache_reduce(&closure->cache, consumed_count);
+		total += consumed_count;
+		if (consumed_count < count)
+			break;
+	}
+
+	*frame_count = total;
 
 	return 0;
 }
@@ -127,7 +153,8 @@ static int r_process_frames_nonblocking(struct libasound_state *state,
 	snd_pcm_uframes_t avail_count;
 	int err = 0;
 
-	if (status != SND_PCM_STATE_RUNNING) {
+	// The linked nodes are started together by the master.
+	if (status != SND_PCM_STATE_RUNNING && !state->linked) {
 		err = snd_pcm_start(state->handle);
 		if (err < 0)
 			goto error;
@@ -175,52 +202,130 @@ error:
 	return err;
 }
 
+// Write data frames mapped in the container without copying them to the cache.
+// Frames left by a short write are kept in the cache.
+static int write_mapped_frames(struct libasound_state *state,
+			       unsigned int *frame_count,
+			       unsigned int avail_count,
+			       struct mapper_context *mapper,
+			       struct container_context *cntrs)
+{
+	struct rw_closure *closure = state->private_data;
+	snd_pcm_sframes_t handled_frame_count;
+	unsigned int bytes_per_frame;
+	unsigned int handled_count;
+	char *buf;
+	int err;
+
+	err = mapper_context_map_frames(mapper, (void **)&buf, &avail_count,
+					cntrs);
+	if (err < 0)
+		return err;
+
+	handled_frame_count = snd_pcm_writei(state->handle, buf, avail_count);
+	if (handled_frame_count < 0)
+		handled_count = 0;
+	else
+		handled_count = (unsigned int)handled_frame_count;
+
+	if (handled_count < avail_count) {
+		bytes_per_frame = closure->cache.bytes_per_sample *
+				  closure->cache.samples_per_frame;
+		memcpy(closure->cache.buf_ptr,
+		       buf + handled_count * bytes_per_frame,
+		       (avail_count - handled_count) * bytes_per_frame);
+		frame_cache_increase_count(&closure->cache,
+					   avail_count - handled_count);
+	}
+
+	if (handled_frame_count < 0)
+		return handled_frame_count;
+
+	*frame_count = handled_count;
+
+	return 0;
+}
+
 static int write_frames(struct libasound_state *state,
 			unsigned int *frame_count, unsigned int avail_count,
 			struct mapper_context *mapper,
 			struct container_context *cntrs)
 {
 	struct rw_closure *closure = state->private_data;
-	snd_pcm_uframes_t consumed_count;
+	unsigned int consumed_count;
 	snd_pcm_sframes_t handled_frame_count;
+	unsigned int count;
+	unsigned int total;
+	int i;
 	int err;
 
 	// Trim according up to expected frame count.
 	if (*frame_count < avail_count)
 		avail_count = *frame_count;
 
-	// Cache required amount of frames.
-	if (avail_count > frame_cache_get_count(&closure->cache)) {
-		avail_count -= frame_cache_get_count(&closure->cache);
+	// The most likely when the container is mapped.
+	if (closure->access == SND_PCM_ACCESS_RW_INTERLEAVED &&
+	    frame_cache_get_count(&closure->cache) == 0) {
+		err = write_mapped_frames(state, frame_count, avail_count,
+					  mapper, cntrs);
+		if (err != -ENXIO)
+			return err;
+	}
+
+	// Cache required amount of frames. The space of cache is split into two
+	// segments at most.
+	for (i = 0; i < 2; ++i) {
+		if (avail_count <= frame_cache_get_count(&closure->cache))
+			break;
+		count = avail_count - frame_cache_get_count(&closure->cache);
+		if (count > frame_cache_get_space(&closure->cache))
+			count = frame_cache_get_space(&closure->cache);
+		if (count == 0)
+			break;
 
 		// Read frames to transfer.
+		consumed_count = count;
 		err = mapper_context_process_frames(mapper,
-				closure->cache.buf_ptr, &avail_count, cntrs);
+				closure->cache.buf_ptr, &consumed_count, cntrs);
 		if (err < 0)
 			return err;
-		frame_cache_increase_count(&closure->cache, avail_count);
-		avail_count = frame_cache_get_count(&closure->cache);
+		frame_cache_increase_count(&closure->cache, consumed_count);
+		if (consumed_count < count)
+			break;
 	}
+	if (avail_count > frame_cache_get_count(&closure->cache))
+		avail_count = frame_cache_get_count(&closure->cache);
 
-	// Execute write operation according to the shape of buffer. These
-	// operations automatically start the stream.
-	consumed_count = avail_count;
-	if (closure->access == SND_PCM_ACCESS_RW_INTERLEAVED) {
-		handled_frame_count = snd_pcm_writei(state->handle,
-					closure->cache.buf, consumed_count);
-	} else {
-		handled_frame_count = snd_pcm_writen(state->handle,
-					closure->cache.buf, consumed_count);
-	}
-	if (handled_frame_count < 0) {
-		err = handled_frame_count;
-		return err;
-	}
+	// Execute write operation according to the shape of buffer for each
+	// contiguous segment. These operations automatically start the stream.
+	total = 0;
+	for (i = 0; i < 2 && total < avail_count; ++i) {
+		count = frame_cache_get_contiguous_count(&closure->cache);
+		if (count > avail_count - total)
+			count = avail_count - total;
+
+		if (closure->access == SND_PCM_ACCESS_RW_INTERLEAVED) {
+			handled_frame_count = snd_pcm_writei(state->handle,
+						closure->cache.buf, count);
+		} else {
+			handled_frame_count = snd_pcm_writen(state->handle,
+						closure->cache.buf, count);
+		}
+		if (handled_frame_count < 0) {
+			// Report frames in the first segment at first.
+			if (i > 0)
+				break;
+			err = handled_frame_count;
+			return err;
+		}
 
-	consumed_count = handled_frame_count;
-	frame_cache_reduce(&closure->cache, consumed_count);
+		frame_cache_reduce(&closure->cache, handled_frame_count);
+		total += handled_frame_count;
+		if (handled_frame_count < count)
+			break;
+	}
 
-	*frame_count = consumed_count;
+	*frame_count = total;
 
 	return 0;
 }
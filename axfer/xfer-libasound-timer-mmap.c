@@ -9,6 +9,12 @@
 #include "xfer-libasound.h"
 #include "misc.h"
 
+#include <time.h>
+#include <sys/timerfd.h>
+
+// The number of retries when waking up before planned frames are available.
+#define MAX_RETRY_COUNT		4
+
 struct map_layout {
 	snd_pcm_status_t *status;
 	bool need_forward_or_rewind;
@@ -17,6 +23,27 @@ struct map_layout {
 	unsigned int frames_per_second;
 	unsigned int samples_per_frame;
 	unsigned int frames_per_buffer;
+	unsigned int frames_per_period;
+
+	// Timer to wake up at nano second deadline, polled with descriptors of
+	// PCM.
+	int timerfd;
+	struct pollfd *pfds;
+	unsigned int pfd_count;
+
+	// Estimation of rate of hw_ptr with reported timestamps.
+	uint64_t status_nsec;
+	int64_t status_avail;	// Including frames committed after the status.
+	bool has_last;
+	uint64_t last_nsec;
+	snd_pcm_uframes_t last_avail;
+	int64_t committed_count;
+	double nsec_per_frame;
+	double nominal_nsec_per_frame;
+
+	// Statistics.
+	unsigned int wakeup_count;
+	unsigned int retry_count;
 };
 
 static int timer_mmap_pre_process(struct libasound_state *state)
@@ -26,6 +53,7 @@ static int timer_mmap_pre_process(struct libasound_state *state)
 	snd_pcm_uframes_t frame_offset;
 	snd_pcm_uframes_t avail = 0;
 	snd_pcm_uframes_t frames_per_buffer;
+	snd_pcm_uframes_t frames_per_period;
 	int i;
 	int err;
 
@@ -39,6 +67,17 @@ static int timer_mmap_pre_process(struct libasound_state *state)
 	if (err < 0)
 		return err;
 
+	// Timestamps in the status are used to estimate the position of
+	// hw_ptr between updates.
+	err = snd_pcm_sw_params_set_tstamp_mode(state->handle, state->sw_params,
+						SND_PCM_TSTAMP_ENABLE);
+	if (err < 0)
+		return err;
+	err = snd_pcm_sw_params_set_tstamp_type(state->handle, state->sw_params,
+					SND_PCM_TSTAMP_TYPE_MONOTONIC);
+	if (err < 0)
+		return err;
+
 	err = snd_pcm_status_malloc(&layout->status);
 	if (err < 0)
 		return err;
@@ -63,6 +102,21 @@ static int timer_mmap_pre_process(struct libasound_state *state)
 		return err;
 	layout->frames_per_buffer = (unsigned int)frames_per_buffer;
 
+	err = snd_pcm_hw_params_get_period_size(state->hw_params,
+						&frames_per_period, NULL);
+	if (err < 0)
+		return err;
+	layout->frames_per_period = (unsigned int)frames_per_period;
+
+	layout->nominal_nsec_per_frame = 1000000000.0 /
+					 layout->frames_per_second;
+	layout->nsec_per_frame = layout->nominal_nsec_per_frame;
+
+	layout->timerfd = timerfd_create(CLOCK_MONOTONIC,
+					 TFD_NONBLOCK | TFD_CLOEXEC);
+	if (layout->timerfd < 0)
+		return -errno;
+
 	if (access == SND_PCM_ACCESS_MMAP_NONINTERLEAVED) {
 		layout->vector = calloc(layout->samples_per_frame,
 					sizeof(*layout->vector));
@@ -116,6 +170,213 @@ static void *get_buffer(struct libasound_state *state,
 	return frame_buf;
 }
 
+static uint64_t timespec_to_nsec(const struct timespec *ts)
+{
+	return (uint64_t)ts->tv_sec * 1000000000ull + ts->tv_nsec;
+}
+
+static uint64_t get_status_nsec(struct map_layout *layout)
+{
+	snd_htimestamp_t tstamp;
+	struct timespec ts;
+
+	snd_pcm_status_get_htstamp(layout->status, &tstamp);
+	if (tstamp.tv_sec == 0 && tstamp.tv_nsec == 0) {
+		// Not supported. The status was just retrieved.
+		clock_gettime(CLOCK_MONOTONIC, &ts);
+		return timespec_to_nsec(&ts);
+	}
+
+	return timespec_to_nsec(&tstamp);
+}
+
+// Estimate the rate of hw_ptr by the number of frames transferred by hardware
+// between two statuses. It is computed by the difference of avail and the
+// number of frames which this program committed meantime.
+static void update_rate_estimation(struct map_layout *layout)
+{
+	snd_pcm_uframes_t avail = snd_pcm_status_get_avail(layout->status);
+	uint64_t nsec = get_status_nsec(layout);
+	int64_t progress;
+	double sample;
+
+	layout->status_nsec = nsec;
+	layout->status_avail = avail;
+
+	if (layout->has_last) {
+		// Too short to be precise against granularity of hw_ptr.
+		if (nsec < layout->last_nsec + 10000000)
+			return;
+
+		progress = (int64_t)avail - (int64_t)layout->last_avail +
+			   layout->committed_count;
+		if (progress > 0) {
+			sample = (double)(nsec - layout->last_nsec) / progress;
+			// Drop samples across XRUN, suspend and so on.
+			if (sample > layout->nominal_nsec_per_frame / 2 &&
+			    sample < layout->nominal_nsec_per_frame * 2) {
+				layout->nsec_per_frame +=
+					(sample - layout->nsec_per_frame) / 8;
+			}
+		}
+	}
+
+	layout->has_last = true;
+	layout->last_nsec = nsec;
+	layout->last_avail = avail;
+	layout->committed_count = 0;
+}
+
+static void account_commit(struct map_layout *layout, int64_t count)
+{
+	layout->committed_count += count;
+	layout->status_avail -= count;
+}
+
+static int get_poll_descriptors(struct libasound_state *state)
+{
+	struct map_layout *layout = state->private_data;
+	int count;
+	int err;
+
+	// The descriptor of timer in 'hw' PCM plugin is available after
+	// configuring sw_params.
+	count = snd_pcm_poll_descriptors_count(state->handle);
+	if (count < 0)
+		return count;
+
+	layout->pfds = calloc(count + 1, sizeof(*layout->pfds));
+	if (layout->pfds == NULL)
+		return -ENOMEM;
+
+	err = snd_pcm_poll_descriptors(state->handle, layout->pfds, count);
+	if (err < 0)
+		return err;
+	layout->pfd_count = count;
+
+	layout->pfds[count].fd = layout->timerfd;
+	layout->pfds[count].events = POLLIN;
+
+	return 0;
+}
+
+// Yield this CPU till the deadline. The descriptors of PCM are polled as well
+// to catch events such as suspend.
+static int wait_until(struct libasound_state *state, uint64_t deadline_nsec)
+{
+	struct map_layout *layout = state->private_data;
+	struct itimerspec its = {0};
+	unsigned short revents;
+	uint64_t expirations;
+	int err;
+
+	if (layout->pfds == NULL) {
+		err = get_poll_descriptors(state);
+		if (err < 0)
+			return err;
+	}
+
+	its.it_value.tv_sec = deadline_nsec / 1000000000;
+	its.it_value.tv_nsec = deadline_nsec % 1000000000;
+	if (timerfd_settime(layout->timerfd, TFD_TIMER_ABSTIME, &its, NULL) < 0) {
+		err = -errno;
+		if (state->verbose)
+			logging(state, "timerfd_settime(2): %s\n", strerror(-err));
+		return err;
+	}
+
+	while (1) {
+		err = ppoll(layout->pfds, layout->pfd_count + 1, NULL, NULL);
+		if (err < 0) {
+			if (errno == EINTR)
+				continue;
+			err = -errno;
+			if (state->verbose)
+				logging(state, "ppoll(2): %s\n", strerror(-err));
+			return err;
+		}
+		break;
+	}
+
+	err = snd_pcm_poll_descriptors_revents(state->handle, layout->pfds,
+					       layout->pfd_count, &revents);
+	if (err < 0)
+		return err;
+	if (revents & POLLERR) {
+		// E.g. the substream is disconnected or stopped.
+		if (state->verbose) {
+			logging(state, "Error event in state %s.\n",
+				snd_pcm_state_name(snd_pcm_state(state->handle)));
+		}
+		return -EIO;
+	}
+
+	xfer_libasound_mark_wakeup(state);
+
+	if (layout->pfds[layout->pfd_count].revents & POLLIN) {
+		// Just to clear the expiration.
+		if (read(layout->timerfd, &expirations, sizeof(expirations)) < 0 &&
+		    errno != EAGAIN)
+			return -errno;
+	} else if (!(revents & (POLLIN | POLLOUT))) {
+		return -EAGAIN;
+	}
+
+	return 0;
+}
+
+// Wait till the planned amount of frames becomes available. The deadline is
+// computed at nano second granularity from the timestamp of status and the
+// estimated rate of hw_ptr.
+static int wait_frames(struct libasound_state *state,
+		       snd_pcm_uframes_t planned_count,
+		       snd_pcm_uframes_t *avail_count)
+{
+	struct map_layout *layout = state->private_data;
+	int64_t avail = layout->status_avail;
+	uint64_t base_nsec = layout->status_nsec;
+	snd_pcm_sframes_t result;
+	struct timespec ts;
+	int i;
+	int err;
+
+	for (i = 0; i <= MAX_RETRY_COUNT; ++i) {
+		if (avail < (int64_t)planned_count) {
+			err = wait_until(state, base_nsec +
+				(uint64_t)((planned_count - avail) *
+					   layout->nsec_per_frame));
+			if (err < 0)
+				return err;
+		}
+		++layout->wakeup_count;
+
+		// MEMO: Need to perform hwsync explicitly because hwptr is not
+		// synchronized to actual position of data frame transmission
+		// on hardware because IRQ handlers are not used in this
+		// scheduling strategy.
+		result = snd_pcm_avail(state->handle);
+		if (result < 0)
+			return (int)result;
+		clock_gettime(CLOCK_MONOTONIC, &ts);
+
+		avail = result;
+		if (avail >= planned_count)
+			break;
+
+		// Wake up again according to the latest position.
+		base_nsec = timespec_to_nsec(&ts);
+		++layout->retry_count;
+	}
+
+	if (avail < planned_count) {
+		logging(state, "Wake up but not enough space: %lu %ld\n",
+			planned_count, (long)avail);
+	}
+	*avail_count = avail;
+
+	return 0;
+}
+
 static int timer_mmap_process_frames(struct libasound_state *state,
 				     unsigned int *frame_count,
 				     struct mapper_context *mapper,
@@ -145,8 +406,9 @@ static int timer_mmap_process_frames(struct libasound_state *state,
 	if (err < 0)
 		return err;
 
-	// MEMO: Use the amount of data frames as you like.
-	planned_count = layout->frames_per_buffer * random() / RAND_MAX;
+	// Process one period at once. It is decided by the size of period in
+	// hardware parameters even if no IRQ is generated for it.
+	planned_count = layout->frames_per_period;
 	if (frame_offset + planned_count > layout->frames_per_buffer)
 		planned_count = layout->frames_per_buffer - frame_offset;
 
@@ -156,43 +418,11 @@ static int timer_mmap_process_frames(struct libasound_state *state,
 
 	// Yield this CPU till planned amount of frames become available.
 	if (avail_count < planned_count) {
-		unsigned short revents;
-		int timeout_msec;
-
-		// TODO; precise granularity of timeout; e.g. ppoll(2).
-		// Furthermore, wrap up according to granularity of reported
-		// value for hw_ptr.
-		timeout_msec = ((planned_count - avail_count) * 1000 +
-				layout->frames_per_second - 1) /
-			       layout->frames_per_second;
-
-		// TODO: However, experimentally, the above is not enough to
-		// keep planned amount of frames when waking up. I don't know
-		// exactly the mechanism yet.
-		err = xfer_libasound_wait_event(state, timeout_msec,
-						&revents);
+		err = wait_frames(state, planned_count, &avail_count);
 		if (err < 0)
 			return err;
-		if (revents & POLLERR) {
-			// TODO: error reporting.
-			return -EIO;
-		}
-		if (!(revents & (POLLIN | POLLOUT)))
-			return -EAGAIN;
-
-		// MEMO: Need to perform hwsync explicitly because hwptr is not
-		// synchronized to actual position of data frame transmission
-		// on hardware because IRQ handlers are not used in this
-		// scheduling strategy.
-		avail = snd_pcm_avail(state->handle);
-		if (avail < 0)
-			return (int)avail;
-		if (avail < planned_count) {
-			logging(state,
-				"Wake up but not enough space: %lu %lu %u\n",
-				planned_count, avail, timeout_msec);
-			planned_count = avail;
-		}
+		if (avail_count < planned_count)
+			planned_count = avail_count;
 	}
 
 	// Let's process data frames.
@@ -211,6 +441,7 @@ static int timer_mmap_process_frames(struct libasound_state *state,
 			"node.\n");
 	}
 	*frame_count = consumed_count;
+	account_commit(layout, consumed_count);
 
 	return 0;
 }
@@ -230,6 +461,7 @@ static int forward_appl_ptr(struct libasound_state *state)
 	forward_count = snd_pcm_forward(state->handle, forwardable_count);
 	if (forward_count < 0)
 		return (int)forward_count;
+	account_commit(layout, forward_count);
 
 	if (state->verbose) {
 		logging(state,
@@ -263,6 +495,8 @@ static int timer_mmap_r_process_frames(struct libasound_state *state,
 	// TODO: if reporting something, do here with the status data.
 
 	if (s == SND_PCM_STATE_RUNNING) {
+		update_rate_estimation(layout);
+
 		// Reduce delay between sampling on hardware and handling by
 		// this program.
 		if (layout->need_forward_or_rewind) {
@@ -277,13 +511,17 @@ static int timer_mmap_r_process_frames(struct libasound_state *state,
 		if (err < 0)
 			goto error;
 	} else {
+		layout->has_last = false;
 		if (s == SND_PCM_STATE_PREPARED) {
 			// For capture direction, need to start stream
-			// explicitly.
-			err = snd_pcm_start(state->handle);
-			if (err < 0)
-				goto error;
-			layout->need_forward_or_rewind = true;
+			// explicitly. The linked nodes are started together
+			// by the master.
+			if (!state->linked) {
+				err = snd_pcm_start(state->handle);
+				if (err < 0)
+					goto error;
+				layout->need_forward_or_rewind = true;
+			}
 			// Not yet.
 			*frame_count = 0;
 		} else {
@@ -322,6 +560,7 @@ static int rewind_appl_ptr(struct libasound_state *state)
 	rewind_count = snd_pcm_rewind(state->handle, rewindable_count);
 	if (rewind_count < 0)
 		return (int)rewind_count;
+	account_commit(layout, -rewind_count);
 
 	if (state->verbose) {
 		logging(state,
@@ -388,6 +627,8 @@ static int timer_mmap_w_process_frames(struct libasound_state *state,
 	// TODO: if reporting something, do here with the status data.
 
 	if (s == SND_PCM_STATE_RUNNING) {
+		update_rate_estimation(layout);
+
 		// Reduce delay between queueing by this program and presenting
 		// on hardware.
 		if (layout->need_forward_or_rewind) {
@@ -402,17 +643,21 @@ static int timer_mmap_w_process_frames(struct libasound_state *state,
 		if (err < 0)
 			goto error;
 	} else {
-		// Need to start playback stream explicitly
+		layout->has_last = false;
+		// Need to start playback stream explicitly, except for the
+		// linked nodes started together by the master.
 		if (s == SND_PCM_STATE_PREPARED) {
-			err = fill_buffer_with_zero_samples(state);
-			if (err < 0)
-				goto error;
+			if (!state->linked) {
+				err = fill_buffer_with_zero_samples(state);
+				if (err < 0)
+					goto error;
 
-			err = snd_pcm_start(state->handle);
-			if (err < 0)
-				goto error;
+				err = snd_pcm_start(state->handle);
+				if (err < 0)
+					goto error;
 
-			layout->need_forward_or_rewind = true;
+				layout->need_forward_or_rewind = true;
+			}
 			// Not yet.
 			*frame_count = 0;
 		} else {
@@ -438,6 +683,21 @@ static void timer_mmap_post_process(struct libasound_state *state)
 	if (layout->vector)
 		free(layout->vector);
 	layout->vector = NULL;
+
+	if (layout->pfds)
+		free(layout->pfds);
+	layout->pfds = NULL;
+
+	if (layout->timerfd > 0) {
+		if (state->verbose) {
+			logging(state,
+				"  wakeups: %u, retries: %u, %.3f nsec/frame\n",
+				layout->wakeup_count, layout->retry_count,
+				layout->nsec_per_frame);
+		}
+		close(layout->timerfd);
+	}
+	layout->timerfd = 0;
 }
 
 const struct xfer_libasound_ops xfer_libasound_timer_mmap_w_ops = {
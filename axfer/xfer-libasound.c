@@ -9,6 +9,8 @@
 #include "xfer-libasound.h"
 #include "misc.h"
 
+#include <pthread.h>
+
 static const char *const sched_model_labels [] = {
 	[SCHED_MODEL_IRQ] = "irq",
 	[SCHED_MODEL_TIMER] = "timer",
@@ -365,9 +367,62 @@ int xfer_libasound_wait_event(struct libasound_state *state, int timeout_msec,
 			*revents = POLLIN;
 	}
 
+	xfer_libasound_mark_wakeup(state);
+
 	return err;
 }
 
+// For instrumentation. The status of PCM substream is queried at wakeup, thus
+// an additional system call is required.
+void xfer_libasound_mark_wakeup(struct libasound_state *state)
+{
+	snd_pcm_sframes_t avail;
+	snd_pcm_sframes_t delay;
+
+	if (state->latency == NULL)
+		return;
+
+	latency_context_wakeup(state->latency);
+	if (snd_pcm_avail_delay(state->handle, &avail, &delay) >= 0)
+		latency_context_set_status(state->latency, avail, delay);
+}
+
+// When the format is not available, samples can be converted by mapper to one
+// of available formats. The one with more significant bits is preferred, then
+// the one in byte order of host.
+static snd_pcm_format_t select_convertible_format(struct libasound_state *state,
+						  snd_pcm_format_t format)
+{
+	snd_pcm_format_mask_t *mask;
+	snd_pcm_format_t candidate;
+	snd_pcm_format_t selected = SND_PCM_FORMAT_UNKNOWN;
+	int score;
+	int best = -1;
+
+	if (!mapper_format_is_convertible(format))
+		return SND_PCM_FORMAT_UNKNOWN;
+
+	if (snd_pcm_format_mask_malloc(&mask) < 0)
+		return SND_PCM_FORMAT_UNKNOWN;
+	snd_pcm_hw_params_get_format_mask(state->hw_params, mask);
+	for (candidate = 0; candidate <= SND_PCM_FORMAT_LAST; ++candidate) {
+		if (!snd_pcm_format_mask_test(mask, candidate) ||
+		    !mapper_format_is_convertible(candidate))
+			continue;
+
+		score = snd_pcm_format_width(candidate) * 2;
+		if (snd_pcm_format_cpu_endian(candidate) == 1)
+			++score;
+		if (score > best) {
+			best = score;
+			selected = candidate;
+		}
+	}
+	snd_pcm_format_mask_free(mask);
+
+	return selected;
+}
+
 static int configure_hw_params(struct libasound_state *state,
 			       snd_pcm_format_t format,
 			       unsigned int samples_per_frame,
@@ -400,6 +455,21 @@ static int configure_hw_params(struct libasound_state *state,
 	}
 	err = snd_pcm_hw_params_set_format(state->handle, state->hw_params,
 					   format);
+	if (err < 0) {
+		snd_pcm_format_t converted;
+
+		converted = select_convertible_format(state, format);
+		if (converted != SND_PCM_FORMAT_UNKNOWN) {
+			err = snd_pcm_hw_params_set_format(state->handle,
+						state->hw_params, converted);
+			if (err >= 0 && state->verbose) {
+				logging(state,
+					"Sample format '%s' is converted to "
+					"'%s'\n", snd_pcm_format_name(format),
+					snd_pcm_format_name(converted));
+			}
+		}
+	}
 	if (err < 0) {
 		logging(state,
 			"Sample format '%s' is not available: %s\n",
@@ -647,6 +717,8 @@ static int xfer_libasound_pre_process(struct xfer_context *xfer,
 	if (err < 0)
 		return -ENXIO;
 
+	state->latency = xfer->latency;
+
 	err = configure_hw_params(state, *format, *samples_per_frame,
 				  *frames_per_second,
 				  state->msec_per_period,
@@ -666,6 +738,11 @@ static int xfer_libasound_pre_process(struct xfer_context *xfer,
 	if (err < 0)
 		return err;
 
+	err = snd_pcm_hw_params_get_period_size(state->hw_params,
+						&xfer->frames_per_period, NULL);
+	if (err < 0)
+		return err;
+
 	// Query software parameters.
 	err = snd_pcm_sw_params_current(state->handle, state->sw_params);
 	if (err < 0)
@@ -748,40 +825,6 @@ static int xfer_libasound_pre_process(struct xfer_context *xfer,
 	return 0;
 }
 
-static int xfer_libasound_process_frames(struct xfer_context *xfer,
-					 unsigned int *frame_count,
-					 struct mapper_context *mapper,
-					 struct container_context *cntrs)
-{
-	struct libasound_state *state = xfer->private_data;
-	int err;
-
-	if (state->handle == NULL)
-		return -ENXIO;
-
-	err = state->ops->process_frames(state, frame_count, mapper, cntrs);
-	if (err < 0) {
-		if (err == -EAGAIN)
-			return err;
-		if (err == -EPIPE && !state->finish_at_xrun) {
-			// Recover the stream and continue processing
-			// immediately. In this program -EPIPE comes from
-			// libasound implementation instead of file I/O.
-			err = snd_pcm_prepare(state->handle);
-		}
-
-		if (err < 0) {
-			// TODO: -EIO from libasound for hw PCM node means
-			// that IRQ disorder. This should be reported to help
-			// developers for drivers.
-			logging(state, "Fail to process frames: %s\n",
-				snd_strerror(err));
-		}
-	}
-
-	return err;
-}
-
 static void xfer_libasound_pause(struct xfer_context *xfer, bool enable)
 {
 	struct libasound_state *state = xfer->private_data;
@@ -809,6 +852,66 @@ static void xfer_libasound_pause(struct xfer_context *xfer, bool enable)
 	}
 }
 
+// The linked nodes still in transmission. XRUN in any of them stops all of
+// them, then they wait for each other to be restarted together.
+struct link_group {
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+
+	struct libasound_state **members;
+	unsigned int member_count;
+	unsigned int waiting_count;
+	unsigned int generation;
+	int err;
+
+	unsigned int refs;
+};
+
+static struct link_group *link_group_create(void)
+{
+	struct link_group *group;
+
+	group = calloc(1, sizeof(*group));
+	if (group == NULL)
+		return NULL;
+	pthread_mutex_init(&group->lock, NULL);
+	pthread_cond_init(&group->cond, NULL);
+
+	return group;
+}
+
+static int link_group_join(struct link_group *group,
+			   struct libasound_state *state)
+{
+	struct libasound_state **members;
+
+	members = realloc(group->members,
+			  (group->member_count + 1) * sizeof(*members));
+	if (members == NULL)
+		return -ENOMEM;
+	members[group->member_count++] = state;
+	group->members = members;
+
+	state->group = group;
+	++group->refs;
+
+	return 0;
+}
+
+static void link_group_release(struct libasound_state *state)
+{
+	struct link_group *group = state->group;
+
+	state->group = NULL;
+	if (--group->refs > 0)
+		return;
+
+	pthread_cond_destroy(&group->cond);
+	pthread_mutex_destroy(&group->lock);
+	free(group->members);
+	free(group);
+}
+
 static void xfer_libasound_post_process(struct xfer_context *xfer)
 {
 	struct libasound_state *state = xfer->private_data;
@@ -878,6 +981,9 @@ static void xfer_libasound_destroy(struct xfer_context *xfer)
 	if (state->log)
 		snd_output_close(state->log);
 	state->log = NULL;
+
+	if (state->group)
+		link_group_release(state);
 }
 
 static void xfer_libasound_help(struct xfer_context *xfer)
@@ -908,6 +1014,332 @@ static void xfer_libasound_help(struct xfer_context *xfer)
 	);
 }
 
+// Any node in the group starts the others when reaching the start threshold,
+// while the buffers of the others for playback are still empty or the others
+// for capture are about to start by themselves. The threshold is raised to the
+// boundary so that the group is started explicitly.
+static int disable_auto_start(struct libasound_state *state)
+{
+	snd_pcm_uframes_t boundary;
+	int err;
+
+	err = snd_pcm_sw_params_get_boundary(state->sw_params, &boundary);
+	if (err < 0)
+		return err;
+
+	err = snd_pcm_sw_params_set_start_threshold(state->handle,
+						    state->sw_params, boundary);
+	if (err < 0)
+		return err;
+
+	return snd_pcm_sw_params(state->handle, state->sw_params);
+}
+
+static int xfer_libasound_link(struct xfer_context *xfer,
+			       struct xfer_context *master)
+{
+	struct libasound_state *state = xfer->private_data;
+	struct libasound_state *master_state = master->private_data;
+	int err;
+
+	if (state->handle == NULL || master_state->handle == NULL)
+		return -ENXIO;
+
+	err = snd_pcm_link(master_state->handle, state->handle);
+	if (err < 0)
+		return err;
+
+	err = disable_auto_start(state);
+	if (err >= 0)
+		err = disable_auto_start(master_state);
+	if (err >= 0 && master_state->group == NULL) {
+		struct link_group *group = link_group_create();
+
+		if (group == NULL)
+			err = -ENOMEM;
+		else
+			err = link_group_join(group, master_state);
+		if (err < 0)
+			free(group);
+	}
+	if (err >= 0)
+		err = link_group_join(master_state->group, state);
+	if (err < 0) {
+		snd_pcm_unlink(state->handle);
+		return err;
+	}
+	state->linked = true;
+	master_state->linked = true;
+
+	return 0;
+}
+
+static int fill_mmap_with_silence(struct libasound_state *state,
+				  snd_pcm_format_t format,
+				  unsigned int samples_per_frame,
+				  snd_pcm_uframes_t avail)
+{
+	const snd_pcm_channel_area_t *areas;
+	snd_pcm_uframes_t frame_offset;
+	snd_pcm_uframes_t frame_count;
+	snd_pcm_sframes_t consumed_count;
+	int err;
+
+	while (avail > 0) {
+		frame_count = avail;
+		err = snd_pcm_mmap_begin(state->handle, &areas, &frame_offset,
+					 &frame_count);
+		if (err < 0)
+			return err;
+
+		err = snd_pcm_areas_silence(areas, frame_offset,
+					    samples_per_frame, frame_count,
+					    format);
+		if (err < 0)
+			return err;
+
+		consumed_count = snd_pcm_mmap_commit(state->handle,
+						     frame_offset, frame_count);
+		if (consumed_count < 0)
+			return consumed_count;
+		if (consumed_count != frame_count)
+			return -EIO;
+		avail -= frame_count;
+	}
+
+	return 0;
+}
+
+static int fill_rw_with_silence(struct libasound_state *state,
+				snd_pcm_format_t format,
+				unsigned int samples_per_frame,
+				snd_pcm_access_t access,
+				snd_pcm_uframes_t avail)
+{
+	unsigned int bytes_per_sample;
+	snd_pcm_sframes_t frame_count;
+	void **bufs = NULL;
+	char *buf;
+	int i;
+	int err = 0;
+
+	bytes_per_sample = snd_pcm_format_physical_width(format) / 8;
+	buf = malloc(bytes_per_sample * samples_per_frame * avail);
+	if (buf == NULL)
+		return -ENOMEM;
+	snd_pcm_format_set_silence(format, buf, samples_per_frame * avail);
+
+	if (access == SND_PCM_ACCESS_RW_NONINTERLEAVED) {
+		bufs = calloc(samples_per_frame, sizeof(*bufs));
+		if (bufs == NULL) {
+			err = -ENOMEM;
+			goto end;
+		}
+		for (i = 0; i < samples_per_frame; ++i)
+			bufs[i] = buf + bytes_per_sample * avail * i;
+	}
+
+	while (avail > 0) {
+		if (bufs == NULL)
+			frame_count = snd_pcm_writei(state->handle, buf, avail);
+		else
+			frame_count = snd_pcm_writen(state->handle, bufs, avail);
+		if (frame_count < 0) {
+			err = frame_count;
+			break;
+		}
+		avail -= frame_count;
+	}
+end:
+	free(bufs);
+	free(buf);
+	return err;
+}
+
+static int prefill_buffer(struct libasound_state *state)
+{
+	snd_pcm_format_t format;
+	unsigned int samples_per_frame;
+	snd_pcm_access_t access;
+	snd_pcm_sframes_t avail;
+	int err;
+
+	err = snd_pcm_hw_params_get_format(state->hw_params, &format);
+	if (err < 0)
+		return err;
+	err = snd_pcm_hw_params_get_channels(state->hw_params,
+					     &samples_per_frame);
+	if (err < 0)
+		return err;
+	err = snd_pcm_hw_params_get_access(state->hw_params, &access);
+	if (err < 0)
+		return err;
+
+	avail = snd_pcm_avail(state->handle);
+	if (avail < 0)
+		return avail;
+
+	if (access == SND_PCM_ACCESS_RW_INTERLEAVED ||
+	    access == SND_PCM_ACCESS_RW_NONINTERLEAVED) {
+		err = fill_rw_with_silence(state, format, samples_per_frame,
+					   access, avail);
+	} else {
+		err = fill_mmap_with_silence(state, format, samples_per_frame,
+					     avail);
+	}
+	if (err < 0)
+		logging(state, "Fail to fill buffer: %s\n", snd_strerror(err));
+
+	return err;
+}
+
+static int xfer_libasound_prefill(struct xfer_context *xfer)
+{
+	struct libasound_state *state = xfer->private_data;
+
+	if (state->handle == NULL)
+		return -ENXIO;
+	if (xfer->direction != SND_PCM_STREAM_PLAYBACK)
+		return 0;
+
+	return prefill_buffer(state);
+}
+
+static int xfer_libasound_start(struct xfer_context *xfer)
+{
+	struct libasound_state *state = xfer->private_data;
+	int err;
+
+	if (state->handle == NULL)
+		return -ENXIO;
+
+	if (snd_pcm_state(state->handle) != SND_PCM_STATE_PREPARED)
+		return 0;
+
+	err = snd_pcm_start(state->handle);
+	if (err < 0)
+		logging(state, "snd_pcm_start(): %s\n", snd_strerror(err));
+
+	return err;
+}
+
+// Called with the lock of group when all of members wait for restart. Any
+// operation to one node is done for all of nodes in the group.
+static void restart_link_group(struct link_group *group)
+{
+	struct libasound_state *state = group->members[0];
+	unsigned int i;
+	int err;
+
+	err = snd_pcm_prepare(state->handle);
+	for (i = 0; err >= 0 && i < group->member_count; ++i) {
+		if (snd_pcm_stream(group->members[i]->handle) ==
+						SND_PCM_STREAM_PLAYBACK)
+			err = prefill_buffer(group->members[i]);
+	}
+	if (err >= 0)
+		err = snd_pcm_start(state->handle);
+	if (err < 0) {
+		logging(state, "Fail to restart the linked PCM nodes: %s\n",
+			snd_strerror(err));
+	}
+
+	group->err = err;
+	group->waiting_count = 0;
+	++group->generation;
+	pthread_cond_broadcast(&group->cond);
+}
+
+static int recover_link_group(struct libasound_state *state)
+{
+	struct link_group *group = state->group;
+	unsigned int generation;
+	int err;
+
+	pthread_mutex_lock(&group->lock);
+	generation = group->generation;
+	if (++group->waiting_count == group->member_count) {
+		restart_link_group(group);
+	} else {
+		while (group->generation == generation)
+			pthread_cond_wait(&group->cond, &group->lock);
+	}
+	err = group->err;
+	pthread_mutex_unlock(&group->lock);
+
+	return err;
+}
+
+// The node leaves the group when finishing transmission so that it's neither
+// waited for nor started again by the others.
+static void xfer_libasound_unlink(struct xfer_context *xfer)
+{
+	struct libasound_state *state = xfer->private_data;
+	struct link_group *group = state->group;
+	unsigned int i;
+
+	if (state->handle == NULL || !state->linked)
+		return;
+
+	snd_pcm_unlink(state->handle);
+	state->linked = false;
+
+	pthread_mutex_lock(&group->lock);
+	for (i = 0; i < group->member_count; ++i) {
+		if (group->members[i] == state) {
+			group->members[i] =
+				group->members[--group->member_count];
+			break;
+		}
+	}
+	if (group->member_count > 0 &&
+	    group->waiting_count == group->member_count)
+		restart_link_group(group);
+	pthread_mutex_unlock(&group->lock);
+}
+
+static int xfer_libasound_process_frames(struct xfer_context *xfer,
+					 unsigned int *frame_count,
+					 struct mapper_context *mapper,
+					 struct container_context *cntrs)
+{
+	struct libasound_state *state = xfer->private_data;
+	int err;
+
+	if (state->handle == NULL)
+		return -ENXIO;
+
+	err = state->ops->process_frames(state, frame_count, mapper, cntrs);
+	if (err < 0) {
+		if (err == -EAGAIN)
+			return err;
+		// XRUN in any of the linked nodes stops the others as well,
+		// and the waiter of them gets an error event then.
+		if (err == -EIO && state->linked &&
+		    snd_pcm_state(state->handle) == SND_PCM_STATE_XRUN)
+			err = -EPIPE;
+		if (err == -EPIPE && !state->finish_at_xrun) {
+			// Recover the stream and continue processing
+			// immediately. In this program -EPIPE comes from
+			// libasound implementation instead of file I/O.
+			if (state->linked)
+				err = recover_link_group(state);
+			else
+				err = snd_pcm_prepare(state->handle);
+		}
+
+		if (err < 0) {
+			// TODO: -EIO from libasound for hw PCM node means
+			// that IRQ disorder. This should be reported to help
+			// developers for drivers.
+			logging(state, "Fail to process frames: %s\n",
+				snd_strerror(err));
+		}
+	}
+
+	return err;
+}
+
 const struct xfer_data xfer_libasound = {
 	.s_opts = S_OPTS,
 	.l_opts = l_opts,
@@ -922,6 +1354,10 @@ const struct xfer_data xfer_libasound = {
 		.post_process	= xfer_libasound_post_process,
 		.destroy	= xfer_libasound_destroy,
 		.help		= xfer_libasound_help,
+		.link		= xfer_libasound_link,
+		.prefill	= xfer_libasound_prefill,
+		.start		= xfer_libasound_start,
+		.unlink		= xfer_libasound_unlink,
 	},
 	.private_size = sizeof(struct libasound_state),
 };
@@ -22,6 +22,7 @@ enum sched_model {
 };
 
 struct xfer_libasound_ops;
+struct link_group;
 
 struct libasound_state {
 	snd_pcm_t *handle;
@@ -58,12 +59,19 @@ struct libasound_state {
 	bool no_softvol:1;
 
 	bool use_waiter:1;
+	bool linked:1;
+
+	// For nodes linked to start/stop together.
+	struct link_group *group;
 
 	enum waiter_type waiter_type;
 	struct waiter_context *waiter;
 
 	// For scheduling type.
 	enum sched_model sched_model;
+
+	// For instrumentation of each iteration.
+	struct latency_context *latency;
 };
 
 // For internal use in 'libasound' module.
@@ -80,6 +88,7 @@ struct xfer_libasound_ops {
 
 int xfer_libasound_wait_event(struct libasound_state *state, int timeout_msec,
 			      unsigned short *revents);
+void xfer_libasound_mark_wakeup(struct libasound_state *state);
 
 extern const struct xfer_libasound_ops xfer_libasound_irq_rw_ops;
 
@@ -192,6 +192,14 @@ static int r_process_frames(struct xfer_context *xfer,
 		int ch;
 		int pos;
 
+		// The buffers are filled for one period at once.
+		if (frame_cache_get_space(&state->cache) <
+						state->frames_per_period) {
+			err = frame_cache_linearize(&state->cache);
+			if (err < 0)
+				return err;
+		}
+
 		// Register buffers.
 		pos = 0;
 		bytes_per_frame = state->cache.bytes_per_sample *
@@ -221,7 +229,7 @@ static int r_process_frames(struct xfer_context *xfer,
 	}
 
 	// Write out to file descriptors.
-	consumed_count = frame_cache_get_count(&state->cache);
+	consumed_count = frame_cache_get_contiguous_count(&state->cache);
 	err = mapper_context_process_frames(mapper, state->cache.buf,
 					    &consumed_count, cntrs);
 	if (err < 0)
@@ -256,6 +264,14 @@ static int w_process_frames(struct xfer_context *xfer,
 	if (avail_count > frame_cache_get_count(&state->cache)) {
 		avail_count -= frame_cache_get_count(&state->cache);
 
+		// The buffers are read for one period at once.
+		if (state->cache.head + state->cache.remained_count +
+		    avail_count > state->cache.frames_per_cache) {
+			err = frame_cache_linearize(&state->cache);
+			if (err < 0)
+				return err;
+		}
+
 		err = mapper_context_process_frames(mapper, state->cache.buf_ptr,
 						    &avail_count, cntrs);
 		if (err < 0)
@@ -449,6 +465,7 @@ static int xfer_libffado_pre_process(struct xfer_context *xfer,
 	*access = SND_PCM_ACCESS_RW_INTERLEAVED;
 	*frames_per_buffer =
 			state->frames_per_period * state->periods_per_buffer;
+	xfer->frames_per_period = state->frames_per_period;
 
 	// Use cache for double number of frames per period.
 	err = frame_cache_init(&state->cache, *access,
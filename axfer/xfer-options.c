@@ -19,8 +19,14 @@ enum no_short_opts {
 	OPT_DUMP_HW_PARAMS,
 	OPT_PERIOD_SIZE,
 	OPT_BUFFER_SIZE,
-	// Obsoleted.
+	OPT_IO_URING,
+	OPT_WRITER_DEPTH,
+	OPT_MMAP_FILE,
 	OPT_MAX_FILE_TIME,
+	OPT_MAX_FILE_SIZE,
+	OPT_LATENCY_LOG,
+	OPT_LATENCY_DEPTH,
+	// Obsoleted.
 	OPT_USE_STRFTIME,
 	OPT_PROCESS_ID_FILE,
 };
@@ -44,7 +50,16 @@ static void print_help()
 "      -r, --rate=#            numeric sample rate in unit of Hz or kHz\n"
 "      -t, --file-type=TYPE    file type (wav, au, sparc, voc or raw, case-insentive)\n"
 "      -I, --separate-channels one file for each channel\n"
+#if WITH_IO_URING
+"      --io-uring=#            file I/O by io_uring with # blocks in flight\n"
+#endif
+"      --writer-depth=#        capture: write files by a thread with # periods\n"
+"      --mmap-file             playback: read files by memory mapping\n"
+"      --max-file-time=#       capture: start another file after # seconds\n"
+"      --max-file-size=#       capture: start another file after # bytes\n"
 "      --dump-hw-params        dump hw_params of the device\n"
+"      --latency-log=FILE      dump records of each iteration (CSV or JSON)\n"
+"      --latency-depth=#       the number of records kept for the log\n"
 "      --xfer-type=BACKEND     backend type (libasound, libffado)\n"
 	);
 }
@@ -88,7 +103,10 @@ static int verify_cntr_format(struct xfer_context *xfer)
 	} *entry, entries[] = {
 		{"raw",		CONTAINER_FORMAT_RAW},
 		{"voc",		CONTAINER_FORMAT_VOC},
+		{"flac",	CONTAINER_FORMAT_FLAC},
 		{"wav",		CONTAINER_FORMAT_RIFF_WAVE},
+		{"rf64",	CONTAINER_FORMAT_RF64},
+		{"w64",		CONTAINER_FORMAT_W64},
 		{"au",		CONTAINER_FORMAT_AU},
 		{"sparc",	CONTAINER_FORMAT_AU},
 	};
@@ -251,6 +269,78 @@ static int validate_options(struct xfer_context *xfer)
 		}
 	}
 
+	if (xfer->io_uring_depth > 256) {
+		fprintf(stderr, "invalid io_uring depth '%u'\n",
+			xfer->io_uring_depth);
+		return -EINVAL;
+	}
+
+	if (xfer->writer_depth > 0) {
+		if (xfer->direction != SND_PCM_STREAM_CAPTURE) {
+			fprintf(stderr,
+				"A writer thread is available for capture "
+				"only.\n");
+			return -EINVAL;
+		}
+		if (xfer->io_uring_depth > 0) {
+			fprintf(stderr,
+				"A writer thread is not available with "
+				"io_uring.\n");
+			return -EINVAL;
+		}
+		if (xfer->writer_depth > 1024) {
+			fprintf(stderr, "invalid writer depth '%u'\n",
+				xfer->writer_depth);
+			return -EINVAL;
+		}
+	}
+
+	if (xfer->mmap_file) {
+		if (xfer->direction != SND_PCM_STREAM_PLAYBACK) {
+			fprintf(stderr,
+				"Memory mapping of files is available for "
+				"playback only.\n");
+			return -EINVAL;
+		}
+		if (xfer->io_uring_depth > 0) {
+			fprintf(stderr,
+				"Memory mapping of files is not available "
+				"with io_uring.\n");
+			return -EINVAL;
+		}
+	}
+
+	if (xfer->max_file_seconds > 0 || xfer->max_file_bytes > 0) {
+		if (xfer->direction != SND_PCM_STREAM_CAPTURE) {
+			fprintf(stderr,
+				"Rotation of files is available for capture "
+				"only.\n");
+			return -EINVAL;
+		}
+		if (!strcmp(xfer->paths[0], "-")) {
+			fprintf(stderr,
+				"Rotation of files is not available with "
+				"standard output.\n");
+			return -EINVAL;
+		}
+	}
+
+	if (xfer->latency_depth > 0 && xfer->latency_log_path == NULL) {
+		fprintf(stderr,
+			"The depth of records is available with the log of "
+			"latency.\n");
+		return -EINVAL;
+	}
+	if (xfer->latency_log_path) {
+		if (xfer->latency_depth == 0)
+			xfer->latency_depth = 65536;
+		if (xfer->latency_depth > 16777216) {
+			fprintf(stderr, "invalid depth of records '%u'\n",
+				xfer->latency_depth);
+			return -EINVAL;
+		}
+	}
+
 	return err;
 }
 
@@ -275,12 +365,20 @@ int xfer_options_parse_args(struct xfer_context *xfer,
 		{"rate",		1, 0, 'r'},
 		// For containers.
 		{"file-type",		1, 0, 't'},
+#if WITH_IO_URING
+		{"io-uring",		1, 0, OPT_IO_URING},
+#endif
+		{"writer-depth",	1, 0, OPT_WRITER_DEPTH},
+		{"mmap-file",		0, 0, OPT_MMAP_FILE},
+		{"max-file-time",	1, 0, OPT_MAX_FILE_TIME},
+		{"max-file-size",	1, 0, OPT_MAX_FILE_SIZE},
 		// For mapper.
 		{"separate-channels",	0, 0, 'I'},
 		// For debugging.
 		{"dump-hw-params",	0, 0, OPT_DUMP_HW_PARAMS},
+		{"latency-log",		1, 0, OPT_LATENCY_LOG},
+		{"latency-depth",	1, 0, OPT_LATENCY_DEPTH},
 		// Obsoleted.
-		{"max-file-time",	1, 0, OPT_MAX_FILE_TIME},
 		{"use-strftime",	0, 0, OPT_USE_STRFTIME},
 		{"process-id-file",	1, 0, OPT_PROCESS_ID_FILE},
 		{"vumeter",		1, 0, 'V'},
@@ -347,15 +445,28 @@ int xfer_options_parse_args(struct xfer_context *xfer,
 			xfer->cntr_format_literal = arg_duplicate_string(optarg, &err);
 		else if (key == 'I')
 			xfer->multiple_cntrs = true;
+		else if (key == OPT_IO_URING)
+			xfer->io_uring_depth = arg_parse_decimal_num(optarg, &err);
+		else if (key == OPT_WRITER_DEPTH)
+			xfer->writer_depth = arg_parse_decimal_num(optarg, &err);
+		else if (key == OPT_MMAP_FILE)
+			xfer->mmap_file = true;
+		else if (key == OPT_MAX_FILE_TIME)
+			xfer->max_file_seconds = arg_parse_decimal_num(optarg, &err);
+		else if (key == OPT_MAX_FILE_SIZE)
+			xfer->max_file_bytes = arg_parse_decimal_num(optarg, &err);
 		else if (key == OPT_DUMP_HW_PARAMS)
 			xfer->dump_hw_params = true;
+		else if (key == OPT_LATENCY_LOG)
+			xfer->latency_log_path = arg_duplicate_string(optarg, &err);
+		else if (key == OPT_LATENCY_DEPTH)
+			xfer->latency_depth = arg_parse_decimal_num(optarg, &err);
 		else if (key == '?') {
 			free(l_opts);
 			free(s_opts);
 			return -EINVAL;
 		}
-		else if (key == OPT_MAX_FILE_TIME ||
-			 key == OPT_USE_STRFTIME ||
+		else if (key == OPT_USE_STRFTIME ||
 			 key == OPT_PROCESS_ID_FILE ||
 			 key == 'V' ||
 			 key == 'i') {
@@ -365,6 +476,11 @@ int xfer_options_parse_args(struct xfer_context *xfer,
 				l_opts[l_index].name);
 			err = -EINVAL;
 		} else {
+			// Several PCM nodes are given. The one for this
+			// context is passed to the backend.
+			if (key == 'D' &&
+			    xfer->device_count++ != xfer->device_index)
+				continue;
 			err = xfer->ops->parse_opt(xfer, key, optarg);
 			if (err < 0 && err != -ENXIO)
 				break;
@@ -385,7 +501,18 @@ int xfer_options_parse_args(struct xfer_context *xfer,
 		return 0;
 	}
 
-	err = allocate_paths(xfer, argv + optind, argc - optind);
+	if (xfer->device_count > 1) {
+		if (argc - optind != xfer->device_count) {
+			fprintf(stderr,
+				"When using several devices, the same number "
+				"of files should be given.\n");
+			return -EINVAL;
+		}
+		err = allocate_paths(xfer, argv + optind + xfer->device_index,
+				     1);
+	} else {
+		err = allocate_paths(xfer, argv + optind, argc - optind);
+	}
 	if (err < 0)
 		return err;
 
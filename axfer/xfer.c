@@ -109,6 +109,9 @@ void xfer_context_destroy(struct xfer_context *xfer)
 
 	free(xfer->cntr_format_literal);
 	xfer->cntr_format_literal = NULL;
+
+	free(xfer->latency_log_path);
+	xfer->latency_log_path = NULL;
 }
 
 int xfer_context_pre_process(struct xfer_context *xfer,
@@ -257,3 +260,50 @@ void xfer_context_post_process(struct xfer_context *xfer)
 
 	xfer->ops->post_process(xfer);
 }
+
+// Start and stop the transfer together with the master.
+int xfer_context_link(struct xfer_context *xfer, struct xfer_context *master)
+{
+	assert(xfer);
+	assert(master);
+
+	if (!xfer->ops || !master->ops)
+		return -ENXIO;
+	if (xfer->type != master->type || !xfer->ops->link)
+		return -ENXIO;
+
+	return xfer->ops->link(xfer, master);
+}
+
+// Fill the buffer of linked node for playback before starting the group.
+int xfer_context_prefill(struct xfer_context *xfer)
+{
+	assert(xfer);
+
+	if (!xfer->ops || !xfer->ops->prefill)
+		return -ENXIO;
+
+	return xfer->ops->prefill(xfer);
+}
+
+// Start the transfer explicitly, together with the linked ones.
+int xfer_context_start(struct xfer_context *xfer)
+{
+	assert(xfer);
+
+	if (!xfer->ops || !xfer->ops->start)
+		return -ENXIO;
+
+	return xfer->ops->start(xfer);
+}
+
+// Leave the group of linked nodes after finishing transmission.
+void xfer_context_unlink(struct xfer_context *xfer)
+{
+	assert(xfer);
+
+	if (!xfer->ops || !xfer->ops->unlink)
+		return;
+
+	xfer->ops->unlink(xfer);
+}
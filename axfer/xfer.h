@@ -10,6 +10,7 @@
 #define __ALSA_UTILS_AXFER_XFER__H_
 
 #include "mapper.h"
+#include "latency.h"
 
 #include <getopt.h>
 
@@ -43,6 +44,7 @@ struct xfer_context {
 	bool quiet:1;
 	bool dump_hw_params:1;
 	bool multiple_cntrs:1;	// For mapper.
+	bool mmap_file:1;	// For containers.
 
 	snd_pcm_format_t sample_format;
 
@@ -50,6 +52,23 @@ struct xfer_context {
 	char **paths;
 	unsigned int path_count;
 	enum container_format cntr_format;
+	unsigned int io_uring_depth;
+	unsigned int writer_depth;
+	// Available after pre-process if the backend has it, else 0.
+	snd_pcm_uframes_t frames_per_period;
+
+	// For rotation of files in capture.
+	unsigned int max_file_seconds;
+	uint64_t max_file_bytes;
+
+	// For instrumentation of each iteration.
+	char *latency_log_path;
+	unsigned int latency_depth;
+	struct latency_context *latency;
+
+	// For several PCM nodes in one process. Each of them has a file.
+	unsigned int device_index;
+	unsigned int device_count;
 };
 
 enum xfer_type xfer_type_from_label(const char *label);
@@ -70,6 +89,10 @@ int xfer_context_process_frames(struct xfer_context *xfer,
 				unsigned int *frame_count);
 void xfer_context_pause(struct xfer_context *xfer, bool enable);
 void xfer_context_post_process(struct xfer_context *xfer);
+int xfer_context_link(struct xfer_context *xfer, struct xfer_context *master);
+int xfer_context_prefill(struct xfer_context *xfer);
+int xfer_context_start(struct xfer_context *xfer);
+void xfer_context_unlink(struct xfer_context *xfer);
 
 struct xfer_data;
 int xfer_options_parse_args(struct xfer_context *xfer,
@@ -98,6 +121,10 @@ struct xfer_ops {
 	void (*destroy)(struct xfer_context *xfer);
 	void (*pause)(struct xfer_context *xfer, bool enable);
 	void (*help)(struct xfer_context *xfer);
+	int (*link)(struct xfer_context *xfer, struct xfer_context *master);
+	int (*prefill)(struct xfer_context *xfer);
+	int (*start)(struct xfer_context *xfer);
+	void (*unlink)(struct xfer_context *xfer);
 };
 
 struct xfer_data {